@@ -0,0 +1,375 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "simd4D.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// A small benchmark harness in the style of Google Benchmark.
+//
+// A benchmark is a function that takes a State and runs its work in a
+// while (state.keep_running()) loop. The harness picks the number of
+// iterations so every run takes at least --min-time seconds, then reports
+// ns/op, GFLOP/s and bytes/s from the counts the benchmark set:
+//
+//	void add(bench::State& state) {
+//		Vector4D a(1, 2, 3), b(4, 5, 6);
+//		while (state.keep_running()) {
+//			bench::do_not_optimize(a = a + b);
+//		}
+//		state.set_items_per_iteration(1);
+//		state.set_flops_per_item(4);
+//	}
+//	BENCH_REGISTER("vector4d/add", add);
+//
+// The results can be written as JSON with the same layout as Google
+// Benchmark's --benchmark_format=json, so the same tools can compare runs.
+
+namespace bench {
+
+	// -----< Optimization barriers >--------------------------------------------------------------
+
+	// Makes the compiler assume the value is used, so the work that made it is not removed.
+	template<class T>
+	inline void do_not_optimize(T const& value) {
+#if defined(_MSC_VER)
+		static volatile const void* sink;
+		sink = &value;
+		_ReadWriteBarrier();
+#else
+		asm volatile("" : : "m"(value) : "memory");
+#endif
+	}
+
+	// Also makes the compiler assume the value was changed, so work that
+	// uses it can not be moved out of the loop or folded to a constant.
+	template<class T>
+	inline void do_not_optimize(T& value) {
+#if defined(_MSC_VER)
+		static volatile void* sink;
+		sink = &value;
+		_ReadWriteBarrier();
+#else
+		asm volatile("" : "+m"(value) : : "memory");
+#endif
+	}
+
+	// Makes the compiler assume all memory was read and written.
+	inline void clobber_memory() {
+#if defined(_MSC_VER)
+		_ReadWriteBarrier();
+#else
+		asm volatile("" : : : "memory");
+#endif
+	}
+
+	// -----< State >------------------------------------------------------------------------------
+
+	class State {
+	private:
+		using Clock = std::chrono::steady_clock;
+
+		std::size_t remaining;
+		std::size_t iterations;
+		bool started = false;
+		Clock::time_point start;
+		Clock::time_point stop;
+
+		double items = 1;
+		double flops = 0;
+		double bytes = 0;
+
+	public:
+
+		// The argument of the run, e.g. the number of elements of a bulk benchmark.
+		const std::size_t arg;
+
+		State(std::size_t iterations, std::size_t arg) : remaining(iterations), iterations(iterations), arg(arg) {}
+
+		// Returns true while there are iterations left. The clock runs from
+		// the first call to the call that returns false.
+		bool keep_running() {
+			if (!started) {
+				started = true;
+				start = Clock::now();
+			}
+			if (remaining == 0) {
+				stop = Clock::now();
+				return false;
+			}
+			remaining--;
+			return true;
+		}
+
+		// The number of operations one iteration does, used for ns/op.
+		void set_items_per_iteration(double n) {
+			items = n;
+		}
+
+		// The number of floating-point operations per item, used for GFLOP/s.
+		void set_flops_per_item(double n) {
+			flops = n;
+		}
+
+		// The number of bytes read and written per item, used for bytes/s.
+		void set_bytes_per_item(double n) {
+			bytes = n;
+		}
+
+		std::size_t get_iterations() const {
+			return iterations;
+		}
+
+		double seconds() const {
+			return std::chrono::duration<double>(stop - start).count();
+		}
+
+		double items_total() const {
+			return items * (double)iterations;
+		}
+
+		double flops_per_item() const {
+			return flops;
+		}
+
+		double bytes_per_item() const {
+			return bytes;
+		}
+	};
+
+	// -----< Registry >---------------------------------------------------------------------------
+
+	struct Benchmark {
+		std::string name;
+		std::function<void(State&)> function;
+		// Returns the arguments, one run per argument. Called after the
+		// command line is read, so it can depend on the options.
+		// Empty means one run with the argument 0.
+		std::function<std::vector<std::size_t>()> args;
+	};
+
+	inline std::vector<Benchmark>& registry() {
+		static std::vector<Benchmark> benchmarks;
+		return benchmarks;
+	}
+
+	inline Benchmark& add(std::string name, std::function<void(State&)> function,
+			std::function<std::vector<std::size_t>()> args = {}) {
+		registry().push_back(Benchmark{ std::move(name), std::move(function), std::move(args) });
+		return registry().back();
+	}
+
+	// Registers a benchmark function at static initialization.
+#define BENCH_CONCAT_INNER(a, b) a##b
+#define BENCH_CONCAT(a, b) BENCH_CONCAT_INNER(a, b)
+#define BENCH_REGISTER(...) \
+	[[maybe_unused]] static const bool BENCH_CONCAT(bench_registered_, __LINE__) = (::bench::add(__VA_ARGS__), true)
+
+	// -----< Results >----------------------------------------------------------------------------
+
+	struct Result {
+		std::string name;
+		std::size_t iterations;
+		double seconds;
+		double ns_per_op;
+		double gflops;
+		double bytes_per_second;
+		double items_per_second;
+	};
+
+	// -----< Options >----------------------------------------------------------------------------
+
+	struct Options {
+		// Only run benchmarks whose name contains this.
+		std::string filter;
+		// Minimum time of one run in seconds.
+		double min_time = 0.2;
+		// The largest element count of the bulk benchmarks. 100000000 adds the 100M runs
+		// (they need about 3.2 GB of memory).
+		std::size_t max_elements = 10000000;
+		// The largest thread count of the scaling benchmarks. 0 is the hardware thread count.
+		std::size_t max_threads = 0;
+		// File to write the JSON results to. Empty writes no JSON.
+		std::string json;
+		// Print the list of benchmarks and stop.
+		bool list = false;
+	};
+
+	inline Options& options() {
+		static Options o;
+		return o;
+	}
+
+	inline std::size_t max_threads() {
+		std::size_t n = options().max_threads;
+		if (n == 0) n = std::thread::hardware_concurrency();
+		return n == 0 ? 1 : n;
+	}
+
+	// Thread counts of the scaling benchmarks: 1, 2, 4, ... and the largest one.
+	inline std::vector<std::size_t> thread_counts() {
+		std::vector<std::size_t> counts;
+		for (std::size_t n = 1; n < max_threads(); n *= 2) {
+			counts.push_back(n);
+		}
+		counts.push_back(max_threads());
+		return counts;
+	}
+
+	// Element counts of the bulk benchmarks: 1K, 10K, ... up to --max-elements.
+	// Pass as the args of bench::add().
+	inline std::vector<std::size_t> bulk_sizes() {
+		std::vector<std::size_t> sizes;
+		for (std::size_t n = 1000; n <= options().max_elements; n *= 10) {
+			sizes.push_back(n);
+		}
+		return sizes;
+	}
+
+	// Returns false and prints the usage if an argument is not known.
+	inline bool parse_arguments(int argc, char** argv) {
+		Options& o = options();
+		for (int i = 1; i < argc; i++) {
+			const char* a = argv[i];
+			auto value = [a](const char* key) -> const char* {
+				std::size_t len = std::strlen(key);
+				return std::strncmp(a, key, len) == 0 ? a + len : nullptr;
+			};
+			if (const char* v = value("--filter=")) o.filter = v;
+			else if (const char* v = value("--min-time=")) o.min_time = std::atof(v);
+			else if (const char* v = value("--max-elements=")) o.max_elements = (std::size_t)std::strtoull(v, nullptr, 10);
+			else if (const char* v = value("--max-threads=")) o.max_threads = (std::size_t)std::strtoull(v, nullptr, 10);
+			else if (const char* v = value("--json=")) o.json = v;
+			else if (std::strcmp(a, "--list") == 0) o.list = true;
+			else {
+				std::fprintf(stderr,
+					"usage: %s [--filter=<text>] [--min-time=<seconds>] [--max-elements=<n>]\n"
+					"       [--max-threads=<n>] [--json=<file>] [--list]\n", argv[0]);
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// -----< Runner >-----------------------------------------------------------------------------
+
+	// Runs one benchmark with one argument, growing the iteration count
+	// until the run takes at least min_time.
+	inline Result run(const Benchmark& b, std::size_t arg, const std::string& name) {
+		const std::size_t max_iterations = 1000000000;
+		std::size_t iterations = 1;
+		for (;;) {
+			State state(iterations, arg);
+			b.function(state);
+			double t = state.seconds();
+			if (t >= options().min_time || iterations >= max_iterations) {
+				Result r;
+				r.name = name;
+				r.iterations = iterations;
+				r.seconds = t;
+				double items = state.items_total();
+				r.ns_per_op = t * 1e9 / items;
+				r.items_per_second = items / t;
+				r.gflops = state.flops_per_item() * items / t * 1e-9;
+				r.bytes_per_second = state.bytes_per_item() * items / t;
+				return r;
+			}
+			// Aim a bit past min_time so the next run is usually the last one.
+			double scale = t > 0 ? options().min_time / t * 1.4 : 10.0;
+			if (scale < 2) scale = 2;
+			if (scale > 100) scale = 100;
+			std::size_t next = (std::size_t)((double)iterations * scale);
+			iterations = next > max_iterations ? max_iterations : next;
+		}
+	}
+
+	inline void print_header() {
+		std::printf("%-48s %14s %12s %12s %10s %12s\n", "Benchmark", "Iterations", "ns/op", "Mitems/s", "GFLOP/s", "GB/s");
+		std::printf("%s\n", std::string(113, '-').c_str());
+	}
+
+	inline void print_result(const Result& r) {
+		std::printf("%-48s %14zu %12.3f %12.2f %10.3f %12.3f\n", r.name.c_str(), r.iterations, r.ns_per_op,
+			r.items_per_second * 1e-6, r.gflops, r.bytes_per_second * 1e-9);
+	}
+
+	inline void write_json(const char* path, const std::vector<Result>& results) {
+		std::FILE* f = std::fopen(path, "w");
+		if (f == nullptr) {
+			std::fprintf(stderr, "Error: could not open %s\n", path);
+			return;
+		}
+		char date[64];
+		std::time_t now = std::time(nullptr);
+		std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+
+		std::fprintf(f, "{\n  \"context\": {\n");
+		std::fprintf(f, "    \"date\": \"%s\",\n", date);
+		std::fprintf(f, "    \"num_cpus\": %u,\n", std::thread::hardware_concurrency());
+		std::fprintf(f, "    \"simd_backend\": \"%s\",\n", math4D::simd::backend_name(math4D::simd::active_backend()));
+#if defined(NDEBUG)
+		std::fprintf(f, "    \"library_build_type\": \"release\"\n");
+#else
+		std::fprintf(f, "    \"library_build_type\": \"debug\"\n");
+#endif
+		std::fprintf(f, "  },\n  \"benchmarks\": [\n");
+		for (std::size_t i = 0; i < results.size(); i++) {
+			const Result& r = results[i];
+			std::fprintf(f, "    {\n");
+			std::fprintf(f, "      \"name\": \"%s\",\n", r.name.c_str());
+			std::fprintf(f, "      \"run_name\": \"%s\",\n", r.name.c_str());
+			std::fprintf(f, "      \"run_type\": \"iteration\",\n");
+			std::fprintf(f, "      \"iterations\": %zu,\n", r.iterations);
+			std::fprintf(f, "      \"real_time\": %.6f,\n", r.ns_per_op);
+			std::fprintf(f, "      \"cpu_time\": %.6f,\n", r.ns_per_op);
+			std::fprintf(f, "      \"time_unit\": \"ns\",\n");
+			std::fprintf(f, "      \"items_per_second\": %.6e,\n", r.items_per_second);
+			std::fprintf(f, "      \"bytes_per_second\": %.6e,\n", r.bytes_per_second);
+			std::fprintf(f, "      \"GFLOPS\": %.6f\n", r.gflops);
+			std::fprintf(f, "    }%s\n", i + 1 < results.size() ? "," : "");
+		}
+		std::fprintf(f, "  ]\n}\n");
+		std::fclose(f);
+	}
+
+	// Runs every registered benchmark that matches the filter.
+	// Returns the exit code for main().
+	inline int run_all(int argc, char** argv) {
+		if (!parse_arguments(argc, argv)) return 1;
+
+		std::vector<Result> results;
+		if (!options().list) print_header();
+		for (const Benchmark& b : registry()) {
+			std::vector<std::size_t> args = b.args ? b.args() : std::vector<std::size_t>{};
+			bool has_args = !args.empty();
+			if (!has_args) args.push_back(0);
+			for (std::size_t arg : args) {
+				std::string name = has_args ? b.name + "/" + std::to_string(arg) : b.name;
+				if (!options().filter.empty() && name.find(options().filter) == std::string::npos) continue;
+				if (options().list) {
+					std::printf("%s\n", name.c_str());
+					continue;
+				}
+				results.push_back(run(b, arg, name));
+				print_result(results.back());
+				std::fflush(stdout);
+			}
+		}
+		if (!options().json.empty()) {
+			write_json(options().json.c_str(), results);
+		}
+		return 0;
+	}
+}
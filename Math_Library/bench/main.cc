@@ -0,0 +1,1154 @@
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "batch4D.h"
+#include "culling4D.h"
+#include "dataset4D.h"
+#include "expression4D.h"
+#include "hierarchy4D.h"
+#include "jobs4D.h"
+#include "matrix4D.h"
+#include "matrix_stream4D.h"
+#include "matrixN.h"
+#include "parallel4D.h"
+#include "pipeline4D.h"
+#include "pool4D.h"
+#include "quaternion.h"
+#include "skin4D.h"
+#include "thread_pool.h"
+#include "trig4D.h"
+#include "vector4D.h"
+#include "vectorN.h"
+
+// Benchmarks for Math_Library.
+//
+//	micro/...		one operation on values in registers, ns per call.
+//	bulk/...		one operation over 1K .. --max-elements values,
+//					ns per element, GFLOP/s and memory bandwidth.
+//	parallel/...	parallel_transform over a fixed list, 1 .. N threads.
+//	reduce/...		parallel_sum / parallel_dot, one thread and 1 .. N threads.
+//	jobs/...		JobSystem overhead and chained async transforms.
+//	chain/...		lazy matrix chains against the eager operators.
+//
+// Kernels with SIMD versions are run once per backend the CPU supports,
+// with the backend name at the end of the benchmark name.
+//
+// Flop counts are the nominal ones (a 4x4 matrix times a vector is 16
+// multiplies and 12 adds = 28), not what a given kernel issues.
+
+using bench::State;
+using math4D::Matrix;
+using math4D::simd::Backend;
+
+namespace {
+
+	// -----< Helpers >----------------------------------------------------------------------------
+
+	// Random values in [-1, 1], the same on every run.
+	std::vector<float> random_floats(std::size_t n, unsigned int seed = 1) {
+		std::mt19937 gen(seed);
+		std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+		std::vector<float> v(n);
+		for (float& x : v) x = dist(gen);
+		return v;
+	}
+
+	std::vector<Vector4D> random_points(std::size_t n) {
+		std::vector<float> f = random_floats(n * 3);
+		std::vector<Vector4D> points(n);
+		for (std::size_t i = 0; i < n; i++) {
+			points[i] = Vector4D(f[i * 3], f[i * 3 + 1], f[i * 3 + 2]);
+		}
+		return points;
+	}
+
+	std::vector<Quaternion> random_rotations(std::size_t n, unsigned int seed) {
+		std::vector<float> f = random_floats(n * 3, seed);
+		std::vector<Quaternion> q(n);
+		for (std::size_t i = 0; i < n; i++) {
+			q[i] = Quaternion::from_euler(f[i * 3] * 3, f[i * 3 + 1] * 3, f[i * 3 + 2] * 3);
+		}
+		return q;
+	}
+
+	Matrix4D sample_matrix() {
+		Matrix4D m = Matrix4D::rotate_x(30) * Matrix4D::rotate_y(45) * Matrix4D::rotate_z(60);
+		m.translate(1, 2, 3);
+		return m;
+	}
+
+	// A 90 degree perspective at the origin looking down -z, near 0.1
+	// and far 1.5. About a third of random_points() is inside.
+	Matrix4D sample_projection() {
+		return Matrix4D::perspective((float)PI / 2, 1, 0.1f, 1.5f);
+	}
+
+	Frustum sample_frustum() {
+		return Frustum::from_matrix(sample_projection());
+	}
+
+	// Runs f once per iteration, one operation per call.
+	template<class F>
+	void micro(State& state, double flops, F f) {
+		while (state.keep_running()) {
+			f();
+		}
+		state.set_flops_per_item(flops);
+	}
+
+	// The backends the CPU supports, scalar first.
+	std::vector<Backend> backends() {
+		std::vector<Backend> list{ Backend::Scalar };
+#if defined(MATH4D_SIMD)
+		Backend best = math4D::simd::detect_backend();
+		if (best >= Backend::SSE41) list.push_back(Backend::SSE41);
+		if (best >= Backend::AVX2) list.push_back(Backend::AVX2);
+#endif
+		return list;
+	}
+
+	// Registers a benchmark once per backend. The backend is set for the
+	// run and the previous one is restored after it.
+	template<class F>
+	bool add_per_backend(const std::string& name, F f, std::function<std::vector<std::size_t>()> args = {}) {
+		for (Backend b : backends()) {
+			bench::add(name + "/" + math4D::simd::backend_name(b), [b, f](State& state) {
+				Backend previous = math4D::simd::active_backend();
+				math4D::simd::set_backend(b);
+				f(state);
+				math4D::simd::set_backend(previous);
+			}, args);
+		}
+		return true;
+	}
+
+	// -----< Vector4D >---------------------------------------------------------------------------
+
+	void vector_add(State& state) {
+		Vector4D a(1, 2, 3, 4), b(0.5f, 0.25f, 0.125f, 1);
+		micro(state, 4, [&] { bench::do_not_optimize(a); bench::do_not_optimize(a + b); });
+	}
+	void vector_sub(State& state) {
+		Vector4D a(1, 2, 3, 4), b(0.5f, 0.25f, 0.125f, 1);
+		micro(state, 4, [&] { bench::do_not_optimize(a); bench::do_not_optimize(a - b); });
+	}
+	void vector_mul(State& state) {
+		Vector4D a(1, 2, 3, 4), b(0.5f, 0.25f, 0.125f, 1);
+		micro(state, 4, [&] { bench::do_not_optimize(a); bench::do_not_optimize(a * b); });
+	}
+	void vector_div(State& state) {
+		Vector4D a(1, 2, 3, 4), b(0.5f, 0.25f, 0.125f, 1);
+		micro(state, 4, [&] { bench::do_not_optimize(a); bench::do_not_optimize(a / b); });
+	}
+	void vector_scalar(State& state) {
+		Vector4D a(1, 2, 3, 4);
+		float s = 1.5f;
+		micro(state, 4, [&] { bench::do_not_optimize(a); bench::do_not_optimize(a.scalar(s)); });
+	}
+	void vector_dot(State& state) {
+		Vector4D a(1, 2, 3, 4), b(0.5f, 0.25f, 0.125f, 1);
+		micro(state, 7, [&] { bench::do_not_optimize(a); bench::do_not_optimize(a.dot_product(b)); });
+	}
+	void vector_length(State& state) {
+		Vector4D a(1, 2, 3, 4);
+		micro(state, 8, [&] { bench::do_not_optimize(a); bench::do_not_optimize(a.lenght()); });
+	}
+	void vector_normalize(State& state) {
+		Vector4D a(1, 2, 3, 4);
+		micro(state, 12, [&] { bench::do_not_optimize(a); bench::do_not_optimize(a.norm()); });
+	}
+	void vector_length_squared(State& state) {
+		Vector4D a(1, 2, 3, 4);
+		micro(state, 7, [&] { bench::do_not_optimize(a); bench::do_not_optimize(a.length_squared()); });
+	}
+	void vector_normalize_fast(State& state) {
+		Vector4D a(1, 2, 3, 4);
+		micro(state, 12, [&] { bench::do_not_optimize(a); bench::do_not_optimize(a.normalize_fast()); });
+	}
+	void vector_normalize3(State& state) {
+		Vector4D a(1, 2, 3, 1);
+		micro(state, 9, [&] { bench::do_not_optimize(a); bench::do_not_optimize(a.normalize3()); });
+	}
+	void vector_normalize3_fast(State& state) {
+		Vector4D a(1, 2, 3, 1);
+		micro(state, 9, [&] { bench::do_not_optimize(a); bench::do_not_optimize(a.normalize3_fast()); });
+	}
+
+	BENCH_REGISTER("micro/vector4d/add", vector_add);
+	BENCH_REGISTER("micro/vector4d/sub", vector_sub);
+	BENCH_REGISTER("micro/vector4d/mul", vector_mul);
+	BENCH_REGISTER("micro/vector4d/div", vector_div);
+	BENCH_REGISTER("micro/vector4d/scalar", vector_scalar);
+	BENCH_REGISTER("micro/vector4d/dot_product", vector_dot);
+	BENCH_REGISTER("micro/vector4d/lenght", vector_length);
+	BENCH_REGISTER("micro/vector4d/norm", vector_normalize);
+	BENCH_REGISTER("micro/vector4d/length_squared", vector_length_squared);
+	BENCH_REGISTER("micro/vector4d/normalize_fast", vector_normalize_fast);
+	BENCH_REGISTER("micro/vector4d/normalize3", vector_normalize3);
+	BENCH_REGISTER("micro/vector4d/normalize3_fast", vector_normalize3_fast);
+
+	// -----< Matrix4D >---------------------------------------------------------------------------
+
+	void matrix_mul_matrix(State& state) {
+		Matrix4D a = sample_matrix(), b = sample_matrix();
+		micro(state, 112, [&] { bench::do_not_optimize(a); bench::do_not_optimize(a * b); });
+	}
+	void matrix_mul_vector(State& state) {
+		Matrix4D m = sample_matrix();
+		Vector4D v(1, 2, 3);
+		micro(state, 28, [&] { bench::do_not_optimize(v); bench::do_not_optimize(m * v); });
+	}
+	void matrix_transpose(State& state) {
+		Matrix4D m = sample_matrix();
+		micro(state, 0, [&] { m.transpose(); bench::do_not_optimize(m); });
+	}
+	void matrix_determinant(State& state) {
+		Matrix4D m = sample_matrix();
+		micro(state, 47, [&] { bench::do_not_optimize(m); bench::do_not_optimize(m.determinant()); });
+	}
+	void matrix_inverse(State& state) {
+		Matrix4D m = sample_matrix();
+		Matrix4D result;
+		micro(state, 144, [&] { bench::do_not_optimize(m); bench::do_not_optimize(m.try_inverse(result)); bench::do_not_optimize(result); });
+	}
+	void matrix_inverse_affine(State& state) {
+		Matrix4D m = sample_matrix();
+		micro(state, 60, [&] { bench::do_not_optimize(m); bench::do_not_optimize(m.inverse_affine()); });
+	}
+	void matrix_inverse_rigid(State& state) {
+		Matrix4D m = sample_matrix();
+		micro(state, 15, [&] { bench::do_not_optimize(m); bench::do_not_optimize(m.inverse_rigid()); });
+	}
+	void matrix_translate(State& state) {
+		Matrix4D m;
+		float x = 1, y = 2, z = 3;
+		micro(state, 0, [&] { bench::do_not_optimize(x); m.translate(x, y, z); bench::do_not_optimize(m); });
+	}
+
+	BENCH_REGISTER("micro/matrix4d/transpose", matrix_transpose);
+	BENCH_REGISTER("micro/matrix4d/determinant", matrix_determinant);
+	BENCH_REGISTER("micro/matrix4d/inverse", matrix_inverse);
+	BENCH_REGISTER("micro/matrix4d/inverse_affine", matrix_inverse_affine);
+	BENCH_REGISTER("micro/matrix4d/inverse_rigid", matrix_inverse_rigid);
+	BENCH_REGISTER("micro/matrix4d/translate", matrix_translate);
+
+	// -----< Accumulation >-----------------------------------------------------------------------
+
+	// Sums and products over a list with the binary operators against the
+	// compound ones. Both should compile to the same loop, with no
+	// temporary Vector4D / Matrix4D written to the stack.
+	void accumulate_vector_binary(State& state) {
+		std::vector<Vector4D> points = random_points(state.arg);
+		while (state.keep_running()) {
+			Vector4D sum(0, 0, 0, 0);
+			for (const Vector4D& p : points) sum = sum + p;
+			bench::do_not_optimize(sum);
+		}
+		state.set_items_per_iteration((double)state.arg);
+		state.set_flops_per_item(4);
+	}
+	void accumulate_vector_compound(State& state) {
+		std::vector<Vector4D> points = random_points(state.arg);
+		while (state.keep_running()) {
+			Vector4D sum(0, 0, 0, 0);
+			for (const Vector4D& p : points) sum += p;
+			bench::do_not_optimize(sum);
+		}
+		state.set_items_per_iteration((double)state.arg);
+		state.set_flops_per_item(4);
+	}
+	void accumulate_matrix_binary(State& state) {
+		std::vector<Matrix4D> list(state.arg, sample_matrix());
+		while (state.keep_running()) {
+			Matrix4D product;
+			for (const Matrix4D& m : list) product = product * m;
+			bench::do_not_optimize(product);
+		}
+		state.set_items_per_iteration((double)state.arg);
+		state.set_flops_per_item(112);
+	}
+	void accumulate_matrix_compound(State& state) {
+		std::vector<Matrix4D> list(state.arg, sample_matrix());
+		while (state.keep_running()) {
+			Matrix4D product;
+			for (const Matrix4D& m : list) product *= m;
+			bench::do_not_optimize(product);
+		}
+		state.set_items_per_iteration((double)state.arg);
+		state.set_flops_per_item(112);
+	}
+
+	std::vector<std::size_t> accumulate_sizes() {
+		return { 1024 };
+	}
+
+	BENCH_REGISTER("accumulate/vector4d/a=a+b", accumulate_vector_binary, accumulate_sizes);
+	BENCH_REGISTER("accumulate/vector4d/a+=b", accumulate_vector_compound, accumulate_sizes);
+	BENCH_REGISTER("accumulate/matrix4d/a=a*b", accumulate_matrix_binary, accumulate_sizes);
+	BENCH_REGISTER("accumulate/matrix4d/a*=b", accumulate_matrix_compound, accumulate_sizes);
+
+	void matrix_double_mul_matrix(State& state) {
+		Matrix4DDouble a(sample_matrix()), b(sample_matrix());
+		micro(state, 112, [&] { bench::do_not_optimize(a); bench::do_not_optimize(a * b); });
+	}
+	void matrix_double_mul_vector(State& state) {
+		Matrix4DDouble m(sample_matrix());
+		Vector4DDouble v(1, 2, 3);
+		micro(state, 28, [&] { bench::do_not_optimize(v); bench::do_not_optimize(m * v); });
+	}
+	void matrix3_determinant(State& state) {
+		Matrix<float, 3, 3> m(1, 2, 3, 0, 1, 4, 5, 6, 0);
+		micro(state, 14, [&] { bench::do_not_optimize(m); bench::do_not_optimize(m.determinant()); });
+	}
+
+	BENCH_REGISTER("micro/matrix3/determinant", matrix3_determinant);
+
+	// The products run once per backend.
+	[[maybe_unused]] const bool registered_matrix_backends =
+		add_per_backend("micro/matrix4d/mul_matrix", matrix_mul_matrix) &&
+		add_per_backend("micro/matrix4d/mul_vector", matrix_mul_vector) &&
+		add_per_backend("micro/matrix4d_double/mul_matrix", matrix_double_mul_matrix) &&
+		add_per_backend("micro/matrix4d_double/mul_vector", matrix_double_mul_vector);
+
+	// -----< Rotations >--------------------------------------------------------------------------
+
+	void rotate_degrees(State& state) {
+		float degrees = 30;
+		micro(state, 0, [&] { bench::do_not_optimize(degrees); bench::do_not_optimize(Matrix4D::rotate_x(degrees)); });
+	}
+	void rotation_radians(State& state) {
+		float radians = 0.5f;
+		micro(state, 0, [&] { bench::do_not_optimize(radians); bench::do_not_optimize(Matrix4D::rotation_x(radians)); });
+	}
+	void rotate_xyz_eager(State& state) {
+		float x = 30, y = 45, z = 60;
+		micro(state, 224, [&] {
+			bench::do_not_optimize(x);
+			bench::do_not_optimize(Matrix4D::rotate_x(x) * Matrix4D::rotate_y(y) * Matrix4D::rotate_z(z));
+		});
+	}
+	void rotation_xyz(State& state) {
+		float x = 0.5f, y = 0.75f, z = 1;
+		micro(state, 16, [&] { bench::do_not_optimize(x); bench::do_not_optimize(Matrix4D::rotation_xyz(x, y, z)); });
+	}
+	void trig_sincos(State& state) {
+		float x = 0.5f;
+		micro(state, 0, [&] { bench::do_not_optimize(x); bench::do_not_optimize(math4D::sincos(x)); });
+	}
+	void trig_std(State& state) {
+		float x = 0.5f;
+		micro(state, 0, [&] {
+			bench::do_not_optimize(x);
+			bench::do_not_optimize(std::sin(x));
+			bench::do_not_optimize(std::cos(x));
+		});
+	}
+
+	BENCH_REGISTER("micro/rotation/rotate_x_degrees", rotate_degrees);
+	BENCH_REGISTER("micro/rotation/rotation_x_radians", rotation_radians);
+	BENCH_REGISTER("micro/rotation/rotate_x*rotate_y*rotate_z", rotate_xyz_eager);
+	BENCH_REGISTER("micro/rotation/rotation_xyz", rotation_xyz);
+	BENCH_REGISTER("micro/trig/math4D::sincos", trig_sincos);
+	BENCH_REGISTER("micro/trig/std::sin+std::cos", trig_std);
+
+	// -----< Quaternion >-------------------------------------------------------------------------
+
+	void quaternion_mul(State& state) {
+		Quaternion a = Quaternion::from_euler(0.1f, 0.2f, 0.3f), b = Quaternion::from_euler(0.4f, 0.5f, 0.6f);
+		micro(state, 28, [&] { bench::do_not_optimize(a); bench::do_not_optimize(a * b); });
+	}
+	void quaternion_rotate(State& state) {
+		Quaternion q = Quaternion::from_euler(0.1f, 0.2f, 0.3f);
+		Vector4D v(1, 2, 3);
+		micro(state, 30, [&] { bench::do_not_optimize(v); bench::do_not_optimize(q * v); });
+	}
+	void quaternion_slerp(State& state) {
+		Quaternion a = Quaternion::from_euler(0.1f, 0.2f, 0.3f), b = Quaternion::from_euler(1.4f, 0.5f, 0.6f);
+		float t = 0.3f;
+		micro(state, 0, [&] { bench::do_not_optimize(t); bench::do_not_optimize(Quaternion::slerp(a, b, t)); });
+	}
+	void quaternion_to_matrix(State& state) {
+		Quaternion q = Quaternion::from_euler(0.1f, 0.2f, 0.3f);
+		micro(state, 0, [&] { bench::do_not_optimize(q); bench::do_not_optimize(q.to_matrix()); });
+	}
+
+	BENCH_REGISTER("micro/quaternion/mul", quaternion_mul);
+	BENCH_REGISTER("micro/quaternion/rotate_vector", quaternion_rotate);
+	BENCH_REGISTER("micro/quaternion/slerp", quaternion_slerp);
+	BENCH_REGISTER("micro/quaternion/to_matrix", quaternion_to_matrix);
+
+	// -----< Bulk >-------------------------------------------------------------------------------
+
+	void bulk_transform_aos(State& state) {
+		std::vector<Vector4D> in = random_points(state.arg), out(state.arg);
+		Matrix4D m = sample_matrix();
+		while (state.keep_running()) {
+			math4D::transform(m, in, out);
+			bench::clobber_memory();
+		}
+		state.set_items_per_iteration((double)state.arg);
+		state.set_flops_per_item(28);
+		state.set_bytes_per_item(2 * sizeof(Vector4D));
+	}
+
+	void bulk_transform_soa(State& state) {
+		std::vector<Vector4D> points = random_points(state.arg);
+		Vector4DStream in(points), out(state.arg);
+		Matrix4D m = sample_matrix();
+		while (state.keep_running()) {
+			math4D::transform(m, in, out);
+			bench::clobber_memory();
+		}
+		state.set_items_per_iteration((double)state.arg);
+		state.set_flops_per_item(28);
+		state.set_bytes_per_item(8 * sizeof(float));
+	}
+
+	void bulk_transform_half(State& state) {
+		std::vector<Vector4D> points = random_points(state.arg);
+		std::vector<Vector4DHalf> in(state.arg), out(state.arg);
+		for (std::size_t i = 0; i < points.size(); i++) in[i] = Vector4DHalf(points[i]);
+		Matrix4D m = sample_matrix();
+		while (state.keep_running()) {
+			math4D::transform(m, in, out);
+			bench::clobber_memory();
+		}
+		state.set_items_per_iteration((double)state.arg);
+		state.set_flops_per_item(28);
+		state.set_bytes_per_item(2 * sizeof(Vector4DHalf));
+	}
+
+	template<math4D::Precision P>
+	void bulk_normalize(State& state) {
+		std::vector<Vector4D> in = random_points(state.arg), out(state.arg);
+		while (state.keep_running()) {
+			math4D::normalize(in, out, P);
+			bench::clobber_memory();
+		}
+		state.set_items_per_iteration((double)state.arg);
+		state.set_flops_per_item(12);
+		state.set_bytes_per_item(2 * sizeof(Vector4D));
+	}
+
+	// The loop the batch call replaces.
+	void bulk_normalize_loop(State& state) {
+		std::vector<Vector4D> in = random_points(state.arg), out(state.arg);
+		while (state.keep_running()) {
+			for (std::size_t i = 0; i < in.size(); i++) out[i] = in[i].norm();
+			bench::clobber_memory();
+		}
+		state.set_items_per_iteration((double)state.arg);
+		state.set_flops_per_item(12);
+		state.set_bytes_per_item(2 * sizeof(Vector4D));
+	}
+
+	void bulk_sincos(State& state) {
+		std::vector<float> angles = random_floats(state.arg), s(state.arg), c(state.arg);
+		while (state.keep_running()) {
+			math4D::sincos_batch(angles, s, c);
+			bench::clobber_memory();
+		}
+		state.set_items_per_iteration((double)state.arg);
+		state.set_bytes_per_item(3 * sizeof(float));
+	}
+
+	void bulk_rotations_xyz(State& state) {
+		std::vector<float> x = random_floats(state.arg, 1), y = random_floats(state.arg, 2), z = random_floats(state.arg, 3);
+		std::vector<Matrix4D> out(state.arg);
+		while (state.keep_running()) {
+			math4D::rotations_xyz(x, y, z, out);
+			bench::clobber_memory();
+		}
+		state.set_items_per_iteration((double)state.arg);
+		state.set_bytes_per_item(3 * sizeof(float) + sizeof(Matrix4D));
+	}
+
+	void bulk_slerp(State& state) {
+		std::vector<Quaternion> a = random_rotations(state.arg, 1), b = random_rotations(state.arg, 2), out(state.arg);
+		std::vector<float> t = random_floats(state.arg, 3);
+		for (float& v : t) v = v * 0.5f + 0.5f;
+		while (state.keep_running()) {
+			math4D::slerp_batch(a, b, t, out);
+			bench::clobber_memory();
+		}
+		state.set_items_per_iteration((double)state.arg);
+		state.set_bytes_per_item(3 * sizeof(Quaternion) + sizeof(float));
+	}
+
+	void bulk_export_column_major(State& state) {
+		std::vector<Matrix4D> m(state.arg, sample_matrix());
+		std::vector<float> out(state.arg * 16);
+		while (state.keep_running()) {
+			math4D::export_matrices(m, out, math4D::MatrixLayout::ColumnMajor);
+			bench::clobber_memory();
+		}
+		state.set_items_per_iteration((double)state.arg);
+		state.set_bytes_per_item(2 * sizeof(Matrix4D));
+	}
+
+	// What user code does without project(): Matrix4D * Vector4D, the
+	// divide with Vector4D::operator/ and the viewport mapping by hand.
+	void bulk_project_loop(State& state) {
+		std::vector<Vector4D> in = random_points(state.arg), out(state.arg);
+		Matrix4D mvp = sample_projection() * sample_matrix();
+		const float width = 1920, height = 1080;
+		while (state.keep_running()) {
+			for (std::size_t i = 0; i < in.size(); i++) {
+				Vector4D c = mvp * in[i];
+				Vector4D ndc = c / Vector4D(c[3], c[3], c[3], c[3]);
+				out[i] = Vector4D((ndc[0] + 1) * 0.5f * width, (ndc[1] + 1) * 0.5f * height, (ndc[2] + 1) * 0.5f, 1 / c[3]);
+			}
+			bench::clobber_memory();
+		}
+		state.set_items_per_iteration((double)state.arg);
+		state.set_bytes_per_item(2 * sizeof(Vector4D));
+	}
+
+	void bulk_project(State& state) {
+		std::vector<Vector4D> in = random_points(state.arg), out(state.arg);
+		std::vector<std::uint8_t> flags(state.arg);
+		Matrix4D mvp = sample_projection() * sample_matrix();
+		Viewport viewport;
+		viewport.width = 1920;
+		viewport.height = 1080;
+		while (state.keep_running()) {
+			math4D::project(mvp, viewport, in, out, flags);
+			bench::clobber_memory();
+		}
+		state.set_items_per_iteration((double)state.arg);
+		state.set_bytes_per_item(2 * sizeof(Vector4D) + 1);
+	}
+
+	void bulk_cull_spheres(State& state) {
+		std::vector<Vector4D> points = random_points(state.arg);
+		std::vector<float> r = random_floats(state.arg, 2);
+		std::vector<Sphere> spheres(state.arg);
+		for (std::size_t i = 0; i < spheres.size(); i++) spheres[i] = Sphere(points[i], std::fabs(r[i]) * 0.1f);
+		std::vector<std::uint32_t> visible(state.arg);
+		Frustum frustum = sample_frustum();
+		while (state.keep_running()) {
+			bench::do_not_optimize(math4D::cull(frustum, spheres, visible));
+			bench::clobber_memory();
+		}
+		state.set_items_per_iteration((double)state.arg);
+		state.set_bytes_per_item(sizeof(Sphere));
+	}
+
+	void bulk_cull_aabbs(State& state) {
+		std::vector<Vector4D> points = random_points(state.arg);
+		std::vector<float> r = random_floats(state.arg, 2);
+		std::vector<AABB> boxes(state.arg);
+		for (std::size_t i = 0; i < boxes.size(); i++) {
+			float e = std::fabs(r[i]) * 0.1f;
+			const Vector4D& c = points[i];
+			boxes[i] = AABB(Vector4D(c[0] - e, c[1] - e, c[2] - e), Vector4D(c[0] + e, c[1] + e, c[2] + e));
+		}
+		std::vector<std::uint32_t> visible(state.arg);
+		Frustum frustum = sample_frustum();
+		while (state.keep_running()) {
+			bench::do_not_optimize(math4D::cull(frustum, boxes, visible));
+			bench::clobber_memory();
+		}
+		state.set_items_per_iteration((double)state.arg);
+		state.set_bytes_per_item(sizeof(AABB));
+	}
+
+	[[maybe_unused]] const bool registered_bulk =
+		add_per_backend("bulk/transform_aos", bulk_transform_aos, bench::bulk_sizes) &&
+		add_per_backend("bulk/transform_soa", bulk_transform_soa, bench::bulk_sizes) &&
+		add_per_backend("bulk/transform_half", bulk_transform_half, bench::bulk_sizes) &&
+		add_per_backend("bulk/normalize", bulk_normalize<math4D::Precision::Exact>, bench::bulk_sizes) &&
+		add_per_backend("bulk/normalize_fast", bulk_normalize<math4D::Precision::Fast>, bench::bulk_sizes) &&
+		add_per_backend("bulk/norm_loop", bulk_normalize_loop, bench::bulk_sizes) &&
+		add_per_backend("bulk/sincos_batch", bulk_sincos, bench::bulk_sizes) &&
+		add_per_backend("bulk/rotations_xyz", bulk_rotations_xyz, bench::bulk_sizes) &&
+		add_per_backend("bulk/slerp_batch", bulk_slerp, bench::bulk_sizes) &&
+		add_per_backend("bulk/export_column_major", bulk_export_column_major, bench::bulk_sizes) &&
+		add_per_backend("bulk/project_loop", bulk_project_loop, bench::bulk_sizes) &&
+		add_per_backend("bulk/project", bulk_project, bench::bulk_sizes) &&
+		add_per_backend("bulk/cull_spheres", bulk_cull_spheres, bench::bulk_sizes) &&
+		add_per_backend("bulk/cull_aabbs", bulk_cull_aabbs, bench::bulk_sizes);
+
+	// -----< Parallel scaling >-------------------------------------------------------------------
+
+	// parallel_transform over --max-elements points (at most 10M) with
+	// 1, 2, 4, ... threads. One thread runs the batch kernel directly.
+	void parallel_transform_threads(State& state) {
+		std::size_t n = bench::options().max_elements < 10000000 ? bench::options().max_elements : 10000000;
+		std::vector<Vector4D> in = random_points(n), out(n);
+		Matrix4D m = sample_matrix();
+		if (state.arg <= 1) {
+			while (state.keep_running()) {
+				math4D::transform(m, in, out);
+				bench::clobber_memory();
+			}
+		}
+		else {
+			math4D::ThreadPool pool((unsigned int)state.arg - 1);
+			math4D::ParallelOptions options;
+			options.pool = &pool;
+			while (state.keep_running()) {
+				math4D::parallel_transform(m, in, out, options);
+				bench::clobber_memory();
+			}
+		}
+		state.set_items_per_iteration((double)n);
+		state.set_flops_per_item(28);
+		state.set_bytes_per_item(2 * sizeof(Vector4D));
+	}
+
+	BENCH_REGISTER("parallel/transform/threads", parallel_transform_threads, bench::thread_counts);
+
+	// -----< Skinning >---------------------------------------------------------------------------
+
+	// A mesh of state.arg vertices on 64 bones, three bones per vertex.
+	template<std::size_t N>
+	struct SkinMesh {
+		std::vector<Matrix4D> palette;
+		std::vector<DualQuaternion> dual_quaternions;
+		std::vector<math4D::BoneInfluences<N>> influences;
+		std::vector<Vector4D> positions, normals, out_positions, out_normals;
+
+		explicit SkinMesh(std::size_t n)
+			: palette(64), dual_quaternions(64), influences(n), positions(random_points(n)),
+			  normals(n), out_positions(n), out_normals(n) {
+			std::vector<float> r = random_floats(64 * 6 + n * 6, 3);
+			for (std::size_t b = 0; b < palette.size(); b++) {
+				const float* a = r.data() + b * 6;
+				palette[b] = Matrix4D::rotation_xyz(a[0], a[1], a[2]);
+				palette[b].translate(a[3], a[4], a[5]);
+			}
+			math4D::dual_quaternion_palette(palette, dual_quaternions);
+			for (std::size_t i = 0; i < n; i++) {
+				const float* a = r.data() + 64 * 6 + i * 6;
+				float w0 = std::fabs(a[0]) + 0.1f, w1 = std::fabs(a[1]), w2 = std::fabs(a[2]);
+				float sum = w0 + w1 + w2;
+				influences[i].weights[0] = w0 / sum;
+				influences[i].weights[1] = w1 / sum;
+				influences[i].weights[2] = w2 / sum;
+				for (std::size_t k = 0; k < 3; k++) influences[i].bones[k] = (std::uint16_t)((i / 64 + k * 7) % 64);
+				normals[i] = Vector4D(a[3], a[4], a[5], 0).normalize3();
+			}
+		}
+	};
+
+	// What user code does without skin(): every bone transforms the vertex
+	// and the results are summed by weight.
+	void skin_per_bone(State& state) {
+		SkinMesh<4> mesh(state.arg);
+		while (state.keep_running()) {
+			for (std::size_t i = 0; i < mesh.positions.size(); i++) {
+				Vector4D p(0, 0, 0, 0), n(0, 0, 0, 0);
+				for (std::size_t k = 0; k < 4; k++) {
+					const Matrix4D& m = mesh.palette[mesh.influences[i].bones[k]];
+					float w = mesh.influences[i].weights[k];
+					p += (m * mesh.positions[i]).scalar(w);
+					n += (m * mesh.normals[i]).scalar(w);
+				}
+				mesh.out_positions[i] = p;
+				mesh.out_normals[i] = n.normalize3();
+			}
+			bench::clobber_memory();
+		}
+		state.set_items_per_iteration((double)state.arg);
+		state.set_bytes_per_item(4 * sizeof(Vector4D) + sizeof(BoneInfluences4));
+	}
+
+	template<std::size_t N, class Palette>
+	void run_skin(State& state, const SkinMesh<N>& mesh, const Palette& palette, SkinMesh<N>& out,
+			const math4D::ParallelOptions& options) {
+		while (state.keep_running()) {
+			math4D::skin(palette, mesh.influences, mesh.positions, mesh.normals, out.out_positions, out.out_normals, options);
+			bench::clobber_memory();
+		}
+		state.set_items_per_iteration((double)state.arg);
+		state.set_bytes_per_item(4 * sizeof(Vector4D) + sizeof(math4D::BoneInfluences<N>));
+	}
+
+	// Single threaded, to compare the kernels.
+	math4D::ParallelOptions serial_options() {
+		math4D::ParallelOptions options;
+		options.chunk = (std::size_t)-1 / 2;
+		return options;
+	}
+
+	void skin_linear4(State& state) {
+		SkinMesh<4> mesh(state.arg);
+		run_skin(state, mesh, mesh.palette, mesh, serial_options());
+	}
+	void skin_linear8(State& state) {
+		SkinMesh<8> mesh(state.arg);
+		run_skin(state, mesh, mesh.palette, mesh, serial_options());
+	}
+	void skin_dual_quaternion4(State& state) {
+		SkinMesh<4> mesh(state.arg);
+		run_skin(state, mesh, mesh.dual_quaternions, mesh, serial_options());
+	}
+
+	// Linear blend skinning of --max-elements vertices (at most 1M) with 1, 2, 4, ... threads.
+	void skin_linear_threads(State& state) {
+		std::size_t n = bench::options().max_elements < 1000000 ? bench::options().max_elements : 1000000;
+		SkinMesh<4> mesh(n);
+		math4D::ThreadPool pool((unsigned int)state.arg - 1);
+		math4D::ParallelOptions options;
+		options.pool = &pool;
+		options.chunk = 4096;
+		while (state.keep_running()) {
+			math4D::skin(mesh.palette, mesh.influences, mesh.positions, mesh.normals, mesh.out_positions, mesh.out_normals, options);
+			bench::clobber_memory();
+		}
+		state.set_items_per_iteration((double)n);
+		state.set_bytes_per_item(4 * sizeof(Vector4D) + sizeof(BoneInfluences4));
+	}
+
+	BENCH_REGISTER("skin/per_bone", skin_per_bone, bench::bulk_sizes);
+	[[maybe_unused]] const bool registered_skin =
+		add_per_backend("skin/linear4", skin_linear4, bench::bulk_sizes) &&
+		add_per_backend("skin/linear8", skin_linear8, bench::bulk_sizes) &&
+		add_per_backend("skin/dual_quaternion4", skin_dual_quaternion4, bench::bulk_sizes);
+	BENCH_REGISTER("skin/linear4/threads", skin_linear_threads, bench::thread_counts);
+
+	// -----< Reductions >-------------------------------------------------------------------------
+
+	// A plain loop summing dot_product(), for comparison.
+	void reduce_dot_loop(State& state) {
+		std::vector<Vector4D> a = random_points(state.arg), b = random_points(state.arg);
+		while (state.keep_running()) {
+			float sum = 0;
+			for (std::size_t i = 0; i < a.size(); i++) sum += a[i].dot_product(b[i]);
+			bench::do_not_optimize(sum);
+		}
+		state.set_items_per_iteration((double)state.arg);
+		state.set_flops_per_item(8);
+		state.set_bytes_per_item(2 * sizeof(Vector4D));
+	}
+
+	void reduce_dot(State& state) {
+		std::vector<Vector4D> a = random_points(state.arg), b = random_points(state.arg);
+		math4D::ParallelOptions options = serial_options();
+		while (state.keep_running()) {
+			bench::do_not_optimize(math4D::parallel_dot(a, b, options));
+		}
+		state.set_items_per_iteration((double)state.arg);
+		state.set_flops_per_item(8);
+		state.set_bytes_per_item(2 * sizeof(Vector4D));
+	}
+
+	void reduce_sum(State& state) {
+		std::vector<Vector4D> a = random_points(state.arg);
+		math4D::ParallelOptions options = serial_options();
+		while (state.keep_running()) {
+			bench::do_not_optimize(math4D::parallel_sum(a, options));
+		}
+		state.set_items_per_iteration((double)state.arg);
+		state.set_flops_per_item(4);
+		state.set_bytes_per_item(sizeof(Vector4D));
+	}
+
+	// parallel_dot over --max-elements points (at most 10M) with 1, 2, 4, ... threads.
+	void reduce_dot_threads(State& state) {
+		std::size_t n = bench::options().max_elements < 10000000 ? bench::options().max_elements : 10000000;
+		std::vector<Vector4D> a = random_points(n), b = random_points(n);
+		math4D::ThreadPool pool((unsigned int)state.arg - 1);
+		math4D::ParallelOptions options;
+		options.pool = &pool;
+		while (state.keep_running()) {
+			bench::do_not_optimize(math4D::parallel_dot(a, b, options));
+		}
+		state.set_items_per_iteration((double)n);
+		state.set_flops_per_item(8);
+		state.set_bytes_per_item(2 * sizeof(Vector4D));
+	}
+
+	BENCH_REGISTER("reduce/dot_loop", reduce_dot_loop, bench::bulk_sizes);
+	[[maybe_unused]] const bool registered_reduce =
+		add_per_backend("reduce/dot", reduce_dot, bench::bulk_sizes) &&
+		add_per_backend("reduce/sum", reduce_sum, bench::bulk_sizes);
+	BENCH_REGISTER("reduce/dot/threads", reduce_dot_threads, bench::thread_counts);
+
+	// -----< Jobs >-------------------------------------------------------------------------------
+
+	// submit() and wait() of an empty job, the fixed cost of a job.
+	void jobs_empty(State& state) {
+		math4D::JobSystem jobs;
+		while (state.keep_running()) {
+			jobs.submit([] {}).wait();
+		}
+	}
+
+	// Two dependent transform_async() jobs over state.arg points, against
+	// the same two transforms called directly.
+	void jobs_transform_chain(State& state) {
+		std::vector<Vector4D> in = random_points(state.arg), mid(state.arg), out(state.arg);
+		Matrix4D a = sample_matrix(), b = sample_projection();
+		math4D::JobSystem jobs;
+		while (state.keep_running()) {
+			math4D::Job first = math4D::transform_async(jobs, a, in, mid);
+			math4D::transform_async(jobs, b, mid, out, { first }).wait();
+			bench::clobber_memory();
+		}
+		state.set_items_per_iteration((double)state.arg);
+		state.set_flops_per_item(2 * 28);
+		state.set_bytes_per_item(4 * sizeof(Vector4D));
+	}
+
+	void jobs_transform_direct(State& state) {
+		std::vector<Vector4D> in = random_points(state.arg), mid(state.arg), out(state.arg);
+		Matrix4D a = sample_matrix(), b = sample_projection();
+		while (state.keep_running()) {
+			math4D::parallel_transform(a, in, mid);
+			math4D::parallel_transform(b, mid, out);
+			bench::clobber_memory();
+		}
+		state.set_items_per_iteration((double)state.arg);
+		state.set_flops_per_item(2 * 28);
+		state.set_bytes_per_item(4 * sizeof(Vector4D));
+	}
+
+	BENCH_REGISTER("jobs/empty", jobs_empty);
+	BENCH_REGISTER("jobs/transform_chain", jobs_transform_chain, bench::bulk_sizes);
+	BENCH_REGISTER("jobs/transform_direct", jobs_transform_direct, bench::bulk_sizes);
+
+	// -----< Matrix streams >---------------------------------------------------------------------
+
+	// Random rigid transforms with a scale, all of them invertible.
+	std::vector<Matrix4D> random_matrices(std::size_t n, unsigned int seed) {
+		std::vector<float> r = random_floats(n * 7, seed);
+		std::vector<Matrix4D> m(n);
+		for (std::size_t i = 0; i < n; i++) {
+			const float* a = r.data() + i * 7;
+			m[i] = Matrix4D::rotation_xyz(a[0], a[1], a[2]);
+			m[i].translate(a[3], a[4], a[5]);
+			float scale = 2 + a[6];
+			m[i] *= Matrix4D(scale, 0, 0, 0, 0, scale, 0, 0, 0, 0, scale, 0, 0, 0, 0, 1);
+		}
+		return m;
+	}
+
+	// What user code does without Matrix4DStream: one operator* per pair.
+	void matrices_multiply_loop(State& state) {
+		std::vector<Matrix4D> a = random_matrices(state.arg, 1), b = random_matrices(state.arg, 2), out(state.arg);
+		while (state.keep_running()) {
+			for (std::size_t i = 0; i < a.size(); i++) out[i] = a[i] * b[i];
+			bench::clobber_memory();
+		}
+		state.set_items_per_iteration((double)state.arg);
+		state.set_flops_per_item(112);
+		state.set_bytes_per_item(3 * sizeof(Matrix4D));
+	}
+
+	void matrices_inverse_loop(State& state) {
+		std::vector<Matrix4D> in = random_matrices(state.arg, 1), out(state.arg);
+		while (state.keep_running()) {
+			for (std::size_t i = 0; i < in.size(); i++) in[i].try_inverse(out[i]);
+			bench::clobber_memory();
+		}
+		state.set_items_per_iteration((double)state.arg);
+		state.set_bytes_per_item(2 * sizeof(Matrix4D));
+	}
+
+	void matrix_stream_multiply(State& state) {
+		Matrix4DStream a(random_matrices(state.arg, 1)), b(random_matrices(state.arg, 2)), out(state.arg);
+		while (state.keep_running()) {
+			math4D::multiply(a, b, out);
+			bench::clobber_memory();
+		}
+		state.set_items_per_iteration((double)state.arg);
+		state.set_flops_per_item(112);
+		state.set_bytes_per_item(3 * sizeof(Matrix4D));
+	}
+
+	void matrix_stream_transpose(State& state) {
+		Matrix4DStream in(random_matrices(state.arg, 1)), out(state.arg);
+		while (state.keep_running()) {
+			math4D::transpose(in, out);
+			bench::clobber_memory();
+		}
+		state.set_items_per_iteration((double)state.arg);
+		state.set_bytes_per_item(2 * sizeof(Matrix4D));
+	}
+
+	void matrix_stream_determinant(State& state) {
+		Matrix4DStream in(random_matrices(state.arg, 1));
+		std::vector<float> out(state.arg);
+		while (state.keep_running()) {
+			math4D::determinant(in, out);
+			bench::clobber_memory();
+		}
+		state.set_items_per_iteration((double)state.arg);
+		state.set_bytes_per_item(sizeof(Matrix4D) + sizeof(float));
+	}
+
+	void matrix_stream_inverse(State& state) {
+		Matrix4DStream in(random_matrices(state.arg, 1)), out(state.arg);
+		std::vector<std::uint8_t> singular(state.arg);
+		while (state.keep_running()) {
+			bench::do_not_optimize(math4D::inverse(in, out, singular));
+			bench::clobber_memory();
+		}
+		state.set_items_per_iteration((double)state.arg);
+		state.set_bytes_per_item(2 * sizeof(Matrix4D) + 1);
+	}
+
+	[[maybe_unused]] const bool registered_matrix_streams =
+		add_per_backend("matrices/multiply_loop", matrices_multiply_loop, bench::bulk_sizes) &&
+		add_per_backend("matrices/inverse_loop", matrices_inverse_loop, bench::bulk_sizes) &&
+		add_per_backend("matrix_stream/multiply", matrix_stream_multiply, bench::bulk_sizes) &&
+		add_per_backend("matrix_stream/transpose", matrix_stream_transpose, bench::bulk_sizes) &&
+		add_per_backend("matrix_stream/determinant", matrix_stream_determinant, bench::bulk_sizes) &&
+		add_per_backend("matrix_stream/inverse", matrix_stream_inverse, bench::bulk_sizes);
+
+	// -----< Transform hierarchy >----------------------------------------------------------------
+
+	// A 4-ary tree of 100K nodes (fewer with a smaller --max-elements).
+	std::size_t hierarchy_size() {
+		return bench::options().max_elements < 100000 ? bench::options().max_elements : 100000;
+	}
+
+	// 1, 10, 100, ... changed nodes, up to the whole tree.
+	std::vector<std::size_t> hierarchy_changes() {
+		std::vector<std::size_t> counts;
+		for (std::size_t n = 1; n <= hierarchy_size(); n *= 10) {
+			counts.push_back(n);
+		}
+		return counts;
+	}
+
+	TransformHierarchy sample_hierarchy(std::size_t n) {
+		TransformHierarchy h;
+		h.reserve(n);
+		Matrix4D local = sample_matrix();
+		for (std::size_t i = 0; i < n; i++) {
+			h.add(local, i == 0 ? TransformHierarchy::none : (TransformHierarchy::Node)((i - 1) / 4));
+		}
+		h.update();
+		return h;
+	}
+
+	// Sets state.arg random local matrices, then updates. The cost should
+	// follow the number of changed nodes, not the size of the tree.
+	void hierarchy_update_changed(State& state) {
+		std::size_t n = hierarchy_size();
+		TransformHierarchy h = sample_hierarchy(n);
+		std::mt19937 gen(1);
+		std::vector<TransformHierarchy::Node> nodes(state.arg);
+		for (TransformHierarchy::Node& node : nodes) node = (TransformHierarchy::Node)(gen() % n);
+		Matrix4D local = Matrix4D::rotate_z(10);
+		while (state.keep_running()) {
+			for (TransformHierarchy::Node node : nodes) h.set_local(node, local);
+			h.update();
+			bench::clobber_memory();
+		}
+		state.set_items_per_iteration((double)state.arg);
+	}
+
+	// Every world matrix recomputed as parent * local, what the hierarchy replaces.
+	void hierarchy_update_all(State& state) {
+		std::size_t n = hierarchy_size();
+		std::vector<Matrix4D> locals(n, sample_matrix()), worlds(n);
+		while (state.keep_running()) {
+			worlds[0] = locals[0];
+			for (std::size_t i = 1; i < n; i++) {
+				worlds[i] = worlds[(i - 1) / 4] * locals[i];
+			}
+			bench::clobber_memory();
+		}
+		state.set_items_per_iteration((double)n);
+		state.set_bytes_per_item(2 * sizeof(Matrix4D));
+	}
+
+	BENCH_REGISTER("hierarchy/update/changed", hierarchy_update_changed, hierarchy_changes);
+	BENCH_REGISTER("hierarchy/update/all_nodes", hierarchy_update_all);
+
+	// -----< Pool / Arena >-----------------------------------------------------------------------
+
+	void pool_create_release(State& state) {
+		Matrix4DPool pool(1024);
+		Matrix4D m = sample_matrix();
+		micro(state, 0, [&] {
+			Matrix4DPool::Handle h = pool.create(m);
+			bench::do_not_optimize(h);
+			pool.release(h);
+		});
+	}
+	void heap_new_delete(State& state) {
+		Matrix4D m = sample_matrix();
+		micro(state, 0, [&] {
+			Matrix4D* p = new Matrix4D(m);
+			bench::do_not_optimize(p);
+			delete p;
+		});
+	}
+	void arena_create(State& state) {
+		math4D::Arena arena(1 << 16);
+		Matrix4D m = sample_matrix();
+		micro(state, 0, [&] {
+			Matrix4D* p = arena.create<Matrix4D>(m);
+			if (p == nullptr) {
+				arena.reset();
+				p = arena.create<Matrix4D>(m);
+			}
+			bench::do_not_optimize(p);
+		});
+	}
+
+	// 64K creates and releases spread over 1, 2, 4, ... threads, each
+	// thread keeping 16 objects alive at a time. The pool's free list
+	// against the global heap.
+	template<class Create, class Release>
+	void churn_threads(State& state, Create create, Release release) {
+		const std::size_t n = 65536;
+		math4D::ThreadPool pool(state.arg > 1 ? (unsigned int)state.arg - 1 : 0);
+		while (state.keep_running()) {
+			pool.parallel_for(0, n, 1024, [&](std::size_t begin, std::size_t end) {
+				for (std::size_t i = begin; i < end; i += 16) {
+					decltype(create()) live[16];
+					for (auto& h : live) h = create();
+					for (auto& h : live) release(h);
+				}
+			});
+		}
+		state.set_items_per_iteration((double)n);
+	}
+	void pool_threads(State& state) {
+		Matrix4DPool objects(16 * 1024);
+		churn_threads(state, [&] { return objects.create(); }, [&](Matrix4DPool::Handle h) { objects.release(h); });
+	}
+	void heap_threads(State& state) {
+		churn_threads(state, [] { return new Matrix4D(); }, [](Matrix4D* p) { delete p; });
+	}
+
+	BENCH_REGISTER("pool/matrix4d/create_release", pool_create_release);
+	BENCH_REGISTER("pool/matrix4d/new_delete", heap_new_delete);
+	BENCH_REGISTER("pool/matrix4d/arena_create", arena_create);
+	BENCH_REGISTER("pool/threads/pool", pool_threads, bench::thread_counts);
+	BENCH_REGISTER("pool/threads/new_delete", heap_threads, bench::thread_counts);
+
+	// -----< Dataset files >----------------------------------------------------------------------
+
+	std::string dataset_path() {
+		return (std::filesystem::temp_directory_path() / "math4d_bench.m4d").string();
+	}
+
+	void dataset_write(State& state) {
+		std::vector<Vector4D> points = random_points(state.arg);
+		std::string path = dataset_path();
+		while (state.keep_running()) {
+			math4D::DatasetWriter<Vector4D> writer;
+			writer.open(path.c_str());
+			writer.append(points);
+			writer.close();
+		}
+		std::filesystem::remove(path);
+		state.set_items_per_iteration((double)state.arg);
+		state.set_bytes_per_item(sizeof(Vector4D));
+	}
+
+	// Maps the file and sums every point. The file was just written, so
+	// it is in the page cache and this is the cost of mapping and the
+	// page faults, not of the disk.
+	void dataset_map_read(State& state) {
+		std::string path = dataset_path();
+		{
+			math4D::DatasetWriter<Vector4D> writer;
+			writer.open(path.c_str());
+			writer.append(random_points(state.arg));
+		}
+		while (state.keep_running()) {
+			math4D::MappedDataset file;
+			file.open(path.c_str());
+			float sum = 0;
+			for (const Vector4D& p : file.elements<Vector4D>()) sum += p[0];
+			bench::do_not_optimize(sum);
+		}
+		std::filesystem::remove(path);
+		state.set_items_per_iteration((double)state.arg);
+		state.set_bytes_per_item(sizeof(Vector4D));
+	}
+
+	// File to file through stream_transform, in chunks of 64K points.
+	void dataset_stream_transform(State& state) {
+		std::string in_path = dataset_path();
+		std::string out_path = in_path + ".out";
+		{
+			math4D::DatasetWriter<Vector4D> writer;
+			writer.open(in_path.c_str());
+			writer.append(random_points(state.arg));
+		}
+		Matrix4D m = sample_matrix();
+		while (state.keep_running()) {
+			math4D::DatasetReader<Vector4D> in;
+			math4D::DatasetWriter<Vector4D> out;
+			in.open(in_path.c_str());
+			out.open(out_path.c_str());
+			math4D::stream_transform(m, math4D::dataset_source(in), math4D::dataset_sink(out));
+		}
+		std::filesystem::remove(in_path);
+		std::filesystem::remove(out_path);
+		state.set_items_per_iteration((double)state.arg);
+		state.set_bytes_per_item(2 * sizeof(Vector4D));
+	}
+
+	BENCH_REGISTER("io/dataset/write", dataset_write, bench::bulk_sizes);
+	BENCH_REGISTER("io/dataset/map_read", dataset_map_read, bench::bulk_sizes);
+	BENCH_REGISTER("io/dataset/stream_transform", dataset_stream_transform, bench::bulk_sizes);
+
+	// -----< Lazy chains >------------------------------------------------------------------------
+
+	struct Chain {
+		Matrix4D proj = Matrix4D::rotate_x(10);
+		Matrix4D view = sample_matrix();
+		Matrix4D model = Matrix4D::rotate_z(20);
+	};
+
+	void chain_vector_eager(State& state) {
+		Chain c;
+		Vector4D v(1, 2, 3);
+		micro(state, 2 * 112 + 28, [&] { bench::do_not_optimize(v); bench::do_not_optimize(c.proj * c.view * c.model * v); });
+	}
+	void chain_vector_lazy(State& state) {
+		Chain c;
+		Vector4D v(1, 2, 3);
+		micro(state, 3 * 28, [&] { bench::do_not_optimize(v); bench::do_not_optimize(math4D::lazy(c.proj) * c.view * c.model * v); });
+	}
+
+	// Every point through the full chain with the eager operators,
+	// against the chain folded once and run through the batch kernel.
+	void chain_bulk_eager(State& state) {
+		Chain c;
+		std::vector<Vector4D> in = random_points(state.arg), out(state.arg);
+		while (state.keep_running()) {
+			for (std::size_t i = 0; i < in.size(); i++) {
+				out[i] = c.proj * c.view * c.model * in[i];
+			}
+			bench::clobber_memory();
+		}
+		state.set_items_per_iteration((double)state.arg);
+		state.set_bytes_per_item(2 * sizeof(Vector4D));
+	}
+	void chain_bulk_lazy(State& state) {
+		Chain c;
+		std::vector<Vector4D> in = random_points(state.arg), out(state.arg);
+		while (state.keep_running()) {
+			(math4D::lazy(c.proj) * c.view * c.model).transform(in, out);
+			bench::clobber_memory();
+		}
+		state.set_items_per_iteration((double)state.arg);
+		state.set_bytes_per_item(2 * sizeof(Vector4D));
+	}
+
+	BENCH_REGISTER("chain/vector/eager", chain_vector_eager);
+	BENCH_REGISTER("chain/vector/lazy", chain_vector_lazy);
+	BENCH_REGISTER("chain/bulk/eager", chain_bulk_eager, bench::bulk_sizes);
+	BENCH_REGISTER("chain/bulk/lazy", chain_bulk_lazy, bench::bulk_sizes);
+}
+
+int main(int argc, char** argv) {
+	return bench::run_all(argc, argv);
+}
@@ -0,0 +1,698 @@
+#pragma once
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <span>
+#include <utility>
+
+#include "half4D.h"
+#include "instrument4D.h"
+#include "matrix4D.h"
+#include "vector4D.h"
+#include "vectorN.h"
+#include "simd4D.h"
+
+// Batched transforms of many points by one Matrix4D.
+//
+// Two layouts are supported:
+//	Array of structs:	std::span<Vector4D>, the points as they are stored today.
+//	Struct of arrays:	Vector4DStream, one plane per component, so 8 points
+//						fit in one AVX2 register per component.
+//	Half precision:		std::span<Vector4DHalf>, 8 bytes per point instead of 16,
+//						for lists that are limited by memory bandwidth.
+//
+// project() runs the model-view-projection matrix, the perspective divide
+// and the viewport mapping in one pass, so every point goes through memory once.
+
+// -----< Vector4DStream >---------------------------------------------------------------------
+
+// A list of points stored as four separate planes (x, y, z and w).
+// Every plane is 64-byte aligned.
+class Vector4DStream {
+private:
+	float* planes[4] = { nullptr, nullptr, nullptr, nullptr };
+	std::size_t count = 0;
+	std::size_t capacity = 0;
+
+	// Planes are padded to a multiple of 16 floats (one cache line).
+	static std::size_t padded(std::size_t n) {
+		return (n + 15) & ~std::size_t(15);
+	}
+
+	void release() {
+		if (planes[0] != nullptr) {
+			::operator delete(planes[0], std::align_val_t(64));
+		}
+		planes[0] = planes[1] = planes[2] = planes[3] = nullptr;
+		count = capacity = 0;
+	}
+
+public:
+
+	// -----< Constructors >-----------------------------------------------------------------------
+
+	// Creates a stream with n points set to (0, 0, 0, 1).
+	explicit Vector4DStream(std::size_t n = 0) {
+		resize(n);
+	}
+
+	// Creates a stream with the same points as a list of Vector4D.
+	explicit Vector4DStream(std::span<const Vector4D> points) {
+		resize(points.size());
+		for (std::size_t i = 0; i < count; i++) {
+			set(i, points[i]);
+		}
+	}
+
+	Vector4DStream(const Vector4DStream& s) {
+		*this = s;
+	}
+
+	Vector4DStream(Vector4DStream&& s) noexcept {
+		*this = std::move(s);
+	}
+
+	~Vector4DStream() {
+		release();
+	}
+
+	Vector4DStream& operator=(const Vector4DStream& s) {
+		if (this != &s) {
+			resize(s.count);
+			for (int c = 0; c < 4; c++) {
+				for (std::size_t i = 0; i < count; i++) {
+					planes[c][i] = s.planes[c][i];
+				}
+			}
+		}
+		return *this;
+	}
+
+	Vector4DStream& operator=(Vector4DStream&& s) noexcept {
+		if (this != &s) {
+			release();
+			for (int c = 0; c < 4; c++) {
+				planes[c] = s.planes[c];
+				s.planes[c] = nullptr;
+			}
+			count = s.count;
+			capacity = s.capacity;
+			s.count = s.capacity = 0;
+		}
+		return *this;
+	}
+
+	// -----< Getters >----------------------------------------------------------------------------
+
+	// Returns the number of points.
+	std::size_t size() const {
+		return count;
+	}
+
+	// Returns the plane for a component.
+	// 0 = x, 1 = y, 2 = z, 3 = w
+	float* plane(int component) {
+		return planes[component];
+	}
+	const float* plane(int component) const {
+		return planes[component];
+	}
+
+	float* x() { return planes[0]; }
+	float* y() { return planes[1]; }
+	float* z() { return planes[2]; }
+	float* w() { return planes[3]; }
+	const float* x() const { return planes[0]; }
+	const float* y() const { return planes[1]; }
+	const float* z() const { return planes[2]; }
+	const float* w() const { return planes[3]; }
+
+	// Returns the point on an index as a Vector4D.
+	Vector4D get(std::size_t index) const {
+		return Vector4D(planes[0][index], planes[1][index], planes[2][index], planes[3][index]);
+	}
+
+	// Copies all the points to a list of Vector4D.
+	// out has to hold at least size() points.
+	void to_aos(std::span<Vector4D> out) const {
+		assert(out.size() >= count);
+		for (std::size_t i = 0; i < count; i++) {
+			out[i] = get(i);
+		}
+	}
+
+	// -----< Setters >----------------------------------------------------------------------------
+
+	// Set the point on an index.
+	void set(std::size_t index, const Vector4D& v) {
+		planes[0][index] = v[0];
+		planes[1][index] = v[1];
+		planes[2][index] = v[2];
+		planes[3][index] = v[3];
+	}
+
+	// Changes the number of points. Existing points are kept,
+	// new points are set to (0, 0, 0, 1).
+	void resize(std::size_t n) {
+		if (n > capacity) {
+			std::size_t new_capacity = padded(n);
+			float* block = static_cast<float*>(::operator new(4 * new_capacity * sizeof(float), std::align_val_t(64)));
+			for (int c = 0; c < 4; c++) {
+				float* p = block + c * new_capacity;
+				for (std::size_t i = 0; i < count; i++) {
+					p[i] = planes[c][i];
+				}
+			}
+			std::size_t old_count = count;
+			release();
+			for (int c = 0; c < 4; c++) {
+				planes[c] = block + c * new_capacity;
+			}
+			count = old_count;
+			capacity = new_capacity;
+		}
+		for (std::size_t i = count; i < n; i++) {
+			planes[0][i] = planes[1][i] = planes[2][i] = 0;
+			planes[3][i] = 1;
+		}
+		count = n;
+	}
+};
+
+// -----< Viewport >---------------------------------------------------------------------------
+
+// The window rectangle and depth range project() maps to, the same as
+// glViewport and glDepthRange. x and y are the lower left corner. For
+// window coordinates with y pointing down, set y to the height of the
+// window and height to minus the height.
+struct Viewport {
+	float x = 0;
+	float y = 0;
+	float width = 1;
+	float height = 1;
+	float min_depth = 0;
+	float max_depth = 1;
+};
+
+namespace math4D {
+namespace kernels {
+
+	// -----< Scalar >-----------------------------------------------------------------------------
+
+	namespace scalar {
+
+		// out[i] = m * in[i] for n points stored as Vector4D.
+		inline void transform_aos(const float* m, const float* in, float* out, std::size_t n) {
+			for (std::size_t i = 0; i < n; i++) {
+				mat4_mul_vec4(m, in + i * 4, out + i * 4);
+			}
+		}
+
+		// out[i] = m * in[i] for n points stored as four planes.
+		inline void transform_soa(const float* m, const float* const in[4], float* const out[4], std::size_t n) {
+			for (std::size_t i = 0; i < n; i++) {
+				float x = in[0][i], y = in[1][i], z = in[2][i], w = in[3][i];
+				for (int r = 0; r < 4; r++) {
+					out[r][i] = m[r * 4 + 0] * x + m[r * 4 + 1] * y + m[r * 4 + 2] * z + m[r * 4 + 3] * w;
+				}
+			}
+		}
+
+		// The clip flags of one clip space point, see math4D::ClipFlags.
+		inline std::uint8_t clip_flags(const float* c, bool zero_to_one) {
+			std::uint8_t f = 0;
+			if (c[0] < -c[3]) f |= 1;
+			if (c[0] > c[3]) f |= 2;
+			if (c[1] < -c[3]) f |= 4;
+			if (c[1] > c[3]) f |= 8;
+			if (zero_to_one ? c[2] < 0 : c[2] < -c[3]) f |= 16;
+			if (c[2] > c[3]) f |= 32;
+			return f;
+		}
+
+		// out[i] = (window x, window y, depth, 1 / w) of m * in[i]. viewport is
+		// the scale (x, y, z, 0) and the offset (x, y, z, 0) from clip space
+		// after the divide to the window. flags may be nullptr.
+		inline void project_aos(const float* m, const float* viewport, const float* in, float* out,
+				std::uint8_t* flags, std::size_t n, bool zero_to_one) {
+			for (std::size_t i = 0; i < n; i++) {
+				float c[4];
+				mat4_mul_vec4(m, in + i * 4, c);
+				if (flags != nullptr) flags[i] = clip_flags(c, zero_to_one);
+				float inv_w = 1 / c[3];
+				for (int k = 0; k < 3; k++) {
+					out[i * 4 + k] = c[k] * inv_w * viewport[k] + viewport[4 + k];
+				}
+				out[i * 4 + 3] = inv_w;
+			}
+		}
+
+		// out[i] = in[i] / |in[i]| over the first components (3 or 4) values.
+		// There is no fast version, fast gives the exact results.
+		inline void normalize_aos(const float* in, float* out, std::size_t n, int components, bool) {
+			for (std::size_t i = 0; i < n; i++) {
+				vec4_normalize(in + i * 4, out + i * 4, components);
+			}
+		}
+	}
+
+#if defined(MATH4D_SIMD)
+
+	// -----< SSE >--------------------------------------------------------------------------------
+
+	namespace sse {
+
+		// The matrix is transposed once, then every point is
+		// column0 * x + column1 * y + column2 * z + column3 * w.
+		MATH4D_TARGET_SSE41 inline void transform_aos(const float* m, const float* in, float* out, std::size_t n) {
+			__m128 c0 = _mm_load_ps(m + 0);
+			__m128 c1 = _mm_load_ps(m + 4);
+			__m128 c2 = _mm_load_ps(m + 8);
+			__m128 c3 = _mm_load_ps(m + 12);
+			_MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+			for (std::size_t i = 0; i < n; i++) {
+				__m128 p = _mm_load_ps(in + i * 4);
+				__m128 r = _mm_mul_ps(_mm_shuffle_ps(p, p, _MM_SHUFFLE(0, 0, 0, 0)), c0);
+				r = _mm_add_ps(r, _mm_mul_ps(_mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1)), c1));
+				r = _mm_add_ps(r, _mm_mul_ps(_mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 2, 2)), c2));
+				r = _mm_add_ps(r, _mm_mul_ps(_mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 3, 3, 3)), c3));
+				_mm_store_ps(out + i * 4, r);
+			}
+		}
+
+		// Four points per iteration, one register per component.
+		MATH4D_TARGET_SSE41 inline void transform_soa(const float* m, const float* const in[4], float* const out[4], std::size_t n) {
+			__m128 mm[16];
+			for (int k = 0; k < 16; k++) mm[k] = _mm_set1_ps(m[k]);
+			std::size_t i = 0;
+			for (; i + 4 <= n; i += 4) {
+				__m128 x = _mm_loadu_ps(in[0] + i);
+				__m128 y = _mm_loadu_ps(in[1] + i);
+				__m128 z = _mm_loadu_ps(in[2] + i);
+				__m128 w = _mm_loadu_ps(in[3] + i);
+				__m128 r[4];
+				for (int k = 0; k < 4; k++) {
+					r[k] = _mm_add_ps(
+						_mm_add_ps(_mm_mul_ps(mm[k * 4 + 0], x), _mm_mul_ps(mm[k * 4 + 1], y)),
+						_mm_add_ps(_mm_mul_ps(mm[k * 4 + 2], z), _mm_mul_ps(mm[k * 4 + 3], w)));
+				}
+				for (int k = 0; k < 4; k++) _mm_storeu_ps(out[k] + i, r[k]);
+			}
+			const float* in_rest[4] = { in[0] + i, in[1] + i, in[2] + i, in[3] + i };
+			float* const out_rest[4] = { out[0] + i, out[1] + i, out[2] + i, out[3] + i };
+			scalar::transform_soa(m, in_rest, out_rest, n - i);
+		}
+
+		// One point per iteration with the vector kernels from simd4D.h.
+		inline void normalize_aos(const float* in, float* out, std::size_t n, int components, bool fast) {
+			for (std::size_t i = 0; i < n; i++) {
+				__m128 v = _mm_load_ps(in + i * 4);
+				_mm_store_ps(out + i * 4, fast ? normalize_fast(v, components) : normalize(v, components));
+			}
+		}
+
+		// The clip flags of a clip space point c with w in all lanes.
+		// low is -w, or -w in x and y and 0 in z for zero_to_one.
+		// Interleaving the below and above masks puts the bits in ClipFlags order.
+		inline std::uint8_t clip_flags(__m128 c, __m128 w, __m128 low) {
+			__m128 below = _mm_cmplt_ps(c, low);
+			__m128 above = _mm_cmpgt_ps(c, w);
+			int xy = _mm_movemask_ps(_mm_unpacklo_ps(below, above));
+			int z = _mm_movemask_ps(_mm_unpackhi_ps(below, above)) & 3;
+			return (std::uint8_t)(xy | (z << 4));
+		}
+
+		// The matrix is transposed once as in transform_aos. The divide is
+		// exact, the same as Vector4D::operator/.
+		MATH4D_TARGET_SSE41 inline void project_aos(const float* m, const float* viewport, const float* in, float* out,
+				std::uint8_t* flags, std::size_t n, bool zero_to_one) {
+			__m128 c0 = _mm_load_ps(m + 0);
+			__m128 c1 = _mm_load_ps(m + 4);
+			__m128 c2 = _mm_load_ps(m + 8);
+			__m128 c3 = _mm_load_ps(m + 12);
+			_MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+			const __m128 scale = _mm_loadu_ps(viewport);
+			const __m128 offset = _mm_loadu_ps(viewport + 4);
+			const __m128 sign = _mm_set1_ps(-0.0f);
+			const __m128 low_mask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, zero_to_one ? 0 : -1, -1));
+			for (std::size_t i = 0; i < n; i++) {
+				__m128 p = _mm_load_ps(in + i * 4);
+				__m128 c = _mm_mul_ps(_mm_shuffle_ps(p, p, _MM_SHUFFLE(0, 0, 0, 0)), c0);
+				c = _mm_add_ps(c, _mm_mul_ps(_mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1)), c1));
+				c = _mm_add_ps(c, _mm_mul_ps(_mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 2, 2)), c2));
+				c = _mm_add_ps(c, _mm_mul_ps(_mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 3, 3, 3)), c3));
+				__m128 w = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 3, 3));
+				if (flags != nullptr) {
+					flags[i] = clip_flags(c, w, _mm_and_ps(_mm_xor_ps(w, sign), low_mask));
+				}
+				__m128 inv_w = _mm_div_ps(_mm_set1_ps(1.0f), w);
+				__m128 r = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(c, inv_w), scale), offset);
+				_mm_store_ps(out + i * 4, _mm_blend_ps(r, inv_w, 8));
+			}
+		}
+	}
+
+	// -----< AVX2 / FMA >-------------------------------------------------------------------------
+
+	namespace avx2 {
+
+		// Above this many bytes of output the results are written with
+		// non-temporal stores so they do not evict the input from the cache.
+		constexpr std::size_t streaming_store_bytes = std::size_t(8) << 20;
+
+		// Two points per iteration, one in each 128-bit half.
+		MATH4D_TARGET_AVX2 inline void transform_aos(const float* m, const float* in, float* out, std::size_t n) {
+			__m128 t0 = _mm_load_ps(m + 0);
+			__m128 t1 = _mm_load_ps(m + 4);
+			__m128 t2 = _mm_load_ps(m + 8);
+			__m128 t3 = _mm_load_ps(m + 12);
+			_MM_TRANSPOSE4_PS(t0, t1, t2, t3);
+			__m256 c0 = _mm256_set_m128(t0, t0);
+			__m256 c1 = _mm256_set_m128(t1, t1);
+			__m256 c2 = _mm256_set_m128(t2, t2);
+			__m256 c3 = _mm256_set_m128(t3, t3);
+
+			bool stream = n * 16 >= streaming_store_bytes && in != out && ((std::size_t)out & 31) == 0;
+
+			std::size_t i = 0;
+			for (; i + 2 <= n; i += 2) {
+				__m256 p = _mm256_loadu_ps(in + i * 4);
+				__m256 r = _mm256_mul_ps(_mm256_shuffle_ps(p, p, _MM_SHUFFLE(0, 0, 0, 0)), c0);
+				r = _mm256_fmadd_ps(_mm256_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1)), c1, r);
+				r = _mm256_fmadd_ps(_mm256_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 2, 2)), c2, r);
+				r = _mm256_fmadd_ps(_mm256_shuffle_ps(p, p, _MM_SHUFFLE(3, 3, 3, 3)), c3, r);
+				if (stream) {
+					_mm256_stream_ps(out + i * 4, r);
+				}
+				else {
+					_mm256_storeu_ps(out + i * 4, r);
+				}
+			}
+			if (stream) _mm_sfence();
+			if (i < n) {
+				sse::transform_aos(m, in + i * 4, out + i * 4, n - i);
+			}
+		}
+
+		// Normalizes the two points in v. mask selects the components that
+		// count. The steps and the length checks are the ones of
+		// sse::normalize / sse::normalize_fast.
+		MATH4D_TARGET_AVX2 inline __m256 normalize2(__m256 v, __m256 mask, bool fast) {
+			__m256 p = _mm256_and_ps(_mm256_mul_ps(v, v), mask);
+			__m256 len2 = _mm256_add_ps(p, _mm256_shuffle_ps(p, p, _MM_SHUFFLE(2, 3, 0, 1)));
+			len2 = _mm256_add_ps(len2, _mm256_shuffle_ps(len2, len2, _MM_SHUFFLE(1, 0, 3, 2)));
+			__m256 r, usable;
+			if (fast) {
+				__m256 y = _mm256_rsqrt_ps(len2);
+				__m256 half_x_yy = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), len2), _mm256_mul_ps(y, y));
+				y = _mm256_mul_ps(y, _mm256_sub_ps(_mm256_set1_ps(1.5f), half_x_yy));
+				r = _mm256_mul_ps(v, y);
+				// rsqrtps flushes denormals, so the length has to be normal.
+				usable = _mm256_cmp_ps(len2, _mm256_set1_ps(1.17549435e-38f), _CMP_GE_OQ);
+			}
+			else {
+				r = _mm256_div_ps(v, _mm256_sqrt_ps(len2));
+				usable = _mm256_cmp_ps(len2, _mm256_setzero_ps(), _CMP_GT_OQ);
+			}
+			return _mm256_blendv_ps(v, r, _mm256_and_ps(usable, mask));
+		}
+
+		// Two points per register, four per iteration. The squared length is
+		// summed inside every 128-bit half, the rest as in the SSE kernels.
+		MATH4D_TARGET_AVX2 inline void normalize_aos(const float* in, float* out, std::size_t n, int components, bool fast) {
+			const __m256 mask = components == 3
+				? _mm256_castsi256_ps(_mm256_setr_epi32(-1, -1, -1, 0, -1, -1, -1, 0))
+				: _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			std::size_t i = 0;
+			for (; i + 4 <= n; i += 4) {
+				__m256 a = normalize2(_mm256_loadu_ps(in + i * 4), mask, fast);
+				__m256 b = normalize2(_mm256_loadu_ps(in + i * 4 + 8), mask, fast);
+				_mm256_storeu_ps(out + i * 4, a);
+				_mm256_storeu_ps(out + i * 4 + 8, b);
+			}
+			sse::normalize_aos(in + i * 4, out + i * 4, n - i, components, fast);
+		}
+
+		// Two points per iteration, one in each 128-bit half, as transform_aos.
+		MATH4D_TARGET_AVX2 inline void project_aos(const float* m, const float* viewport, const float* in, float* out,
+				std::uint8_t* flags, std::size_t n, bool zero_to_one) {
+			__m128 t0 = _mm_load_ps(m + 0);
+			__m128 t1 = _mm_load_ps(m + 4);
+			__m128 t2 = _mm_load_ps(m + 8);
+			__m128 t3 = _mm_load_ps(m + 12);
+			_MM_TRANSPOSE4_PS(t0, t1, t2, t3);
+			__m256 c0 = _mm256_set_m128(t0, t0);
+			__m256 c1 = _mm256_set_m128(t1, t1);
+			__m256 c2 = _mm256_set_m128(t2, t2);
+			__m256 c3 = _mm256_set_m128(t3, t3);
+			const __m256 scale = _mm256_broadcast_ps((const __m128*)viewport);
+			const __m256 offset = _mm256_broadcast_ps((const __m128*)(viewport + 4));
+			const __m256 sign = _mm256_set1_ps(-0.0f);
+			const __m256 low_mask = _mm256_castsi256_ps(_mm256_setr_epi32(
+				-1, -1, zero_to_one ? 0 : -1, -1, -1, -1, zero_to_one ? 0 : -1, -1));
+
+			std::size_t i = 0;
+			for (; i + 2 <= n; i += 2) {
+				__m256 p = _mm256_loadu_ps(in + i * 4);
+				__m256 c = _mm256_mul_ps(_mm256_shuffle_ps(p, p, _MM_SHUFFLE(0, 0, 0, 0)), c0);
+				c = _mm256_fmadd_ps(_mm256_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1)), c1, c);
+				c = _mm256_fmadd_ps(_mm256_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 2, 2)), c2, c);
+				c = _mm256_fmadd_ps(_mm256_shuffle_ps(p, p, _MM_SHUFFLE(3, 3, 3, 3)), c3, c);
+				__m256 w = _mm256_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 3, 3));
+				if (flags != nullptr) {
+					__m256 below = _mm256_cmp_ps(c, _mm256_and_ps(_mm256_xor_ps(w, sign), low_mask), _CMP_LT_OQ);
+					__m256 above = _mm256_cmp_ps(c, w, _CMP_GT_OQ);
+					int xy = _mm256_movemask_ps(_mm256_unpacklo_ps(below, above));
+					int z = _mm256_movemask_ps(_mm256_unpackhi_ps(below, above)) & 0x33;
+					flags[i] = (std::uint8_t)((xy & 15) | (z << 4));
+					flags[i + 1] = (std::uint8_t)((xy >> 4) | (z & 0x30));
+				}
+				__m256 inv_w = _mm256_div_ps(_mm256_set1_ps(1.0f), w);
+				__m256 r = _mm256_fmadd_ps(_mm256_mul_ps(c, inv_w), scale, offset);
+				_mm256_storeu_ps(out + i * 4, _mm256_blend_ps(r, inv_w, 0x88));
+			}
+			if (i < n) {
+				sse::project_aos(m, viewport, in + i * 4, out + i * 4, flags != nullptr ? flags + i : nullptr, n - i, zero_to_one);
+			}
+		}
+
+		// Eight points per iteration, one register per component.
+		MATH4D_TARGET_AVX2 inline void transform_soa(const float* m, const float* const in[4], float* const out[4], std::size_t n) {
+			__m256 mm[16];
+			for (int k = 0; k < 16; k++) mm[k] = _mm256_set1_ps(m[k]);
+			std::size_t i = 0;
+			for (; i + 8 <= n; i += 8) {
+				__m256 x = _mm256_loadu_ps(in[0] + i);
+				__m256 y = _mm256_loadu_ps(in[1] + i);
+				__m256 z = _mm256_loadu_ps(in[2] + i);
+				__m256 w = _mm256_loadu_ps(in[3] + i);
+				__m256 r[4];
+				for (int k = 0; k < 4; k++) {
+					r[k] = _mm256_mul_ps(mm[k * 4 + 0], x);
+					r[k] = _mm256_fmadd_ps(mm[k * 4 + 1], y, r[k]);
+					r[k] = _mm256_fmadd_ps(mm[k * 4 + 2], z, r[k]);
+					r[k] = _mm256_fmadd_ps(mm[k * 4 + 3], w, r[k]);
+				}
+				for (int k = 0; k < 4; k++) _mm256_storeu_ps(out[k] + i, r[k]);
+			}
+			const float* in_rest[4] = { in[0] + i, in[1] + i, in[2] + i, in[3] + i };
+			float* const out_rest[4] = { out[0] + i, out[1] + i, out[2] + i, out[3] + i };
+			scalar::transform_soa(m, in_rest, out_rest, n - i);
+		}
+	}
+
+#endif
+
+	// -----< Dispatch >---------------------------------------------------------------------------
+
+	// out[i] = m * in[i], in and out may be the same array.
+	inline void transform_aos(const float* m, const float* in, float* out, std::size_t n) {
+#if defined(MATH4D_SIMD)
+		switch (simd::active_backend()) {
+		case simd::Backend::AVX2:	avx2::transform_aos(m, in, out, n); return;
+		case simd::Backend::SSE41:	sse::transform_aos(m, in, out, n); return;
+		default: break;
+		}
+#endif
+		scalar::transform_aos(m, in, out, n);
+	}
+
+	// out[i] = m * in[i], in and out may be the same planes.
+	inline void transform_soa(const float* m, const float* const in[4], float* const out[4], std::size_t n) {
+#if defined(MATH4D_SIMD)
+		switch (simd::active_backend()) {
+		case simd::Backend::AVX2:	avx2::transform_soa(m, in, out, n); return;
+		case simd::Backend::SSE41:	sse::transform_soa(m, in, out, n); return;
+		default: break;
+		}
+#endif
+		scalar::transform_soa(m, in, out, n);
+	}
+
+	// out[i] = m * in[i] divided by w and mapped by viewport, in and out may be the same array.
+	inline void project_aos(const float* m, const float* viewport, const float* in, float* out,
+			std::uint8_t* flags, std::size_t n, bool zero_to_one) {
+#if defined(MATH4D_SIMD)
+		switch (simd::active_backend()) {
+		case simd::Backend::AVX2:	avx2::project_aos(m, viewport, in, out, flags, n, zero_to_one); return;
+		case simd::Backend::SSE41:	sse::project_aos(m, viewport, in, out, flags, n, zero_to_one); return;
+		default: break;
+		}
+#endif
+		scalar::project_aos(m, viewport, in, out, flags, n, zero_to_one);
+	}
+
+	// out[i] = in[i] / |in[i]| over the first components (3 or 4) values,
+	// with rsqrt and one Newton-Raphson step if fast. in and out may be the same array.
+	inline void normalize_aos(const float* in, float* out, std::size_t n, int components, bool fast) {
+#if defined(MATH4D_SIMD)
+		switch (simd::active_backend()) {
+		case simd::Backend::AVX2:	avx2::normalize_aos(in, out, n, components, fast); return;
+		case simd::Backend::SSE41:	sse::normalize_aos(in, out, n, components, fast); return;
+		default: break;
+		}
+#endif
+		scalar::normalize_aos(in, out, n, components, fast);
+	}
+}
+
+	// -----< Transform >--------------------------------------------------------------------------
+
+	// Transforms every point in "in" by m and writes the results to "out".
+	// out has to hold at least in.size() points. in and out may be the same list.
+	inline void transform(const Matrix4D& m, std::span<const Vector4D> in, std::span<Vector4D> out) {
+		MATH4D_TIME(Transform, in.size());
+		assert(out.size() >= in.size());
+		if (in.empty()) return;
+		kernels::transform_aos(m.data(), in[0].data(), out[0].data(), in.size());
+	}
+
+	// Transforms every point in the list by m, in place.
+	inline void transform(const Matrix4D& m, std::span<Vector4D> points) {
+		transform(m, std::span<const Vector4D>(points), points);
+	}
+
+	// Transforms every point in "in" by m and writes the results to "out".
+	// out is resized to in.size(). in and out may be the same stream.
+	inline void transform(const Matrix4D& m, const Vector4DStream& in, Vector4DStream& out) {
+		MATH4D_TIME(Transform, in.size());
+		if (&in != &out) out.resize(in.size());
+		const float* in_planes[4] = { in.x(), in.y(), in.z(), in.w() };
+		float* const out_planes[4] = { out.x(), out.y(), out.z(), out.w() };
+		kernels::transform_soa(m.data(), in_planes, out_planes, in.size());
+	}
+
+	// Transforms every point in the stream by m, in place.
+	inline void transform(const Matrix4D& m, Vector4DStream& points) {
+		transform(m, points, points);
+	}
+
+	// Transforms points stored as half floats. The points are converted to
+	// float a block at a time (F16C on AVX2), transformed in the cache and
+	// converted back, so memory only sees the half-size data.
+	// out has to hold at least in.size() points. in and out may be the same list.
+	inline void transform(const Matrix4D& m, std::span<const Vector4DHalf> in, std::span<Vector4DHalf> out) {
+		MATH4D_TIME(Transform, in.size());
+		assert(out.size() >= in.size());
+		constexpr std::size_t block = 256;
+		alignas(64) float buffer[block * 4];
+		for (std::size_t first = 0; first < in.size(); first += block) {
+			std::size_t n = in.size() - first < block ? in.size() - first : block;
+			kernels::f16_to_f32(in[first].data(), buffer, n * 4);
+			kernels::transform_aos(m.data(), buffer, buffer, n);
+			kernels::f32_to_f16(buffer, out[first].data(), n * 4);
+		}
+	}
+
+	// Transforms every half float point in the list by m, in place.
+	inline void transform(const Matrix4D& m, std::span<Vector4DHalf> points) {
+		transform(m, std::span<const Vector4DHalf>(points), points);
+	}
+
+	// -----< Project >----------------------------------------------------------------------------
+
+	// The bits of the clip flags written by project(). A bit is set when the
+	// point is outside that clip plane, in the order of Frustum::Side.
+	enum ClipFlags : std::uint8_t {
+		ClipLeft = 1 << 0,		// x < -w
+		ClipRight = 1 << 1,		// x > w
+		ClipBottom = 1 << 2,	// y < -w
+		ClipTop = 1 << 3,		// y > w
+		ClipNear = 1 << 4,		// z < -w, or z < 0 for ClipDepth::ZeroToOne
+		ClipFar = 1 << 5		// z > w
+	};
+
+	// Projects every point in "in" to the window in one pass:
+	//	clip = mvp * in[i], out[i] = (window x, window y, depth, 1 / clip w),
+	// where x, y and depth are clip / w mapped to viewport. depth tells how
+	// mvp maps z, as for Frustum::from_matrix. If clip_flags is not empty, it
+	// gets the ClipFlags of every point; points with flags set may have
+	// divided by a w of 0 or less, and their results are not usable.
+	// out and clip_flags (if not empty) have to hold at least in.size() values.
+	// in and out may be the same list.
+	inline void project(const Matrix4D& mvp, const Viewport& viewport, std::span<const Vector4D> in, std::span<Vector4D> out,
+			std::span<std::uint8_t> clip_flags = {}, ClipDepth depth = ClipDepth::NegativeOneToOne) {
+		MATH4D_TIME(Project, in.size());
+		assert(out.size() >= in.size());
+		assert(clip_flags.empty() || clip_flags.size() >= in.size());
+		if (in.empty()) return;
+		bool zero_to_one = depth == ClipDepth::ZeroToOne;
+		float depth_range = viewport.max_depth - viewport.min_depth;
+		alignas(16) float mapping[8] = {
+			viewport.width * 0.5f, viewport.height * 0.5f, zero_to_one ? depth_range : depth_range * 0.5f, 0,
+			viewport.x + viewport.width * 0.5f, viewport.y + viewport.height * 0.5f,
+			zero_to_one ? viewport.min_depth : viewport.min_depth + depth_range * 0.5f, 0 };
+		kernels::project_aos(mvp.data(), mapping, in[0].data(), out[0].data(),
+			clip_flags.empty() ? nullptr : clip_flags.data(), in.size(), zero_to_one);
+	}
+
+	// Projects every point in the list to the window, in place. See project() above.
+	inline void project(const Matrix4D& mvp, const Viewport& viewport, std::span<Vector4D> points,
+			std::span<std::uint8_t> clip_flags = {}, ClipDepth depth = ClipDepth::NegativeOneToOne) {
+		project(mvp, viewport, std::span<const Vector4D>(points), points, clip_flags, depth);
+	}
+
+	// -----< Normalize >--------------------------------------------------------------------------
+
+	// Exact:	square root and division, within 2e-7 of the exact unit vector.
+	// Fast:	reciprocal square root estimate and one Newton-Raphson step,
+	//			within 6e-7.
+	// On the SSE 4.1 and AVX2 backends Exact gives the same bits as
+	// Vector4D::normalize(). Fast does the steps of Vector4D::normalize_fast(),
+	// but the compiler may fuse some of them into FMAs in the AVX2 version,
+	// so only the bound above holds. The scalar backend sums the squares in
+	// another order and has no fast version; it stays within the bounds too.
+	enum class Precision {
+		Exact,
+		Fast
+	};
+
+	// out[i] = in[i].normalize() (or normalize_fast()). Zero vectors stay zero.
+	// out has to hold at least in.size() points. in and out may be the same list.
+	inline void normalize(std::span<const Vector4D> in, std::span<Vector4D> out, Precision precision = Precision::Exact) {
+		MATH4D_TIME(Normalize, in.size());
+		assert(out.size() >= in.size());
+		if (in.empty()) return;
+		kernels::normalize_aos(in[0].data(), out[0].data(), in.size(), 4, precision == Precision::Fast);
+	}
+
+	// Normalizes every point in the list, in place.
+	inline void normalize(std::span<Vector4D> points, Precision precision = Precision::Exact) {
+		normalize(std::span<const Vector4D>(points), points, precision);
+	}
+
+	// out[i] = in[i].normalize3() (or normalize3_fast()): x, y and z
+	// normalized, w copied. in and out may be the same list.
+	inline void normalize3(std::span<const Vector4D> in, std::span<Vector4D> out, Precision precision = Precision::Exact) {
+		MATH4D_TIME(Normalize, in.size());
+		assert(out.size() >= in.size());
+		if (in.empty()) return;
+		kernels::normalize_aos(in[0].data(), out[0].data(), in.size(), 3, precision == Precision::Fast);
+	}
+
+	// Normalizes x, y and z of every point in the list, in place.
+	inline void normalize3(std::span<Vector4D> points, Precision precision = Precision::Exact) {
+		normalize3(std::span<const Vector4D>(points), points, precision);
+	}
+}
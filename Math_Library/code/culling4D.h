@@ -0,0 +1,485 @@
+#pragma once
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include "instrument4D.h"
+#include "matrix4D.h"
+#include "vector4D.h"
+#include "simd4D.h"
+
+// Frustum culling.
+//
+// A Frustum is the six planes of a view-projection matrix. Bounding
+// spheres and boxes are tested against it one at a time, or in batches
+// with cull(), which writes the indices of the visible ones to a list:
+//
+//	Frustum frustum = Frustum::from_matrix(proj * view);
+//	std::size_t count = math4D::cull(frustum, bounds, visible);
+//	for (std::size_t i = 0; i < count; i++) {
+//		// only transform and draw object visible[i]
+//	}
+//
+// A bound is visible if it is inside or intersects the frustum. Like all
+// plane tests this is conservative: a bound near a corner of the frustum
+// can be reported visible while it is just outside. The AVX2 kernels use
+// FMA, so a bound exactly touching a plane can come out differently there.
+
+// -----< Bounds >-----------------------------------------------------------------------------
+
+// A bounding sphere, stored as (x, y, z, radius) so a batch of them
+// loads straight into SIMD registers.
+struct alignas(16) Sphere {
+	float x = 0;
+	float y = 0;
+	float z = 0;
+	float radius = 0;
+
+	constexpr Sphere() noexcept = default;
+
+	constexpr Sphere(const Vector4D& center, float radius) noexcept
+		: x(center[0]), y(center[1]), z(center[2]), radius(radius) {
+	}
+
+	constexpr Vector4D center() const noexcept {
+		return Vector4D(x, y, z);
+	}
+};
+
+// An axis-aligned bounding box. The w values of min and max are not used.
+struct AABB {
+	Vector4D min;
+	Vector4D max;
+
+	constexpr AABB() noexcept = default;
+
+	constexpr AABB(const Vector4D& min, const Vector4D& max) noexcept : min(min), max(max) {}
+
+	// Returns the smallest box around a list of points.
+	static AABB from_points(std::span<const Vector4D> points) noexcept {
+		if (points.empty()) return AABB();
+		AABB box(points[0], points[0]);
+		for (const Vector4D& p : points) {
+			for (int c = 0; c < 3; c++) {
+				if (p[c] < box.min[c]) box.min[c] = p[c];
+				if (p[c] > box.max[c]) box.max[c] = p[c];
+			}
+		}
+		return box;
+	}
+
+	constexpr Vector4D center() const noexcept {
+		return Vector4D((min[0] + max[0]) * 0.5f, (min[1] + max[1]) * 0.5f, (min[2] + max[2]) * 0.5f);
+	}
+
+	// Half the size on every axis.
+	constexpr Vector4D extents() const noexcept {
+		return Vector4D((max[0] - min[0]) * 0.5f, (max[1] - min[1]) * 0.5f, (max[2] - min[2]) * 0.5f, 0);
+	}
+
+	// Returns the box around this box transformed by m (Arvo's method):
+	// the new extents are |A| * extents, where A is the 3x3 part of m.
+	AABB transformed(const Matrix4D& m) const noexcept {
+		Vector4D c = m * center();
+		Vector4D e = extents();
+		float ne[3];
+		for (int r = 0; r < 3; r++) {
+			ne[r] = std::fabs(m[r][0]) * e[0] + std::fabs(m[r][1]) * e[1] + std::fabs(m[r][2]) * e[2];
+		}
+		return AABB(Vector4D(c[0] - ne[0], c[1] - ne[1], c[2] - ne[2]),
+					Vector4D(c[0] + ne[0], c[1] + ne[1], c[2] + ne[2]));
+	}
+};
+
+static_assert(sizeof(Sphere) == 4 * sizeof(float), "Sphere must be exactly four floats");
+static_assert(sizeof(AABB) == 8 * sizeof(float), "AABB must be exactly eight floats");
+
+// -----< Frustum >----------------------------------------------------------------------------
+
+class Frustum {
+private:
+	// (nx, ny, nz, d), with n pointing into the frustum and |n| = 1.
+	// A point p is inside a plane when n . p + d >= 0.
+	Vector4D planes[6];
+
+public:
+
+	enum Side {
+		Left = 0,
+		Right = 1,
+		Bottom = 2,
+		Top = 3,
+		Near = 4,
+		Far = 5
+	};
+
+	// -----< Constructors >-----------------------------------------------------------------------
+
+	// A frustum that contains everything.
+	constexpr Frustum() noexcept
+		: planes{ Vector4D(0, 0, 0, 1), Vector4D(0, 0, 0, 1), Vector4D(0, 0, 0, 1),
+				  Vector4D(0, 0, 0, 1), Vector4D(0, 0, 0, 1), Vector4D(0, 0, 0, 1) } {
+	}
+
+	// Extracts the planes from a view-projection matrix (Gribb / Hartmann).
+	// With column vectors, clip = m * p, a point is inside when
+	// -w <= x <= w, -w <= y <= w and the depth range holds, so every plane
+	// is line 3 of m plus or minus one of the other lines.
+	// The planes are in the space m transforms from, ex) world space for proj * view.
+	static Frustum from_matrix(const Matrix4D& m, ClipDepth depth = ClipDepth::NegativeOneToOne) noexcept {
+		Frustum f;
+		Vector4D l0 = m[0], l1 = m[1], l2 = m[2], l3 = m[3];
+		f.planes[Left] = l3 + l0;
+		f.planes[Right] = l3 - l0;
+		f.planes[Bottom] = l3 + l1;
+		f.planes[Top] = l3 - l1;
+		f.planes[Near] = depth == ClipDepth::ZeroToOne ? l2 : l3 + l2;
+		f.planes[Far] = l3 - l2;
+
+		// Normalized so n . p + d is the distance to the plane, which the sphere test needs.
+		for (Vector4D& p : f.planes) {
+			float len = std::sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+			if (len > 0) p = p.scalar(1.0f / len);
+		}
+		return f;
+	}
+
+	// -----< Getters >----------------------------------------------------------------------------
+
+	constexpr const Vector4D& plane(int side) const noexcept {
+		return planes[side];
+	}
+
+	// Returns a pointer to the 24 plane values, (nx, ny, nz, d) for every plane.
+	// The planes are back to back by layout, not by the standard (as for
+	// Matrix4D::data()), so this is not constexpr.
+	const float* data() const noexcept {
+		return planes[0].data();
+	}
+
+	// -----< Tests >------------------------------------------------------------------------------
+
+	// Returns the signed distance from a plane to a point, positive inside.
+	constexpr float distance(int side, float x, float y, float z) const noexcept {
+		const Vector4D& p = planes[side];
+		return p[0] * x + p[1] * y + p[2] * z + p[3];
+	}
+
+	bool contains(const Vector4D& point) const noexcept {
+		for (int i = 0; i < 6; i++) {
+			if (!(distance(i, point[0], point[1], point[2]) >= 0)) return false;
+		}
+		return true;
+	}
+
+	// True if the sphere is inside or intersects the frustum.
+	bool intersects(const Sphere& s) const noexcept {
+		for (int i = 0; i < 6; i++) {
+			if (!(distance(i, s.x, s.y, s.z) + s.radius >= 0)) return false;
+		}
+		return true;
+	}
+
+	// True if the box is inside or intersects the frustum. For every plane the
+	// box corner furthest inside is tested, which is the center plus the
+	// extents projected on the normal.
+	bool intersects(const AABB& box) const noexcept {
+		Vector4D c = box.center(), e = box.extents();
+		for (int i = 0; i < 6; i++) {
+			const Vector4D& p = planes[i];
+			float r = std::fabs(p[0]) * e[0] + std::fabs(p[1]) * e[1] + std::fabs(p[2]) * e[2];
+			if (!(distance(i, c[0], c[1], c[2]) + r >= 0)) return false;
+		}
+		return true;
+	}
+};
+
+static_assert(sizeof(Frustum) == 24 * sizeof(float), "Frustum must be exactly 24 floats");
+
+namespace math4D {
+namespace kernels {
+
+	// The kernels take the 24 plane values of a Frustum, the bounds as raw
+	// floats (4 per sphere, 8 per box: min xyzw, max xyzw) and write the
+	// indices of the visible bounds to out, in order. They return how many
+	// were written. out has to hold n indices.
+
+	namespace scalar {
+
+		inline std::size_t cull_spheres(const float* planes, const float* spheres, std::size_t n,
+				std::uint32_t* out, std::uint32_t first = 0) {
+			std::size_t count = 0;
+			for (std::size_t i = 0; i < n; i++) {
+				const float* s = spheres + i * 4;
+				bool visible = true;
+				for (int k = 0; k < 6; k++) {
+					const float* p = planes + k * 4;
+					visible &= p[0] * s[0] + p[1] * s[1] + p[2] * s[2] + p[3] + s[3] >= 0;
+				}
+				out[count] = first + (std::uint32_t)i;
+				count += visible;
+			}
+			return count;
+		}
+
+		inline std::size_t cull_aabbs(const float* planes, const float* boxes, std::size_t n,
+				std::uint32_t* out, std::uint32_t first = 0) {
+			std::size_t count = 0;
+			for (std::size_t i = 0; i < n; i++) {
+				const float* lo = boxes + i * 8;
+				const float* hi = lo + 4;
+				float c[3], e[3];
+				for (int a = 0; a < 3; a++) {
+					c[a] = (hi[a] + lo[a]) * 0.5f;
+					e[a] = (hi[a] - lo[a]) * 0.5f;
+				}
+				bool visible = true;
+				for (int k = 0; k < 6; k++) {
+					const float* p = planes + k * 4;
+					float d = p[0] * c[0] + p[1] * c[1] + p[2] * c[2] + p[3];
+					float r = std::fabs(p[0]) * e[0] + std::fabs(p[1]) * e[1] + std::fabs(p[2]) * e[2];
+					visible &= d + r >= 0;
+				}
+				out[count] = first + (std::uint32_t)i;
+				count += visible;
+			}
+			return count;
+		}
+	}
+
+#if defined(MATH4D_SIMD)
+
+	namespace sse {
+
+		// One plane against four bounds in SoA form. Returns the lanes
+		// that are inside or intersect it.
+		inline __m128 plane_test(const float* p, __m128 x, __m128 y, __m128 z, __m128 r) {
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(p[0]), x), _mm_mul_ps(_mm_set1_ps(p[1]), y)),
+								  _mm_add_ps(_mm_mul_ps(_mm_set1_ps(p[2]), z), _mm_set1_ps(p[3])));
+			return _mm_cmpge_ps(_mm_add_ps(d, r), _mm_setzero_ps());
+		}
+
+		// Appends first + the set bits of mask to out.
+		inline std::size_t write_indices(int mask, std::uint32_t first, std::uint32_t* out) {
+			std::size_t count = 0;
+			while (mask != 0) {
+				out[count++] = first + (std::uint32_t)std::countr_zero((unsigned int)mask);
+				mask &= mask - 1;
+			}
+			return count;
+		}
+
+		// Four spheres per iteration, transposed to SoA in registers.
+		inline std::size_t cull_spheres(const float* planes, const float* spheres, std::size_t n,
+				std::uint32_t* out, std::uint32_t first = 0) {
+			std::size_t count = 0;
+			std::size_t i = 0;
+			for (; i + 4 <= n; i += 4) {
+				__m128 x = _mm_loadu_ps(spheres + i * 4 + 0);
+				__m128 y = _mm_loadu_ps(spheres + i * 4 + 4);
+				__m128 z = _mm_loadu_ps(spheres + i * 4 + 8);
+				__m128 r = _mm_loadu_ps(spheres + i * 4 + 12);
+				_MM_TRANSPOSE4_PS(x, y, z, r);
+				__m128 visible = plane_test(planes, x, y, z, r);
+				for (int k = 1; k < 6; k++) {
+					visible = _mm_and_ps(visible, plane_test(planes + k * 4, x, y, z, r));
+				}
+				count += write_indices(_mm_movemask_ps(visible), first + (std::uint32_t)i, out + count);
+			}
+			return count + scalar::cull_spheres(planes, spheres + i * 4, n - i, out + count, first + (std::uint32_t)i);
+		}
+
+		// Four boxes per iteration. The boxes are turned into center and
+		// extents, and every plane tests the center against the extents
+		// projected on its normal.
+		inline std::size_t cull_aabbs(const float* planes, const float* boxes, std::size_t n,
+				std::uint32_t* out, std::uint32_t first = 0) {
+			const __m128 half = _mm_set1_ps(0.5f);
+			const __m128 sign = _mm_set1_ps(-0.0f);
+			std::size_t count = 0;
+			std::size_t i = 0;
+			for (; i + 4 <= n; i += 4) {
+				__m128 c[4], e[4];
+				for (int b = 0; b < 4; b++) {
+					__m128 lo = _mm_loadu_ps(boxes + (i + b) * 8);
+					__m128 hi = _mm_loadu_ps(boxes + (i + b) * 8 + 4);
+					c[b] = _mm_mul_ps(_mm_add_ps(hi, lo), half);
+					e[b] = _mm_mul_ps(_mm_sub_ps(hi, lo), half);
+				}
+				_MM_TRANSPOSE4_PS(c[0], c[1], c[2], c[3]);
+				_MM_TRANSPOSE4_PS(e[0], e[1], e[2], e[3]);
+				__m128 visible = _mm_castsi128_ps(_mm_set1_epi32(-1));
+				for (int k = 0; k < 6; k++) {
+					const float* p = planes + k * 4;
+					__m128 r = _mm_add_ps(
+						_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(sign, _mm_set1_ps(p[0])), e[0]),
+								   _mm_mul_ps(_mm_andnot_ps(sign, _mm_set1_ps(p[1])), e[1])),
+						_mm_mul_ps(_mm_andnot_ps(sign, _mm_set1_ps(p[2])), e[2]));
+					visible = _mm_and_ps(visible, plane_test(p, c[0], c[1], c[2], r));
+				}
+				count += write_indices(_mm_movemask_ps(visible), first + (std::uint32_t)i, out + count);
+			}
+			return count + scalar::cull_aabbs(planes, boxes + i * 8, n - i, out + count, first + (std::uint32_t)i);
+		}
+	}
+
+	namespace avx2 {
+
+		// For every 8-bit visibility mask, the positions of its set bits
+		// packed as 4-bit values, lowest first. Used to write the visible
+		// indices of 8 bounds with one permute and one store.
+		inline constexpr std::array<std::uint32_t, 256> compress_table = [] {
+			std::array<std::uint32_t, 256> table{};
+			for (unsigned int mask = 0; mask < 256; mask++) {
+				std::uint32_t packed = 0;
+				int slot = 0;
+				for (unsigned int bit = 0; bit < 8; bit++) {
+					if (mask & (1u << bit)) packed |= bit << (slot++ * 4);
+				}
+				table[mask] = packed;
+			}
+			return table;
+		}();
+
+		// Writes first + the set bits of mask to out. Always stores 8 values,
+		// so out needs room for 8 even if fewer bits are set.
+		MATH4D_TARGET_AVX2 inline std::size_t write_indices(int mask, std::uint32_t first, std::uint32_t* out) {
+			__m256i packed = _mm256_set1_epi32((int)compress_table[mask]);
+			__m256i slots = _mm256_and_si256(
+				_mm256_srlv_epi32(packed, _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28)), _mm256_set1_epi32(15));
+			_mm256_storeu_si256((__m256i*)out, _mm256_add_epi32(slots, _mm256_set1_epi32((int)first)));
+			return (std::size_t)std::popcount((unsigned int)mask);
+		}
+
+		MATH4D_TARGET_AVX2 inline __m256 plane_test(const float* p, __m256 x, __m256 y, __m256 z, __m256 r) {
+			__m256 d = _mm256_fmadd_ps(_mm256_set1_ps(p[0]), x, _mm256_set1_ps(p[3]));
+			d = _mm256_fmadd_ps(_mm256_set1_ps(p[1]), y, d);
+			d = _mm256_fmadd_ps(_mm256_set1_ps(p[2]), z, d);
+			return _mm256_cmp_ps(_mm256_add_ps(d, r), _mm256_setzero_ps(), _CMP_GE_OQ);
+		}
+
+		// Transposes 8 (x, y, z, w) values, two per register, to one register
+		// per component. The lanes come out in the order 0, 2, 4, 6, 1, 3, 5, 7.
+		MATH4D_TARGET_AVX2 inline void transpose8x4(__m256 v01, __m256 v23, __m256 v45, __m256 v67,
+				__m256& x, __m256& y, __m256& z, __m256& w) {
+			__m256 t0 = _mm256_unpacklo_ps(v01, v23);
+			__m256 t1 = _mm256_unpackhi_ps(v01, v23);
+			__m256 t2 = _mm256_unpacklo_ps(v45, v67);
+			__m256 t3 = _mm256_unpackhi_ps(v45, v67);
+			x = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+			y = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+			z = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+			w = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+		}
+
+		// Puts the lanes of a transpose8x4 result back in index order.
+		MATH4D_TARGET_AVX2 inline int ordered_mask(__m256 visible) {
+			return _mm256_movemask_ps(_mm256_permutevar8x32_ps(visible, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7)));
+		}
+
+		// Eight spheres per iteration.
+		MATH4D_TARGET_AVX2 inline std::size_t cull_spheres(const float* planes, const float* spheres, std::size_t n,
+				std::uint32_t* out, std::uint32_t first = 0) {
+			std::size_t count = 0;
+			std::size_t i = 0;
+			for (; i + 8 <= n; i += 8) {
+				const float* s = spheres + i * 4;
+				__m256 x, y, z, r;
+				transpose8x4(_mm256_loadu_ps(s), _mm256_loadu_ps(s + 8), _mm256_loadu_ps(s + 16), _mm256_loadu_ps(s + 24),
+					x, y, z, r);
+				__m256 visible = plane_test(planes, x, y, z, r);
+				for (int k = 1; k < 6; k++) {
+					visible = _mm256_and_ps(visible, plane_test(planes + k * 4, x, y, z, r));
+				}
+				// count <= i, so there is room for 8 indices while i + 8 <= n.
+				count += write_indices(ordered_mask(visible), first + (std::uint32_t)i, out + count);
+			}
+			return count + sse::cull_spheres(planes, spheres + i * 4, n - i, out + count, first + (std::uint32_t)i);
+		}
+
+		// Eight boxes per iteration, as center and extents.
+		MATH4D_TARGET_AVX2 inline std::size_t cull_aabbs(const float* planes, const float* boxes, std::size_t n,
+				std::uint32_t* out, std::uint32_t first = 0) {
+			const __m256 half = _mm256_set1_ps(0.5f);
+			const __m256 sign = _mm256_set1_ps(-0.0f);
+			std::size_t count = 0;
+			std::size_t i = 0;
+			for (; i + 8 <= n; i += 8) {
+				__m256 c[4], e[4];
+				for (int b = 0; b < 4; b++) {
+					// (min, max) of two boxes to (min0, min1) and (max0, max1).
+					__m256 b0 = _mm256_loadu_ps(boxes + (i + b * 2) * 8);
+					__m256 b1 = _mm256_loadu_ps(boxes + (i + b * 2 + 1) * 8);
+					__m256 lo = _mm256_permute2f128_ps(b0, b1, 0x20);
+					__m256 hi = _mm256_permute2f128_ps(b0, b1, 0x31);
+					c[b] = _mm256_mul_ps(_mm256_add_ps(hi, lo), half);
+					e[b] = _mm256_mul_ps(_mm256_sub_ps(hi, lo), half);
+				}
+				__m256 cx, cy, cz, cw, ex, ey, ez, ew;
+				transpose8x4(c[0], c[1], c[2], c[3], cx, cy, cz, cw);
+				transpose8x4(e[0], e[1], e[2], e[3], ex, ey, ez, ew);
+				__m256 visible = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+				for (int k = 0; k < 6; k++) {
+					const float* p = planes + k * 4;
+					__m256 r = _mm256_mul_ps(_mm256_andnot_ps(sign, _mm256_set1_ps(p[0])), ex);
+					r = _mm256_fmadd_ps(_mm256_andnot_ps(sign, _mm256_set1_ps(p[1])), ey, r);
+					r = _mm256_fmadd_ps(_mm256_andnot_ps(sign, _mm256_set1_ps(p[2])), ez, r);
+					visible = _mm256_and_ps(visible, plane_test(p, cx, cy, cz, r));
+				}
+				count += write_indices(ordered_mask(visible), first + (std::uint32_t)i, out + count);
+			}
+			return count + sse::cull_aabbs(planes, boxes + i * 8, n - i, out + count, first + (std::uint32_t)i);
+		}
+	}
+
+#endif
+
+	inline std::size_t cull_spheres(const float* planes, const float* spheres, std::size_t n, std::uint32_t* out) {
+#if defined(MATH4D_SIMD)
+		switch (simd::active_backend()) {
+		case simd::Backend::AVX2:	return avx2::cull_spheres(planes, spheres, n, out);
+		case simd::Backend::SSE41:	return sse::cull_spheres(planes, spheres, n, out);
+		default: break;
+		}
+#endif
+		return scalar::cull_spheres(planes, spheres, n, out);
+	}
+
+	inline std::size_t cull_aabbs(const float* planes, const float* boxes, std::size_t n, std::uint32_t* out) {
+#if defined(MATH4D_SIMD)
+		switch (simd::active_backend()) {
+		case simd::Backend::AVX2:	return avx2::cull_aabbs(planes, boxes, n, out);
+		case simd::Backend::SSE41:	return sse::cull_aabbs(planes, boxes, n, out);
+		default: break;
+		}
+#endif
+		return scalar::cull_aabbs(planes, boxes, n, out);
+	}
+}
+
+	// -----< Batch culling >----------------------------------------------------------------------
+
+	// Tests every sphere against the frustum and writes the indices of the
+	// visible ones to the start of "visible", in order. Returns how many
+	// were written. visible has to hold spheres.size() indices.
+	inline std::size_t cull(const Frustum& frustum, std::span<const Sphere> spheres, std::span<std::uint32_t> visible) {
+		MATH4D_TIME(Cull, spheres.size());
+		assert(visible.size() >= spheres.size());
+		if (spheres.empty()) return 0;
+		return kernels::cull_spheres(frustum.data(), &spheres[0].x, spheres.size(), visible.data());
+	}
+
+	// Tests every box against the frustum and writes the indices of the
+	// visible ones to the start of "visible", in order. Returns how many
+	// were written. visible has to hold boxes.size() indices.
+	inline std::size_t cull(const Frustum& frustum, std::span<const AABB> boxes, std::span<std::uint32_t> visible) {
+		MATH4D_TIME(Cull, boxes.size());
+		assert(visible.size() >= boxes.size());
+		if (boxes.empty()) return 0;
+		return kernels::cull_aabbs(frustum.data(), boxes[0].min.data(), boxes.size(), visible.data());
+	}
+}
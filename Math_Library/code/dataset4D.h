@@ -0,0 +1,476 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <span>
+#include <type_traits>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "half4D.h"
+#include "matrix4D.h"
+#include "matrixN.h"
+#include "vector4D.h"
+#include "vectorN.h"
+
+// Binary files of Vector4D / Matrix4D.
+//
+// A dataset file is a 64-byte header followed by the elements, stored
+// exactly as they are in memory:
+//
+//	offset	size	field
+//	0		8		magic, "MATH4DDS"
+//	8		4		byte order tag, 0x01020304 written in the byte order of the writer
+//	12		2		major version (1)
+//	14		2		minor version (0)
+//	16		4		element type (DatasetType)
+//	20		4		stride, bytes from one element to the next
+//	24		8		number of elements
+//	32		8		offset of the first element from the start of the file (64)
+//	40		24		reserved, zero
+//
+// The elements start on a 64-byte border, so a memory-mapped file can be
+// used as a std::span<const Vector4D> without copying anything:
+//
+//	math4D::DatasetWriter<Vector4D> writer;
+//	writer.open("points.m4d");
+//	writer.append(points);			// any number of times, the file can be larger than memory
+//	writer.close();
+//
+//	math4D::MappedDataset file;
+//	if (file.open("points.m4d")) {
+//		std::span<const Vector4D> points = file.elements<Vector4D>();
+//	}
+//
+// Opening a file only maps it. The pages are read by the operating system
+// the first time they are touched, so the cost of a load is its page faults.
+//
+// A reader refuses files of another major version or byte order; the data
+// is never converted, since that would need a copy.
+
+namespace math4D {
+
+	enum class DatasetType : std::uint32_t {
+		Vector4D = 1,
+		Matrix4D = 2,
+		Vector4DHalf = 3,
+		Vector4DDouble = 4,
+		Matrix4DDouble = 5
+	};
+
+	enum class DatasetError {
+		None,
+		// The file could not be opened, created or written.
+		File,
+		// The file could not be mapped.
+		Map,
+		// Not a dataset file, or shorter than its header says.
+		Format,
+		// Written on a machine with the other byte order.
+		ByteOrder,
+		// A newer major version.
+		Version
+	};
+
+	// Access pattern hint for a mapped file.
+	enum class DatasetAccess {
+		Sequential,
+		Random
+	};
+
+	template<class T>
+	constexpr DatasetType dataset_type_of() noexcept {
+		if constexpr (std::is_same_v<T, Vector4D>) return DatasetType::Vector4D;
+		else if constexpr (std::is_same_v<T, Matrix4D>) return DatasetType::Matrix4D;
+		else if constexpr (std::is_same_v<T, Vector4DHalf>) return DatasetType::Vector4DHalf;
+		else if constexpr (std::is_same_v<T, Vector4DDouble>) return DatasetType::Vector4DDouble;
+		else if constexpr (std::is_same_v<T, Matrix4DDouble>) return DatasetType::Matrix4DDouble;
+		else static_assert(sizeof(T) == 0, "not a dataset element type");
+	}
+
+	// -----< Header >-----------------------------------------------------------------------------
+
+	struct DatasetHeader {
+		char magic[8] = { 'M', 'A', 'T', 'H', '4', 'D', 'D', 'S' };
+		std::uint32_t byte_order = 0x01020304u;
+		std::uint16_t version_major = 1;
+		std::uint16_t version_minor = 0;
+		DatasetType type = DatasetType::Vector4D;
+		std::uint32_t stride = 0;
+		std::uint64_t count = 0;
+		std::uint64_t data_offset = 64;
+		std::uint8_t reserved[24] = {};
+	};
+
+	static_assert(sizeof(DatasetHeader) == 64, "DatasetHeader must be exactly 64 bytes");
+	static_assert(std::is_trivially_copyable_v<DatasetHeader>, "DatasetHeader is written as raw bytes");
+
+	// -----< Writer >-----------------------------------------------------------------------------
+
+	// Writes a dataset file front to back. Elements go through a buffer to
+	// the file, so the dataset never has to fit in memory. The header is
+	// written again with the final count by close().
+	template<class T>
+	class DatasetWriter {
+	private:
+		std::FILE* file = nullptr;
+		DatasetHeader header;
+		DatasetError status = DatasetError::None;
+
+		bool write_header() {
+			if (std::fseek(file, 0, SEEK_SET) != 0 || std::fwrite(&header, sizeof(header), 1, file) != 1) {
+				status = DatasetError::File;
+				return false;
+			}
+			return true;
+		}
+
+	public:
+
+		// -----< Constructors >-----------------------------------------------------------------------
+
+		DatasetWriter() = default;
+
+		DatasetWriter(const DatasetWriter&) = delete;
+		DatasetWriter& operator=(const DatasetWriter&) = delete;
+
+		~DatasetWriter() {
+			close();
+		}
+
+		// -----< Writing >----------------------------------------------------------------------------
+
+		// Creates (or replaces) a file. Returns false if it could not be created.
+		bool open(const char* path) {
+			close();
+			header = DatasetHeader();
+			header.type = dataset_type_of<T>();
+			header.stride = sizeof(T);
+			status = DatasetError::None;
+			file = std::fopen(path, "wb");
+			if (file == nullptr) {
+				status = DatasetError::File;
+				return false;
+			}
+			// Large writes go straight to the file, small ones fill 1 MB first.
+			std::setvbuf(file, nullptr, _IOFBF, 1 << 20);
+			return write_header();
+		}
+
+		// Appends elements to the file. Returns false if they could not be written.
+		bool append(std::span<const T> elements) {
+			if (file == nullptr || status != DatasetError::None) return false;
+			if (std::fwrite(elements.data(), sizeof(T), elements.size(), file) != elements.size()) {
+				status = DatasetError::File;
+				return false;
+			}
+			header.count += elements.size();
+			return true;
+		}
+
+		bool append(const T& element) {
+			return append(std::span<const T>(&element, 1));
+		}
+
+		// Writes the final header and closes the file. Returns false if
+		// anything could not be written since open().
+		bool close() {
+			if (file == nullptr) return status == DatasetError::None;
+			if (status == DatasetError::None) write_header();
+			if (std::fclose(file) != 0) status = DatasetError::File;
+			file = nullptr;
+			return status == DatasetError::None;
+		}
+
+		// -----< Getters >----------------------------------------------------------------------------
+
+		// Number of elements appended since open().
+		std::uint64_t size() const noexcept {
+			return header.count;
+		}
+
+		DatasetError error() const noexcept {
+			return status;
+		}
+	};
+
+	// -----< Streaming reader >-------------------------------------------------------------------
+
+	// Reads a dataset file front to back in pieces, for files that should
+	// not be mapped as a whole (ex. read once by a streaming pipeline).
+	template<class T>
+	class DatasetReader {
+	private:
+		std::FILE* file = nullptr;
+		DatasetHeader header;
+		std::uint64_t remaining = 0;
+		DatasetError status = DatasetError::None;
+
+		bool fail(DatasetError e) {
+			close();
+			status = e;
+			return false;
+		}
+
+	public:
+
+		// -----< Constructors >-----------------------------------------------------------------------
+
+		DatasetReader() = default;
+
+		DatasetReader(const DatasetReader&) = delete;
+		DatasetReader& operator=(const DatasetReader&) = delete;
+
+		~DatasetReader() {
+			close();
+		}
+
+		// -----< Reading >----------------------------------------------------------------------------
+
+		// Opens a file and checks its header. Returns false and sets error()
+		// if it is not a dataset of T this build can read.
+		bool open(const char* path) {
+			close();
+			status = DatasetError::None;
+			file = std::fopen(path, "rb");
+			if (file == nullptr) return fail(DatasetError::File);
+			std::setvbuf(file, nullptr, _IOFBF, 1 << 20);
+			if (std::fread(&header, sizeof(header), 1, file) != 1) return fail(DatasetError::Format);
+			if (std::memcmp(header.magic, DatasetHeader().magic, sizeof(header.magic)) != 0) return fail(DatasetError::Format);
+			if (header.byte_order != DatasetHeader().byte_order) return fail(DatasetError::ByteOrder);
+			if (header.version_major != DatasetHeader().version_major) return fail(DatasetError::Version);
+			if (header.type != dataset_type_of<T>() || header.stride != sizeof(T) || header.data_offset < sizeof(header)) {
+				return fail(DatasetError::Format);
+			}
+			// Skips to the elements. Reading the gap keeps this within the 32-bit fseek offsets.
+			for (std::uint64_t gap = header.data_offset - sizeof(header); gap > 0; gap--) {
+				if (std::fgetc(file) == EOF) return fail(DatasetError::Format);
+			}
+			remaining = header.count;
+			return true;
+		}
+
+		// Reads the next elements into out. Returns how many were read, 0 at
+		// the end of the file. Fewer than out.size() are only returned at the end.
+		std::size_t read(std::span<T> out) {
+			if (file == nullptr || remaining == 0) return 0;
+			std::size_t n = out.size() < remaining ? out.size() : (std::size_t)remaining;
+			std::size_t got = std::fread(out.data(), sizeof(T), n, file);
+			if (got != n) {
+				status = DatasetError::Format;
+				remaining = 0;
+			}
+			else {
+				remaining -= got;
+			}
+			return got;
+		}
+
+		void close() {
+			if (file != nullptr) std::fclose(file);
+			file = nullptr;
+			remaining = 0;
+		}
+
+		// -----< Getters >----------------------------------------------------------------------------
+
+		// Number of elements in the file.
+		std::uint64_t size() const noexcept {
+			return header.count;
+		}
+
+		DatasetError error() const noexcept {
+			return status;
+		}
+	};
+
+	// -----< Reader >-----------------------------------------------------------------------------
+
+	// A dataset file mapped read-only into memory.
+	class MappedDataset {
+	private:
+		const std::byte* base = nullptr;
+		std::uint64_t bytes = 0;
+		DatasetHeader header;
+		DatasetError status = DatasetError::None;
+#if defined(_WIN32)
+		HANDLE mapping = nullptr;
+#endif
+
+		bool fail(DatasetError e) {
+			close();
+			status = e;
+			return false;
+		}
+
+		bool map(const char* path, DatasetAccess access) {
+#if defined(_WIN32)
+			HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+				access == DatasetAccess::Sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS, nullptr);
+			if (file == INVALID_HANDLE_VALUE) return fail(DatasetError::File);
+			LARGE_INTEGER size;
+			if (!GetFileSizeEx(file, &size)) {
+				CloseHandle(file);
+				return fail(DatasetError::File);
+			}
+			bytes = (std::uint64_t)size.QuadPart;
+			if (bytes < sizeof(DatasetHeader)) {
+				CloseHandle(file);
+				return fail(DatasetError::Format);
+			}
+			mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			CloseHandle(file);
+			if (mapping == nullptr) return fail(DatasetError::Map);
+			base = static_cast<const std::byte*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+			if (base == nullptr) return fail(DatasetError::Map);
+#else
+			int fd = ::open(path, O_RDONLY);
+			if (fd < 0) return fail(DatasetError::File);
+			struct stat st;
+			if (::fstat(fd, &st) != 0) {
+				::close(fd);
+				return fail(DatasetError::File);
+			}
+			bytes = (std::uint64_t)st.st_size;
+			if (bytes < sizeof(DatasetHeader)) {
+				::close(fd);
+				return fail(DatasetError::Format);
+			}
+			void* p = ::mmap(nullptr, (std::size_t)bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+			// The mapping keeps the file open.
+			::close(fd);
+			if (p == MAP_FAILED) return fail(DatasetError::Map);
+			base = static_cast<const std::byte*>(p);
+			::madvise(p, (std::size_t)bytes, access == DatasetAccess::Sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+#endif
+			return true;
+		}
+
+	public:
+
+		// -----< Constructors >-----------------------------------------------------------------------
+
+		MappedDataset() = default;
+
+		MappedDataset(const MappedDataset&) = delete;
+		MappedDataset& operator=(const MappedDataset&) = delete;
+
+		MappedDataset(MappedDataset&& d) noexcept {
+			*this = static_cast<MappedDataset&&>(d);
+		}
+
+		MappedDataset& operator=(MappedDataset&& d) noexcept {
+			if (this != &d) {
+				close();
+				base = d.base;
+				bytes = d.bytes;
+				header = d.header;
+				status = d.status;
+#if defined(_WIN32)
+				mapping = d.mapping;
+				d.mapping = nullptr;
+#endif
+				d.base = nullptr;
+				d.bytes = 0;
+				d.header = DatasetHeader();
+			}
+			return *this;
+		}
+
+		~MappedDataset() {
+			close();
+		}
+
+		// -----< Open / Close >-----------------------------------------------------------------------
+
+		// Maps a dataset file and checks its header. Returns false and sets
+		// error() if it is not a dataset this build can read. Only the page
+		// with the header is read here.
+		bool open(const char* path, DatasetAccess access = DatasetAccess::Sequential) {
+			close();
+			status = DatasetError::None;
+			if (!map(path, access)) return false;
+
+			std::memcpy(&header, base, sizeof(DatasetHeader));
+			if (std::memcmp(header.magic, DatasetHeader().magic, sizeof(header.magic)) != 0) return fail(DatasetError::Format);
+			if (header.byte_order != DatasetHeader().byte_order) return fail(DatasetError::ByteOrder);
+			if (header.version_major != DatasetHeader().version_major) return fail(DatasetError::Version);
+			if (header.data_offset < sizeof(DatasetHeader) || header.data_offset > bytes || header.stride == 0 ||
+				header.count > (bytes - header.data_offset) / header.stride) {
+				return fail(DatasetError::Format);
+			}
+			return true;
+		}
+
+		void close() {
+			if (base != nullptr) {
+#if defined(_WIN32)
+				UnmapViewOfFile(base);
+#else
+				::munmap(const_cast<std::byte*>(base), (std::size_t)bytes);
+#endif
+			}
+#if defined(_WIN32)
+			if (mapping != nullptr) CloseHandle(mapping);
+			mapping = nullptr;
+#endif
+			base = nullptr;
+			bytes = 0;
+			header = DatasetHeader();
+		}
+
+		// -----< Getters >----------------------------------------------------------------------------
+
+		bool is_open() const noexcept {
+			return base != nullptr;
+		}
+
+		DatasetError error() const noexcept {
+			return status;
+		}
+
+		DatasetType type() const noexcept {
+			return header.type;
+		}
+
+		// Number of elements in the file.
+		std::uint64_t size() const noexcept {
+			return header.count;
+		}
+
+		// Bytes from one element to the next.
+		std::uint32_t stride() const noexcept {
+			return header.stride;
+		}
+
+		// Returns a pointer to the first element, for strides other than sizeof(T).
+		const std::byte* data() const noexcept {
+			return base != nullptr ? base + header.data_offset : nullptr;
+		}
+
+		// Returns the elements as a span over the mapped file, or an empty
+		// span if they are not of type T (or are stored with padding).
+		template<class T>
+		std::span<const T> elements() const noexcept {
+			if (base == nullptr || header.type != dataset_type_of<T>() || header.stride != sizeof(T) ||
+				(header.data_offset % alignof(T)) != 0) {
+				return {};
+			}
+			return std::span<const T>(reinterpret_cast<const T*>(data()), (std::size_t)header.count);
+		}
+	};
+}
@@ -0,0 +1,140 @@
+#pragma once
+#include <cstddef>
+#include <span>
+
+#include "batch4D.h"
+#include "matrix4D.h"
+#include "vector4D.h"
+
+// Lazy matrix chains.
+//
+// The normal operators are eager: proj * view * model * v builds a full
+// Matrix4D for every step. A chain started with math4D::lazy() only keeps
+// references to its factors and picks the cheapest order when it is used:
+//
+//	Vector4D p = math4D::lazy(proj) * view * model * v;
+//		-> proj * (view * (model * v)), three matrix-vector products
+//		   and no temporary matrices.
+//
+//	Matrix4D mvp = math4D::lazy(proj) * view * model;
+//		-> the product, multiplied once from left to right.
+//
+//	(math4D::lazy(proj) * view * model).transform(in, out);
+//		-> the chain is folded into one matrix, then every point is
+//		   transformed with the batch kernels.
+//
+// A chain refers to its factors, so it has to be used in the same
+// statement it is made in (the same rule as for any expression template).
+// The chain functions are constexpr, so a chain of constant matrices
+// folds at compile time wherever the Matrix4D operations it uses are constexpr.
+
+namespace math4D {
+
+	template<std::size_t N>
+	class MatrixChain {
+	private:
+		static_assert(N > 0, "a MatrixChain needs at least one factor");
+
+		template<std::size_t M>
+		friend class MatrixChain;
+
+		// The factors from left to right.
+		const Matrix4D* factors[N];
+
+	public:
+
+		// -----< Constructors >-----------------------------------------------------------------------
+
+		constexpr explicit MatrixChain(const Matrix4D& m) : factors{ &m } {
+			static_assert(N == 1, "use operator* to make longer chains");
+		}
+
+		constexpr MatrixChain() : factors{} {}
+
+		// -----< Getters >----------------------------------------------------------------------------
+
+		// Returns the number of matrices in the chain.
+		static constexpr std::size_t size() {
+			return N;
+		}
+
+		// Returns the factor on an index, 0 is the leftmost one.
+		constexpr const Matrix4D& operator[] (std::size_t index) const {
+			return *factors[index];
+		}
+
+		// -----< Operators >--------------------------------------------------------------------------
+
+		// Adds a matrix to the right end of the chain.
+		constexpr MatrixChain<N + 1> operator*(const Matrix4D& m) const {
+			MatrixChain<N + 1> chain;
+			for (std::size_t i = 0; i < N; i++) chain.factors[i] = factors[i];
+			chain.factors[N] = &m;
+			return chain;
+		}
+
+		// Joins two chains.
+		template<std::size_t M>
+		constexpr MatrixChain<N + M> operator*(const MatrixChain<M>& c) const {
+			MatrixChain<N + M> chain;
+			for (std::size_t i = 0; i < N; i++) chain.factors[i] = factors[i];
+			for (std::size_t i = 0; i < M; i++) chain.factors[N + i] = c.factors[i];
+			return chain;
+		}
+
+		// Multiplies the chain with a vector from right to left,
+		// one matrix-vector product per factor.
+		constexpr Vector4D operator*(const Vector4D& v) const {
+			Vector4D result = *factors[N - 1] * v;
+			for (std::size_t i = N - 1; i > 0; i--) {
+				result = *factors[i - 1] * result;
+			}
+			return result;
+		}
+
+		// -----< Evaluate >---------------------------------------------------------------------------
+
+		// Returns the product of all the factors as one Matrix4D.
+		constexpr Matrix4D eval() const {
+			Matrix4D result = *factors[0];
+			for (std::size_t i = 1; i < N; i++) {
+				result = result * *factors[i];
+			}
+			return result;
+		}
+
+		constexpr operator Matrix4D() const {
+			return eval();
+		}
+
+		// Transforms every point in "in" by the chain and writes the results to "out".
+		// The chain is folded into one matrix first, since that is cheaper as
+		// soon as there are more points than factors.
+		void transform(std::span<const Vector4D> in, std::span<Vector4D> out) const {
+			math4D::transform(eval(), in, out);
+		}
+
+		// Transforms every point in the list by the chain, in place.
+		void transform(std::span<Vector4D> points) const {
+			math4D::transform(eval(), points);
+		}
+	};
+
+	// Starts a lazy chain with one matrix.
+	constexpr MatrixChain<1> lazy(const Matrix4D& m) {
+		return MatrixChain<1>(m);
+	}
+}
+
+// -----< Compile-time checks >----------------------------------------------------------------
+
+namespace math4D {
+namespace checks {
+
+	inline constexpr Matrix4D chain_scale(2, 0, 0, 0, 0, 2, 0, 0, 0, 0, 2, 0, 0, 0, 0, 1);
+	inline constexpr Matrix4D chain_move(1, 0, 0, 3, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1);
+
+	static_assert(Matrix4D(lazy(chain_scale) * chain_move)[0][3] == 6, "constexpr MatrixChain::eval");
+	static_assert(lazy(chain_scale) * chain_move * Vector4D(1, 1, 1) == Vector4D(8, 2, 2, 1), "constexpr MatrixChain * Vector4D");
+}
+}
\ No newline at end of file
@@ -0,0 +1,180 @@
+#pragma once
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include "simd4D.h"
+
+// IEEE 754 half precision (fp16) storage.
+//
+// math4D::half only stores a value, all math is done in float. Arrays of
+// half take half the memory and bandwidth of float arrays, which is what
+// counts for large, memory-bound point lists (see the Vector4DHalf
+// transform in batch4D.h). The precision is about 3 decimal digits and
+// the largest finite value is 65504.
+//
+// Conversions round to nearest even, keep infinities and NaN (as a quiet
+// NaN) and handle subnormals. The batch conversions use the F16C
+// instructions on the AVX2 backend, which give the same results.
+
+namespace math4D {
+
+	// -----< Scalar conversion >------------------------------------------------------------------
+
+	constexpr std::uint16_t float_to_half_bits(float f) noexcept {
+		std::uint32_t x = std::bit_cast<std::uint32_t>(f);
+		std::uint32_t sign = (x >> 16) & 0x8000u;
+		std::uint32_t exponent = (x >> 23) & 0xffu;
+		std::uint32_t mantissa = x & 0x7fffffu;
+
+		// Infinity and NaN.
+		if (exponent == 0xff) {
+			return (std::uint16_t)(sign | 0x7c00u | (mantissa != 0 ? 0x200u | (mantissa >> 13) : 0));
+		}
+
+		int e = (int)exponent - 127 + 15;
+		// Too large, rounds to infinity.
+		if (e >= 31) return (std::uint16_t)(sign | 0x7c00u);
+
+		// Subnormal half (or zero).
+		if (e <= 0) {
+			if (e < -10) return (std::uint16_t)sign;
+			std::uint32_t full = mantissa | 0x800000u;
+			int shift = 14 - e;
+			std::uint32_t h = full >> shift;
+			std::uint32_t rest = full & ((1u << shift) - 1);
+			std::uint32_t halfway = 1u << (shift - 1);
+			if (rest > halfway || (rest == halfway && (h & 1))) h++;
+			return (std::uint16_t)(sign | h);
+		}
+
+		// Normal half. A carry out of the mantissa moves into the exponent,
+		// which also turns the largest values into infinity as it should.
+		std::uint32_t h = ((std::uint32_t)e << 10) | (mantissa >> 13);
+		std::uint32_t rest = mantissa & 0x1fffu;
+		if (rest > 0x1000u || (rest == 0x1000u && (h & 1))) h++;
+		return (std::uint16_t)(sign | h);
+	}
+
+	constexpr float half_bits_to_float(std::uint16_t h) noexcept {
+		std::uint32_t sign = (std::uint32_t)(h & 0x8000u) << 16;
+		std::uint32_t exponent = (h >> 10) & 0x1fu;
+		std::uint32_t mantissa = h & 0x3ffu;
+
+		if (exponent == 0) {
+			if (mantissa == 0) return std::bit_cast<float>(sign);
+			// Subnormal, shift the mantissa up until it has the implicit bit.
+			int e = 1;
+			while ((mantissa & 0x400u) == 0) {
+				mantissa <<= 1;
+				e--;
+			}
+			mantissa &= 0x3ffu;
+			return std::bit_cast<float>(sign | ((std::uint32_t)(e + 112) << 23) | (mantissa << 13));
+		}
+		if (exponent == 31) {
+			// NaN comes out quiet, as with F16C.
+			std::uint32_t quiet = mantissa != 0 ? 0x400000u : 0;
+			return std::bit_cast<float>(sign | 0x7f800000u | quiet | (mantissa << 13));
+		}
+		return std::bit_cast<float>(sign | ((exponent + 112) << 23) | (mantissa << 13));
+	}
+
+	// -----< half >-------------------------------------------------------------------------------
+
+	struct half {
+		std::uint16_t bits = 0;
+
+		constexpr half() noexcept = default;
+
+		explicit constexpr half(float f) noexcept : bits(float_to_half_bits(f)) {}
+
+		constexpr operator float() const noexcept {
+			return half_bits_to_float(bits);
+		}
+
+		static constexpr half from_bits(std::uint16_t b) noexcept {
+			half h;
+			h.bits = b;
+			return h;
+		}
+	};
+
+	static_assert(sizeof(half) == 2, "half must be exactly two bytes");
+
+namespace kernels {
+
+	namespace scalar {
+
+		inline void f32_to_f16(const float* in, half* out, std::size_t n) {
+			for (std::size_t i = 0; i < n; i++) out[i] = half(in[i]);
+		}
+
+		inline void f16_to_f32(const half* in, float* out, std::size_t n) {
+			for (std::size_t i = 0; i < n; i++) out[i] = (float)in[i];
+		}
+	}
+
+#if defined(MATH4D_SIMD)
+
+	namespace avx2 {
+
+		// Eight values per instruction with F16C.
+		MATH4D_TARGET_AVX2 inline void f32_to_f16(const float* in, half* out, std::size_t n) {
+			std::size_t i = 0;
+			for (; i + 8 <= n; i += 8) {
+				__m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT);
+				_mm_storeu_si128((__m128i*)(out + i), h);
+			}
+			scalar::f32_to_f16(in + i, out + i, n - i);
+		}
+
+		MATH4D_TARGET_AVX2 inline void f16_to_f32(const half* in, float* out, std::size_t n) {
+			std::size_t i = 0;
+			for (; i + 8 <= n; i += 8) {
+				__m128i h = _mm_loadu_si128((const __m128i*)(in + i));
+				_mm256_storeu_ps(out + i, _mm256_cvtph_ps(h));
+			}
+			scalar::f16_to_f32(in + i, out + i, n - i);
+		}
+	}
+
+#endif
+
+	inline void f32_to_f16(const float* in, half* out, std::size_t n) {
+#if defined(MATH4D_SIMD)
+		if (simd::active_backend() == simd::Backend::AVX2) {
+			avx2::f32_to_f16(in, out, n);
+			return;
+		}
+#endif
+		scalar::f32_to_f16(in, out, n);
+	}
+
+	inline void f16_to_f32(const half* in, float* out, std::size_t n) {
+#if defined(MATH4D_SIMD)
+		if (simd::active_backend() == simd::Backend::AVX2) {
+			avx2::f16_to_f32(in, out, n);
+			return;
+		}
+#endif
+		scalar::f16_to_f32(in, out, n);
+	}
+}
+
+	// -----< Batch conversion >-------------------------------------------------------------------
+
+	// out[i] = half(in[i]). out has to hold at least in.size() values.
+	inline void to_half(std::span<const float> in, std::span<half> out) {
+		assert(out.size() >= in.size());
+		kernels::f32_to_f16(in.data(), out.data(), in.size());
+	}
+
+	// out[i] = float(in[i]). out has to hold at least in.size() values.
+	inline void to_float(std::span<const half> in, std::span<float> out) {
+		assert(out.size() >= in.size());
+		kernels::f16_to_f32(in.data(), out.data(), in.size());
+	}
+}
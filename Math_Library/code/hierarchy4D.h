@@ -0,0 +1,330 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "instrument4D.h"
+#include "matrix4D.h"
+#include "parallel4D.h"
+#include "simd4D.h"
+#include "thread_pool.h"
+
+// Transform hierarchy (scene graph) with incremental world matrices.
+//
+// Every node has a local Matrix4D and a parent. Its world matrix is
+// world(parent) * local, or local for a root. update() recomputes only
+// the nodes whose local matrix changed since the last update and
+// everything below them, so a frame where a few objects move costs a
+// few matrix products, not one per node:
+//
+//	TransformHierarchy scene;
+//	TransformHierarchy::Node body = scene.add(Matrix4D::rotation_y(0.3f));
+//	TransformHierarchy::Node arm = scene.add(Matrix4D::rotation_z(0.5f), body);
+//	scene.update();
+//	scene.set_local(body, Matrix4D::rotation_y(0.4f));	// arm moves with it
+//	scene.update();	// two matrix products
+//
+// The nodes are stored in one flat array in depth-first order, so every
+// parent comes before its children and every subtree is one contiguous
+// range of the array. A changed node is recomputed by walking its range
+// front to back. Ranges that do not overlap are independent and run in
+// parallel when there is enough work.
+//
+// Node handles are the order the nodes were added in and never change.
+// Adding a child node breaks the depth-first order; the array is then
+// sorted again by the next update(), which costs one pass over all nodes.
+// Build the hierarchy once and only change local matrices per frame.
+
+class TransformHierarchy {
+public:
+	using Node = std::uint32_t;
+
+	// Parent of a root node.
+	static constexpr Node none = 0xffffffffu;
+
+private:
+	// A range of slots, [begin, end).
+	struct Range {
+		std::uint32_t begin;
+		std::uint32_t end;
+	};
+
+	// Per slot, in depth-first order. The subtree of the node in a slot is
+	// [slot, subtree_end[slot]).
+	std::vector<Matrix4D> locals;
+	std::vector<Matrix4D> worlds;
+	std::vector<std::uint32_t> parent_slots;
+	std::vector<std::uint32_t> subtree_end;
+
+	// Per node.
+	std::vector<Node> parents;
+	std::vector<std::uint32_t> slots;
+	std::vector<std::uint8_t> changed;
+
+	// Nodes marked since the last update.
+	std::vector<Node> dirty;
+	// False after add() until the next update() sorts the array again.
+	bool ordered = true;
+
+	// Kept between updates so they do not allocate every frame.
+	std::vector<std::uint32_t> dirty_slots;
+	std::vector<std::uint8_t> slot_flags;
+	std::vector<Range> ranges;
+	std::vector<Range> pieces;
+	std::vector<std::size_t> batches;
+
+	void mark(Node node) {
+		if (!changed[node]) {
+			changed[node] = 1;
+			dirty.push_back(node);
+		}
+	}
+
+	void update_slot(std::uint32_t slot) {
+		std::uint32_t parent = parent_slots[slot];
+		if (parent == none) {
+			worlds[slot] = locals[slot];
+		}
+		else {
+			math4D::kernels::mat4_mul(worlds[parent].data(), locals[slot].data(), worlds[slot].data());
+		}
+	}
+
+	void update_range(Range r) {
+		for (std::uint32_t slot = r.begin; slot < r.end; slot++) {
+			update_slot(slot);
+		}
+	}
+
+	// Puts the nodes back in depth-first order. A parent is always added
+	// before its children, so the subtree sizes are summed in one
+	// backwards pass over the nodes and the slots handed out in one
+	// forward pass.
+	void sort_nodes() {
+		std::size_t n = parents.size();
+
+		std::vector<std::uint32_t> size(n, 1);
+		for (std::size_t i = n; i-- > 0;) {
+			if (parents[i] != none) size[parents[i]] += size[i];
+		}
+
+		// The first free slot inside every subtree. Children take slots in the
+		// order they were added, right after their parent and older siblings.
+		std::vector<std::uint32_t> next(n);
+		std::uint32_t next_root = 0;
+		std::vector<std::uint32_t> new_slots(n);
+		for (std::size_t i = 0; i < n; i++) {
+			std::uint32_t slot;
+			if (parents[i] == none) {
+				slot = next_root;
+				next_root += size[i];
+			}
+			else {
+				slot = next[parents[i]];
+				next[parents[i]] += size[i];
+			}
+			new_slots[i] = slot;
+			next[i] = slot + 1;
+		}
+
+		std::vector<Matrix4D> new_locals(n), new_worlds(n);
+		for (std::size_t i = 0; i < n; i++) {
+			std::uint32_t s = new_slots[i];
+			new_locals[s] = locals[slots[i]];
+			new_worlds[s] = worlds[slots[i]];
+			parent_slots[s] = parents[i] == none ? none : new_slots[parents[i]];
+			subtree_end[s] = s + size[i];
+		}
+		locals.swap(new_locals);
+		worlds.swap(new_worlds);
+		slots.swap(new_slots);
+		ordered = true;
+	}
+
+	// Splits the ranges larger than chunk at their children, so one big
+	// changed subtree is spread over the threads too. The node a range is
+	// split at is updated here, before its children run.
+	void split_ranges(std::size_t chunk) {
+		pieces.clear();
+		std::vector<Range> stack;
+		for (Range r : ranges) {
+			stack.push_back(r);
+			while (!stack.empty()) {
+				Range x = stack.back();
+				stack.pop_back();
+				if (x.end - x.begin <= chunk) {
+					pieces.push_back(x);
+					continue;
+				}
+				update_slot(x.begin);
+				for (std::uint32_t c = x.begin + 1; c < x.end; c = subtree_end[c]) {
+					stack.push_back(Range{ c, subtree_end[c] });
+				}
+			}
+		}
+
+		// Neighbouring small pieces are grouped into batches of about chunk nodes.
+		batches.clear();
+		batches.push_back(0);
+		std::size_t nodes = 0;
+		for (std::size_t i = 0; i < pieces.size(); i++) {
+			nodes += pieces[i].end - pieces[i].begin;
+			if (nodes >= chunk) {
+				batches.push_back(i + 1);
+				nodes = 0;
+			}
+		}
+		if (batches.back() != pieces.size()) batches.push_back(pieces.size());
+	}
+
+public:
+
+	// -----< Constructors >-----------------------------------------------------------------------
+
+	TransformHierarchy() = default;
+
+	// Reserves memory for a number of nodes.
+	void reserve(std::size_t n) {
+		locals.reserve(n);
+		worlds.reserve(n);
+		parent_slots.reserve(n);
+		subtree_end.reserve(n);
+		parents.reserve(n);
+		slots.reserve(n);
+		changed.reserve(n);
+	}
+
+	// Removes all nodes.
+	void clear() {
+		locals.clear();
+		worlds.clear();
+		parent_slots.clear();
+		subtree_end.clear();
+		parents.clear();
+		slots.clear();
+		changed.clear();
+		dirty.clear();
+		ordered = true;
+	}
+
+	// -----< Nodes >------------------------------------------------------------------------------
+
+	// Adds a node below parent, or a root for none. Returns its handle.
+	// Its world matrix is set by the next update().
+	Node add(const Matrix4D& local, Node parent = none) {
+		assert(parent == none || parent < parents.size());
+		assert(parents.size() < none);
+		Node node = (Node)parents.size();
+		std::uint32_t slot = (std::uint32_t)locals.size();
+		std::uint32_t parent_slot = parent == none ? none : slots[parent];
+
+		// A root appended at the back keeps the depth-first order, a child
+		// only does if no other node follows its parent's subtree. That is
+		// not checked (it would mean walking up all ancestors), the next
+		// update() sorts instead.
+		if (parent_slot != none) ordered = false;
+
+		locals.push_back(local);
+		worlds.push_back(local);
+		parent_slots.push_back(parent_slot);
+		subtree_end.push_back(slot + 1);
+		parents.push_back(parent);
+		slots.push_back(slot);
+		changed.push_back(0);
+		mark(node);
+		return node;
+	}
+
+	// Returns the number of nodes.
+	std::size_t size() const noexcept {
+		return parents.size();
+	}
+
+	Node parent(Node node) const noexcept {
+		return parents[node];
+	}
+
+	const Matrix4D& local(Node node) const noexcept {
+		return locals[slots[node]];
+	}
+
+	// Returns the world matrix of a node as of the last update().
+	const Matrix4D& world(Node node) const noexcept {
+		return worlds[slots[node]];
+	}
+
+	// Sets the local matrix of a node. It and its subtree are recomputed
+	// by the next update().
+	void set_local(Node node, const Matrix4D& local) {
+		locals[slots[node]] = local;
+		mark(node);
+	}
+
+	// Returns the number of nodes set since the last update().
+	std::size_t changed_count() const noexcept {
+		return dirty.size();
+	}
+
+	// -----< Update >-----------------------------------------------------------------------------
+
+	// Recomputes the world matrices of the changed nodes and their subtrees.
+	// When more than options.chunk nodes have to be recomputed, independent
+	// subtrees are spread over the threads of options.pool, in tasks of
+	// about options.chunk nodes.
+	void update(const math4D::ParallelOptions& options = math4D::ParallelOptions()) {
+		MATH4D_TIME(HierarchyUpdate, dirty.size());
+		if (!ordered) sort_nodes();
+		if (dirty.empty()) return;
+
+		// A changed node inside the subtree of an earlier one is already
+		// covered by it. The changed slots are visited in order: sorted when
+		// there are few, with a pass over a flag per slot when there are many.
+		ranges.clear();
+		std::size_t total = 0;
+		std::uint32_t n = (std::uint32_t)locals.size();
+		if (dirty.size() * 64 < n) {
+			dirty_slots.clear();
+			for (Node node : dirty) dirty_slots.push_back(slots[node]);
+			std::sort(dirty_slots.begin(), dirty_slots.end());
+			std::uint32_t covered = 0;
+			for (std::uint32_t slot : dirty_slots) {
+				if (slot < covered) continue;
+				covered = subtree_end[slot];
+				ranges.push_back(Range{ slot, covered });
+				total += covered - slot;
+			}
+		}
+		else {
+			slot_flags.assign(n, 0);
+			for (Node node : dirty) slot_flags[slots[node]] = 1;
+			for (std::uint32_t slot = 0; slot < n;) {
+				if (slot_flags[slot]) {
+					ranges.push_back(Range{ slot, subtree_end[slot] });
+					total += subtree_end[slot] - slot;
+					slot = subtree_end[slot];
+				}
+				else {
+					slot++;
+				}
+			}
+		}
+		for (Node node : dirty) changed[node] = 0;
+		dirty.clear();
+
+		math4D::ThreadPool& pool = options.pool != nullptr ? *options.pool : math4D::ThreadPool::default_pool();
+		std::size_t chunk = options.chunk > 0 ? options.chunk : 1;
+		if (total <= chunk || pool.size() == 0) {
+			for (Range r : ranges) update_range(r);
+			return;
+		}
+
+		split_ranges(chunk);
+		pool.parallel_for(0, batches.size() - 1, 1, [&](std::size_t begin, std::size_t end) {
+			for (std::size_t p = batches[begin]; p < batches[end]; p++) {
+				update_range(pieces[p]);
+			}
+		});
+	}
+};
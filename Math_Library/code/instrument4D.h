@@ -0,0 +1,357 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <type_traits>
+
+#if defined(MATH4D_INSTRUMENT)
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#endif
+
+// Opt-in instrumentation of the library hot paths.
+//
+// Define MATH4D_INSTRUMENT (for the whole program) to count calls per
+// operation, singular matrices and NaN results, and to time the batch
+// APIs. Without it the hooks expand to nothing and nothing is recorded.
+// The snapshot API is always there, so telemetry code compiles either
+// way; it then reports enabled = false and zeros:
+//
+//	math4D::instrument::Snapshot s = math4D::instrument::snapshot();
+//	std::uint64_t singular = s[math4D::instrument::Counter::SingularMatrix];
+//	send_to_telemetry(s.to_json());
+//	math4D::instrument::reset();	// per frame counts
+//
+// Every thread counts in its own thread-local block, so counting is a
+// plain load and store without a lock or a locked instruction. snapshot()
+// sums the blocks of all threads, including threads that have exited.
+//
+// The timers cover one call of a batch API each and are inclusive:
+// stream_transform() also counts the parallel_transform() calls it makes.
+
+namespace math4D {
+namespace instrument {
+
+	// True when the library was compiled with MATH4D_INSTRUMENT.
+#if defined(MATH4D_INSTRUMENT)
+	constexpr bool enabled = true;
+#else
+	constexpr bool enabled = false;
+#endif
+
+	// -----< Counters / Timers >------------------------------------------------------------------
+
+	enum class Counter {
+		MatrixMultiply,			// Matrix4D * Matrix4D and *=, one per matrix in multiply() on streams
+		MatrixVectorMultiply,	// Matrix4D * Vector4D
+		MatrixInverse,			// inverse() and try_inverse(), one per matrix on streams
+		MatrixInverseAffine,	// inverse_affine() and try_inverse_affine()
+		MatrixInverseRigid,		// inverse_rigid()
+		SingularMatrix,			// inversions that failed because the determinant was 0
+		VectorNormalize,		// normalize(), norm(), normalize3() and the _fast versions
+		NaN,					// results of the operations above with a NaN in them
+		Count
+	};
+
+	enum class Timer {
+		Transform,				// transform()
+		ParallelTransform,		// parallel_transform()
+		Normalize,				// normalize() / normalize3() on lists
+		Rotations,				// rotations() / rotations_xyz()
+		Slerp,					// slerp_batch()
+		Cull,					// cull()
+		Skin,					// skin()
+		HierarchyUpdate,		// TransformHierarchy::update()
+		StreamTransform,		// stream_transform()
+		MatrixStream,			// multiply(), transpose(), determinant() and inverse() on Matrix4DStream
+		Project,				// project()
+		Reduce,					// parallel_sum() and parallel_dot()
+		Count
+	};
+
+	constexpr std::size_t counter_count = (std::size_t)Counter::Count;
+	constexpr std::size_t timer_count = (std::size_t)Timer::Count;
+
+	// Names used in the JSON and CSV exports.
+	inline const char* counter_name(Counter c) {
+		switch (c) {
+		case Counter::MatrixMultiply:		return "matrix_multiply";
+		case Counter::MatrixVectorMultiply:	return "matrix_vector_multiply";
+		case Counter::MatrixInverse:		return "matrix_inverse";
+		case Counter::MatrixInverseAffine:	return "matrix_inverse_affine";
+		case Counter::MatrixInverseRigid:	return "matrix_inverse_rigid";
+		case Counter::SingularMatrix:		return "singular_matrix";
+		case Counter::VectorNormalize:		return "vector_normalize";
+		case Counter::NaN:					return "nan";
+		default:							return "unknown";
+		}
+	}
+
+	inline const char* timer_name(Timer t) {
+		switch (t) {
+		case Timer::Transform:			return "transform";
+		case Timer::ParallelTransform:	return "parallel_transform";
+		case Timer::Normalize:			return "normalize";
+		case Timer::Rotations:			return "rotations";
+		case Timer::Slerp:				return "slerp";
+		case Timer::Cull:				return "cull";
+		case Timer::Skin:				return "skin";
+		case Timer::HierarchyUpdate:	return "hierarchy_update";
+		case Timer::StreamTransform:	return "stream_transform";
+		case Timer::MatrixStream:		return "matrix_stream";
+		case Timer::Project:			return "project";
+		case Timer::Reduce:				return "reduce";
+		default:						return "unknown";
+		}
+	}
+
+	// -----< Snapshot >---------------------------------------------------------------------------
+
+	struct TimerStats {
+		std::uint64_t calls = 0;
+		// Points, matrices, nodes, ... handed to the calls.
+		std::uint64_t elements = 0;
+		std::uint64_t nanoseconds = 0;
+
+		double seconds() const noexcept { return nanoseconds * 1e-9; }
+	};
+
+	// The counts of all threads at one point in time.
+	struct Snapshot {
+		std::uint64_t counters[counter_count] = {};
+		TimerStats timers[timer_count] = {};
+
+		std::uint64_t operator[](Counter c) const noexcept {
+			return counters[(std::size_t)c];
+		}
+		const TimerStats& operator[](Timer t) const noexcept {
+			return timers[(std::size_t)t];
+		}
+
+		// {"enabled": true, "counters": {"matrix_multiply": 12, ...},
+		//  "timers": {"transform": {"calls": 1, "elements": 1000, "nanoseconds": 5300}, ...}}
+		std::string to_json() const {
+			std::string s = enabled ? "{\"enabled\": true, \"counters\": {" : "{\"enabled\": false, \"counters\": {";
+			char line[160];
+			for (std::size_t i = 0; i < counter_count; i++) {
+				std::snprintf(line, sizeof(line), "%s\"%s\": %llu", i > 0 ? ", " : "",
+					counter_name((Counter)i), (unsigned long long)counters[i]);
+				s += line;
+			}
+			s += "}, \"timers\": {";
+			for (std::size_t i = 0; i < timer_count; i++) {
+				std::snprintf(line, sizeof(line), "%s\"%s\": {\"calls\": %llu, \"elements\": %llu, \"nanoseconds\": %llu}",
+					i > 0 ? ", " : "", timer_name((Timer)i), (unsigned long long)timers[i].calls,
+					(unsigned long long)timers[i].elements, (unsigned long long)timers[i].nanoseconds);
+				s += line;
+			}
+			s += "}}";
+			return s;
+		}
+
+		// One line per counter and timer, with a header:
+		// kind,name,calls,elements,nanoseconds
+		// counter,matrix_multiply,12,,
+		// timer,transform,1,1000,5300
+		std::string to_csv() const {
+			std::string s = "kind,name,calls,elements,nanoseconds\n";
+			char line[160];
+			for (std::size_t i = 0; i < counter_count; i++) {
+				std::snprintf(line, sizeof(line), "counter,%s,%llu,,\n", counter_name((Counter)i), (unsigned long long)counters[i]);
+				s += line;
+			}
+			for (std::size_t i = 0; i < timer_count; i++) {
+				std::snprintf(line, sizeof(line), "timer,%s,%llu,%llu,%llu\n", timer_name((Timer)i),
+					(unsigned long long)timers[i].calls, (unsigned long long)timers[i].elements,
+					(unsigned long long)timers[i].nanoseconds);
+				s += line;
+			}
+			return s;
+		}
+	};
+
+#if defined(MATH4D_INSTRUMENT)
+
+	namespace detail {
+
+		struct ThreadBlock;
+
+		// The block of the calling thread. The block has a destructor, so every
+		// access to it would go through the check whether it was constructed
+		// yet; the pointer to it is constant initialized and does not.
+		inline thread_local ThreadBlock* current = nullptr;
+
+		// The blocks of the running threads, and the sum of the ones that exited.
+		struct Registry {
+			std::mutex mutex;
+			std::vector<ThreadBlock*> threads;
+			Snapshot exited;
+		};
+
+		inline Registry& registry() {
+			static Registry r;
+			return r;
+		}
+
+		// Only the owning thread writes a block. The values are atomics so
+		// snapshot() can read them from another thread, but a count is a
+		// relaxed load and store, not a locked read-modify-write.
+		struct ThreadBlock {
+			std::atomic<std::uint64_t> counters[counter_count] = {};
+			std::atomic<std::uint64_t> calls[timer_count] = {};
+			std::atomic<std::uint64_t> elements[timer_count] = {};
+			std::atomic<std::uint64_t> nanoseconds[timer_count] = {};
+
+			ThreadBlock() {
+				Registry& r = registry();
+				std::lock_guard<std::mutex> lock(r.mutex);
+				r.threads.push_back(this);
+			}
+
+			~ThreadBlock() {
+				Registry& r = registry();
+				std::lock_guard<std::mutex> lock(r.mutex);
+				add_to(r.exited);
+				r.threads.erase(std::find(r.threads.begin(), r.threads.end(), this));
+				current = nullptr;
+			}
+
+			void add_to(Snapshot& s) const {
+				for (std::size_t i = 0; i < counter_count; i++) {
+					s.counters[i] += counters[i].load(std::memory_order_relaxed);
+				}
+				for (std::size_t i = 0; i < timer_count; i++) {
+					s.timers[i].calls += calls[i].load(std::memory_order_relaxed);
+					s.timers[i].elements += elements[i].load(std::memory_order_relaxed);
+					s.timers[i].nanoseconds += nanoseconds[i].load(std::memory_order_relaxed);
+				}
+			}
+
+			void clear() {
+				for (auto& c : counters) c.store(0, std::memory_order_relaxed);
+				for (std::size_t i = 0; i < timer_count; i++) {
+					calls[i].store(0, std::memory_order_relaxed);
+					elements[i].store(0, std::memory_order_relaxed);
+					nanoseconds[i].store(0, std::memory_order_relaxed);
+				}
+			}
+		};
+
+		inline ThreadBlock* attach() {
+			thread_local ThreadBlock block;
+			current = &block;
+			return current;
+		}
+
+		inline ThreadBlock& local() {
+			ThreadBlock* b = current;
+			if (b == nullptr) b = attach();
+			return *b;
+		}
+
+		inline void bump(std::atomic<std::uint64_t>& a, std::uint64_t n) {
+			a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+		}
+	}
+
+	inline void count(Counter c, std::uint64_t n = 1) {
+		detail::bump(detail::local().counters[(std::size_t)c], n);
+	}
+
+	// Counts a NaN result if one of the n values is NaN.
+	inline void count_nan(const float* values, std::size_t n) {
+		bool nan = false;
+		for (std::size_t i = 0; i < n; i++) nan |= values[i] != values[i];
+		if (nan) count(Counter::NaN);
+	}
+
+	// Adds the time from construction to destruction to a timer.
+	class ScopedTimer {
+	private:
+		Timer timer;
+		std::uint64_t elements;
+		std::chrono::steady_clock::time_point start;
+
+	public:
+		ScopedTimer(Timer t, std::size_t n) noexcept
+			: timer(t), elements(n), start(std::chrono::steady_clock::now()) {
+		}
+
+		ScopedTimer(const ScopedTimer&) = delete;
+		ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+		// For calls that only know their size at the end.
+		void add_elements(std::size_t n) noexcept {
+			elements += n;
+		}
+
+		~ScopedTimer() {
+			std::uint64_t ns = (std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - start).count();
+			detail::ThreadBlock& b = detail::local();
+			std::size_t i = (std::size_t)timer;
+			detail::bump(b.calls[i], 1);
+			detail::bump(b.elements[i], elements);
+			detail::bump(b.nanoseconds[i], ns);
+		}
+	};
+
+	// Returns the sums over all threads since the start or the last reset().
+	inline Snapshot snapshot() {
+		Snapshot s;
+		detail::Registry& r = detail::registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		s = r.exited;
+		for (const detail::ThreadBlock* b : r.threads) b->add_to(s);
+		return s;
+	}
+
+	// Sets every count to 0. Counts other threads make during the reset
+	// may be lost or survive it.
+	inline void reset() {
+		detail::Registry& r = detail::registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		r.exited = Snapshot();
+		for (detail::ThreadBlock* b : r.threads) b->clear();
+	}
+
+#else
+
+	inline Snapshot snapshot() {
+		return Snapshot();
+	}
+
+	inline void reset() {}
+
+#endif
+}
+}
+
+// -----< Hooks >------------------------------------------------------------------------------
+
+// Used inside the library. MATH4D_COUNT and MATH4D_COUNT_NAN may appear in
+// constexpr functions; nothing is counted during constant evaluation.
+// MATH4D_COUNT_N adds n at once, for the batch APIs.
+// MATH4D_TIME declares a variable, so it is used once per function and not
+// in constexpr functions. MATH4D_TIME_ELEMENTS adds to the elements of it.
+#if defined(MATH4D_INSTRUMENT)
+#define MATH4D_COUNT(counter) \
+	do { if (!std::is_constant_evaluated()) ::math4D::instrument::count(::math4D::instrument::Counter::counter); } while (0)
+#define MATH4D_COUNT_N(counter, n) \
+	::math4D::instrument::count(::math4D::instrument::Counter::counter, (std::uint64_t)(n))
+#define MATH4D_COUNT_NAN(values, n) \
+	do { if (!std::is_constant_evaluated()) ::math4D::instrument::count_nan(values, n); } while (0)
+#define MATH4D_TIME(timer, elements) \
+	::math4D::instrument::ScopedTimer math4D_scoped_timer(::math4D::instrument::Timer::timer, (std::size_t)(elements))
+#define MATH4D_TIME_ELEMENTS(elements) math4D_scoped_timer.add_elements((std::size_t)(elements))
+#else
+#define MATH4D_COUNT(counter) ((void)0)
+#define MATH4D_COUNT_N(counter, n) ((void)0)
+#define MATH4D_COUNT_NAN(values, n) ((void)0)
+#define MATH4D_TIME(timer, elements) ((void)0)
+#define MATH4D_TIME_ELEMENTS(elements) ((void)0)
+#endif
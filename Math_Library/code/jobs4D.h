@@ -0,0 +1,381 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "matrix4D.h"
+#include "matrix_stream4D.h"
+#include "parallel4D.h"
+#include "thread_pool.h"
+#include "vector4D.h"
+
+// Asynchronous jobs on a ThreadPool.
+//
+// JobSystem::submit() queues a function and returns at once with a Job,
+// which can be waited on, turned into a std::shared_future or given to
+// later jobs as a dependency. A job starts when all the jobs it depends on
+// are done, so a frame can be queued as a chain:
+//
+//	math4D::JobSystem jobs;
+//	math4D::Job world = jobs.submit([&] { hierarchy.update(); });
+//	math4D::Job skinned = jobs.submit([&] { math4D::skin(...); }, { world });
+//	math4D::Job culled = jobs.submit([&] { math4D::cull(...); }, { skinned });
+//	... other work ...
+//	culled.wait();
+//
+// transform_async() and inverse_async() queue the library batch operations.
+//
+// A JobSystem allows a fixed number of jobs in flight (queued, waiting for
+// dependencies or running). submit() blocks when that many are in flight
+// and runs queued pool tasks while it waits; try_submit() returns an empty
+// Job instead. Every job records how long it waited and how long it ran.
+//
+// Job::wait() and a full submit() run other pool tasks while they wait,
+// so they can be called from inside jobs without blocking a worker.
+//
+// An exception thrown by a job is stored in its future (future().get()
+// rethrows it). The job still counts as done and its dependents still run.
+
+namespace math4D {
+
+	class JobSystem;
+
+	// How long a job took, in nanoseconds.
+	struct JobTimes {
+		// From submit() until it started: dependencies and queueing.
+		std::uint64_t wait_ns = 0;
+		// From start to end of the job function.
+		std::uint64_t run_ns = 0;
+
+		std::uint64_t latency_ns() const noexcept { return wait_ns + run_ns; }
+	};
+
+	// Called with the times of a job, on the thread that ran it.
+	using JobCallback = std::function<void(const JobTimes&)>;
+
+	// -----< Job >--------------------------------------------------------------------------------
+
+	// A handle to a submitted job. Copies refer to the same job.
+	// A default constructed Job is empty and counts as done.
+	class Job {
+	private:
+		friend class JobSystem;
+
+		struct State {
+			JobSystem* system = nullptr;
+			std::function<void()> work;
+			JobCallback on_done;
+
+			// Unfinished dependencies, plus one held by submit() until all are registered.
+			std::atomic<std::size_t> pending{ 1 };
+			std::atomic<bool> finished{ false };
+			std::mutex mutex;
+			std::vector<std::shared_ptr<State>> dependents;
+
+			std::promise<void> promise;
+			std::shared_future<void> future;
+			std::chrono::steady_clock::time_point submitted;
+			JobTimes times;
+		};
+
+		std::shared_ptr<State> state;
+
+		explicit Job(std::shared_ptr<State> s) noexcept : state(std::move(s)) {}
+
+	public:
+
+		Job() noexcept = default;
+
+		// Returns true if the Job refers to a submitted job.
+		bool valid() const noexcept {
+			return state != nullptr;
+		}
+
+		// Returns true once the job and its callback have run.
+		bool done() const noexcept {
+			return state == nullptr || state->finished.load(std::memory_order_acquire);
+		}
+
+		// Waits until the job is done, running other pool tasks meanwhile.
+		void wait() const;
+
+		// Returns a future that becomes ready when the job is done. get()
+		// rethrows an exception thrown by the job.
+		// Blocking on the future does not help the pool, see wait().
+		std::shared_future<void> future() const {
+			if (state == nullptr) {
+				std::promise<void> ready;
+				ready.set_value();
+				return ready.get_future().share();
+			}
+			return state->future;
+		}
+
+		// Returns the times of the job. Only valid once done() is true.
+		JobTimes times() const noexcept {
+			assert(done());
+			return state != nullptr ? state->times : JobTimes();
+		}
+	};
+
+	// -----< JobSystem >--------------------------------------------------------------------------
+
+	class JobSystem {
+	public:
+
+		// Totals over all jobs that are done.
+		struct Stats {
+			std::uint64_t submitted = 0;
+			std::uint64_t completed = 0;
+			// submit() calls that had to wait for a free slot.
+			std::uint64_t stalls = 0;
+			std::uint64_t wait_ns_total = 0;
+			std::uint64_t wait_ns_max = 0;
+			std::uint64_t run_ns_total = 0;
+			std::uint64_t run_ns_max = 0;
+
+			double mean_wait_ns() const noexcept { return completed != 0 ? (double)wait_ns_total / completed : 0; }
+			double mean_run_ns() const noexcept { return completed != 0 ? (double)run_ns_total / completed : 0; }
+		};
+
+	private:
+		friend class Job;
+		using State = Job::State;
+
+		ThreadPool* pool_;
+		std::size_t capacity_;
+		std::atomic<std::size_t> in_flight{ 0 };
+
+		// Signalled when a job is done, for wait() and full submit() calls.
+		std::mutex changed_mutex;
+		std::condition_variable changed;
+
+		mutable std::mutex stats_mutex;
+		Stats totals;
+
+		static std::uint64_t elapsed_ns(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+			return (std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count();
+		}
+
+		// Runs pool tasks until ready() is true, sleeping when there are none.
+		// The sleep is bounded, since the tasks that finish a job may be
+		// queued on this pool after the check.
+		template<class Ready>
+		void help_until(const Ready& ready) {
+			while (!ready()) {
+				if (pool_->run_one()) continue;
+				std::unique_lock<std::mutex> lock(changed_mutex);
+				if (ready()) return;
+				changed.wait_for(lock, std::chrono::microseconds(200));
+			}
+		}
+
+		// Takes a slot for a new job. Returns false if all are in use and block is false.
+		bool acquire_slot(bool block) {
+			bool stalled = false;
+			while (true) {
+				std::size_t n = in_flight.load(std::memory_order_relaxed);
+				if (n < capacity_) {
+					if (in_flight.compare_exchange_weak(n, n + 1, std::memory_order_acq_rel)) break;
+					continue;
+				}
+				if (!block) return false;
+				stalled = true;
+				help_until([this] { return in_flight.load(std::memory_order_acquire) < capacity_; });
+			}
+			std::lock_guard<std::mutex> lock(stats_mutex);
+			totals.submitted++;
+			if (stalled) totals.stalls++;
+			return true;
+		}
+
+		Job enqueue(std::function<void()> work, const std::vector<Job>& after, JobCallback on_done) {
+			auto state = std::make_shared<State>();
+			state->system = this;
+			state->work = std::move(work);
+			state->on_done = std::move(on_done);
+			state->future = state->promise.get_future().share();
+			state->submitted = std::chrono::steady_clock::now();
+
+			for (const Job& dep : after) {
+				if (dep.state == nullptr) continue;
+				std::lock_guard<std::mutex> lock(dep.state->mutex);
+				if (!dep.state->finished.load(std::memory_order_relaxed)) {
+					state->pending.fetch_add(1, std::memory_order_relaxed);
+					dep.state->dependents.push_back(state);
+				}
+			}
+			release(state);
+			return Job(std::move(state));
+		}
+
+		// Drops one pending count and queues the job when none are left.
+		void release(const std::shared_ptr<State>& state) {
+			if (state->pending.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+			pool_->submit([this, state] { run(state); });
+		}
+
+		void run(const std::shared_ptr<State>& state) {
+			// An exception must not reach the pool worker (std::terminate)
+			// or skip the bookkeeping below, which wait() and ~JobSystem() need.
+			std::exception_ptr error;
+			auto start = std::chrono::steady_clock::now();
+			try {
+				state->work();
+			}
+			catch (...) {
+				error = std::current_exception();
+			}
+			auto end = std::chrono::steady_clock::now();
+			state->work = nullptr;
+			state->times.wait_ns = elapsed_ns(state->submitted, start);
+			state->times.run_ns = elapsed_ns(start, end);
+			if (state->on_done) {
+				try {
+					state->on_done(state->times);
+				}
+				catch (...) {
+					if (!error) error = std::current_exception();
+				}
+				state->on_done = nullptr;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(stats_mutex);
+				totals.completed++;
+				totals.wait_ns_total += state->times.wait_ns;
+				totals.run_ns_total += state->times.run_ns;
+				totals.wait_ns_max = std::max(totals.wait_ns_max, state->times.wait_ns);
+				totals.run_ns_max = std::max(totals.run_ns_max, state->times.run_ns);
+			}
+
+			std::vector<std::shared_ptr<State>> dependents;
+			{
+				std::lock_guard<std::mutex> lock(state->mutex);
+				state->finished.store(true, std::memory_order_release);
+				dependents.swap(state->dependents);
+			}
+			if (error) state->promise.set_exception(error);
+			else state->promise.set_value();
+			for (const std::shared_ptr<State>& dependent : dependents) {
+				release(dependent);
+			}
+
+			// Last, under the lock: once in_flight can reach 0 the destructor
+			// may run. It takes the lock before it returns, so it waits for
+			// the unlock and nothing of this JobSystem is used after it.
+			std::lock_guard<std::mutex> lock(changed_mutex);
+			in_flight.fetch_sub(1, std::memory_order_acq_rel);
+			changed.notify_all();
+		}
+
+	public:
+
+		// -----< Constructors >-----------------------------------------------------------------------
+
+		// Creates a job system on a pool (nullptr uses ThreadPool::default_pool())
+		// that allows at most capacity jobs in flight.
+		explicit JobSystem(ThreadPool* pool = nullptr, std::size_t capacity = 256)
+			: pool_(pool != nullptr ? pool : &ThreadPool::default_pool()), capacity_(capacity != 0 ? capacity : 1) {
+		}
+
+		JobSystem(const JobSystem&) = delete;
+		JobSystem& operator=(const JobSystem&) = delete;
+
+		// Waits for all jobs in flight.
+		~JobSystem() {
+			wait_all();
+			// wait_all() does not take the lock, so a job may still be in
+			// changed.notify_all() at the end of run(). Wait for it to leave.
+			std::lock_guard<std::mutex> lock(changed_mutex);
+		}
+
+		// -----< Getters >----------------------------------------------------------------------------
+
+		ThreadPool& pool() const noexcept {
+			return *pool_;
+		}
+
+		std::size_t capacity() const noexcept {
+			return capacity_;
+		}
+
+		// Returns the number of jobs submitted and not done yet.
+		std::size_t pending() const noexcept {
+			return in_flight.load(std::memory_order_acquire);
+		}
+
+		Stats stats() const {
+			std::lock_guard<std::mutex> lock(stats_mutex);
+			return totals;
+		}
+
+		void reset_stats() {
+			std::lock_guard<std::mutex> lock(stats_mutex);
+			totals = Stats();
+		}
+
+		// -----< Jobs >-------------------------------------------------------------------------------
+
+		// Queues work to run once every job in after is done, and returns its Job.
+		// on_done is called with the job times after work, on the same thread,
+		// before the job counts as done (so it must not wait on the job itself).
+		// Blocks while capacity() jobs are in flight.
+		Job submit(std::function<void()> work, const std::vector<Job>& after = {}, JobCallback on_done = {}) {
+			acquire_slot(true);
+			return enqueue(std::move(work), after, std::move(on_done));
+		}
+
+		// Same as submit(), but returns an empty Job instead of blocking
+		// when capacity() jobs are in flight.
+		Job try_submit(std::function<void()> work, const std::vector<Job>& after = {}, JobCallback on_done = {}) {
+			if (!acquire_slot(false)) return Job();
+			return enqueue(std::move(work), after, std::move(on_done));
+		}
+
+		// Waits until every submitted job is done, running pool tasks meanwhile.
+		void wait_all() {
+			help_until([this] { return in_flight.load(std::memory_order_acquire) == 0; });
+		}
+	};
+
+	inline void Job::wait() const {
+		if (state == nullptr) return;
+		const State* s = state.get();
+		state->system->help_until([s] { return s->finished.load(std::memory_order_acquire); });
+	}
+
+	// -----< Batch jobs >-------------------------------------------------------------------------
+
+	// Queues parallel_transform(m, in, out) on the pool of jobs. The lists
+	// have to stay alive and unchanged until the job is done.
+	inline Job transform_async(JobSystem& jobs, const Matrix4D& m, std::span<const Vector4D> in, std::span<Vector4D> out,
+			const std::vector<Job>& after = {}, JobCallback on_done = {}) {
+		return jobs.submit([&jobs, m, in, out] {
+			ParallelOptions options;
+			options.pool = &jobs.pool();
+			parallel_transform(m, in, out, options);
+		}, after, std::move(on_done));
+	}
+
+	// Queues inverse(in, out, singular). in, out and singular have to stay
+	// alive until the job is done. in may be filled by a job in after.
+	inline Job inverse_async(JobSystem& jobs, const Matrix4DStream& in, Matrix4DStream& out,
+			std::span<std::uint8_t> singular = {}, const std::vector<Job>& after = {}, JobCallback on_done = {}) {
+		return jobs.submit([&in, &out, singular] {
+			inverse(in, out, singular);
+		}, after, std::move(on_done));
+	}
+}
@@ -1,7 +1,23 @@
 #include <iostream>
 
+#include "batch4D.h"
+#include "culling4D.h"
+#include "dataset4D.h"
+#include "expression4D.h"
+#include "half4D.h"
+#include "hierarchy4D.h"
+#include "instrument4D.h"
+#include "jobs4D.h"
 #include "matrix4D.h"
+#include "matrix_stream4D.h"
+#include "matrixN.h"
+#include "parallel4D.h"
+#include "pipeline4D.h"
+#include "pool4D.h"
+#include "quaternion.h"
+#include "skin4D.h"
 #include "vector4D.h"
+#include "vectorN.h"
 
 using namespace std;
 
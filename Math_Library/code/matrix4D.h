@@ -1,10 +1,20 @@
 #pragma once
 #include <iostream>
 #include <cmath>
+#include <array>
+#include <cassert>
+#include <cstddef>
 #include <cstdio>
+#include <cstring>
+#include <span>
+#include <type_traits>
 #include <vector>
 
+#include "instrument4D.h"
+#include "matrixN.h"
 #include "vector4D.h"
+#include "simd4D.h"
+#include "trig4D.h"
 
 // Defines the value of PI.
 // Used when calculating degrees to radians.
@@ -12,15 +22,47 @@
 #define PI 3.14159265358979323846
 #endif
 
-class Matrix4D {
+// Matrix4D is math4D::Matrix<float, 4, 4>, specialized here with the SSE / AVX2 kernels.
+
+// The depth range of clip space, for the projection builders and Frustum::from_matrix.
+enum class ClipDepth {
+	NegativeOneToOne,	// OpenGL, -w <= z <= w
+	ZeroToOne			// Direct3D / Vulkan, 0 <= z <= w
+};
+
+namespace math4D {
+
+template<>
+class Matrix<float, 4, 4> {
 private:
+	// The four lines are stored back to back, so lines[0].data()
+	// points to all 16 values in row-major order.
+	//
+	// That is a guarantee of the layout, not of the standard: for the
+	// standard lines[0].data() points into an array of 4 floats, and going
+	// past its end into lines[1] is out of bounds, even though the checks
+	// at the end of the file rule out any padding in between. The 16-float
+	// views (data(), row_major() and the SIMD kernels) rely on the layout
+	// the same way any code that reads a Matrix4D as raw floats does, so
+	// they are not constexpr. Code that has to stay within the standard
+	// uses operator[] or column_major().
 	Vector4D lines[4];
 
-	// Function wich returns the determinant for a Matrix3D.
-	float determinant3(	float a, float b, float c,
-						float d, float e, float f,
-						float g, float h, float i) {
-		return a * ((e * i) - (f * h)) - b * ((d * i) - (g * f)) + c * ((d * h) - (e * g));
+	// The constexpr paths cannot use the 16-float view, so they copy the
+	// values to a plain array and back instead.
+	constexpr void to_array(float* out) const noexcept {
+		for (int i = 0; i < 4; i++) {
+			for (int j = 0; j < 4; j++) {
+				out[i * 4 + j] = lines[i][j];
+			}
+		}
+	}
+
+	static constexpr Matrix4D from_array(const float* v) noexcept {
+		return Matrix4D(v[0], v[1], v[2], v[3],
+						v[4], v[5], v[6], v[7],
+						v[8], v[9], v[10], v[11],
+						v[12], v[13], v[14], v[15]);
 	}
 
 public:
@@ -28,22 +70,25 @@ public:
 	// -----< Constructors >-----------------------------------------------------------------------
 
 	// Create a Matrix4D with inserted values.
-	Matrix4D(	float x1 = 1, float y1 = 0, float z1 = 0, float w1 = 0,
-				float x2 = 0, float y2 = 1, float z2 = 0, float w2 = 0,
-				float x3 = 0, float y3 = 0, float z3 = 1, float w3 = 0,
-				float x4 = 0, float y4 = 0, float z4 = 0, float w4 = 1) {
-		lines[0].set_components(x1, y1, z1, w1);
-		lines[1].set_components(x2, y2, z2, w2);
-		lines[2].set_components(x3, y3, z3, w3);
-		lines[3].set_components(x4, y4, z4, w4);
+	constexpr Matrix(	float x1 = 1, float y1 = 0, float z1 = 0, float w1 = 0,
+						float x2 = 0, float y2 = 1, float z2 = 0, float w2 = 0,
+						float x3 = 0, float y3 = 0, float z3 = 1, float w3 = 0,
+						float x4 = 0, float y4 = 0, float z4 = 0, float w4 = 1) noexcept
+		: lines{	Vector4D(x1, y1, z1, w1),
+					Vector4D(x2, y2, z2, w2),
+					Vector4D(x3, y3, z3, w3),
+					Vector4D(x4, y4, z4, w4) } {
 	}
 
-	// Creates a Matrix4D with the same values as another Matrix4D.
-	Matrix4D(const Matrix4D& m) {
-		lines[0] = m.lines[0];
-		lines[1] = m.lines[1];
-		lines[2] = m.lines[2];
-		lines[3] = m.lines[3];
+	// Copying is defaulted, a copy is a plain 64-byte move and
+	// Matrix4D stays trivially copyable (see the checks at the end of the file).
+	constexpr Matrix(const Matrix4D& m) noexcept = default;
+	constexpr Matrix4D& operator=(const Matrix4D& m) noexcept = default;
+
+	// Converts from a matrix with another value type, ex) Matrix4DDouble to Matrix4D.
+	template<class U>
+	explicit constexpr Matrix(const Matrix<U, 4, 4>& m) noexcept
+		: lines{ Vector4D(m[0]), Vector4D(m[1]), Vector4D(m[2]), Vector4D(m[3]) } {
 	}
 
 	// -----< Getters >----------------------------------------------------------------------------
@@ -54,32 +99,60 @@ public:
 	//
 	// ex)	lines[0][0] = x1
 	//		lines[2][1] = y3
-	Vector4D& operator[] (int index) {
+	constexpr Vector4D& operator[] (int index) noexcept {
 		return lines[index];
 	}
-	Vector4D operator[] (int index) const {
+	constexpr const Vector4D& operator[] (int index) const noexcept {
 		return lines[index];
 	}
 
+	// Returns a pointer to all 16 values in row-major order (16-byte aligned).
+	// Contiguous by layout, not by the standard (see lines above), so not
+	// for constant expressions.
+	const float* data() const noexcept {
+		return lines[0].data();
+	}
+	float* data() noexcept {
+		return lines[0].data();
+	}
+
+	// Returns a view of all 16 values in row-major order, without copying.
+	// Same layout assumption as data().
+	//
+	// ex)	values[0] = x1, values[1] = y1, values[4] = x2
+	std::span<const float, 16> row_major() const noexcept {
+		return std::span<const float, 16>(data(), 16);
+	}
+	std::span<float, 16> row_major() noexcept {
+		return std::span<float, 16>(data(), 16);
+	}
+
+	// Returns all 16 values in column-major order (the layout OpenGL expects).
+	// The values are stored row-major, so this is a transposed copy, but it
+	// is returned on the stack and never allocates.
+	//
+	// ex)	values[0] = x1, values[1] = x2, values[4] = y1
+	std::array<float, 16> column_major() const noexcept {
+		std::array<float, 16> result;
+		math4D::kernels::mat4_transpose(data(), result.data());
+		return result;
+	}
+
 	// Returns all the values from the Matrix4D
 	// in a vector of floats.
-	std::vector<float> get_all() {
-		std::vector<float> result;
-		for (int i = 0; i < 4; i++) {
-			for (int j = 0; j < 4; j++) {
-				result.push_back(lines[i][j]);
-			}
-		}
-		return result;
+	// Allocates every call, use row_major() or column_major() in hot code.
+	std::vector<float> get_all() const {
+		std::span<const float, 16> values = row_major();
+		return std::vector<float>(values.begin(), values.end());
 	}
 
 	// -----< Setters >----------------------------------------------------------------------------
 
 	// Set all the values in the matrix.
-	void set_components(float x1 = 1, float y1 = 0, float z1 = 0, float w1 = 0,
-						float x2 = 0, float y2 = 1, float z2 = 0, float w2 = 0,
-						float x3 = 0, float y3 = 0, float z3 = 1, float w3 = 0,
-						float x4 = 0, float y4 = 0, float z4 = 0, float w4 = 1) {
+	constexpr void set_components(	float x1 = 1, float y1 = 0, float z1 = 0, float w1 = 0,
+									float x2 = 0, float y2 = 1, float z2 = 0, float w2 = 0,
+									float x3 = 0, float y3 = 0, float z3 = 1, float w3 = 0,
+									float x4 = 0, float y4 = 0, float z4 = 0, float w4 = 1) noexcept {
 		lines[0] = Vector4D(x1, y1, z1, w1);
 		lines[1] = Vector4D(x2, y2, z2, w2);
 		lines[2] = Vector4D(x3, y3, z3, w3);
@@ -89,59 +162,51 @@ public:
 	// -----< Operators >--------------------------------------------------------------------------
 
 	// Operator for multiplication between two Matrix4D.
-	Matrix4D operator*(const Matrix4D& m) {
-		float	x1, y1, z1, w1,
-				x2, y2, z2, w2,
-				x3, y3, z3, w3,
-				x4, y4, z4, w4;
-
-		x1 = lines[0][0] * m[0][0] + lines[0][1] * m[1][0] + lines[0][2] * m[2][0] + lines[0][3] * m[3][0];
-		y1 = lines[0][0] * m[0][1] + lines[0][1] * m[1][1] + lines[0][2] * m[2][1] + lines[0][3] * m[3][1];
-		z1 = lines[0][0] * m[0][2] + lines[0][1] * m[1][2] + lines[0][2] * m[2][2] + lines[0][3] * m[3][2];
-		w1 = lines[0][0] * m[0][3] + lines[0][1] * m[1][3] + lines[0][2] * m[2][3] + lines[0][3] * m[3][3];
-
-		x2 = lines[1][0] * m[0][0] + lines[1][1] * m[1][0] + lines[1][2] * m[2][0] + lines[1][3] * m[3][0];
-		y2 = lines[1][0] * m[0][1] + lines[1][1] * m[1][1] + lines[1][2] * m[2][1] + lines[1][3] * m[3][1];
-		z2 = lines[1][0] * m[0][2] + lines[1][1] * m[1][2] + lines[1][2] * m[2][2] + lines[1][3] * m[3][2];
-		w2 = lines[1][0] * m[0][3] + lines[1][1] * m[1][3] + lines[1][2] * m[2][3] + lines[1][3] * m[3][3];
-
-		x3 = lines[2][0] * m[0][0] + lines[2][1] * m[1][0] + lines[2][2] * m[2][0] + lines[2][3] * m[3][0];
-		y3 = lines[2][0] * m[0][1] + lines[2][1] * m[1][1] + lines[2][2] * m[2][1] + lines[2][3] * m[3][1];
-		z3 = lines[2][0] * m[0][2] + lines[2][1] * m[1][2] + lines[2][2] * m[2][2] + lines[2][3] * m[3][2];
-		w3 = lines[2][0] * m[0][3] + lines[2][1] * m[1][3] + lines[2][2] * m[2][3] + lines[2][3] * m[3][3];
-
-		x4 = lines[3][0] * m[0][0] + lines[3][1] * m[1][0] + lines[3][2] * m[2][0] + lines[3][3] * m[3][0];
-		y4 = lines[3][0] * m[0][1] + lines[3][1] * m[1][1] + lines[3][2] * m[2][1] + lines[3][3] * m[3][1];
-		z4 = lines[3][0] * m[0][2] + lines[3][1] * m[1][2] + lines[3][2] * m[2][2] + lines[3][3] * m[3][2];
-		w4 = lines[3][0] * m[0][3] + lines[3][1] * m[1][3] + lines[3][2] * m[2][3] + lines[3][3] * m[3][3];
-
-
-		return Matrix4D(
-			x1, y1, z1, w1,
-			x2, y2, z2, w2,
-			x3, y3, z3, w3,
-			x4, y4, z4, w4
-		);
+	constexpr Matrix4D operator*(const Matrix4D& m) const noexcept {
+		if (std::is_constant_evaluated()) {
+			float a[16], b[16], r[16];
+			to_array(a);
+			m.to_array(b);
+			math4D::kernels::scalar::mat4_mul(a, b, r);
+			return from_array(r);
+		}
+		MATH4D_COUNT(MatrixMultiply);
+		Matrix4D result;
+		math4D::kernels::mat4_mul(lines[0].data(), m.lines[0].data(), result.lines[0].data());
+		MATH4D_COUNT_NAN(result.data(), 16);
+		return result;
 	}
 
-	// Operator for copying the values from one matrix to a new one.
-	Matrix4D operator=(const Matrix4D& m) {
-		Matrix4D new_m;
-		new_m[0] = lines[0] = m[0];
-		new_m[1] = lines[1] = m[1];
-		new_m[2] = lines[2] = m[2];
-		new_m[3] = lines[3] = m[3];
-		return new_m;
+	// Multiplies in place, *this = *this * m, without a temporary Matrix4D.
+	// The kernels read both matrices before they write, so m may be *this.
+	constexpr Matrix4D& operator*=(const Matrix4D& m) noexcept {
+		if (std::is_constant_evaluated()) {
+			float a[16], b[16], r[16];
+			to_array(a);
+			m.to_array(b);
+			math4D::kernels::scalar::mat4_mul(a, b, r);
+			*this = from_array(r);
+			return *this;
+		}
+		MATH4D_COUNT(MatrixMultiply);
+		math4D::kernels::mat4_mul(lines[0].data(), m.lines[0].data(), lines[0].data());
+		MATH4D_COUNT_NAN(data(), 16);
+		return *this;
 	}
 
 	// Operator for multiplication between a Matrix4D and a Vector4D.
-	Vector4D operator*(const Vector4D& v) {
-		Vector4D new_v(
-			lines[0][0] * v[0] + lines[0][1] * v[1] + lines[0][2] * v[2] + lines[0][3] * v[3],	// x value
-			lines[1][0] * v[0] + lines[1][1] * v[1] + lines[1][2] * v[2] + lines[1][3] * v[3],	// y value
-			lines[2][0] * v[0] + lines[2][1] * v[1] + lines[2][2] * v[2] + lines[2][3] * v[3],	// z value
-			lines[3][0] * v[0] + lines[3][1] * v[1] + lines[3][2] * v[2] + lines[3][3] * v[3]	// w value
-		);
+	constexpr Vector4D operator*(const Vector4D& v) const noexcept {
+		if (std::is_constant_evaluated()) {
+			float a[16];
+			to_array(a);
+			Vector4D new_v;
+			math4D::kernels::scalar::mat4_mul_vec4(a, v.data(), new_v.data());
+			return new_v;
+		}
+		MATH4D_COUNT(MatrixVectorMultiply);
+		Vector4D new_v;
+		math4D::kernels::mat4_mul_vec4(lines[0].data(), v.data(), new_v.data());
+		MATH4D_COUNT_NAN(new_v.data(), 4);
 		return new_v;
 	}
 
@@ -151,7 +216,7 @@ public:
 	// 0, 1, 0, y
 	// 0, 0, 1, z
 	// 0, 0, 0, 1
-	void translate(float nx = 0, float ny = 0, float nz = 0) {
+	constexpr void translate(float nx = 0, float ny = 0, float nz = 0) noexcept {
 		lines[0][3] = nx;
 		lines[1][3] = ny;
 		lines[2][3] = nz;
@@ -160,7 +225,7 @@ public:
 	// -----< Transpose >--------------------------------------------------------------------------
 
 	// Returns the Transpose of a Matrix
-	void transpose() {
+	constexpr void transpose() noexcept {
 		float	x1, y1, z1, w1,
 				x2, y2, z2, w2,
 				x3, y3, z3, w3,
@@ -201,182 +266,118 @@ public:
 	// -----< Inverse >----------------------------------------------------------------------------
 
 	// Function for returning the determinant of a Matrix4D.
-	float determinant() {
-		// The determinant start at 0
-		float det = 0;
-
-		// The values in the first line multiplicated with
-		// the determinant of a Matrix3D made of the values 
-		// From the Matrix4D minus the first line and the 
-		// columb that the number comes from. 
-		det += lines[0][0] * determinant3(lines[1][1], lines[1][2], lines[1][3],
-			lines[2][1], lines[2][2], lines[2][3],
-			lines[3][1], lines[3][2], lines[3][3]);
-
-		det -= lines[0][1] * determinant3(lines[1][0], lines[1][2], lines[1][3],
-			lines[2][0], lines[2][2], lines[2][3],
-			lines[3][0], lines[3][2], lines[3][3]);
-
-		det += lines[0][2] * determinant3(lines[1][0], lines[1][1], lines[1][3],
-			lines[2][0], lines[2][1], lines[2][3],
-			lines[3][0], lines[3][1], lines[3][3]);
-
-		det -= lines[0][3] * determinant3(lines[1][0], lines[1][1], lines[1][2],
-			lines[2][0], lines[2][1], lines[2][2],
-			lines[3][0], lines[3][1], lines[3][2]);
+	// Built from the six 2x2 determinants of the upper and the lower two lines.
+	constexpr float determinant() const noexcept {
+		if (std::is_constant_evaluated()) {
+			float a[16];
+			to_array(a);
+			return math4D::kernels::scalar::mat4_determinant(a);
+		}
+		return math4D::kernels::mat4_determinant(lines[0].data());
+	}
 
-		return det;
+	// Function for calculating the inverse of a Matrix4D without printing anything.
+	// Returns true and sets result if the matrix can be inverted.
+	// Returns false and leaves result as it was if the determinant is 0 (zero).
+	//
+	// The 2x2 determinants used for the determinant are reused for all
+	// the cofactors, and 1 / det is only calculated once.
+	bool try_inverse(Matrix4D& result) const {
+		MATH4D_COUNT(MatrixInverse);
+		bool inverted = math4D::kernels::mat4_inverse(lines[0].data(), result.lines[0].data());
+		if (!inverted) MATH4D_COUNT(SingularMatrix);
+		else MATH4D_COUNT_NAN(result.data(), 16);
+		return inverted;
 	}
 
 	// Function for returning (if possible) the inverse of a Matrix4D.
-	Matrix4D inverse() {
-		float	x1, y1, z1, w1,
-				x2, y2, z2, w2,
-				x3, y3, z3, w3,
-				x4, y4, z4, w4;
-
-		float det = determinant();
-
-		// check if the determinant is 0 (zero).
-		if (det == 0) {
+	// If the determinant is 0 (zero) an error is printed and
+	// the identity matrix is returned.
+	Matrix4D inverse() const {
+		Matrix4D inverse_m;
+		if (!try_inverse(inverse_m)) {
 			std::cout << "\nError: Determinant = 0\n\n";
 		}
-		else {
-			// Set all the values to be incerted to the inverce Matrix4D.
-			// Solution found online 
-			// https://www.euclideanspace.com/maths/algebra/matrix/functions/inverse/fourD/index.htm 
-			x1 = 1 / det * (lines[1][2] * lines[2][3] * lines[3][1]
-				- lines[1][3] * lines[2][2] * lines[3][1]
-				+ lines[1][3] * lines[2][1] * lines[3][2]
-				- lines[1][1] * lines[2][3] * lines[3][2]
-				- lines[1][2] * lines[2][1] * lines[3][3]
-				+ lines[1][1] * lines[2][2] * lines[3][3]);
-
-			y1 = 1 / det * (lines[0][3] * lines[2][2] * lines[3][1]
-				- lines[0][2] * lines[2][3] * lines[3][1]
-				- lines[0][3] * lines[2][1] * lines[3][2]
-				+ lines[0][1] * lines[2][3] * lines[3][2]
-				+ lines[0][2] * lines[2][1] * lines[3][3]
-				- lines[0][1] * lines[2][2] * lines[3][3]);
-
-			z1 = 1 / det * (lines[0][2] * lines[1][3] * lines[3][1]
-				- lines[0][3] * lines[1][2] * lines[3][1]
-				+ lines[0][3] * lines[1][1] * lines[3][2]
-				- lines[0][1] * lines[1][3] * lines[3][2]
-				- lines[0][2] * lines[1][1] * lines[3][3]
-				+ lines[0][1] * lines[1][2] * lines[3][3]);
-
-			w1 = 1 / det * (lines[0][3] * lines[1][2] * lines[2][1]
-				- lines[0][2] * lines[1][3] * lines[2][1]
-				- lines[0][3] * lines[1][1] * lines[2][2]
-				+ lines[0][1] * lines[1][3] * lines[2][2]
-				+ lines[0][2] * lines[1][1] * lines[2][3]
-				- lines[0][1] * lines[1][2] * lines[2][3]);
-
-			x2 = 1 / det * (lines[1][3] * lines[2][2] * lines[3][0]
-				- lines[1][2] * lines[2][3] * lines[3][0]
-				- lines[1][3] * lines[2][0] * lines[3][2]
-				+ lines[1][0] * lines[2][3] * lines[3][2]
-				+ lines[1][2] * lines[2][0] * lines[3][3]
-				- lines[1][0] * lines[2][2] * lines[3][3]);
-
-			y2 = 1 / det * (lines[0][2] * lines[2][3] * lines[3][0]
-				- lines[0][3] * lines[2][2] * lines[3][0]
-				+ lines[0][3] * lines[2][0] * lines[3][2]
-				- lines[0][0] * lines[2][3] * lines[3][2]
-				- lines[0][2] * lines[2][0] * lines[3][3]
-				+ lines[0][0] * lines[2][2] * lines[3][3]);
-
-			z2 = 1 / det * (lines[0][3] * lines[1][2] * lines[3][0]
-				- lines[0][2] * lines[1][3] * lines[3][0]
-				- lines[0][3] * lines[1][0] * lines[3][2]
-				+ lines[0][0] * lines[1][3] * lines[3][2]
-				+ lines[0][2] * lines[1][0] * lines[3][3]
-				- lines[0][0] * lines[1][2] * lines[3][3]);
-
-			w2 = 1 / det * (lines[0][2] * lines[1][3] * lines[2][0]
-				- lines[0][3] * lines[1][2] * lines[2][0]
-				+ lines[0][3] * lines[1][0] * lines[2][2]
-				- lines[0][0] * lines[1][3] * lines[2][2]
-				- lines[0][2] * lines[1][0] * lines[2][3]
-				+ lines[0][0] * lines[1][2] * lines[2][3]);
-
-			x3 = 1 / det * (lines[1][1] * lines[2][3] * lines[3][0]
-				- lines[1][3] * lines[2][1] * lines[3][0]
-				+ lines[1][3] * lines[2][0] * lines[3][1]
-				- lines[1][0] * lines[2][3] * lines[3][1]
-				- lines[1][1] * lines[2][0] * lines[3][3]
-				+ lines[1][0] * lines[2][1] * lines[3][3]);
-
-			y3 = 1 / det * (lines[0][3] * lines[2][1] * lines[3][0]
-				- lines[0][1] * lines[2][3] * lines[3][0]
-				- lines[0][3] * lines[2][0] * lines[3][1]
-				+ lines[0][0] * lines[2][3] * lines[3][1]
-				+ lines[0][1] * lines[2][0] * lines[3][3]
-				- lines[0][0] * lines[2][1] * lines[3][3]);
-
-			z3 = 1 / det * (lines[0][1] * lines[1][3] * lines[3][0]
-				- lines[0][3] * lines[1][1] * lines[3][0]
-				+ lines[0][3] * lines[1][0] * lines[3][1]
-				- lines[0][0] * lines[1][3] * lines[3][1]
-				- lines[0][1] * lines[1][0] * lines[3][3]
-				+ lines[0][0] * lines[1][1] * lines[3][3]);
-
-			w3 = 1 / det * (lines[0][3] * lines[1][1] * lines[2][0]
-				- lines[0][1] * lines[1][3] * lines[2][0]
-				- lines[0][3] * lines[1][0] * lines[2][1]
-				+ lines[0][0] * lines[1][3] * lines[2][1]
-				+ lines[0][1] * lines[1][0] * lines[2][3]
-				- lines[0][0] * lines[1][1] * lines[2][3]);
-
-			x4 = 1 / det * (lines[1][2] * lines[2][1] * lines[3][0]
-				- lines[1][1] * lines[2][2] * lines[3][0]
-				- lines[1][2] * lines[2][0] * lines[3][1]
-				+ lines[1][0] * lines[2][2] * lines[3][1]
-				+ lines[1][1] * lines[2][0] * lines[3][2]
-				- lines[1][0] * lines[2][1] * lines[3][2]);
-
-			y4 = 1 / det * (lines[0][1] * lines[2][2] * lines[3][0]
-				- lines[0][2] * lines[2][1] * lines[3][0]
-				+ lines[0][2] * lines[2][0] * lines[3][1]
-				- lines[0][0] * lines[2][2] * lines[3][1]
-				- lines[0][1] * lines[2][0] * lines[3][2]
-				+ lines[0][0] * lines[2][1] * lines[3][2]);
-
-			z4 = 1 / det * (lines[0][2] * lines[1][1] * lines[3][0]
-				- lines[0][1] * lines[1][2] * lines[3][0]
-				- lines[0][2] * lines[1][0] * lines[3][1]
-				+ lines[0][0] * lines[1][2] * lines[3][1]
-				+ lines[0][1] * lines[1][0] * lines[3][2]
-				- lines[0][0] * lines[1][1] * lines[3][2]);
-
-			w4 = 1 / det * (lines[0][1] * lines[1][2] * lines[2][0]
-				- lines[0][2] * lines[1][1] * lines[2][0]
-				+ lines[0][2] * lines[1][0] * lines[2][1]
-				- lines[0][0] * lines[1][2] * lines[2][1]
-				- lines[0][1] * lines[1][0] * lines[2][2]
-				+ lines[0][0] * lines[1][1] * lines[2][2]);
-
-			Matrix4D inverse_m;
-			// Incert all the values to the inverse Matrix4D.
-			inverse_m.set_components(x1, y1, z1, w1,
-				x2, y2, z2, w2,
-				x3, y3, z3, w3,
-				x4, y4, z4, w4);
-			// Returns the inverce Matrix4D.
-			return inverse_m;
+		return inverse_m;
+	}
+
+	// Function for calculating the inverse of an affine Matrix4D,
+	// a matrix where the last line is (0, 0, 0, 1).
+	//
+	// | A t |-1    | A^-1  -A^-1 * t |
+	// | 0 1 |    = | 0      1        |
+	//
+	// Only the 3x3 part A has to be inverted.
+	// Returns false and leaves result as it was if A can not be inverted.
+	bool try_inverse_affine(Matrix4D& result) const {
+		const float* m = lines[0].data();
+		float det = Matrix<float, 3, 3>(	m[0], m[1], m[2],
+											m[4], m[5], m[6],
+											m[8], m[9], m[10]).determinant();
+		float inv_det = 1.0f / det;
+		MATH4D_COUNT(MatrixInverseAffine);
+		if (!(inv_det - inv_det == 0.0f)) {
+			MATH4D_COUNT(SingularMatrix);
+			return false;
 		}
+
+		// A^-1 from the cofactors of A.
+		float a[9] = {
+			(m[5] * m[10] - m[6] * m[9]) * inv_det,
+			(m[2] * m[9] - m[1] * m[10]) * inv_det,
+			(m[1] * m[6] - m[2] * m[5]) * inv_det,
+			(m[6] * m[8] - m[4] * m[10]) * inv_det,
+			(m[0] * m[10] - m[2] * m[8]) * inv_det,
+			(m[2] * m[4] - m[0] * m[6]) * inv_det,
+			(m[4] * m[9] - m[5] * m[8]) * inv_det,
+			(m[1] * m[8] - m[0] * m[9]) * inv_det,
+			(m[0] * m[5] - m[1] * m[4]) * inv_det
+		};
+		float tx = m[3], ty = m[7], tz = m[11];
+
+		result.set_components(
+			a[0], a[1], a[2], -(a[0] * tx + a[1] * ty + a[2] * tz),
+			a[3], a[4], a[5], -(a[3] * tx + a[4] * ty + a[5] * tz),
+			a[6], a[7], a[8], -(a[6] * tx + a[7] * ty + a[8] * tz),
+			0, 0, 0, 1);
+		return true;
+	}
+
+	// Function for returning the inverse of an affine Matrix4D
+	// (rotation, scale and translation, last line (0, 0, 0, 1)).
+	// If the matrix can not be inverted the identity matrix is returned.
+	Matrix4D inverse_affine() const {
+		Matrix4D inverse_m;
+		try_inverse_affine(inverse_m);
+		return inverse_m;
+	}
+
+	// Function for returning the inverse of a rigid Matrix4D,
+	// only rotation and translation (no scale).
+	// The rotation R is orthonormal, so R^-1 = R^T.
+	//
+	// | R t |-1    | R^T  -R^T * t |
+	// | 0 1 |    = | 0     1       |
+	Matrix4D inverse_rigid() const {
+		MATH4D_COUNT(MatrixInverseRigid);
+		const float* m = lines[0].data();
+		float tx = m[3], ty = m[7], tz = m[11];
+		return Matrix4D(
+			m[0], m[4], m[8],  -(m[0] * tx + m[4] * ty + m[8] * tz),
+			m[1], m[5], m[9],  -(m[1] * tx + m[5] * ty + m[9] * tz),
+			m[2], m[6], m[10], -(m[2] * tx + m[6] * ty + m[10] * tz),
+			0, 0, 0, 1);
 	}
 
 	// -----< Rotation >---------------------------------------------------------------------------
 
 	// Function for returnin a Matrix4D with a 
 	// rotation around the x-axis.
-	Matrix4D rotate_x(float degrees) {
+	static constexpr Matrix4D rotate_x(float degrees) noexcept {
 		// Radians.
 		float radians = degrees * (PI / 180);
 		// Declare Cos and Sin for simplicity.
-		float c = cos(radians), s = sin(radians);
+		float c = (float)math4D::cos(radians), s = (float)math4D::sin(radians);
 		// The rotation matrix.
 		Matrix4D rotation(
 			1, 0,  0, 0,
@@ -390,11 +391,11 @@ public:
 
 	// Function for returnin a Matrix4D with a 
 	// rotation around the y-axis.
-	Matrix4D rotate_y(float degrees) {
+	static constexpr Matrix4D rotate_y(float degrees) noexcept {
 		// Radians.
 		float radians = degrees * (PI / 180);
 		// Declare Cos and Sin for simplicity.
-		float c = cos(radians), s = sin(radians);
+		float c = (float)math4D::cos(radians), s = (float)math4D::sin(radians);
 		// The rotation matrix.
 		Matrix4D rotation(
 			 c, 0, s, 0,
@@ -408,11 +409,11 @@ public:
 
 	// Function for returnin a Matrix4D with a 
 	// rotation around the z-axis.
-	Matrix4D rotate_z(float degrees) {
+	static constexpr Matrix4D rotate_z(float degrees) noexcept {
 		// Radians.
 		float radians = degrees * (PI / 180);
 		// Declare Cos and Sin for simplicity.
-		float c = cos(radians), s = sin(radians);
+		float c = (float)math4D::cos(radians), s = (float)math4D::sin(radians);
 		// The rotation matrix.
 		Matrix4D rotation(
 			c, -s, 0, 0,
@@ -423,10 +424,124 @@ public:
 		return rotation;
 	}
 
+	// Rotation around the x-axis from a sine / cosine pair that is
+	// already known, e.g. one math4D::sincos() result used for many matrices.
+	static constexpr Matrix4D rotation_x(math4D::SinCos sc) noexcept {
+		return Matrix4D(
+			1, 0,     0,    0,
+			0, sc.c, -sc.s, 0,
+			0, sc.s,  sc.c, 0,
+			0, 0,     0,    1);
+	}
+
+	// Rotation around the y-axis from a sine / cosine pair.
+	static constexpr Matrix4D rotation_y(math4D::SinCos sc) noexcept {
+		return Matrix4D(
+			 sc.c, 0, sc.s, 0,
+			 0,    1, 0,    0,
+			-sc.s, 0, sc.c, 0,
+			 0,    0, 0,    1);
+	}
+
+	// Rotation around the z-axis from a sine / cosine pair.
+	static constexpr Matrix4D rotation_z(math4D::SinCos sc) noexcept {
+		return Matrix4D(
+			sc.c, -sc.s, 0, 0,
+			sc.s,  sc.c, 0, 0,
+			0,     0,    1, 0,
+			0,     0,    0, 1);
+	}
+
+	// rotation_x(x) * rotation_y(y) * rotation_z(z), written out so it is
+	// built in one pass without the two matrix products.
+	static constexpr Matrix4D rotation_xyz(math4D::SinCos x, math4D::SinCos y, math4D::SinCos z) noexcept {
+		float sxsy = x.s * y.s, cxsy = x.c * y.s;
+		return Matrix4D(
+			y.c * z.c,                -y.c * z.s,                 y.s,       0,
+			sxsy * z.c + x.c * z.s,   -sxsy * z.s + x.c * z.c,   -x.s * y.c, 0,
+			-cxsy * z.c + x.s * z.s,   cxsy * z.s + x.s * z.c,    x.c * y.c, 0,
+			0,                         0,                         0,         1);
+	}
+
+	// Rotations from angles in radians. These use the float math4D::sincos,
+	// which is faster than rotate_x / rotate_y / rotate_z at runtime but
+	// can not be used in constant expressions.
+	static Matrix4D rotation_x(float radians) noexcept {
+		return rotation_x(math4D::sincos(radians));
+	}
+
+	static Matrix4D rotation_y(float radians) noexcept {
+		return rotation_y(math4D::sincos(radians));
+	}
+
+	static Matrix4D rotation_z(float radians) noexcept {
+		return rotation_z(math4D::sincos(radians));
+	}
+
+	static Matrix4D rotation_xyz(float x, float y, float z) noexcept {
+		return rotation_xyz(math4D::sincos(x), math4D::sincos(y), math4D::sincos(z));
+	}
+
+	// -----< Projection / View >------------------------------------------------------------------
+
+	// The projections are right-handed: the camera looks down -z, with x to
+	// the right and y up, and the clip space w is the distance in front of
+	// the camera. z_near and z_far are distances and both positive.
+
+	// Perspective projection with a vertical field of view in radians and
+	// aspect = width / height.
+	static Matrix4D perspective(float fov_y, float aspect, float z_near, float z_far,
+			ClipDepth depth = ClipDepth::NegativeOneToOne) noexcept {
+		math4D::SinCos sc = math4D::sincos(fov_y * 0.5f);
+		float f = sc.c / sc.s;
+		float range = 1 / (z_near - z_far);
+		float a = depth == ClipDepth::ZeroToOne ? z_far * range : (z_far + z_near) * range;
+		float b = depth == ClipDepth::ZeroToOne ? z_near * z_far * range : 2 * z_near * z_far * range;
+		return Matrix4D(
+			f / aspect, 0,  0, 0,
+			0,          f,  0, 0,
+			0,          0,  a, b,
+			0,          0, -1, 0);
+	}
+
+	// Orthographic projection of the box left..right, bottom..top and
+	// z_near..z_far in front of the camera.
+	static constexpr Matrix4D orthographic(float left, float right, float bottom, float top, float z_near, float z_far,
+			ClipDepth depth = ClipDepth::NegativeOneToOne) noexcept {
+		float w = 1 / (right - left), h = 1 / (top - bottom), d = 1 / (z_far - z_near);
+		float a = depth == ClipDepth::ZeroToOne ? -d : -2 * d;
+		float b = depth == ClipDepth::ZeroToOne ? -z_near * d : -(z_far + z_near) * d;
+		return Matrix4D(
+			2 * w, 0,     0, -(right + left) * w,
+			0,     2 * h, 0, -(top + bottom) * h,
+			0,     0,     a, b,
+			0,     0,     0, 1);
+	}
+
+	// View matrix of a camera at eye looking at target, with up as the
+	// direction that comes out on top. Only x, y and z of the points are used;
+	// up must not be parallel to target - eye.
+	static Matrix4D look_at(const Vector4D& eye, const Vector4D& target, const Vector4D& up) noexcept {
+		Vector4D f = Vector4D(target[0] - eye[0], target[1] - eye[1], target[2] - eye[2], 0).normalize3();
+		// s = f x up, u = s x f.
+		Vector4D s = Vector4D(	f[1] * up[2] - f[2] * up[1],
+								f[2] * up[0] - f[0] * up[2],
+								f[0] * up[1] - f[1] * up[0], 0).normalize3();
+		Vector4D u(	s[1] * f[2] - s[2] * f[1],
+					s[2] * f[0] - s[0] * f[2],
+					s[0] * f[1] - s[1] * f[0], 0);
+		Vector4D e(eye[0], eye[1], eye[2], 0);
+		return Matrix4D(
+			 s[0],  s[1],  s[2], -s.dot_product(e),
+			 u[0],  u[1],  u[2], -u.dot_product(e),
+			-f[0], -f[1], -f[2],  f.dot_product(e),
+			 0,     0,     0,     1);
+	}
+
 	// -----< Print / Debug >----------------------------------------------------------------------
 
 	// Prints the values of the Matrix4D. 
-	void print() {
+	void print() const {
 		std::cout << "Line1:\t";
 		lines[0].print_line();
 		std::cout << "\nLine2:\t";
@@ -437,4 +552,140 @@ public:
 		lines[3].print_line();
 		std::cout << "\n\n";
 	}
-};
\ No newline at end of file
+};
+
+}
+
+static_assert(sizeof(Vector4D) == 4 * sizeof(float), "Vector4D must be exactly four floats");
+static_assert(sizeof(Matrix4D) == 16 * sizeof(float), "Matrix4D must be exactly sixteen floats");
+static_assert(alignof(Matrix4D) == 16, "Matrix4D must be 16-byte aligned");
+static_assert(std::is_standard_layout_v<Matrix4D>, "Matrix4D must be standard-layout");
+static_assert(std::is_trivially_copyable_v<Matrix4D>, "Matrix4D must be trivially copyable");
+
+namespace math4D {
+
+	// -----< Export >-----------------------------------------------------------------------------
+
+	// The order the 16 values of a matrix are written in.
+	enum class MatrixLayout {
+		RowMajor,
+		ColumnMajor
+	};
+
+	// Copies the values of a list of matrices to a buffer, 16 floats per matrix.
+	// Writes as many matrices as fit in dst and returns how many were written.
+	// Nothing is allocated.
+	inline std::size_t export_matrices(std::span<const Matrix4D> src, std::span<float> dst,
+			MatrixLayout layout = MatrixLayout::RowMajor) noexcept {
+		std::size_t count = dst.size() / 16;
+		if (count > src.size()) count = src.size();
+		if (count == 0) return 0;
+
+		if (layout == MatrixLayout::RowMajor) {
+			// The matrices are back to back in memory, so this is one copy.
+			std::memcpy(dst.data(), src[0].data(), count * sizeof(Matrix4D));
+		}
+		else {
+			for (std::size_t i = 0; i < count; i++) {
+				kernels::mat4_transpose(src[i].data(), dst.data() + i * 16);
+			}
+		}
+		return count;
+	}
+
+	// -----< Batch rotations >--------------------------------------------------------------------
+
+	// The axis of a batch of rotations.
+	enum class Axis {
+		X,
+		Y,
+		Z
+	};
+
+	// out[i] = rotation around the axis by radians[i]. The sines and cosines
+	// are computed with the SIMD sincos kernels, a block of angles at a time;
+	// angles above 8192 radians, NaN and infinities take the scalar path,
+	// so they give the same matrix on every backend.
+	// out has to hold at least radians.size() matrices.
+	inline void rotations(Axis axis, std::span<const float> radians, std::span<Matrix4D> out) {
+		MATH4D_TIME(Rotations, radians.size());
+		assert(out.size() >= radians.size());
+		constexpr std::size_t block = 64;
+		float s[block], c[block];
+		for (std::size_t first = 0; first < radians.size(); first += block) {
+			std::size_t n = radians.size() - first < block ? radians.size() - first : block;
+			kernels::sincos_batch(radians.data() + first, s, c, n);
+			for (std::size_t i = 0; i < n; i++) {
+				SinCos sc{ s[i], c[i] };
+				switch (axis) {
+				case Axis::X: out[first + i] = Matrix4D::rotation_x(sc); break;
+				case Axis::Y: out[first + i] = Matrix4D::rotation_y(sc); break;
+				case Axis::Z: out[first + i] = Matrix4D::rotation_z(sc); break;
+				}
+			}
+		}
+	}
+
+	// out[i] = Matrix4D::rotation_xyz(x[i], y[i], z[i]), bit for bit on the
+	// scalar backend. The SIMD backends stay within the sincos accuracy
+	// (see trig4D.h) and may differ in the last bits. x, y and z have to
+	// be the same length and out has to hold at least that many matrices.
+	inline void rotations_xyz(std::span<const float> x, std::span<const float> y, std::span<const float> z,
+			std::span<Matrix4D> out) {
+		MATH4D_TIME(Rotations, x.size());
+		assert(y.size() == x.size() && z.size() == x.size() && out.size() >= x.size());
+		constexpr std::size_t block = 64;
+		float s[3][block], c[3][block];
+		for (std::size_t first = 0; first < x.size(); first += block) {
+			std::size_t n = x.size() - first < block ? x.size() - first : block;
+			kernels::sincos_batch(x.data() + first, s[0], c[0], n);
+			kernels::sincos_batch(y.data() + first, s[1], c[1], n);
+			kernels::sincos_batch(z.data() + first, s[2], c[2], n);
+			for (std::size_t i = 0; i < n; i++) {
+				out[first + i] = Matrix4D::rotation_xyz(
+					SinCos{ s[0][i], c[0][i] }, SinCos{ s[1][i], c[1][i] }, SinCos{ s[2][i], c[2][i] });
+			}
+		}
+	}
+}
+
+// -----< Compile-time checks >----------------------------------------------------------------
+
+namespace math4D {
+namespace checks {
+
+	constexpr bool near(float a, float b) {
+		return (a - b) < 1e-6f && (b - a) < 1e-6f;
+	}
+
+	constexpr Matrix4D translated(float x, float y, float z) {
+		Matrix4D m;
+		m.translate(x, y, z);
+		return m;
+	}
+
+	constexpr Matrix4D transposed(Matrix4D m) {
+		m.transpose();
+		return m;
+	}
+
+	constexpr Matrix4D multiplied_in_place(Matrix4D m) {
+		m *= translated(1, 2, 3);
+		m *= m;
+		return m;
+	}
+
+	static_assert(Matrix4D()[2][2] == 1, "Matrix4D constructor is not constexpr");
+	static_assert((Matrix4D() * translated(1, 2, 3))[1][3] == 2, "constexpr Matrix4D * Matrix4D");
+	static_assert(translated(1, 2, 3) * Vector4D(1, 1, 1) == Vector4D(2, 3, 4, 1), "constexpr Matrix4D * Vector4D");
+	static_assert(transposed(translated(1, 2, 3))[3] == Vector4D(1, 2, 3, 1), "constexpr transpose");
+	static_assert(multiplied_in_place(Matrix4D())[2][3] == 6, "constexpr Matrix4D *= Matrix4D");
+	static_assert(Matrix4D(2, 0, 0, 0, 0, 3, 0, 0, 0, 0, 4, 0, 0, 0, 0, 5).determinant() == 120, "constexpr determinant");
+	static_assert(near(Matrix4D::rotate_z(90)[0][1], -1) && near(Matrix4D::rotate_z(90)[1][0], 1), "constexpr rotate_z");
+	static_assert(near(Matrix4D::rotate_x(180)[1][1], -1) && near(Matrix4D::rotate_y(-90)[0][2], -1), "constexpr rotate_x / rotate_y");
+	static_assert(near(Matrix4D::rotate_x(30)[2][1], 0.5f), "constexpr sin");
+	static_assert(Matrix4D::rotation_xyz(SinCos{ 0, 1 }, SinCos{ 1, 0 }, SinCos{ 0, 1 })[0][2] == 1, "constexpr rotation_xyz");
+	static_assert(Matrix4D::orthographic(-2, 2, -1, 1, 1, 3) * Vector4D(2, 1, -3) == Vector4D(1, 1, 1, 1), "constexpr orthographic");
+	static_assert(Matrix4D::orthographic(-2, 2, -1, 1, 1, 3, ClipDepth::ZeroToOne) * Vector4D(-2, -1, -1) == Vector4D(-1, -1, 0, 1), "constexpr orthographic, z in 0..1");
+}
+}
\ No newline at end of file
@@ -0,0 +1,339 @@
+#pragma once
+#include <cstddef>
+#include <type_traits>
+
+#include "simd4D.h"
+#include "vector4D.h"
+#include "vectorN.h"
+
+// Fixed-size matrix template.
+//
+// Matrix<T, R, C> has R lines of C values, stored as R Vector<T, C> back
+// to back (row-major, the same layout as Matrix4D). Matrices multiply
+// column vectors from the left, m * v.
+//
+// Matrix4D is the float, 4, 4 specialization (matrix4D.h). Matrix<double, 4, 4>
+// uses the double AVX kernels from simd4D.h for its products and the
+// templated scalar kernels for the determinant and inverse. Other sizes
+// use plain loops over compile-time bounds, which the compiler unrolls.
+
+namespace math4D {
+
+	template<class T, std::size_t R, std::size_t C>
+	class Matrix {
+	private:
+		static_assert(R > 0 && C > 0, "a Matrix needs at least one line and one column");
+		static_assert(sizeof(Vector<T, C>) == C * sizeof(T), "the lines of a Matrix must not have padding");
+
+		// Matrix<double, 4, 4> has AVX kernels.
+		static constexpr bool has_kernels = R == 4 && C == 4 && std::is_same_v<T, double>;
+
+		Vector<T, C> lines[R];
+
+		// See Matrix4D::to_array, the kernels can not read across the lines in a constant expression.
+		constexpr void to_array(T* out) const noexcept {
+			for (std::size_t i = 0; i < R; i++) {
+				for (std::size_t j = 0; j < C; j++) {
+					out[i * C + j] = lines[i][j];
+				}
+			}
+		}
+
+		static constexpr Matrix from_array(const T* v) noexcept {
+			Matrix m;
+			for (std::size_t i = 0; i < R; i++) {
+				for (std::size_t j = 0; j < C; j++) {
+					m.lines[i][j] = v[i * C + j];
+				}
+			}
+			return m;
+		}
+
+		static constexpr T abs(T x) noexcept {
+			return x < T(0) ? -x : x;
+		}
+
+	public:
+
+		// -----< Constructors >-----------------------------------------------------------------------
+
+		// Ones on the diagonal and zeros everywhere else (the identity for square matrices).
+		constexpr Matrix() noexcept {
+			for (std::size_t i = 0; i < R; i++) {
+				for (std::size_t j = 0; j < C; j++) {
+					lines[i][j] = i == j ? T(1) : T(0);
+				}
+			}
+		}
+
+		// Takes all R * C values, line by line.
+		template<class... Args>
+			requires (sizeof...(Args) == R * C && (std::is_constructible_v<T, Args> && ...))
+		constexpr Matrix(Args... args) noexcept {
+			const T v[R * C] = { T(args)... };
+			for (std::size_t i = 0; i < R; i++) {
+				for (std::size_t j = 0; j < C; j++) {
+					lines[i][j] = v[i * C + j];
+				}
+			}
+		}
+
+		// Converts from a matrix with another value type, ex) Matrix4D to Matrix<double, 4, 4>.
+		template<class U>
+			requires (!std::is_same_v<U, T>)
+		explicit constexpr Matrix(const Matrix<U, R, C>& m) noexcept {
+			for (std::size_t i = 0; i < R; i++) {
+				lines[i] = Vector<T, C>(m[i]);
+			}
+		}
+
+		static constexpr Matrix identity() noexcept {
+			return Matrix();
+		}
+
+		// -----< Getters >----------------------------------------------------------------------------
+
+		static constexpr std::size_t rows() noexcept {
+			return R;
+		}
+
+		static constexpr std::size_t columns() noexcept {
+			return C;
+		}
+
+		constexpr Vector<T, C>& operator[] (std::size_t index) noexcept {
+			return lines[index];
+		}
+		constexpr const Vector<T, C>& operator[] (std::size_t index) const noexcept {
+			return lines[index];
+		}
+
+		// Returns a pointer to all R * C values in row-major order. As for
+		// Matrix4D, the lines are back to back by layout (no padding, see the
+		// check above), not by the standard, so this is not constexpr.
+		const T* data() const noexcept {
+			return lines[0].data();
+		}
+		T* data() noexcept {
+			return lines[0].data();
+		}
+
+		// -----< Operators >--------------------------------------------------------------------------
+
+		// Matrix product, (R x C) * (C x K) = (R x K).
+		template<std::size_t K>
+		constexpr Matrix<T, R, K> operator*(const Matrix<T, C, K>& b) const noexcept {
+			Matrix<T, R, K> r;
+			if constexpr (has_kernels && K == 4) {
+				if (!std::is_constant_evaluated()) {
+					kernels::mat4_mul(data(), b.data(), r.data());
+					return r;
+				}
+			}
+			for (std::size_t i = 0; i < R; i++) {
+				for (std::size_t j = 0; j < K; j++) {
+					T sum = lines[i][0] * b[0][j];
+					for (std::size_t k = 1; k < C; k++) sum += lines[i][k] * b[k][j];
+					r[i][j] = sum;
+				}
+			}
+			return r;
+		}
+
+		// Matrix times column vector.
+		constexpr Vector<T, R> operator*(const Vector<T, C>& v) const noexcept {
+			Vector<T, R> r;
+			if constexpr (has_kernels) {
+				if (!std::is_constant_evaluated()) {
+					kernels::mat4_mul_vec4(data(), v.data(), r.data());
+					return r;
+				}
+			}
+			for (std::size_t i = 0; i < R; i++) {
+				T sum = lines[i][0] * v[0];
+				for (std::size_t k = 1; k < C; k++) sum += lines[i][k] * v[k];
+				r[i] = sum;
+			}
+			return r;
+		}
+
+		constexpr Matrix operator+(const Matrix& m) const noexcept {
+			Matrix r;
+			for (std::size_t i = 0; i < R; i++) r.lines[i] = lines[i] + m.lines[i];
+			return r;
+		}
+
+		constexpr Matrix operator-(const Matrix& m) const noexcept {
+			Matrix r;
+			for (std::size_t i = 0; i < R; i++) r.lines[i] = lines[i] - m.lines[i];
+			return r;
+		}
+
+		constexpr Matrix& operator+=(const Matrix& m) noexcept {
+			for (std::size_t i = 0; i < R; i++) lines[i] += m.lines[i];
+			return *this;
+		}
+
+		constexpr Matrix& operator-=(const Matrix& m) noexcept {
+			for (std::size_t i = 0; i < R; i++) lines[i] -= m.lines[i];
+			return *this;
+		}
+
+		// *this = *this * m, for square matrices. The 4x4 kernels multiply in
+		// place (and allow m to be *this), the others go through one temporary.
+		constexpr Matrix& operator*=(const Matrix& m) noexcept requires (R == C) {
+			if constexpr (has_kernels) {
+				if (!std::is_constant_evaluated()) {
+					kernels::mat4_mul(data(), m.data(), data());
+					return *this;
+				}
+			}
+			*this = *this * m;
+			return *this;
+		}
+
+		constexpr Matrix scalar(T s) const noexcept {
+			Matrix r;
+			for (std::size_t i = 0; i < R; i++) r.lines[i] = lines[i].scalar(s);
+			return r;
+		}
+
+		constexpr bool operator==(const Matrix& m) const noexcept {
+			for (std::size_t i = 0; i < R; i++) {
+				if (lines[i] != m.lines[i]) return false;
+			}
+			return true;
+		}
+
+		constexpr bool operator!=(const Matrix& m) const noexcept {
+			return !(*this == m);
+		}
+
+		// -----< Transpose >--------------------------------------------------------------------------
+
+		// Returns the transpose as a new (C x R) matrix.
+		constexpr Matrix<T, C, R> transposed() const noexcept {
+			Matrix<T, C, R> r;
+			for (std::size_t i = 0; i < R; i++) {
+				for (std::size_t j = 0; j < C; j++) {
+					r[j][i] = lines[i][j];
+				}
+			}
+			return r;
+		}
+
+		// Transposes a square matrix in place.
+		constexpr void transpose() noexcept requires (R == C) {
+			*this = transposed();
+		}
+
+		// -----< Determinant / Inverse >--------------------------------------------------------------
+
+		// 2x2, 3x3 and 4x4 use closed forms (4x4 the shared 2x2 determinants
+		// from simd4D.h), larger sizes Gaussian elimination with partial pivoting.
+		constexpr T determinant() const noexcept requires (R == C) {
+			if constexpr (R == 1) {
+				return lines[0][0];
+			}
+			else if constexpr (R == 2) {
+				return lines[0][0] * lines[1][1] - lines[0][1] * lines[1][0];
+			}
+			else if constexpr (R == 3) {
+				T a = lines[0][0], b = lines[0][1], c = lines[0][2];
+				T d = lines[1][0], e = lines[1][1], f = lines[1][2];
+				T g = lines[2][0], h = lines[2][1], i = lines[2][2];
+				return a * ((e * i) - (f * h)) - b * ((d * i) - (g * f)) + c * ((d * h) - (e * g));
+			}
+			else if constexpr (R == 4) {
+				T m[16];
+				to_array(m);
+				return kernels::scalar::mat4_determinant(m);
+			}
+			else {
+				T m[R * C];
+				to_array(m);
+				T det = T(1);
+				for (std::size_t k = 0; k < R; k++) {
+					std::size_t pivot = k;
+					for (std::size_t i = k + 1; i < R; i++) {
+						if (abs(m[i * C + k]) > abs(m[pivot * C + k])) pivot = i;
+					}
+					if (m[pivot * C + k] == T(0)) return T(0);
+					if (pivot != k) {
+						for (std::size_t j = 0; j < C; j++) {
+							T t = m[k * C + j];
+							m[k * C + j] = m[pivot * C + j];
+							m[pivot * C + j] = t;
+						}
+						det = -det;
+					}
+					det *= m[k * C + k];
+					for (std::size_t i = k + 1; i < R; i++) {
+						T f = m[i * C + k] / m[k * C + k];
+						for (std::size_t j = k; j < C; j++) m[i * C + j] -= f * m[k * C + j];
+					}
+				}
+				return det;
+			}
+		}
+
+		// Returns true and sets result if the matrix can be inverted.
+		// Returns false and leaves result as it was otherwise.
+		// 4x4 uses the cofactor kernel from simd4D.h, other sizes Gauss-Jordan
+		// elimination with partial pivoting.
+		constexpr bool try_inverse(Matrix& result) const noexcept requires (R == C) {
+			T m[R * C];
+			to_array(m);
+			if constexpr (R == 4) {
+				T r[16];
+				if (!kernels::scalar::mat4_inverse(m, r)) return false;
+				result = from_array(r);
+				return true;
+			}
+			else {
+				T inv[R * C];
+				Matrix().to_array(inv);
+				for (std::size_t k = 0; k < R; k++) {
+					std::size_t pivot = k;
+					for (std::size_t i = k + 1; i < R; i++) {
+						if (abs(m[i * C + k]) > abs(m[pivot * C + k])) pivot = i;
+					}
+					T inv_pivot = T(1) / m[pivot * C + k];
+					// Catches a zero pivot (inf) and NaN, the same test as the 4x4 kernel.
+					if (!(inv_pivot - inv_pivot == T(0))) return false;
+					if (pivot != k) {
+						for (std::size_t j = 0; j < C; j++) {
+							T t = m[k * C + j];
+							m[k * C + j] = m[pivot * C + j];
+							m[pivot * C + j] = t;
+							t = inv[k * C + j];
+							inv[k * C + j] = inv[pivot * C + j];
+							inv[pivot * C + j] = t;
+						}
+					}
+					for (std::size_t j = 0; j < C; j++) {
+						m[k * C + j] *= inv_pivot;
+						inv[k * C + j] *= inv_pivot;
+					}
+					for (std::size_t i = 0; i < R; i++) {
+						if (i == k) continue;
+						T f = m[i * C + k];
+						for (std::size_t j = 0; j < C; j++) {
+							m[i * C + j] -= f * m[k * C + j];
+							inv[i * C + j] -= f * inv[k * C + j];
+						}
+					}
+				}
+				result = from_array(inv);
+				return true;
+			}
+		}
+	};
+
+	// Defined in matrix4D.h.
+	template<>
+	class Matrix<float, 4, 4>;
+}
+
+using Matrix4D = math4D::Matrix<float, 4, 4>;
+using Matrix4DDouble = math4D::Matrix<double, 4, 4>;
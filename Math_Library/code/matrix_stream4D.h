@@ -0,0 +1,695 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <span>
+#include <utility>
+
+#include "instrument4D.h"
+#include "matrix4D.h"
+#include "simd4D.h"
+
+// Batched operations on many independent Matrix4D.
+//
+// Matrix4DStream stores element (row, column) of every matrix in its own
+// plane, so one SIMD register holds the same element of 4 (SSE) or 8 (AVX2)
+// matrices and the kernels do the work of 4 or 8 operator*, determinant()
+// or inverse() calls per instruction, without any shuffles:
+//
+//	Matrix4DStream world(locals), inverse_world;
+//	math4D::multiply(parents, locals, world);
+//	std::vector<std::uint8_t> singular(world.size());
+//	std::size_t failed = math4D::inverse(world, inverse_world, singular);
+//
+// inverse() reports matrices that can not be inverted in a mask and in its
+// return value instead of printing an error like Matrix4D::inverse().
+
+// -----< Matrix4DStream >---------------------------------------------------------------------
+
+// A list of matrices stored as sixteen planes, one per element.
+// Plane row * 4 + column holds element (row, column) of every matrix.
+// Every plane is 64-byte aligned.
+class Matrix4DStream {
+private:
+	float* block = nullptr;
+	float* planes[16] = {};
+	std::size_t count = 0;
+	std::size_t capacity = 0;
+
+	// Planes are padded to a multiple of 16 floats (one cache line).
+	static std::size_t padded(std::size_t n) {
+		return (n + 15) & ~std::size_t(15);
+	}
+
+	void release() {
+		if (block != nullptr) {
+			::operator delete(block, std::align_val_t(64));
+		}
+		block = nullptr;
+		for (float*& p : planes) p = nullptr;
+		count = capacity = 0;
+	}
+
+public:
+
+	// -----< Constructors >-----------------------------------------------------------------------
+
+	// Creates a stream with n identity matrices.
+	explicit Matrix4DStream(std::size_t n = 0) {
+		resize(n);
+	}
+
+	// Creates a stream with the same matrices as a list of Matrix4D.
+	explicit Matrix4DStream(std::span<const Matrix4D> matrices) {
+		assign(matrices);
+	}
+
+	Matrix4DStream(const Matrix4DStream& s) {
+		*this = s;
+	}
+
+	Matrix4DStream(Matrix4DStream&& s) noexcept {
+		*this = std::move(s);
+	}
+
+	~Matrix4DStream() {
+		release();
+	}
+
+	Matrix4DStream& operator=(const Matrix4DStream& s) {
+		if (this != &s) {
+			resize(s.count);
+			for (int e = 0; e < 16; e++) {
+				std::copy(s.planes[e], s.planes[e] + count, planes[e]);
+			}
+		}
+		return *this;
+	}
+
+	Matrix4DStream& operator=(Matrix4DStream&& s) noexcept {
+		if (this != &s) {
+			release();
+			block = s.block;
+			for (int e = 0; e < 16; e++) {
+				planes[e] = s.planes[e];
+				s.planes[e] = nullptr;
+			}
+			count = s.count;
+			capacity = s.capacity;
+			s.block = nullptr;
+			s.count = s.capacity = 0;
+		}
+		return *this;
+	}
+
+	// -----< Getters >----------------------------------------------------------------------------
+
+	// Returns the number of matrices.
+	std::size_t size() const {
+		return count;
+	}
+
+	// Returns the plane for element (row, column).
+	float* plane(int row, int column) {
+		return planes[row * 4 + column];
+	}
+	const float* plane(int row, int column) const {
+		return planes[row * 4 + column];
+	}
+
+	// Returns all sixteen planes, in row-major order.
+	float* const* data() {
+		return planes;
+	}
+	const float* const* data() const {
+		return planes;
+	}
+
+	// Returns the matrix on an index as a Matrix4D.
+	Matrix4D get(std::size_t index) const {
+		const float* const* p = planes;
+		return Matrix4D(p[0][index], p[1][index], p[2][index], p[3][index],
+						p[4][index], p[5][index], p[6][index], p[7][index],
+						p[8][index], p[9][index], p[10][index], p[11][index],
+						p[12][index], p[13][index], p[14][index], p[15][index]);
+	}
+
+	// Copies all the matrices to a list of Matrix4D.
+	// out has to hold at least size() matrices.
+	void to_aos(std::span<Matrix4D> out) const;
+
+	// -----< Setters >----------------------------------------------------------------------------
+
+	// Set the matrix on an index.
+	void set(std::size_t index, const Matrix4D& m) {
+		const float* v = m.data();
+		for (int e = 0; e < 16; e++) {
+			planes[e][index] = v[e];
+		}
+	}
+
+	// Replaces all the matrices with the ones in a list of Matrix4D.
+	void assign(std::span<const Matrix4D> matrices);
+
+	// Changes the number of matrices. Existing matrices are kept,
+	// new matrices are set to the identity.
+	void resize(std::size_t n) {
+		if (n > capacity) {
+			std::size_t new_capacity = padded(n);
+			float* new_block = static_cast<float*>(::operator new(16 * new_capacity * sizeof(float), std::align_val_t(64)));
+			for (int e = 0; e < 16; e++) {
+				std::copy(planes[e], planes[e] + count, new_block + e * new_capacity);
+			}
+			std::size_t old_count = count;
+			release();
+			block = new_block;
+			for (int e = 0; e < 16; e++) {
+				planes[e] = block + e * new_capacity;
+			}
+			count = old_count;
+			capacity = new_capacity;
+		}
+		for (int e = 0; e < 16; e++) {
+			std::fill(planes[e] + std::min(count, n), planes[e] + n, e % 5 == 0 ? 1.0f : 0.0f);
+		}
+		count = n;
+	}
+
+	// Transposes every matrix in place. Only the planes are swapped,
+	// no values are moved.
+	void transpose() {
+		for (int i = 0; i < 4; i++) {
+			for (int j = i + 1; j < 4; j++) {
+				std::swap(planes[i * 4 + j], planes[j * 4 + i]);
+			}
+		}
+	}
+};
+
+namespace math4D {
+namespace kernels {
+
+	// Operands of the inverse: the 16 values of the matrix, then the six
+	// 2x2 determinants of the upper lines (s), then those of the lower lines (c),
+	// the same as in scalar::mat4_inverse.
+	namespace soa {
+
+		constexpr int s = 16;
+		constexpr int c = 22;
+
+		// s[k] = m[a] * m[b] - m[c] * m[d], c[k] the same 8 elements further on.
+		constexpr int subdeterminants[6][4] = {
+			{ 0, 5, 4, 1 }, { 0, 6, 4, 2 }, { 0, 7, 4, 3 },
+			{ 1, 6, 5, 2 }, { 1, 7, 5, 3 }, { 2, 7, 6, 3 }
+		};
+
+		// Element k of the inverse is (a * b - c * d + e * f) / det,
+		// negated where row + column is odd.
+		constexpr int cofactors[16][6] = {
+			{ 5, c + 5, 6, c + 4, 7, c + 3 },		{ 1, c + 5, 2, c + 4, 3, c + 3 },
+			{ 13, s + 5, 14, s + 4, 15, s + 3 },	{ 9, s + 5, 10, s + 4, 11, s + 3 },
+			{ 4, c + 5, 6, c + 2, 7, c + 1 },		{ 0, c + 5, 2, c + 2, 3, c + 1 },
+			{ 12, s + 5, 14, s + 2, 15, s + 1 },	{ 8, s + 5, 10, s + 2, 11, s + 1 },
+			{ 4, c + 4, 5, c + 2, 7, c + 0 },		{ 0, c + 4, 1, c + 2, 3, c + 0 },
+			{ 12, s + 4, 13, s + 2, 15, s + 0 },	{ 8, s + 4, 9, s + 2, 11, s + 0 },
+			{ 4, c + 3, 5, c + 1, 6, c + 0 },		{ 0, c + 3, 1, c + 1, 2, c + 0 },
+			{ 12, s + 3, 13, s + 1, 14, s + 0 },	{ 8, s + 3, 9, s + 1, 10, s + 0 }
+		};
+	}
+
+	// -----< Scalar >-----------------------------------------------------------------------------
+
+	namespace scalar {
+
+		// Gathers matrix i from the planes.
+		inline void mat4_gather(const float* const planes[16], std::size_t i, float* m) {
+			for (int e = 0; e < 16; e++) m[e] = planes[e][i];
+		}
+
+		inline void mat4_scatter(const float* m, float* const planes[16], std::size_t i) {
+			for (int e = 0; e < 16; e++) planes[e][i] = m[e];
+		}
+
+		// planes = n matrices stored back to back in row-major order.
+		inline void mat4_to_soa(const float* in, float* const out[16], std::size_t n) {
+			for (std::size_t i = 0; i < n; i++) {
+				mat4_scatter(in + i * 16, out, i);
+			}
+		}
+
+		inline void mat4_from_soa(const float* const in[16], float* out, std::size_t n) {
+			for (std::size_t i = 0; i < n; i++) {
+				mat4_gather(in, i, out + i * 16);
+			}
+		}
+
+		// out[i] = a[i] * b[i] for n matrices.
+		inline void mat4_mul_soa(const float* const a[16], const float* const b[16], float* const out[16], std::size_t n) {
+			for (std::size_t i = 0; i < n; i++) {
+				float ma[16], mb[16];
+				mat4_gather(a, i, ma);
+				mat4_gather(b, i, mb);
+				mat4_mul(ma, mb, ma);
+				mat4_scatter(ma, out, i);
+			}
+		}
+
+		// out[i] = determinant of in[i] for n matrices.
+		inline void mat4_determinant_soa(const float* const in[16], float* out, std::size_t n) {
+			for (std::size_t i = 0; i < n; i++) {
+				float m[16];
+				mat4_gather(in, i, m);
+				out[i] = mat4_determinant(m);
+			}
+		}
+
+		// out[i] = inverse of in[i] for n matrices. Matrices that can not be
+		// inverted are left as they were in out and get a 1 in singular
+		// (if not nullptr), the others a 0. Returns the number of singular matrices.
+		inline std::size_t mat4_inverse_soa(const float* const in[16], float* const out[16], std::uint8_t* singular, std::size_t n) {
+			std::size_t failed = 0;
+			for (std::size_t i = 0; i < n; i++) {
+				float m[16];
+				mat4_gather(in, i, m);
+				bool inverted = mat4_inverse(m, m);
+				if (inverted) mat4_scatter(m, out, i);
+				if (singular != nullptr) singular[i] = inverted ? 0 : 1;
+				failed += inverted ? 0 : 1;
+			}
+			return failed;
+		}
+	}
+
+#if defined(MATH4D_SIMD)
+
+	// -----< SSE >--------------------------------------------------------------------------------
+
+	// Four matrices per iteration, the rest with the scalar kernels.
+	namespace sse {
+
+		// a * b - c * d in every lane.
+		inline __m128 mul_sub(__m128 a, __m128 b, __m128 c, __m128 d) {
+			return _mm_sub_ps(_mm_mul_ps(a, b), _mm_mul_ps(c, d));
+		}
+
+		// Four matrices at a time: row r of the four is transposed
+		// to elements (r, 0..3) of four matrices.
+		inline void mat4_to_soa(const float* in, float* const out[16], std::size_t n) {
+			std::size_t i = 0;
+			for (; i + 4 <= n; i += 4) {
+				const float* m = in + i * 16;
+				for (int r = 0; r < 4; r++) {
+					__m128 r0 = _mm_loadu_ps(m + 0 + r * 4);
+					__m128 r1 = _mm_loadu_ps(m + 16 + r * 4);
+					__m128 r2 = _mm_loadu_ps(m + 32 + r * 4);
+					__m128 r3 = _mm_loadu_ps(m + 48 + r * 4);
+					_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+					_mm_storeu_ps(out[r * 4 + 0] + i, r0);
+					_mm_storeu_ps(out[r * 4 + 1] + i, r1);
+					_mm_storeu_ps(out[r * 4 + 2] + i, r2);
+					_mm_storeu_ps(out[r * 4 + 3] + i, r3);
+				}
+			}
+			float* const rest[16] = {
+				out[0] + i, out[1] + i, out[2] + i, out[3] + i, out[4] + i, out[5] + i, out[6] + i, out[7] + i,
+				out[8] + i, out[9] + i, out[10] + i, out[11] + i, out[12] + i, out[13] + i, out[14] + i, out[15] + i };
+			scalar::mat4_to_soa(in + i * 16, rest, n - i);
+		}
+
+		inline void mat4_from_soa(const float* const in[16], float* out, std::size_t n) {
+			std::size_t i = 0;
+			for (; i + 4 <= n; i += 4) {
+				float* m = out + i * 16;
+				for (int r = 0; r < 4; r++) {
+					__m128 e0 = _mm_loadu_ps(in[r * 4 + 0] + i);
+					__m128 e1 = _mm_loadu_ps(in[r * 4 + 1] + i);
+					__m128 e2 = _mm_loadu_ps(in[r * 4 + 2] + i);
+					__m128 e3 = _mm_loadu_ps(in[r * 4 + 3] + i);
+					_MM_TRANSPOSE4_PS(e0, e1, e2, e3);
+					_mm_storeu_ps(m + 0 + r * 4, e0);
+					_mm_storeu_ps(m + 16 + r * 4, e1);
+					_mm_storeu_ps(m + 32 + r * 4, e2);
+					_mm_storeu_ps(m + 48 + r * 4, e3);
+				}
+			}
+			const float* const rest[16] = {
+				in[0] + i, in[1] + i, in[2] + i, in[3] + i, in[4] + i, in[5] + i, in[6] + i, in[7] + i,
+				in[8] + i, in[9] + i, in[10] + i, in[11] + i, in[12] + i, in[13] + i, in[14] + i, in[15] + i };
+			scalar::mat4_from_soa(rest, out + i * 16, n - i);
+		}
+
+		// Element (row, col) of four products, a0..a3 are row "row" of a.
+		inline __m128 mul_element(__m128 a0, __m128 a1, __m128 a2, __m128 a3,
+				const float* const b[16], int col, std::size_t i) {
+			return _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(a0, _mm_loadu_ps(b[0 * 4 + col] + i)), _mm_mul_ps(a1, _mm_loadu_ps(b[1 * 4 + col] + i))),
+				_mm_add_ps(_mm_mul_ps(a2, _mm_loadu_ps(b[2 * 4 + col] + i)), _mm_mul_ps(a3, _mm_loadu_ps(b[3 * 4 + col] + i))));
+		}
+
+		// All 16 results are kept until the end, so out may be the same planes as a or b.
+		inline void mat4_mul_soa(const float* const a[16], const float* const b[16], float* const out[16], std::size_t n) {
+			std::size_t i = 0;
+			for (; i + 4 <= n; i += 4) {
+				__m128 r[16];
+				for (int row = 0; row < 4; row++) {
+					__m128 a0 = _mm_loadu_ps(a[row * 4 + 0] + i);
+					__m128 a1 = _mm_loadu_ps(a[row * 4 + 1] + i);
+					__m128 a2 = _mm_loadu_ps(a[row * 4 + 2] + i);
+					__m128 a3 = _mm_loadu_ps(a[row * 4 + 3] + i);
+					r[row * 4 + 0] = mul_element(a0, a1, a2, a3, b, 0, i);
+					r[row * 4 + 1] = mul_element(a0, a1, a2, a3, b, 1, i);
+					r[row * 4 + 2] = mul_element(a0, a1, a2, a3, b, 2, i);
+					r[row * 4 + 3] = mul_element(a0, a1, a2, a3, b, 3, i);
+				}
+				for (int e = 0; e < 16; e++) _mm_storeu_ps(out[e] + i, r[e]);
+			}
+			for (; i < n; i++) {
+				const float* const a_rest[16] = {
+					a[0] + i, a[1] + i, a[2] + i, a[3] + i, a[4] + i, a[5] + i, a[6] + i, a[7] + i,
+					a[8] + i, a[9] + i, a[10] + i, a[11] + i, a[12] + i, a[13] + i, a[14] + i, a[15] + i };
+				const float* const b_rest[16] = {
+					b[0] + i, b[1] + i, b[2] + i, b[3] + i, b[4] + i, b[5] + i, b[6] + i, b[7] + i,
+					b[8] + i, b[9] + i, b[10] + i, b[11] + i, b[12] + i, b[13] + i, b[14] + i, b[15] + i };
+				float* const out_rest[16] = {
+					out[0] + i, out[1] + i, out[2] + i, out[3] + i, out[4] + i, out[5] + i, out[6] + i, out[7] + i,
+					out[8] + i, out[9] + i, out[10] + i, out[11] + i, out[12] + i, out[13] + i, out[14] + i, out[15] + i };
+				scalar::mat4_mul_soa(a_rest, b_rest, out_rest, 1);
+			}
+		}
+
+		// Loads the 16 values of four matrices and their 2x2 determinants
+		// to v, in the order of soa::cofactors.
+		inline void load_subdeterminants(const float* const in[16], std::size_t i, __m128 v[28]) {
+			for (int e = 0; e < 16; e++) v[e] = _mm_loadu_ps(in[e] + i);
+			for (int k = 0; k < 6; k++) {
+				const int* t = soa::subdeterminants[k];
+				v[soa::s + k] = mul_sub(v[t[0]], v[t[1]], v[t[2]], v[t[3]]);
+				v[soa::c + k] = mul_sub(v[t[0] + 8], v[t[1] + 8], v[t[2] + 8], v[t[3] + 8]);
+			}
+		}
+
+		inline __m128 determinant(const __m128 v[28]) {
+			const __m128* s = v + soa::s;
+			const __m128* c = v + soa::c;
+			__m128 d = _mm_sub_ps(mul_sub(s[0], c[5], s[1], c[4]), mul_sub(s[4], c[1], s[5], c[0]));
+			return _mm_add_ps(d, _mm_add_ps(_mm_mul_ps(s[2], c[3]), _mm_mul_ps(s[3], c[2])));
+		}
+
+		inline void mat4_determinant_soa(const float* const in[16], float* out, std::size_t n) {
+			std::size_t i = 0;
+			for (; i + 4 <= n; i += 4) {
+				__m128 v[28];
+				load_subdeterminants(in, i, v);
+				_mm_storeu_ps(out + i, determinant(v));
+			}
+			for (; i < n; i++) {
+				float m[16];
+				scalar::mat4_gather(in, i, m);
+				out[i] = scalar::mat4_determinant(m);
+			}
+		}
+
+		// Singular lanes keep the values that were in out, so in and out may be the same planes.
+		MATH4D_TARGET_SSE41 inline std::size_t mat4_inverse_soa(const float* const in[16], float* const out[16], std::uint8_t* singular, std::size_t n) {
+			std::size_t failed = 0;
+			std::size_t i = 0;
+			for (; i + 4 <= n; i += 4) {
+				__m128 v[28];
+				load_subdeterminants(in, i, v);
+				__m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0f), determinant(v));
+				// Catches det = 0 (inf), NaN and a det so small that 1 / det overflows.
+				__m128 ok = _mm_cmpeq_ps(_mm_sub_ps(inv_det, inv_det), _mm_setzero_ps());
+				__m128 neg_inv_det = _mm_sub_ps(_mm_setzero_ps(), inv_det);
+				for (int e = 0; e < 16; e++) {
+					const int* t = soa::cofactors[e];
+					__m128 r = _mm_add_ps(mul_sub(v[t[0]], v[t[1]], v[t[2]], v[t[3]]), _mm_mul_ps(v[t[4]], v[t[5]]));
+					r = _mm_mul_ps(r, ((e >> 2) + e) & 1 ? neg_inv_det : inv_det);
+					_mm_storeu_ps(out[e] + i, _mm_blendv_ps(_mm_loadu_ps(out[e] + i), r, ok));
+				}
+				int bits = _mm_movemask_ps(ok);
+				for (int k = 0; k < 4; k++) {
+					std::uint8_t s = (bits >> k) & 1 ? 0 : 1;
+					if (singular != nullptr) singular[i + k] = s;
+					failed += s;
+				}
+			}
+			const float* const in_rest[16] = {
+				in[0] + i, in[1] + i, in[2] + i, in[3] + i, in[4] + i, in[5] + i, in[6] + i, in[7] + i,
+				in[8] + i, in[9] + i, in[10] + i, in[11] + i, in[12] + i, in[13] + i, in[14] + i, in[15] + i };
+			float* const out_rest[16] = {
+				out[0] + i, out[1] + i, out[2] + i, out[3] + i, out[4] + i, out[5] + i, out[6] + i, out[7] + i,
+				out[8] + i, out[9] + i, out[10] + i, out[11] + i, out[12] + i, out[13] + i, out[14] + i, out[15] + i };
+			return failed + scalar::mat4_inverse_soa(in_rest, out_rest, singular != nullptr ? singular + i : nullptr, n - i);
+		}
+	}
+
+	// -----< AVX2 / FMA >-------------------------------------------------------------------------
+
+	// Eight matrices per iteration, the rest with the SSE kernels.
+	namespace avx2 {
+
+		MATH4D_TARGET_AVX2 inline __m256 mul_sub(__m256 a, __m256 b, __m256 c, __m256 d) {
+			return _mm256_fmsub_ps(a, b, _mm256_mul_ps(c, d));
+		}
+
+		// Element (row, col) of eight products, a0..a3 are row "row" of a.
+		MATH4D_TARGET_AVX2 inline __m256 mul_element(__m256 a0, __m256 a1, __m256 a2, __m256 a3,
+				const float* const b[16], int col, std::size_t i) {
+			__m256 e = _mm256_mul_ps(a0, _mm256_loadu_ps(b[0 * 4 + col] + i));
+			e = _mm256_fmadd_ps(a1, _mm256_loadu_ps(b[1 * 4 + col] + i), e);
+			e = _mm256_fmadd_ps(a2, _mm256_loadu_ps(b[2 * 4 + col] + i), e);
+			return _mm256_fmadd_ps(a3, _mm256_loadu_ps(b[3 * 4 + col] + i), e);
+		}
+
+		MATH4D_TARGET_AVX2 inline void mat4_mul_soa(const float* const a[16], const float* const b[16], float* const out[16], std::size_t n) {
+			std::size_t i = 0;
+			for (; i + 8 <= n; i += 8) {
+				__m256 r[16];
+				for (int row = 0; row < 4; row++) {
+					__m256 a0 = _mm256_loadu_ps(a[row * 4 + 0] + i);
+					__m256 a1 = _mm256_loadu_ps(a[row * 4 + 1] + i);
+					__m256 a2 = _mm256_loadu_ps(a[row * 4 + 2] + i);
+					__m256 a3 = _mm256_loadu_ps(a[row * 4 + 3] + i);
+					r[row * 4 + 0] = mul_element(a0, a1, a2, a3, b, 0, i);
+					r[row * 4 + 1] = mul_element(a0, a1, a2, a3, b, 1, i);
+					r[row * 4 + 2] = mul_element(a0, a1, a2, a3, b, 2, i);
+					r[row * 4 + 3] = mul_element(a0, a1, a2, a3, b, 3, i);
+				}
+				for (int e = 0; e < 16; e++) _mm256_storeu_ps(out[e] + i, r[e]);
+			}
+			const float* const a_rest[16] = {
+				a[0] + i, a[1] + i, a[2] + i, a[3] + i, a[4] + i, a[5] + i, a[6] + i, a[7] + i,
+				a[8] + i, a[9] + i, a[10] + i, a[11] + i, a[12] + i, a[13] + i, a[14] + i, a[15] + i };
+			const float* const b_rest[16] = {
+				b[0] + i, b[1] + i, b[2] + i, b[3] + i, b[4] + i, b[5] + i, b[6] + i, b[7] + i,
+				b[8] + i, b[9] + i, b[10] + i, b[11] + i, b[12] + i, b[13] + i, b[14] + i, b[15] + i };
+			float* const out_rest[16] = {
+				out[0] + i, out[1] + i, out[2] + i, out[3] + i, out[4] + i, out[5] + i, out[6] + i, out[7] + i,
+				out[8] + i, out[9] + i, out[10] + i, out[11] + i, out[12] + i, out[13] + i, out[14] + i, out[15] + i };
+			sse::mat4_mul_soa(a_rest, b_rest, out_rest, n - i);
+		}
+
+		MATH4D_TARGET_AVX2 inline void load_subdeterminants(const float* const in[16], std::size_t i, __m256 v[28]) {
+			for (int e = 0; e < 16; e++) v[e] = _mm256_loadu_ps(in[e] + i);
+			for (int k = 0; k < 6; k++) {
+				const int* t = soa::subdeterminants[k];
+				v[soa::s + k] = mul_sub(v[t[0]], v[t[1]], v[t[2]], v[t[3]]);
+				v[soa::c + k] = mul_sub(v[t[0] + 8], v[t[1] + 8], v[t[2] + 8], v[t[3] + 8]);
+			}
+		}
+
+		MATH4D_TARGET_AVX2 inline __m256 determinant(const __m256 v[28]) {
+			const __m256* s = v + soa::s;
+			const __m256* c = v + soa::c;
+			__m256 d = _mm256_sub_ps(mul_sub(s[0], c[5], s[1], c[4]), mul_sub(s[4], c[1], s[5], c[0]));
+			return _mm256_add_ps(d, _mm256_fmadd_ps(s[2], c[3], _mm256_mul_ps(s[3], c[2])));
+		}
+
+		MATH4D_TARGET_AVX2 inline void mat4_determinant_soa(const float* const in[16], float* out, std::size_t n) {
+			std::size_t i = 0;
+			for (; i + 8 <= n; i += 8) {
+				__m256 v[28];
+				load_subdeterminants(in, i, v);
+				_mm256_storeu_ps(out + i, determinant(v));
+			}
+			const float* const rest[16] = {
+				in[0] + i, in[1] + i, in[2] + i, in[3] + i, in[4] + i, in[5] + i, in[6] + i, in[7] + i,
+				in[8] + i, in[9] + i, in[10] + i, in[11] + i, in[12] + i, in[13] + i, in[14] + i, in[15] + i };
+			sse::mat4_determinant_soa(rest, out + i, n - i);
+		}
+
+		MATH4D_TARGET_AVX2 inline std::size_t mat4_inverse_soa(const float* const in[16], float* const out[16], std::uint8_t* singular, std::size_t n) {
+			std::size_t failed = 0;
+			std::size_t i = 0;
+			for (; i + 8 <= n; i += 8) {
+				__m256 v[28];
+				load_subdeterminants(in, i, v);
+				__m256 inv_det = _mm256_div_ps(_mm256_set1_ps(1.0f), determinant(v));
+				__m256 ok = _mm256_cmp_ps(_mm256_sub_ps(inv_det, inv_det), _mm256_setzero_ps(), _CMP_EQ_OQ);
+				__m256 neg_inv_det = _mm256_sub_ps(_mm256_setzero_ps(), inv_det);
+				for (int e = 0; e < 16; e++) {
+					const int* t = soa::cofactors[e];
+					__m256 r = _mm256_fmadd_ps(v[t[4]], v[t[5]], mul_sub(v[t[0]], v[t[1]], v[t[2]], v[t[3]]));
+					r = _mm256_mul_ps(r, ((e >> 2) + e) & 1 ? neg_inv_det : inv_det);
+					_mm256_storeu_ps(out[e] + i, _mm256_blendv_ps(_mm256_loadu_ps(out[e] + i), r, ok));
+				}
+				int bits = _mm256_movemask_ps(ok);
+				for (int k = 0; k < 8; k++) {
+					std::uint8_t s = (bits >> k) & 1 ? 0 : 1;
+					if (singular != nullptr) singular[i + k] = s;
+					failed += s;
+				}
+			}
+			const float* const in_rest[16] = {
+				in[0] + i, in[1] + i, in[2] + i, in[3] + i, in[4] + i, in[5] + i, in[6] + i, in[7] + i,
+				in[8] + i, in[9] + i, in[10] + i, in[11] + i, in[12] + i, in[13] + i, in[14] + i, in[15] + i };
+			float* const out_rest[16] = {
+				out[0] + i, out[1] + i, out[2] + i, out[3] + i, out[4] + i, out[5] + i, out[6] + i, out[7] + i,
+				out[8] + i, out[9] + i, out[10] + i, out[11] + i, out[12] + i, out[13] + i, out[14] + i, out[15] + i };
+			return failed + sse::mat4_inverse_soa(in_rest, out_rest, singular != nullptr ? singular + i : nullptr, n - i);
+		}
+	}
+
+#endif
+
+	// -----< Dispatch >---------------------------------------------------------------------------
+
+	// The AoS / SoA conversions are bound by memory, AVX2 uses the SSE kernels.
+	inline void mat4_to_soa(const float* in, float* const out[16], std::size_t n) {
+#if defined(MATH4D_SIMD)
+		if (simd::active_backend() != simd::Backend::Scalar) {
+			sse::mat4_to_soa(in, out, n);
+			return;
+		}
+#endif
+		scalar::mat4_to_soa(in, out, n);
+	}
+
+	inline void mat4_from_soa(const float* const in[16], float* out, std::size_t n) {
+#if defined(MATH4D_SIMD)
+		if (simd::active_backend() != simd::Backend::Scalar) {
+			sse::mat4_from_soa(in, out, n);
+			return;
+		}
+#endif
+		scalar::mat4_from_soa(in, out, n);
+	}
+
+	// out[i] = a[i] * b[i], out may be the same planes as a or b.
+	inline void mat4_mul_soa(const float* const a[16], const float* const b[16], float* const out[16], std::size_t n) {
+#if defined(MATH4D_SIMD)
+		switch (simd::active_backend()) {
+		case simd::Backend::AVX2:	avx2::mat4_mul_soa(a, b, out, n); return;
+		case simd::Backend::SSE41:	sse::mat4_mul_soa(a, b, out, n); return;
+		default: break;
+		}
+#endif
+		scalar::mat4_mul_soa(a, b, out, n);
+	}
+
+	// out[i] = determinant of in[i].
+	inline void mat4_determinant_soa(const float* const in[16], float* out, std::size_t n) {
+#if defined(MATH4D_SIMD)
+		switch (simd::active_backend()) {
+		case simd::Backend::AVX2:	avx2::mat4_determinant_soa(in, out, n); return;
+		case simd::Backend::SSE41:	sse::mat4_determinant_soa(in, out, n); return;
+		default: break;
+		}
+#endif
+		scalar::mat4_determinant_soa(in, out, n);
+	}
+
+	// out[i] = inverse of in[i], in and out may be the same planes.
+	// Returns the number of matrices that could not be inverted.
+	inline std::size_t mat4_inverse_soa(const float* const in[16], float* const out[16], std::uint8_t* singular, std::size_t n) {
+#if defined(MATH4D_SIMD)
+		switch (simd::active_backend()) {
+		case simd::Backend::AVX2:	return avx2::mat4_inverse_soa(in, out, singular, n);
+		case simd::Backend::SSE41:	return sse::mat4_inverse_soa(in, out, singular, n);
+		default: break;
+		}
+#endif
+		return scalar::mat4_inverse_soa(in, out, singular, n);
+	}
+}
+
+	// -----< Multiply >---------------------------------------------------------------------------
+
+	// out[i] = a[i] * b[i] for every matrix. a and b have to be the same size,
+	// out is resized to it. out may be the same stream as a or b.
+	inline void multiply(const Matrix4DStream& a, const Matrix4DStream& b, Matrix4DStream& out) {
+		MATH4D_TIME(MatrixStream, a.size());
+		assert(a.size() == b.size());
+		if (&out != &a && &out != &b) out.resize(a.size());
+		kernels::mat4_mul_soa(a.data(), b.data(), out.data(), a.size());
+		MATH4D_COUNT_N(MatrixMultiply, a.size());
+	}
+
+	// -----< Transpose >--------------------------------------------------------------------------
+
+	// out[i] = in[i] transposed. out is resized to in.size().
+	// The planes are copied to their transposed places, in place use
+	// Matrix4DStream::transpose() which only swaps them.
+	inline void transpose(const Matrix4DStream& in, Matrix4DStream& out) {
+		MATH4D_TIME(MatrixStream, in.size());
+		if (&in == &out) {
+			out.transpose();
+			return;
+		}
+		out.resize(in.size());
+		for (int i = 0; i < 4; i++) {
+			for (int j = 0; j < 4; j++) {
+				std::copy(in.plane(i, j), in.plane(i, j) + in.size(), out.plane(j, i));
+			}
+		}
+	}
+
+	// -----< Determinant >------------------------------------------------------------------------
+
+	// out[i] = in[i].determinant(). out has to hold at least in.size() values.
+	inline void determinant(const Matrix4DStream& in, std::span<float> out) {
+		MATH4D_TIME(MatrixStream, in.size());
+		assert(out.size() >= in.size());
+		kernels::mat4_determinant_soa(in.data(), out.data(), in.size());
+	}
+
+	// -----< Inverse >----------------------------------------------------------------------------
+
+	// out[i] = inverse of in[i]. out is resized to in.size(), in and out may be
+	// the same stream. Matrices that can not be inverted (determinant 0) are
+	// left as they were in out and get a 1 in singular, the others a 0.
+	// singular has to hold at least in.size() values, or be empty if the
+	// mask is not needed. Nothing is printed.
+	// Returns the number of matrices that could not be inverted.
+	inline std::size_t inverse(const Matrix4DStream& in, Matrix4DStream& out, std::span<std::uint8_t> singular = {}) {
+		MATH4D_TIME(MatrixStream, in.size());
+		assert(singular.empty() || singular.size() >= in.size());
+		if (&in != &out) out.resize(in.size());
+		std::size_t failed = kernels::mat4_inverse_soa(in.data(), out.data(),
+			singular.empty() ? nullptr : singular.data(), in.size());
+		MATH4D_COUNT_N(MatrixInverse, in.size());
+		MATH4D_COUNT_N(SingularMatrix, failed);
+		return failed;
+	}
+
+	// Inverts every matrix in the stream, in place. See inverse() above.
+	inline std::size_t inverse(Matrix4DStream& matrices, std::span<std::uint8_t> singular = {}) {
+		return inverse(matrices, matrices, singular);
+	}
+}
+
+// -----< Conversions >------------------------------------------------------------------------
+
+inline void Matrix4DStream::to_aos(std::span<Matrix4D> out) const {
+	assert(out.size() >= count);
+	if (count == 0) return;
+	math4D::kernels::mat4_from_soa(planes, out[0].data(), count);
+}
+
+inline void Matrix4DStream::assign(std::span<const Matrix4D> matrices) {
+	resize(matrices.size());
+	if (count == 0) return;
+	math4D::kernels::mat4_to_soa(matrices[0].data(), planes, count);
+}
@@ -0,0 +1,285 @@
+#pragma once
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "batch4D.h"
+#include "instrument4D.h"
+#include "matrix4D.h"
+#include "simd4D.h"
+#include "thread_pool.h"
+#include "vector4D.h"
+
+// Multithreaded transforms of large point lists.
+//
+// The list is split into chunks that are run with the batch kernels from
+// batch4D.h on a work-stealing ThreadPool. Chunk borders are placed on
+// 64-byte cache line borders of the output, so two threads never write
+// to the same cache line.
+//
+// The reductions (parallel_sum, parallel_dot) add the list in fixed blocks
+// of reduction_block points and combine the block sums in a fixed tree, so
+// on one backend the result has the same bits for every pool size and
+// chunk setting.
+
+namespace math4D {
+
+	// Settings for the parallel functions.
+	struct ParallelOptions {
+		// Pool to run on. nullptr uses ThreadPool::default_pool().
+		ThreadPool* pool = nullptr;
+		// Number of points per task. Rounded up to whole cache lines (4 points).
+		std::size_t chunk = 16384;
+	};
+
+	// Number of Vector4D in one cache line.
+	constexpr std::size_t points_per_cache_line = 64 / sizeof(Vector4D);
+
+	// -----< Transform >--------------------------------------------------------------------------
+
+	// Transforms every point in "in" by m and writes the results to "out", using
+	// all the threads of the pool. out has to hold at least in.size() points.
+	// in and out may be the same list.
+	inline void parallel_transform(const Matrix4D& m, std::span<const Vector4D> in, std::span<Vector4D> out,
+			const ParallelOptions& options = ParallelOptions()) {
+		MATH4D_TIME(ParallelTransform, in.size());
+		assert(out.size() >= in.size());
+		std::size_t n = in.size();
+		if (n == 0) return;
+
+		ThreadPool& pool = options.pool != nullptr ? *options.pool : ThreadPool::default_pool();
+		std::size_t chunk = options.chunk < points_per_cache_line ? points_per_cache_line : options.chunk;
+		chunk = (chunk + points_per_cache_line - 1) / points_per_cache_line * points_per_cache_line;
+
+		const float* mv = m.data();
+		const float* src = in[0].data();
+		float* dst = out[0].data();
+
+		// The points before the first cache line border of the output are done
+		// here, so every chunk after that starts on a border.
+		std::size_t lead = ((64 - ((std::uintptr_t)dst & 63)) & 63) / sizeof(Vector4D);
+		if (lead > n) lead = n;
+		if (lead > 0) {
+			kernels::transform_aos(mv, src, dst, lead);
+		}
+
+		pool.parallel_for(lead, n, chunk, [&](std::size_t begin, std::size_t end) {
+			kernels::transform_aos(mv, src + begin * 4, dst + begin * 4, end - begin);
+		});
+	}
+
+	// Transforms every point in the list by m, in place, using all the threads of the pool.
+	inline void parallel_transform(const Matrix4D& m, std::span<Vector4D> points,
+			const ParallelOptions& options = ParallelOptions()) {
+		parallel_transform(m, std::span<const Vector4D>(points), points, options);
+	}
+
+	// -----< Reductions >-------------------------------------------------------------------------
+
+	// Number of points summed by one task of a reduction. Fixed, so the
+	// order of the additions does not depend on the pool or the chunk size.
+	constexpr std::size_t reduction_block = 4096;
+
+namespace kernels {
+
+	// Every reduction kernel keeps four running sums, point i goes to sum
+	// i % 4, and returns (sum0 + sum1) + (sum2 + sum3). The SIMD kernels
+	// do the same additions in the same order as the scalar ones. The
+	// compiler may fuse the multiply and add of the AVX2 dot_aos into an
+	// FMA, so its result can differ from the scalar one in the last bits.
+	namespace scalar {
+
+		// Adds in[i] (dot == false) or a[i] * b[i] (dot == true) for i in [begin, n)
+		// to the running sums.
+		template<bool dot>
+		inline void reduce_tail(const float* a, const float* b, std::size_t begin, std::size_t n, float acc[4][4]) {
+			for (std::size_t i = begin; i < n; i++) {
+				for (int k = 0; k < 4; k++) {
+					float v = dot ? a[i * 4 + k] * b[i * 4 + k] : a[i * 4 + k];
+					acc[i & 3][k] += v;
+				}
+			}
+		}
+
+		inline void reduce_finish(const float acc[4][4], float* out) {
+			for (int k = 0; k < 4; k++) {
+				out[k] = (acc[0][k] + acc[1][k]) + (acc[2][k] + acc[3][k]);
+			}
+		}
+
+		// out = sum of the n points in "in".
+		inline void sum_aos(const float* in, std::size_t n, float* out) {
+			float acc[4][4] = {};
+			reduce_tail<false>(in, nullptr, 0, n, acc);
+			reduce_finish(acc, out);
+		}
+
+		// out = sum of a[i] * b[i] (per component) over n points.
+		inline void dot_aos(const float* a, const float* b, std::size_t n, float* out) {
+			float acc[4][4] = {};
+			reduce_tail<true>(a, b, 0, n, acc);
+			reduce_finish(acc, out);
+		}
+	}
+
+#if defined(MATH4D_SIMD)
+
+	namespace sse {
+
+		template<bool dot>
+		inline __m128 load(const float* a, const float* b, std::size_t i) {
+			__m128 v = _mm_loadu_ps(a + i * 4);
+			if constexpr (dot) v = _mm_mul_ps(v, _mm_loadu_ps(b + i * 4));
+			return v;
+		}
+
+		template<bool dot>
+		inline void reduce_aos(const float* a, const float* b, std::size_t n, float* out) {
+			__m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+			__m128 acc2 = _mm_setzero_ps(), acc3 = _mm_setzero_ps();
+			std::size_t i = 0;
+			for (; i + 4 <= n; i += 4) {
+				acc0 = _mm_add_ps(acc0, load<dot>(a, b, i));
+				acc1 = _mm_add_ps(acc1, load<dot>(a, b, i + 1));
+				acc2 = _mm_add_ps(acc2, load<dot>(a, b, i + 2));
+				acc3 = _mm_add_ps(acc3, load<dot>(a, b, i + 3));
+			}
+			float sums[4][4];
+			_mm_storeu_ps(sums[0], acc0);
+			_mm_storeu_ps(sums[1], acc1);
+			_mm_storeu_ps(sums[2], acc2);
+			_mm_storeu_ps(sums[3], acc3);
+			scalar::reduce_tail<dot>(a, b, i, n, sums);
+			scalar::reduce_finish(sums, out);
+		}
+
+		inline void sum_aos(const float* in, std::size_t n, float* out) {
+			reduce_aos<false>(in, nullptr, n, out);
+		}
+
+		inline void dot_aos(const float* a, const float* b, std::size_t n, float* out) {
+			reduce_aos<true>(a, b, n, out);
+		}
+	}
+
+	namespace avx2 {
+
+		// acc01 holds the sums of points 0 and 1 (mod 4) in its low and high
+		// half, acc23 the sums of points 2 and 3.
+		template<bool dot>
+		MATH4D_TARGET_AVX2 inline void reduce_aos(const float* a, const float* b, std::size_t n, float* out) {
+			__m256 acc01 = _mm256_setzero_ps();
+			__m256 acc23 = _mm256_setzero_ps();
+			std::size_t i = 0;
+			for (; i + 4 <= n; i += 4) {
+				__m256 v01 = _mm256_loadu_ps(a + i * 4);
+				__m256 v23 = _mm256_loadu_ps(a + i * 4 + 8);
+				if constexpr (dot) {
+					v01 = _mm256_mul_ps(v01, _mm256_loadu_ps(b + i * 4));
+					v23 = _mm256_mul_ps(v23, _mm256_loadu_ps(b + i * 4 + 8));
+				}
+				acc01 = _mm256_add_ps(acc01, v01);
+				acc23 = _mm256_add_ps(acc23, v23);
+			}
+			float sums[4][4];
+			_mm256_storeu_ps(sums[0], acc01);
+			_mm256_storeu_ps(sums[2], acc23);
+			scalar::reduce_tail<dot>(a, b, i, n, sums);
+			scalar::reduce_finish(sums, out);
+		}
+
+		MATH4D_TARGET_AVX2 inline void sum_aos(const float* in, std::size_t n, float* out) {
+			reduce_aos<false>(in, nullptr, n, out);
+		}
+
+		MATH4D_TARGET_AVX2 inline void dot_aos(const float* a, const float* b, std::size_t n, float* out) {
+			reduce_aos<true>(a, b, n, out);
+		}
+	}
+
+#endif
+
+	inline void sum_aos(const float* in, std::size_t n, float* out) {
+#if defined(MATH4D_SIMD)
+		switch (simd::active_backend()) {
+		case simd::Backend::AVX2:	avx2::sum_aos(in, n, out); return;
+		case simd::Backend::SSE41:	sse::sum_aos(in, n, out); return;
+		default: break;
+		}
+#endif
+		scalar::sum_aos(in, n, out);
+	}
+
+	inline void dot_aos(const float* a, const float* b, std::size_t n, float* out) {
+#if defined(MATH4D_SIMD)
+		switch (simd::active_backend()) {
+		case simd::Backend::AVX2:	avx2::dot_aos(a, b, n, out); return;
+		case simd::Backend::SSE41:	sse::dot_aos(a, b, n, out); return;
+		default: break;
+		}
+#endif
+		scalar::dot_aos(a, b, n, out);
+	}
+
+	// Runs block(begin, end, partial) for every reduction_block points of the
+	// n, on the pool, and adds the block results in a fixed pairwise tree.
+	template<class Block>
+	inline Vector4D reduce_blocks(std::size_t n, const ParallelOptions& options, const Block& block) {
+		std::size_t blocks = (n + reduction_block - 1) / reduction_block;
+		if (blocks <= 1) {
+			Vector4D r;
+			block(0, n, r.data());
+			return r;
+		}
+
+		std::vector<Vector4D> partial(blocks);
+		ThreadPool& pool = options.pool != nullptr ? *options.pool : ThreadPool::default_pool();
+		std::size_t grain = options.chunk / reduction_block;
+		if (grain == 0) grain = 1;
+		pool.parallel_for(0, blocks, grain, [&](std::size_t first, std::size_t last) {
+			for (std::size_t k = first; k < last; k++) {
+				std::size_t begin = k * reduction_block;
+				std::size_t end = begin + reduction_block < n ? begin + reduction_block : n;
+				block(begin, end, partial[k].data());
+			}
+		});
+
+		for (std::size_t step = 1; step < blocks; step *= 2) {
+			for (std::size_t k = 0; k + step < blocks; k += 2 * step) {
+				partial[k] += partial[k + step];
+			}
+		}
+		return partial[0];
+	}
+}
+
+	// Returns the sum of all points in the list, using all the threads of the pool.
+	// The result is the same for every pool and chunk size and every backend.
+	inline Vector4D parallel_sum(std::span<const Vector4D> points,
+			const ParallelOptions& options = ParallelOptions()) {
+		MATH4D_TIME(Reduce, points.size());
+		if (points.empty()) return Vector4D(0, 0, 0, 0);
+		const float* src = points[0].data();
+		return kernels::reduce_blocks(points.size(), options, [&](std::size_t begin, std::size_t end, float* out) {
+			kernels::sum_aos(src + begin * 4, end - begin, out);
+		});
+	}
+
+	// Returns the sum of dot(a[i], b[i]) over the lists (all four components),
+	// using all the threads of the pool. b has to hold at least a.size() points.
+	// The result is the same for every pool and chunk size (see dot_aos).
+	inline float parallel_dot(std::span<const Vector4D> a, std::span<const Vector4D> b,
+			const ParallelOptions& options = ParallelOptions()) {
+		MATH4D_TIME(Reduce, a.size());
+		assert(b.size() >= a.size());
+		if (a.empty()) return 0;
+		const float* pa = a[0].data();
+		const float* pb = b[0].data();
+		Vector4D r = kernels::reduce_blocks(a.size(), options, [&](std::size_t begin, std::size_t end, float* out) {
+			kernels::dot_aos(pa + begin * 4, pb + begin * 4, end - begin, out);
+		});
+		return (r[0] + r[1]) + (r[2] + r[3]);
+	}
+}
@@ -0,0 +1,303 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include "batch4D.h"
+#include "dataset4D.h"
+#include "instrument4D.h"
+#include "matrix4D.h"
+#include "parallel4D.h"
+#include "thread_pool.h"
+#include "vector4D.h"
+
+// Out-of-core transform of point lists that do not fit in memory.
+//
+// stream_transform() runs three stages at the same time:
+//
+//	read		a reader thread fills a chunk from the source
+//	transform	the calling thread transforms the chunk (parallel_transform on the pool)
+//	write		a writer thread hands the chunk to the sink
+//
+// The chunks circle through a fixed number of buffers, so while one chunk
+// is transformed the next is already being read and the previous one
+// written, and memory stays at buffers * chunk points whatever the size
+// of the data:
+//
+//	math4D::DatasetReader<Vector4D> in;
+//	math4D::DatasetWriter<Vector4D> out;
+//	in.open("scan.m4d");
+//	out.open("scan_world.m4d");
+//	math4D::StreamStats stats;
+//	math4D::stream_transform(to_world, math4D::dataset_source(in), math4D::dataset_sink(out), {}, &stats);
+//
+// StreamStats has the time every stage was busy. The stage with the most
+// busy time is the bottleneck; the others wait on it.
+//
+// An exception thrown by the source, the sink or the transform stops all
+// three stages. stream_transform() joins both threads and rethrows it (the
+// first one if several stages throw).
+
+namespace math4D {
+
+	// Fills the span with the next points and returns how many it wrote.
+	// 0 ends the stream.
+	using StreamSource = std::function<std::size_t(std::span<Vector4D>)>;
+
+	// Takes a chunk of results. Returning false stops the stream.
+	using StreamSink = std::function<bool(std::span<const Vector4D>)>;
+
+	struct StreamOptions {
+		// Points per chunk.
+		std::size_t chunk = 1 << 16;
+		// Number of chunk buffers, at least 3 so every stage has one.
+		std::size_t buffers = 3;
+		// Normalizes every result after the transform, as Vector4D::norm().
+		bool normalize = false;
+		// Pool for the transform. nullptr uses ThreadPool::default_pool().
+		ThreadPool* pool = nullptr;
+	};
+
+	// Per stage throughput of a stream_transform().
+	struct StreamStats {
+		std::uint64_t points = 0;
+		std::uint64_t chunks = 0;
+		// Time every stage spent working, not waiting for the others.
+		double read_seconds = 0;
+		double transform_seconds = 0;
+		double write_seconds = 0;
+		// Wall clock time of the whole stream.
+		double total_seconds = 0;
+
+		// Points per second of a stage while it was busy.
+		double read_rate() const noexcept { return read_seconds > 0 ? points / read_seconds : 0; }
+		double transform_rate() const noexcept { return transform_seconds > 0 ? points / transform_seconds : 0; }
+		double write_rate() const noexcept { return write_seconds > 0 ? points / write_seconds : 0; }
+	};
+
+	namespace detail {
+
+		// A chunk buffer and the number of points in it.
+		struct StreamChunk {
+			std::vector<Vector4D> points;
+			std::size_t count = 0;
+		};
+
+		// Blocking queue of chunk indices between two stages. A closed queue
+		// still hands out what it holds, then returns false.
+		class ChunkQueue {
+		private:
+			std::mutex mutex;
+			std::condition_variable cv;
+			std::deque<std::size_t> items;
+			bool closed = false;
+
+		public:
+			void push(std::size_t index) {
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					items.push_back(index);
+				}
+				cv.notify_one();
+			}
+
+			bool pop(std::size_t& index) {
+				std::unique_lock<std::mutex> lock(mutex);
+				cv.wait(lock, [this] { return closed || !items.empty(); });
+				if (items.empty()) return false;
+				index = items.front();
+				items.pop_front();
+				return true;
+			}
+
+			void close() {
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					closed = true;
+				}
+				cv.notify_all();
+			}
+		};
+
+		// Joins the reader and the writer when it goes out of scope, after
+		// stop() made them return, so they are joined on every path, also
+		// when the calling thread throws. Threads already joined are skipped.
+		class StageJoiner {
+		private:
+			std::thread& reader;
+			std::thread& writer;
+			std::function<void()> stop;
+
+		public:
+			StageJoiner(std::thread& reader, std::thread& writer, std::function<void()> stop)
+				: reader(reader), writer(writer), stop(std::move(stop)) {}
+			~StageJoiner() {
+				if (!reader.joinable() && !writer.joinable()) return;
+				stop();
+				if (writer.joinable()) writer.join();
+				if (reader.joinable()) reader.join();
+			}
+			StageJoiner(const StageJoiner&) = delete;
+			StageJoiner& operator=(const StageJoiner&) = delete;
+		};
+
+		inline double seconds_since(std::chrono::steady_clock::time_point start) {
+			return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+	}
+
+	// -----< Sources / Sinks >--------------------------------------------------------------------
+
+	// Reads the points of a dataset file. The reader has to outlive the stream.
+	inline StreamSource dataset_source(DatasetReader<Vector4D>& reader) {
+		return [&reader](std::span<Vector4D> out) { return reader.read(out); };
+	}
+
+	// Reads the points of a mapped dataset file.
+	inline StreamSource dataset_source(const MappedDataset& file) {
+		std::span<const Vector4D> points = file.elements<Vector4D>();
+		std::size_t next = 0;
+		return [points, next](std::span<Vector4D> out) mutable {
+			std::size_t n = points.size() - next < out.size() ? points.size() - next : out.size();
+			for (std::size_t i = 0; i < n; i++) out[i] = points[next + i];
+			next += n;
+			return n;
+		};
+	}
+
+	// Appends the results to a dataset file. The writer has to outlive the stream.
+	inline StreamSink dataset_sink(DatasetWriter<Vector4D>& writer) {
+		return [&writer](std::span<const Vector4D> points) { return writer.append(points); };
+	}
+
+	// -----< Stream transform >-------------------------------------------------------------------
+
+	// Transforms every point of source by m (and normalizes it if asked) and
+	// passes the results to sink in the same order. Returns false if the sink
+	// stopped the stream, rethrows an exception of the source, the sink or the
+	// transform. Memory use is options.buffers * options.chunk points.
+	inline bool stream_transform(const Matrix4D& m, StreamSource source, StreamSink sink,
+			const StreamOptions& options = StreamOptions(), StreamStats* stats = nullptr) {
+		MATH4D_TIME(StreamTransform, 0);
+		using clock = std::chrono::steady_clock;
+		clock::time_point start = clock::now();
+
+		std::size_t chunk = options.chunk > 0 ? options.chunk : 1;
+		std::size_t buffers = options.buffers < 3 ? 3 : options.buffers;
+		std::vector<detail::StreamChunk> chunks(buffers);
+		for (detail::StreamChunk& c : chunks) c.points.resize(chunk);
+
+		// free -> read -> filled -> transform -> done -> write -> free
+		detail::ChunkQueue free_queue, filled_queue, done_queue;
+		for (std::size_t i = 0; i < buffers; i++) free_queue.push(i);
+
+		ParallelOptions parallel;
+		parallel.pool = options.pool;
+
+		StreamStats s;
+		bool sink_ok = true;
+		// Set by the writer when the sink stops the stream, and by any stage
+		// that throws. The free queue can still hold buffers then, so the
+		// reader checks it before every read.
+		std::atomic<bool> stopped{ false };
+		std::mutex error_mutex;
+		std::exception_ptr error;
+
+		auto stop = [&] {
+			stopped.store(true, std::memory_order_release);
+			free_queue.close();
+			filled_queue.close();
+			done_queue.close();
+		};
+		// Keeps the first exception and stops every stage. Called in a catch block.
+		auto fail = [&] {
+			{
+				std::lock_guard<std::mutex> lock(error_mutex);
+				if (!error) error = std::current_exception();
+			}
+			stop();
+		};
+
+		std::thread reader, writer;
+		detail::StageJoiner joiner(reader, writer, stop);
+
+		reader = std::thread([&] {
+			try {
+				std::size_t index;
+				while (!stopped.load(std::memory_order_acquire) && free_queue.pop(index)) {
+					if (stopped.load(std::memory_order_acquire)) break;
+					clock::time_point t = clock::now();
+					detail::StreamChunk& c = chunks[index];
+					c.count = source(c.points);
+					s.read_seconds += detail::seconds_since(t);
+					if (c.count == 0) break;
+					filled_queue.push(index);
+				}
+			}
+			catch (...) {
+				fail();
+			}
+			filled_queue.close();
+		});
+
+		writer = std::thread([&] {
+			try {
+				std::size_t index;
+				while (done_queue.pop(index)) {
+					detail::StreamChunk& c = chunks[index];
+					// After an exception the chunks still queued are dropped.
+					if (sink_ok && !stopped.load(std::memory_order_acquire)) {
+						clock::time_point t = clock::now();
+						sink_ok = sink(std::span<const Vector4D>(c.points.data(), c.count));
+						s.write_seconds += detail::seconds_since(t);
+						// Stops the reader; the chunks already read are dropped
+						// and no buffer goes back to it.
+						if (!sink_ok) {
+							stopped.store(true, std::memory_order_release);
+							free_queue.close();
+						}
+					}
+					if (sink_ok) free_queue.push(index);
+				}
+			}
+			catch (...) {
+				fail();
+			}
+		});
+
+		std::size_t index;
+		while (filled_queue.pop(index)) {
+			if (!stopped.load(std::memory_order_acquire)) {
+				clock::time_point t = clock::now();
+				detail::StreamChunk& c = chunks[index];
+				std::span<Vector4D> points(c.points.data(), c.count);
+				parallel_transform(m, points, parallel);
+				if (options.normalize) normalize(points);
+				s.transform_seconds += detail::seconds_since(t);
+				s.points += c.count;
+				s.chunks++;
+			}
+			done_queue.push(index);
+		}
+		done_queue.close();
+
+		writer.join();
+		free_queue.close();
+		reader.join();
+		if (error) std::rethrow_exception(error);
+
+		s.total_seconds = detail::seconds_since(start);
+		MATH4D_TIME_ELEMENTS(s.points);
+		if (stats != nullptr) *stats = s;
+		return sink_ok;
+	}
+}
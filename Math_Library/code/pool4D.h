@@ -0,0 +1,320 @@
+#pragma once
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+#include "matrix4D.h"
+#include "vector4D.h"
+
+// Pool and arena allocation for Matrix4D and Vector4D.
+//
+// Pool<T> holds a fixed number of T in one 64-byte aligned block. Objects
+// are addressed by a Handle: the slot index and a generation, so a handle
+// to a released object is detected instead of pointing at whatever took
+// its place. Free slots are kept on a lock-free stack, so any number of
+// threads can create and release objects at the same time:
+//
+//	Matrix4DPool transforms(100000);
+//	Matrix4DPool::Handle h = transforms.create(Matrix4D::rotation_x(0.5f));
+//	if (Matrix4D* m = transforms.get(h)) { ... }
+//	transforms.release(h);	// transforms.get(h) is nullptr from here on
+//
+// Arena is a lock-free bump allocator over one 64-byte aligned block,
+// for objects that all go away together (ex. per frame). ArenaAllocator
+// lets standard containers use one:
+//
+//	math4D::Arena frame(1 << 20);
+//	std::vector<Matrix4D, math4D::ArenaAllocator<Matrix4D>> list(frame);
+//	...
+//	list = {};
+//	frame.reset();
+
+namespace math4D {
+
+	// -----< Pool >-------------------------------------------------------------------------------
+
+	template<class T>
+	class Pool {
+	public:
+		// Refers to one object in a pool. The default handle refers to nothing.
+		struct Handle {
+			std::uint32_t index = 0xffffffffu;
+			std::uint32_t generation = 0;
+
+			constexpr bool operator==(const Handle& h) const noexcept = default;
+		};
+
+	private:
+		static constexpr std::uint32_t empty = 0xffffffffu;
+		static constexpr std::size_t alignment = alignof(T) > 64 ? alignof(T) : 64;
+
+		T* objects = nullptr;
+		// Odd while the slot holds an object, even while it is free.
+		// Every create and release moves it one up.
+		std::atomic<std::uint32_t>* generations = nullptr;
+		// The next free slot below a free slot on the stack.
+		std::atomic<std::uint32_t>* next = nullptr;
+		std::uint32_t slots = 0;
+
+		// Top of the free stack in the low 32 bits, a counter in the high 32
+		// bits. The counter changes on every push and pop, so a pop that read
+		// a slot which was taken and given back in between fails its
+		// compare-exchange (the ABA problem).
+		std::atomic<std::uint64_t> head{ empty };
+
+		static constexpr std::uint64_t pack(std::uint64_t tag, std::uint32_t index) noexcept {
+			return (tag << 32) | index;
+		}
+
+		std::uint32_t pop() noexcept {
+			std::uint64_t h = head.load(std::memory_order_acquire);
+			while (true) {
+				std::uint32_t index = (std::uint32_t)h;
+				if (index == empty) return empty;
+				std::uint32_t below = next[index].load(std::memory_order_relaxed);
+				if (head.compare_exchange_weak(h, pack((h >> 32) + 1, below),
+						std::memory_order_acq_rel, std::memory_order_acquire)) {
+					return index;
+				}
+			}
+		}
+
+		void push(std::uint32_t index) noexcept {
+			std::uint64_t h = head.load(std::memory_order_relaxed);
+			while (true) {
+				next[index].store((std::uint32_t)h, std::memory_order_relaxed);
+				if (head.compare_exchange_weak(h, pack((h >> 32) + 1, index),
+						std::memory_order_release, std::memory_order_relaxed)) {
+					return;
+				}
+			}
+		}
+
+	public:
+
+		// -----< Constructors >-----------------------------------------------------------------------
+
+		// Creates a pool with room for capacity objects. The memory is taken
+		// up front, the pool never grows.
+		explicit Pool(std::size_t capacity) {
+			assert(capacity < empty);
+			slots = (std::uint32_t)capacity;
+			if (slots == 0) return;
+			objects = static_cast<T*>(::operator new(slots * sizeof(T), std::align_val_t(alignment)));
+			generations = new std::atomic<std::uint32_t>[slots];
+			next = new std::atomic<std::uint32_t>[slots];
+			for (std::uint32_t i = 0; i < slots; i++) {
+				generations[i].store(0, std::memory_order_relaxed);
+				next[i].store(i + 1 < slots ? i + 1 : empty, std::memory_order_relaxed);
+			}
+			head.store(pack(0, 0), std::memory_order_release);
+		}
+
+		Pool(const Pool&) = delete;
+		Pool& operator=(const Pool&) = delete;
+
+		// Destroys the objects that were not released.
+		~Pool() {
+			if (objects == nullptr) return;
+			if constexpr (!std::is_trivially_destructible_v<T>) {
+				for (std::uint32_t i = 0; i < slots; i++) {
+					if (generations[i].load(std::memory_order_relaxed) & 1) objects[i].~T();
+				}
+			}
+			::operator delete(objects, std::align_val_t(alignment));
+			delete[] generations;
+			delete[] next;
+		}
+
+		// -----< Getters >----------------------------------------------------------------------------
+
+		std::size_t capacity() const noexcept {
+			return slots;
+		}
+
+		// Returns the number of objects that were created and not released.
+		// Counted over all slots (a shared counter would cost create() and
+		// release() one more atomic operation), so not for every frame.
+		std::size_t size() const noexcept {
+			std::size_t count = 0;
+			for (std::uint32_t i = 0; i < slots; i++) {
+				count += generations[i].load(std::memory_order_relaxed) & 1;
+			}
+			return count;
+		}
+
+		// Returns the object of a handle, or nullptr if it was released (or
+		// the handle is the default one). A handle must not be released by
+		// one thread while another is still using its object.
+		T* get(Handle h) noexcept {
+			if (h.index >= slots || generations[h.index].load(std::memory_order_acquire) != h.generation) return nullptr;
+			return objects + h.index;
+		}
+		const T* get(Handle h) const noexcept {
+			if (h.index >= slots || generations[h.index].load(std::memory_order_acquire) != h.generation) return nullptr;
+			return objects + h.index;
+		}
+
+		bool valid(Handle h) const noexcept {
+			return get(h) != nullptr;
+		}
+
+		// -----< Create / Release >-------------------------------------------------------------------
+
+		// Constructs an object from args in a free slot and returns its
+		// handle. Returns the default handle if the pool is full.
+		// Safe to call from several threads at once.
+		template<class... Args>
+		Handle create(Args&&... args) {
+			std::uint32_t index = pop();
+			if (index == empty) return Handle();
+			::new (static_cast<void*>(objects + index)) T(std::forward<Args>(args)...);
+			std::uint32_t generation = generations[index].load(std::memory_order_relaxed) + 1;
+			generations[index].store(generation, std::memory_order_release);
+			return Handle{ index, generation };
+		}
+
+		// Destroys the object of a handle and frees its slot. Returns false if
+		// the handle was already released. Safe to call from several threads
+		// at once, also with the same handle: only one of them releases it.
+		bool release(Handle h) noexcept {
+			if (h.index >= slots) return false;
+			std::uint32_t expected = h.generation;
+			if ((expected & 1) == 0 || !generations[h.index].compare_exchange_strong(expected, expected + 1,
+					std::memory_order_acq_rel, std::memory_order_relaxed)) {
+				return false;
+			}
+			objects[h.index].~T();
+			push(h.index);
+			return true;
+		}
+	};
+
+	// -----< Arena >------------------------------------------------------------------------------
+
+	class Arena {
+	private:
+		std::byte* block = nullptr;
+		std::size_t bytes = 0;
+		std::atomic<std::size_t> used{ 0 };
+
+	public:
+
+		// Alignment used for size bytes of T: a cache line for blocks of at
+		// least one cache line (a Matrix4D, an array of Vector4D), so they do
+		// not straddle more lines than needed, alignof(T) for smaller ones.
+		template<class T>
+		static constexpr std::size_t alignment_for(std::size_t size) noexcept {
+			return size >= 64 && alignof(T) < 64 ? 64 : alignof(T);
+		}
+
+		// -----< Constructors >-----------------------------------------------------------------------
+
+		// Creates an arena over one block of a number of bytes, 64-byte aligned.
+		explicit Arena(std::size_t capacity) : bytes(capacity) {
+			if (bytes > 0) block = static_cast<std::byte*>(::operator new(bytes, std::align_val_t(64)));
+		}
+
+		Arena(const Arena&) = delete;
+		Arena& operator=(const Arena&) = delete;
+
+		~Arena() {
+			if (block != nullptr) ::operator delete(block, std::align_val_t(64));
+		}
+
+		// -----< Getters >----------------------------------------------------------------------------
+
+		std::size_t capacity() const noexcept {
+			return bytes;
+		}
+
+		// Returns the number of bytes handed out since the last reset(),
+		// with the alignment padding.
+		std::size_t size() const noexcept {
+			return used.load(std::memory_order_relaxed);
+		}
+
+		// -----< Allocate >---------------------------------------------------------------------------
+
+		// Returns size bytes aligned to align (a power of two, at most 64),
+		// or nullptr if the arena is full. Safe to call from several threads at once.
+		void* allocate(std::size_t size, std::size_t align) noexcept {
+			assert(align > 0 && align <= 64 && (align & (align - 1)) == 0);
+			std::size_t offset = used.load(std::memory_order_relaxed);
+			while (true) {
+				std::size_t start = (offset + align - 1) & ~(align - 1);
+				if (start > bytes || size > bytes - start) return nullptr;
+				if (used.compare_exchange_weak(offset, start + size, std::memory_order_relaxed)) {
+					return block + start;
+				}
+			}
+		}
+
+		// Constructs an object in the arena, or returns nullptr if it is full.
+		// The arena never calls destructors, so T has to be trivially destructible.
+		template<class T, class... Args>
+		T* create(Args&&... args) {
+			static_assert(std::is_trivially_destructible_v<T>, "the arena does not destroy its objects");
+			void* p = allocate(sizeof(T), alignment_for<T>(sizeof(T)));
+			return p != nullptr ? ::new (p) T(std::forward<Args>(args)...) : nullptr;
+		}
+
+		// Constructs n default objects in the arena, or returns an empty span if it is full.
+		template<class T>
+		std::span<T> create_array(std::size_t n) {
+			static_assert(std::is_trivially_destructible_v<T>, "the arena does not destroy its objects");
+			void* p = allocate(n * sizeof(T), alignment_for<T>(n * sizeof(T)));
+			if (p == nullptr) return {};
+			T* first = static_cast<T*>(p);
+			for (std::size_t i = 0; i < n; i++) ::new (static_cast<void*>(first + i)) T();
+			return std::span<T>(first, n);
+		}
+
+		// Frees everything at once. No other thread may use the arena while
+		// it is reset, and nothing allocated before may be used after.
+		void reset() noexcept {
+			used.store(0, std::memory_order_relaxed);
+		}
+	};
+
+	// Standard allocator over an Arena. deallocate() does nothing, the
+	// memory comes back with Arena::reset(). allocate() throws
+	// std::bad_alloc when the arena is full, as the standard containers expect.
+	template<class T>
+	class ArenaAllocator {
+	private:
+		template<class U>
+		friend class ArenaAllocator;
+
+		Arena* arena;
+
+	public:
+		using value_type = T;
+
+		ArenaAllocator(Arena& a) noexcept : arena(&a) {}
+
+		template<class U>
+		ArenaAllocator(const ArenaAllocator<U>& a) noexcept : arena(a.arena) {}
+
+		T* allocate(std::size_t n) {
+			void* p = arena->allocate(n * sizeof(T), Arena::alignment_for<T>(n * sizeof(T)));
+			if (p == nullptr) throw std::bad_alloc();
+			return static_cast<T*>(p);
+		}
+
+		void deallocate(T*, std::size_t) noexcept {}
+
+		template<class U>
+		bool operator==(const ArenaAllocator<U>& a) const noexcept {
+			return arena == a.arena;
+		}
+	};
+}
+
+using Matrix4DPool = math4D::Pool<Matrix4D>;
+using Vector4DPool = math4D::Pool<Vector4D>;
@@ -0,0 +1,460 @@
+#pragma once
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <span>
+
+#include "instrument4D.h"
+#include "matrix4D.h"
+#include "vector4D.h"
+#include "simd4D.h"
+
+// A rotation stored as a unit quaternion.
+//
+// The values are stored as (x, y, z, w), where w is the real part,
+// so a Quaternion has the same layout as a Vector4D.
+//
+// Rotations follow the same convention as Matrix4D: to_matrix() of
+// from_axis_angle(x-axis, a) is the same matrix as Matrix4D::rotate_x(a)
+// (with a in radians instead of degrees).
+
+class Quaternion {
+private:
+	alignas(16) float arr_values[4];
+public:
+
+	// -----< Constructors >-----------------------------------------------------------------------
+
+	// Create a Quaternion with inserted values.
+	// The default is the identity rotation (0, 0, 0, 1).
+	constexpr Quaternion(float nx = 0, float ny = 0, float nz = 0, float nw = 1) noexcept
+		: arr_values{ nx, ny, nz, nw } {
+	}
+
+	// Returns a rotation of an angle (in radians) around an axis.
+	// The axis does not have to be normalized, its w value is ignored.
+	static Quaternion from_axis_angle(const Vector4D& axis, float radians) noexcept {
+		float len = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+		if (len == 0) return Quaternion();
+		float s = math4D::sin_float(radians * 0.5f) / len;
+		return Quaternion(axis[0] * s, axis[1] * s, axis[2] * s, math4D::cos_float(radians * 0.5f));
+	}
+
+	// Returns the rotation of Euler angles in radians, in the same order as
+	// Matrix4D::rotate_x(x) * Matrix4D::rotate_y(y) * Matrix4D::rotate_z(z).
+	static Quaternion from_euler(float x, float y, float z) noexcept {
+		float cx = math4D::cos_float(x * 0.5f), sx = math4D::sin_float(x * 0.5f);
+		float cy = math4D::cos_float(y * 0.5f), sy = math4D::sin_float(y * 0.5f);
+		float cz = math4D::cos_float(z * 0.5f), sz = math4D::sin_float(z * 0.5f);
+		// qx * qy * qz, written out.
+		return Quaternion(
+			sx * cy * cz + cx * sy * sz,
+			cx * sy * cz - sx * cy * sz,
+			cx * cy * sz + sx * sy * cz,
+			cx * cy * cz - sx * sy * sz);
+	}
+
+	// Returns the rotation of a Matrix4D. Only the upper 3x3 part is used and
+	// it has to be a pure rotation. The result has w >= 0.
+	//
+	// Shepperd's method: the largest of |w|, |x|, |y|, |z| comes from the
+	// diagonal and the others from the off-diagonal sums and differences
+	// divided by it. Taking only the signs from the differences fails for
+	// 180 degree rotations, where w = 0 and all the differences are 0.
+	static Quaternion from_matrix(const Matrix4D& m) noexcept {
+		const float* v = m.data();
+		float m00 = v[0], m11 = v[5], m22 = v[10];
+		// 4 w^2, 4 x^2, 4 y^2 and 4 z^2.
+		float tw = 1 + m00 + m11 + m22;
+		float tx = 1 + m00 - m11 - m22;
+		float ty = 1 - m00 + m11 - m22;
+		float tz = 1 - m00 - m11 + m22;
+		Quaternion q;
+		if (tw >= tx && tw >= ty && tw >= tz) {
+			float s = 0.5f / std::sqrt(tw);
+			q = Quaternion((v[9] - v[6]) * s, (v[2] - v[8]) * s, (v[4] - v[1]) * s, tw * s);
+		}
+		else if (tx >= ty && tx >= tz) {
+			float s = 0.5f / std::sqrt(tx);
+			q = Quaternion(tx * s, (v[1] + v[4]) * s, (v[2] + v[8]) * s, (v[9] - v[6]) * s);
+		}
+		else if (ty >= tz) {
+			float s = 0.5f / std::sqrt(ty);
+			q = Quaternion((v[1] + v[4]) * s, ty * s, (v[6] + v[9]) * s, (v[2] - v[8]) * s);
+		}
+		else {
+			float s = 0.5f / std::sqrt(tz);
+			q = Quaternion((v[2] + v[8]) * s, (v[6] + v[9]) * s, tz * s, (v[4] - v[1]) * s);
+		}
+		if (q[3] < 0) q = q.scalar(-1);
+		return q.normalize();
+	}
+
+	// -----< Getters >----------------------------------------------------------------------------
+
+	// Operator that returns the value of the inserted index.
+	// 0 = x, 1 = y, 2 = z, 3 = w
+	constexpr float operator[] (int index) const noexcept {
+		return arr_values[index];
+	}
+	constexpr float& operator[] (int index) noexcept {
+		return arr_values[index];
+	}
+
+	constexpr const float* data() const noexcept {
+		return arr_values;
+	}
+	constexpr float* data() noexcept {
+		return arr_values;
+	}
+
+	// -----< Setters >----------------------------------------------------------------------------
+
+	// Set all the values in the quaternion.
+	constexpr void set_components(float nx = 0, float ny = 0, float nz = 0, float nw = 1) noexcept {
+		arr_values[0] = nx;
+		arr_values[1] = ny;
+		arr_values[2] = nz;
+		arr_values[3] = nw;
+	}
+
+	// -----< Operators >--------------------------------------------------------------------------
+
+	// Operator for the Hamilton product, (a * b) rotates by b first and then by a.
+	constexpr Quaternion operator*(const Quaternion& q) const noexcept {
+		float ax = arr_values[0], ay = arr_values[1], az = arr_values[2], aw = arr_values[3];
+		float bx = q[0], by = q[1], bz = q[2], bw = q[3];
+		return Quaternion(
+			aw * bx + ax * bw + ay * bz - az * by,
+			aw * by - ax * bz + ay * bw + az * bx,
+			aw * bz + ax * by - ay * bx + az * bw,
+			aw * bw - ax * bx - ay * by - az * bz);
+	}
+
+	// Operator for rotating a Vector4D. The w value of the vector is kept.
+	constexpr Vector4D operator*(const Vector4D& v) const noexcept {
+		float qx = arr_values[0], qy = arr_values[1], qz = arr_values[2], qw = arr_values[3];
+		// t = 2 * (q x v)
+		float tx = 2 * (qy * v[2] - qz * v[1]);
+		float ty = 2 * (qz * v[0] - qx * v[2]);
+		float tz = 2 * (qx * v[1] - qy * v[0]);
+		// v + w * t + q x t
+		return Vector4D(
+			v[0] + qw * tx + (qy * tz - qz * ty),
+			v[1] + qw * ty + (qz * tx - qx * tz),
+			v[2] + qw * tz + (qx * ty - qy * tx),
+			v[3]);
+	}
+
+	constexpr Quaternion operator+(const Quaternion& q) const noexcept {
+		return Quaternion(arr_values[0] + q[0], arr_values[1] + q[1], arr_values[2] + q[2], arr_values[3] + q[3]);
+	}
+
+	constexpr Quaternion operator-(const Quaternion& q) const noexcept {
+		return Quaternion(arr_values[0] - q[0], arr_values[1] - q[1], arr_values[2] - q[2], arr_values[3] - q[3]);
+	}
+
+	constexpr bool operator==(const Quaternion& q) const noexcept {
+		return	arr_values[0] == q[0] && arr_values[1] == q[1] &&
+				arr_values[2] == q[2] && arr_values[3] == q[3];
+	}
+	constexpr bool operator!=(const Quaternion& q) const noexcept {
+		return !(*this == q);
+	}
+
+	// Returns the quaternion with every value multiplied by s.
+	constexpr Quaternion scalar(float s) const noexcept {
+		return Quaternion(arr_values[0] * s, arr_values[1] * s, arr_values[2] * s, arr_values[3] * s);
+	}
+
+	// Returns the Dot Product as a float.
+	constexpr float dot_product(const Quaternion& q) const noexcept {
+		return	arr_values[0] * q[0] + arr_values[1] * q[1] +
+				arr_values[2] * q[2] + arr_values[3] * q[3];
+	}
+
+	// -----< Conjugate / Inverse >----------------------------------------------------------------
+
+	// Returns (-x, -y, -z, w), the inverse of a unit quaternion.
+	constexpr Quaternion conjugate() const noexcept {
+		return Quaternion(-arr_values[0], -arr_values[1], -arr_values[2], arr_values[3]);
+	}
+
+	// Returns the inverse, also for quaternions that are not unit length.
+	// The inverse of (0, 0, 0, 0) is (0, 0, 0, 0).
+	constexpr Quaternion inverse() const noexcept {
+		float len2 = dot_product(*this);
+		if (len2 == 0) return Quaternion(0, 0, 0, 0);
+		return conjugate().scalar(1 / len2);
+	}
+
+	// -----< Normalize >--------------------------------------------------------------------------
+
+	// Returns the length of the quaternion.
+	float length() const noexcept {
+		return std::sqrt(dot_product(*this));
+	}
+
+	// Returns the quaternion scaled to unit length.
+	// (0, 0, 0, 0) gives the identity rotation.
+	Quaternion normalize() const noexcept {
+		float len2 = dot_product(*this);
+		if (len2 == 0) return Quaternion();
+		return scalar(1 / std::sqrt(len2));
+	}
+
+	// -----< Interpolation >----------------------------------------------------------------------
+
+	// Normalized linear interpolation, t = 0 gives a and t = 1 gives b.
+	// Takes the short way around. Cheaper than slerp(), but the angular
+	// speed is not constant over t.
+	static Quaternion nlerp(const Quaternion& a, const Quaternion& b, float t) noexcept {
+		float s = a.dot_product(b) < 0 ? -t : t;
+		return Quaternion(
+			a[0] + (b[0] * s - a[0] * t),
+			a[1] + (b[1] * s - a[1] * t),
+			a[2] + (b[2] * s - a[2] * t),
+			a[3] + (b[3] * s - a[3] * t)).normalize();
+	}
+
+	// Spherical linear interpolation, t = 0 gives a and t = 1 gives b.
+	// Takes the short way around with constant angular speed.
+	// This is the reference version, math4D::slerp_batch() is the fast one.
+	static Quaternion slerp(const Quaternion& a, const Quaternion& b, float t) noexcept {
+		float cos_theta = a.dot_product(b);
+		Quaternion end = b;
+		if (cos_theta < 0) {
+			cos_theta = -cos_theta;
+			end = b.scalar(-1);
+		}
+		// Almost the same rotation, sin(theta) is too close to 0 (zero).
+		if (cos_theta > 0.9995f) {
+			return nlerp(a, end, t);
+		}
+		float theta = math4D::acos_float(cos_theta);
+		float inv_sin = 1 / math4D::sin_float(theta);
+		float wa = math4D::sin_float((1 - t) * theta) * inv_sin;
+		float wb = math4D::sin_float(t * theta) * inv_sin;
+		return a.scalar(wa) + end.scalar(wb);
+	}
+
+	// -----< Matrix >-----------------------------------------------------------------------------
+
+	// Returns the rotation as a Matrix4D. Branch-free.
+	constexpr Matrix4D to_matrix() const noexcept {
+		float x = arr_values[0], y = arr_values[1], z = arr_values[2], w = arr_values[3];
+		float xx = x * x, yy = y * y, zz = z * z;
+		float xy = x * y, xz = x * z, yz = y * z;
+		float wx = w * x, wy = w * y, wz = w * z;
+		return Matrix4D(
+			1 - 2 * (yy + zz), 2 * (xy - wz), 2 * (xz + wy), 0,
+			2 * (xy + wz), 1 - 2 * (xx + zz), 2 * (yz - wx), 0,
+			2 * (xz - wy), 2 * (yz + wx), 1 - 2 * (xx + yy), 0,
+			0, 0, 0, 1);
+	}
+
+	// -----< Print / Debug >----------------------------------------------------------------------
+
+	// Prints the values of the Quaternion in a line.
+	void print_line() const {
+		std::cout << arr_values[0] << "\t" << arr_values[1] << "\t" << arr_values[2] << "\t" << arr_values[3] << "\n";
+	}
+};
+
+static_assert(sizeof(Quaternion) == sizeof(Vector4D), "Quaternion must have the same layout as Vector4D");
+
+namespace math4D {
+namespace kernels {
+
+	// -----< Batch slerp >------------------------------------------------------------------------
+
+	// The batch slerp uses the polynomial from D. Eberly, "A Fast and Accurate
+	// Algorithm for Computing SLERP". sin(t * theta) / sin(theta) is written as a
+	// polynomial in t and cos(theta) - 1, so there is no acos, sin or division
+	// and no branch. Measured against the acos/sin slerp in double, the error
+	// for unit inputs is below 1.5e-6 when dot(a, b) >= 0.5 (keyframes less than
+	// 120 degrees apart) and at most 3e-5 when the rotations are opposite.
+	namespace slerp_coefficients {
+		constexpr float mu = 1.85298109240830f;
+		constexpr float u[8] = {
+			1.0f / (1 * 3), 1.0f / (2 * 5), 1.0f / (3 * 7), 1.0f / (4 * 9),
+			1.0f / (5 * 11), 1.0f / (6 * 13), 1.0f / (7 * 15), mu / (8 * 17)
+		};
+		constexpr float v[8] = {
+			1.0f / 3, 2.0f / 5, 3.0f / 7, 4.0f / 9,
+			5.0f / 11, 6.0f / 13, 7.0f / 15, mu * 8 / 17
+		};
+	}
+
+	namespace scalar {
+
+		// out[i] = slerp(a[i], b[i], t[i]) for n quaternions stored as (x, y, z, w).
+		inline void slerp_batch(const float* a, const float* b, const float* t, float* out, std::size_t n) {
+			using namespace slerp_coefficients;
+			for (std::size_t i = 0; i < n; i++) {
+				const float* qa = a + i * 4;
+				const float* qb = b + i * 4;
+				float x = qa[0] * qb[0] + qa[1] * qb[1] + qa[2] * qb[2] + qa[3] * qb[3];
+				float sign = x < 0 ? -1.0f : 1.0f;
+				x *= sign;
+				float xm1 = x - 1;
+				float ti = t[i], d = 1 - ti;
+				float tt = ti * ti, dd = d * d;
+				float ct = 1, cd = 1;
+				for (int k = 7; k >= 0; k--) {
+					ct = 1 + (u[k] * tt - v[k]) * xm1 * ct;
+					cd = 1 + (u[k] * dd - v[k]) * xm1 * cd;
+				}
+				ct *= ti;
+				cd *= d;
+				ct *= sign;
+				for (int c = 0; c < 4; c++) {
+					out[i * 4 + c] = qa[c] * cd + qb[c] * ct;
+				}
+			}
+		}
+	}
+
+#if defined(MATH4D_SIMD)
+
+	namespace sse {
+
+		// Four quaternions per iteration, transposed to one register per component.
+		MATH4D_TARGET_SSE41 inline void slerp_batch(const float* a, const float* b, const float* t, float* out, std::size_t n) {
+			using namespace slerp_coefficients;
+			const __m128 one = _mm_set1_ps(1.0f);
+			const __m128 sign_bit = _mm_set1_ps(-0.0f);
+			std::size_t i = 0;
+			for (; i + 4 <= n; i += 4) {
+				__m128 ax = _mm_loadu_ps(a + i * 4 + 0), ay = _mm_loadu_ps(a + i * 4 + 4);
+				__m128 az = _mm_loadu_ps(a + i * 4 + 8), aw = _mm_loadu_ps(a + i * 4 + 12);
+				__m128 bx = _mm_loadu_ps(b + i * 4 + 0), by = _mm_loadu_ps(b + i * 4 + 4);
+				__m128 bz = _mm_loadu_ps(b + i * 4 + 8), bw = _mm_loadu_ps(b + i * 4 + 12);
+				_MM_TRANSPOSE4_PS(ax, ay, az, aw);
+				_MM_TRANSPOSE4_PS(bx, by, bz, bw);
+
+				__m128 x = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)),
+									  _mm_add_ps(_mm_mul_ps(az, bz), _mm_mul_ps(aw, bw)));
+				// Take the short way: |x| and flip the weight of b.
+				__m128 sign = _mm_and_ps(x, sign_bit);
+				x = _mm_xor_ps(x, sign);
+				__m128 xm1 = _mm_sub_ps(x, one);
+				__m128 tv = _mm_loadu_ps(t + i);
+				__m128 d = _mm_sub_ps(one, tv);
+				__m128 tt = _mm_mul_ps(tv, tv), dd = _mm_mul_ps(d, d);
+				__m128 ct = one, cd = one;
+				for (int k = 7; k >= 0; k--) {
+					__m128 uk = _mm_set1_ps(u[k]), vk = _mm_set1_ps(v[k]);
+					ct = _mm_add_ps(one, _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(_mm_mul_ps(uk, tt), vk), xm1), ct));
+					cd = _mm_add_ps(one, _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(_mm_mul_ps(uk, dd), vk), xm1), cd));
+				}
+				ct = _mm_xor_ps(_mm_mul_ps(ct, tv), sign);
+				cd = _mm_mul_ps(cd, d);
+
+				__m128 rx = _mm_add_ps(_mm_mul_ps(ax, cd), _mm_mul_ps(bx, ct));
+				__m128 ry = _mm_add_ps(_mm_mul_ps(ay, cd), _mm_mul_ps(by, ct));
+				__m128 rz = _mm_add_ps(_mm_mul_ps(az, cd), _mm_mul_ps(bz, ct));
+				__m128 rw = _mm_add_ps(_mm_mul_ps(aw, cd), _mm_mul_ps(bw, ct));
+				_MM_TRANSPOSE4_PS(rx, ry, rz, rw);
+				_mm_storeu_ps(out + i * 4 + 0, rx);
+				_mm_storeu_ps(out + i * 4 + 4, ry);
+				_mm_storeu_ps(out + i * 4 + 8, rz);
+				_mm_storeu_ps(out + i * 4 + 12, rw);
+			}
+			scalar::slerp_batch(a + i * 4, b + i * 4, t + i, out + i * 4, n - i);
+		}
+	}
+
+	namespace avx2 {
+
+		// 4x4 transpose inside each 128-bit half of four ymm registers.
+		MATH4D_TARGET_AVX2 inline void transpose_halves(__m256& r0, __m256& r1, __m256& r2, __m256& r3) {
+			__m256 t0 = _mm256_unpacklo_ps(r0, r1);
+			__m256 t1 = _mm256_unpacklo_ps(r2, r3);
+			__m256 t2 = _mm256_unpackhi_ps(r0, r1);
+			__m256 t3 = _mm256_unpackhi_ps(r2, r3);
+			r0 = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+			r1 = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+			r2 = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+			r3 = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2));
+		}
+
+		// Eight quaternions per iteration. Each ymm register holds two
+		// quaternions, one per half, so after the transpose the lanes are in
+		// the order 0, 2, 4, 6, 1, 3, 5, 7. t is permuted to match and the
+		// second transpose puts the results back in order.
+		MATH4D_TARGET_AVX2 inline void slerp_batch(const float* a, const float* b, const float* t, float* out, std::size_t n) {
+			using namespace slerp_coefficients;
+			const __m256 one = _mm256_set1_ps(1.0f);
+			const __m256 sign_bit = _mm256_set1_ps(-0.0f);
+			const __m256i lane_order = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+			std::size_t i = 0;
+			for (; i + 8 <= n; i += 8) {
+				__m256 ax = _mm256_loadu_ps(a + i * 4 + 0), ay = _mm256_loadu_ps(a + i * 4 + 8);
+				__m256 az = _mm256_loadu_ps(a + i * 4 + 16), aw = _mm256_loadu_ps(a + i * 4 + 24);
+				__m256 bx = _mm256_loadu_ps(b + i * 4 + 0), by = _mm256_loadu_ps(b + i * 4 + 8);
+				__m256 bz = _mm256_loadu_ps(b + i * 4 + 16), bw = _mm256_loadu_ps(b + i * 4 + 24);
+				transpose_halves(ax, ay, az, aw);
+				transpose_halves(bx, by, bz, bw);
+
+				__m256 x = _mm256_mul_ps(ax, bx);
+				x = _mm256_fmadd_ps(ay, by, x);
+				x = _mm256_fmadd_ps(az, bz, x);
+				x = _mm256_fmadd_ps(aw, bw, x);
+				__m256 sign = _mm256_and_ps(x, sign_bit);
+				x = _mm256_xor_ps(x, sign);
+				__m256 xm1 = _mm256_sub_ps(x, one);
+				__m256 tv = _mm256_permutevar8x32_ps(_mm256_loadu_ps(t + i), lane_order);
+				__m256 d = _mm256_sub_ps(one, tv);
+				__m256 tt = _mm256_mul_ps(tv, tv), dd = _mm256_mul_ps(d, d);
+				__m256 ct = one, cd = one;
+				for (int k = 7; k >= 0; k--) {
+					__m256 uk = _mm256_set1_ps(u[k]), vk = _mm256_set1_ps(v[k]);
+					ct = _mm256_fmadd_ps(_mm256_mul_ps(_mm256_fmsub_ps(uk, tt, vk), xm1), ct, one);
+					cd = _mm256_fmadd_ps(_mm256_mul_ps(_mm256_fmsub_ps(uk, dd, vk), xm1), cd, one);
+				}
+				ct = _mm256_xor_ps(_mm256_mul_ps(ct, tv), sign);
+				cd = _mm256_mul_ps(cd, d);
+
+				__m256 rx = _mm256_fmadd_ps(bx, ct, _mm256_mul_ps(ax, cd));
+				__m256 ry = _mm256_fmadd_ps(by, ct, _mm256_mul_ps(ay, cd));
+				__m256 rz = _mm256_fmadd_ps(bz, ct, _mm256_mul_ps(az, cd));
+				__m256 rw = _mm256_fmadd_ps(bw, ct, _mm256_mul_ps(aw, cd));
+				transpose_halves(rx, ry, rz, rw);
+				_mm256_storeu_ps(out + i * 4 + 0, rx);
+				_mm256_storeu_ps(out + i * 4 + 8, ry);
+				_mm256_storeu_ps(out + i * 4 + 16, rz);
+				_mm256_storeu_ps(out + i * 4 + 24, rw);
+			}
+			sse::slerp_batch(a + i * 4, b + i * 4, t + i, out + i * 4, n - i);
+		}
+	}
+
+#endif
+
+	inline void slerp_batch(const float* a, const float* b, const float* t, float* out, std::size_t n) {
+#if defined(MATH4D_SIMD)
+		switch (simd::active_backend()) {
+		case simd::Backend::AVX2:	avx2::slerp_batch(a, b, t, out, n); return;
+		case simd::Backend::SSE41:	sse::slerp_batch(a, b, t, out, n); return;
+		default: break;
+		}
+#endif
+		scalar::slerp_batch(a, b, t, out, n);
+	}
+}
+
+	// -----< Batch >------------------------------------------------------------------------------
+
+	// out[i] = slerp(a[i], b[i], t[i]) for arrays of keyframes.
+	// a, b and t must have the same size and out has to hold that many.
+	// out may be the same array as a or b.
+	inline void slerp_batch(std::span<const Quaternion> a, std::span<const Quaternion> b,
+			std::span<const float> t, std::span<Quaternion> out) {
+		MATH4D_TIME(Slerp, a.size());
+		assert(b.size() == a.size() && t.size() == a.size() && out.size() >= a.size());
+		if (a.empty()) return;
+		kernels::slerp_batch(a[0].data(), b[0].data(), t.data(), out[0].data(), a.size());
+	}
+}
@@ -0,0 +1,791 @@
+#pragma once
+#include <atomic>
+#include <cmath>
+#include <type_traits>
+
+// SIMD backend used by Vector4D and Matrix4D.
+//
+// All kernels work on raw row-major float arrays:
+//	vec4 = float[4]
+//	mat4 = float[16], mat4[row * 4 + column]
+// The scalar kernels are templates and also take double arrays. The
+// double versions have AVX kernels, used by Vector<double, 4> and
+// Matrix<double, 4, 4>.
+//
+// The scalar kernels are the reference implementation. The SSE and AVX2
+// kernels must give the same results within rounding.
+//
+// Every kernel is constexpr. In a constant expression the dispatch always
+// picks the scalar kernel, since the intrinsics can not be evaluated there.
+//
+// Define MATH4D_FORCE_SCALAR to compile out every SIMD path.
+//
+// Define MATH4D_DETERMINISTIC for results that are the same bits on every
+// machine and build: the SIMD paths are compiled out (the scalar kernels
+// have a fixed operation order), math4D::sin / cos and the float helpers
+// use the in-library series instead of the C library, and fast-math or
+// excess-precision builds are rejected. FMA contraction also has to be
+// off (-ffp-contract=off, /fp:strict); the MATH4D_DETERMINISTIC CMake
+// option sets both. std::sqrt is kept, IEEE 754 requires it to be
+// correctly rounded.
+
+#if defined(MATH4D_DETERMINISTIC)
+#include <cfloat>
+#if defined(__FAST_MATH__)
+#error "MATH4D_DETERMINISTIC can not be used with -ffast-math"
+#endif
+#if FLT_EVAL_METHOD != 0
+#error "MATH4D_DETERMINISTIC needs float math in float precision (SSE2, not x87)"
+#endif
+#endif
+
+#if (defined(__x86_64__) || defined(_M_X64)) && !defined(MATH4D_FORCE_SCALAR) && !defined(MATH4D_DETERMINISTIC)
+#define MATH4D_SIMD 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// Functions using instructions above the SSE2 baseline have to be marked
+// for GCC and Clang. MSVC allows the intrinsics without a target.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define MATH4D_TARGET_SSE41
+#define MATH4D_TARGET_AVX2
+#else
+#define MATH4D_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define MATH4D_TARGET_AVX2 __attribute__((target("avx2,fma,f16c")))
+#endif
+
+namespace math4D {
+
+	// True in MATH4D_DETERMINISTIC builds.
+#if defined(MATH4D_DETERMINISTIC)
+	constexpr bool deterministic = true;
+#else
+	constexpr bool deterministic = false;
+#endif
+
+namespace simd {
+
+	// -----< Backend >----------------------------------------------------------------------------
+
+	// The instruction sets that kernels can be dispatched to.
+	// Ordered so a higher value is a superset of a lower one.
+	enum class Backend {
+		Scalar = 0,
+		SSE41 = 1,
+		AVX2 = 2
+	};
+
+	// Returns the name of a backend, for logs and benchmarks.
+	inline const char* backend_name(Backend b) {
+		switch (b) {
+		case Backend::SSE41:	return "sse4.1";
+		case Backend::AVX2:		return "avx2+fma";
+		default:				return "scalar";
+		}
+	}
+
+	// Returns the best backend the running CPU (and OS) supports.
+	inline Backend detect_backend() {
+#if defined(MATH4D_SIMD)
+		unsigned int regs[4] = { 0, 0, 0, 0 };
+		unsigned int regs7[4] = { 0, 0, 0, 0 };
+#if defined(_MSC_VER)
+		int r[4];
+		__cpuid(r, 0);
+		int max_leaf = r[0];
+		__cpuidex(r, 1, 0);
+		for (int i = 0; i < 4; i++) regs[i] = (unsigned int)r[i];
+		if (max_leaf >= 7) {
+			__cpuidex(r, 7, 0);
+			for (int i = 0; i < 4; i++) regs7[i] = (unsigned int)r[i];
+		}
+#else
+		if (!__get_cpuid(1, &regs[0], &regs[1], &regs[2], &regs[3])) {
+			return Backend::Scalar;
+		}
+		__get_cpuid_count(7, 0, &regs7[0], &regs7[1], &regs7[2], &regs7[3]);
+#endif
+		bool sse41 = (regs[2] >> 19) & 1;
+		bool fma = (regs[2] >> 12) & 1;
+		bool osxsave = (regs[2] >> 27) & 1;
+		bool avx = (regs[2] >> 28) & 1;
+		bool f16c = (regs[2] >> 29) & 1;
+		bool avx2 = (regs7[1] >> 5) & 1;
+
+		// The OS also has to save the ymm registers on context switches.
+		bool ymm_enabled = false;
+		if (osxsave) {
+#if defined(_MSC_VER)
+			unsigned long long xcr0 = _xgetbv(0);
+#else
+			unsigned int eax, edx;
+			__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+			unsigned long long xcr0 = ((unsigned long long)edx << 32) | eax;
+#endif
+			ymm_enabled = (xcr0 & 6) == 6;
+		}
+
+		if (avx && avx2 && fma && f16c && ymm_enabled) return Backend::AVX2;
+		if (sse41) return Backend::SSE41;
+#endif
+		return Backend::Scalar;
+	}
+
+	// The backend used by the dispatched kernels.
+	// Zero (Scalar) until the detection has run, so calls made during
+	// static initialization fall back to the reference path.
+	inline std::atomic<Backend> g_backend{ detect_backend() };
+
+	// Returns the backend currently in use.
+	inline Backend active_backend() {
+		return g_backend.load(std::memory_order_relaxed);
+	}
+
+	// Selects the backend to use, ex) Backend::Scalar to run the reference path.
+	// Requests above what the CPU supports are lowered to the best supported one.
+	// Returns the backend that was actually selected.
+	inline Backend set_backend(Backend b) {
+		Backend best = detect_backend();
+		if (b > best) b = best;
+		g_backend.store(b, std::memory_order_relaxed);
+		return b;
+	}
+}
+
+namespace kernels {
+
+	// -----< Scalar >-----------------------------------------------------------------------------
+
+	// Reference kernels. The vector and multiply kernels use the same
+	// arithmetic as the original Vector4D / Matrix4D code.
+	namespace scalar {
+
+		template<class T>
+		constexpr void vec4_add(const T* a, const T* b, T* out) {
+			for (int i = 0; i < 4; i++) out[i] = a[i] + b[i];
+		}
+
+		template<class T>
+		constexpr void vec4_sub(const T* a, const T* b, T* out) {
+			for (int i = 0; i < 4; i++) out[i] = a[i] - b[i];
+		}
+
+		template<class T>
+		constexpr void vec4_mul(const T* a, const T* b, T* out) {
+			for (int i = 0; i < 4; i++) out[i] = a[i] * b[i];
+		}
+
+		template<class T>
+		constexpr void vec4_div(const T* a, const T* b, T* out) {
+			for (int i = 0; i < 4; i++) out[i] = a[i] / b[i];
+		}
+
+		template<class T>
+		constexpr void vec4_scale(const T* a, T s, T* out) {
+			for (int i = 0; i < 4; i++) out[i] = a[i] * s;
+		}
+
+		template<class T>
+		constexpr T vec4_dot(const T* a, const T* b) {
+			return a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+		}
+
+		// out = a / |a| over the first n components (3 or 4), the others are
+		// copied. A zero vector stays zero. The scalar backend has no fast
+		// reciprocal square root, so normalize_fast uses this too.
+		inline void vec4_normalize(const float* a, float* out, int n) {
+			float len2 = a[0] * a[0] + a[1] * a[1] + a[2] * a[2];
+			if (n == 4) len2 += a[3] * a[3];
+			float len = std::sqrt(len2);
+			for (int i = 0; i < 4; i++) out[i] = i < n && len > 0 ? a[i] / len : a[i];
+		}
+
+		// out = a * b. out may be the same array as a or b.
+		template<class T>
+		constexpr void mat4_mul(const T* a, const T* b, T* out) {
+			T r[16];
+			for (int i = 0; i < 4; i++) {
+				for (int j = 0; j < 4; j++) {
+					r[i * 4 + j] =	a[i * 4 + 0] * b[0 * 4 + j] +
+									a[i * 4 + 1] * b[1 * 4 + j] +
+									a[i * 4 + 2] * b[2 * 4 + j] +
+									a[i * 4 + 3] * b[3 * 4 + j];
+				}
+			}
+			for (int i = 0; i < 16; i++) out[i] = r[i];
+		}
+
+		// out = m * v. out may be the same array as v.
+		template<class T>
+		constexpr void mat4_mul_vec4(const T* m, const T* v, T* out) {
+			T r[4];
+			for (int i = 0; i < 4; i++) {
+				r[i] = m[i * 4 + 0] * v[0] + m[i * 4 + 1] * v[1] + m[i * 4 + 2] * v[2] + m[i * 4 + 3] * v[3];
+			}
+			for (int i = 0; i < 4; i++) out[i] = r[i];
+		}
+
+		// out = transpose of m. out may be the same array as m.
+		template<class T>
+		constexpr void mat4_transpose(const T* m, T* out) {
+			T r[16];
+			for (int i = 0; i < 4; i++) {
+				for (int j = 0; j < 4; j++) {
+					r[j * 4 + i] = m[i * 4 + j];
+				}
+			}
+			for (int i = 0; i < 16; i++) out[i] = r[i];
+		}
+
+		// The six 2x2 determinants of the two upper lines (s) and the two
+		// lower lines (c). Both the determinant and the inverse are built
+		// from these, so every partial product is computed once.
+		template<class T>
+		struct Subdeterminants {
+			T s[6];
+			T c[6];
+		};
+
+		template<class T>
+		constexpr Subdeterminants<T> mat4_subdeterminants(const T* m) {
+			Subdeterminants<T> d{};
+			d.s[0] = m[0] * m[5] - m[4] * m[1];
+			d.s[1] = m[0] * m[6] - m[4] * m[2];
+			d.s[2] = m[0] * m[7] - m[4] * m[3];
+			d.s[3] = m[1] * m[6] - m[5] * m[2];
+			d.s[4] = m[1] * m[7] - m[5] * m[3];
+			d.s[5] = m[2] * m[7] - m[6] * m[3];
+
+			d.c[0] = m[8] * m[13] - m[12] * m[9];
+			d.c[1] = m[8] * m[14] - m[12] * m[10];
+			d.c[2] = m[8] * m[15] - m[12] * m[11];
+			d.c[3] = m[9] * m[14] - m[13] * m[10];
+			d.c[4] = m[9] * m[15] - m[13] * m[11];
+			d.c[5] = m[10] * m[15] - m[14] * m[11];
+			return d;
+		}
+
+		template<class T>
+		constexpr T mat4_determinant(const Subdeterminants<T>& d) {
+			return d.s[0] * d.c[5] - d.s[1] * d.c[4] + d.s[2] * d.c[3]
+				 + d.s[3] * d.c[2] - d.s[4] * d.c[1] + d.s[5] * d.c[0];
+		}
+
+		template<class T>
+		constexpr T mat4_determinant(const T* m) {
+			return mat4_determinant(mat4_subdeterminants(m));
+		}
+
+		// out = inverse of m. out may be the same array as m.
+		// Returns false, and leaves out untouched, if m can not be inverted.
+		template<class T>
+		constexpr bool mat4_inverse(const T* m, T* out) {
+			Subdeterminants<T> d = mat4_subdeterminants(m);
+			T inv_det = T(1) / mat4_determinant(d);
+			// Catches det = 0 (inf), NaN and a det so small that 1 / det overflows.
+			if (!(inv_det - inv_det == T(0))) return false;
+
+			const T* s = d.s;
+			const T* c = d.c;
+			T r[16];
+			r[0]  = ( m[5] * c[5] - m[6] * c[4] + m[7] * c[3]) * inv_det;
+			r[1]  = (-m[1] * c[5] + m[2] * c[4] - m[3] * c[3]) * inv_det;
+			r[2]  = ( m[13] * s[5] - m[14] * s[4] + m[15] * s[3]) * inv_det;
+			r[3]  = (-m[9] * s[5] + m[10] * s[4] - m[11] * s[3]) * inv_det;
+
+			r[4]  = (-m[4] * c[5] + m[6] * c[2] - m[7] * c[1]) * inv_det;
+			r[5]  = ( m[0] * c[5] - m[2] * c[2] + m[3] * c[1]) * inv_det;
+			r[6]  = (-m[12] * s[5] + m[14] * s[2] - m[15] * s[1]) * inv_det;
+			r[7]  = ( m[8] * s[5] - m[10] * s[2] + m[11] * s[1]) * inv_det;
+
+			r[8]  = ( m[4] * c[4] - m[5] * c[2] + m[7] * c[0]) * inv_det;
+			r[9]  = (-m[0] * c[4] + m[1] * c[2] - m[3] * c[0]) * inv_det;
+			r[10] = ( m[12] * s[4] - m[13] * s[2] + m[15] * s[0]) * inv_det;
+			r[11] = (-m[8] * s[4] + m[9] * s[2] - m[11] * s[0]) * inv_det;
+
+			r[12] = (-m[4] * c[3] + m[5] * c[1] - m[6] * c[0]) * inv_det;
+			r[13] = ( m[0] * c[3] - m[1] * c[1] + m[2] * c[0]) * inv_det;
+			r[14] = (-m[12] * s[3] + m[13] * s[1] - m[14] * s[0]) * inv_det;
+			r[15] = ( m[8] * s[3] - m[9] * s[1] + m[10] * s[0]) * inv_det;
+
+			for (int i = 0; i < 16; i++) out[i] = r[i];
+			return true;
+		}
+	}
+
+#if defined(MATH4D_SIMD)
+
+	// -----< SSE >--------------------------------------------------------------------------------
+
+	// The vector kernels only use SSE2, which every x86-64 CPU has, so they
+	// are called directly. The matrix kernels use SSE3/SSE4.1 and are dispatched.
+	// Vector arguments have to be 16-byte aligned.
+	namespace sse {
+
+		inline void vec4_add(const float* a, const float* b, float* out) {
+			_mm_store_ps(out, _mm_add_ps(_mm_load_ps(a), _mm_load_ps(b)));
+		}
+
+		inline void vec4_sub(const float* a, const float* b, float* out) {
+			_mm_store_ps(out, _mm_sub_ps(_mm_load_ps(a), _mm_load_ps(b)));
+		}
+
+		inline void vec4_mul(const float* a, const float* b, float* out) {
+			_mm_store_ps(out, _mm_mul_ps(_mm_load_ps(a), _mm_load_ps(b)));
+		}
+
+		inline void vec4_div(const float* a, const float* b, float* out) {
+			_mm_store_ps(out, _mm_div_ps(_mm_load_ps(a), _mm_load_ps(b)));
+		}
+
+		inline void vec4_scale(const float* a, float s, float* out) {
+			_mm_store_ps(out, _mm_mul_ps(_mm_load_ps(a), _mm_set1_ps(s)));
+		}
+
+		inline float vec4_dot(const float* a, const float* b) {
+			__m128 p = _mm_mul_ps(_mm_load_ps(a), _mm_load_ps(b));
+			// (x + z, y + w, ...) then (x + z) + (y + w).
+			__m128 s = _mm_add_ps(p, _mm_movehl_ps(p, p));
+			s = _mm_add_ss(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 1, 1, 1)));
+			return _mm_cvtss_f32(s);
+		}
+
+		// Squared length of the first n components (3 or 4) in all lanes.
+		inline __m128 length_squared(__m128 v, int n) {
+			__m128 p = _mm_mul_ps(v, v);
+			if (n == 3) p = _mm_and_ps(p, _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0)));
+			__m128 s = _mm_add_ps(p, _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 3, 0, 1)));
+			return _mm_add_ps(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 0, 3, 2)));
+		}
+
+		// r where the length is usable, v elsewhere (zero vectors, and w when n is 3).
+		inline __m128 select_normalized(__m128 v, __m128 r, __m128 usable, int n) {
+			if (n == 3) usable = _mm_and_ps(usable, _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0)));
+			return _mm_or_ps(_mm_and_ps(usable, r), _mm_andnot_ps(usable, v));
+		}
+
+		// v / sqrt(|v|^2). The square root and division are correctly rounded;
+		// with the rounding of the sum of squares every component is within
+		// 2e-7 of the exact unit vector. Vectors whose squared length
+		// underflows to zero (shorter than about 1e-19) are returned as they are.
+		inline __m128 normalize(__m128 v, int n) {
+			__m128 len2 = length_squared(v, n);
+			__m128 r = _mm_div_ps(v, _mm_sqrt_ps(len2));
+			return select_normalized(v, r, _mm_cmpgt_ps(len2, _mm_setzero_ps()), n);
+		}
+
+		// v * rsqrt(|v|^2) with one Newton-Raphson step, y' = y * (1.5 - 0.5 * x * y * y).
+		// rsqrtps is good to 1.5 * 2^-12 and the step squares that, so every
+		// component is within 6e-7 of the exact unit vector on any x86 CPU
+		// (3e-7 measured). rsqrtps flushes denormals, so vectors shorter than
+		// about 1e-19 are returned as they are.
+		inline __m128 normalize_fast(__m128 v, int n) {
+			__m128 len2 = length_squared(v, n);
+			__m128 y = _mm_rsqrt_ps(len2);
+			__m128 half_x_yy = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), len2), _mm_mul_ps(y, y));
+			y = _mm_mul_ps(y, _mm_sub_ps(_mm_set1_ps(1.5f), half_x_yy));
+			return select_normalized(v, _mm_mul_ps(v, y), _mm_cmpge_ps(len2, _mm_set1_ps(1.17549435e-38f)), n);
+		}
+
+		inline void vec4_normalize(const float* a, float* out, int n) {
+			_mm_store_ps(out, normalize(_mm_load_ps(a), n));
+		}
+
+		inline void vec4_normalize_fast(const float* a, float* out, int n) {
+			_mm_store_ps(out, normalize_fast(_mm_load_ps(a), n));
+		}
+
+		// Transposes with the SSE unpack / move sequence.
+		// m and out only have to be 4-byte aligned.
+		inline void mat4_transpose(const float* m, float* out) {
+			__m128 r0 = _mm_loadu_ps(m + 0);
+			__m128 r1 = _mm_loadu_ps(m + 4);
+			__m128 r2 = _mm_loadu_ps(m + 8);
+			__m128 r3 = _mm_loadu_ps(m + 12);
+			_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+			_mm_storeu_ps(out + 0, r0);
+			_mm_storeu_ps(out + 4, r1);
+			_mm_storeu_ps(out + 8, r2);
+			_mm_storeu_ps(out + 12, r3);
+		}
+
+		// Every line of the result is the lines of b scaled by
+		// the values on the same line in a (broadcast) and summed.
+		MATH4D_TARGET_SSE41 inline void mat4_mul(const float* a, const float* b, float* out) {
+			__m128 b0 = _mm_load_ps(b + 0);
+			__m128 b1 = _mm_load_ps(b + 4);
+			__m128 b2 = _mm_load_ps(b + 8);
+			__m128 b3 = _mm_load_ps(b + 12);
+			__m128 r[4];
+			for (int i = 0; i < 4; i++) {
+				__m128 line = _mm_load_ps(a + i * 4);
+				__m128 x = _mm_mul_ps(_mm_shuffle_ps(line, line, _MM_SHUFFLE(0, 0, 0, 0)), b0);
+				__m128 y = _mm_mul_ps(_mm_shuffle_ps(line, line, _MM_SHUFFLE(1, 1, 1, 1)), b1);
+				__m128 z = _mm_mul_ps(_mm_shuffle_ps(line, line, _MM_SHUFFLE(2, 2, 2, 2)), b2);
+				__m128 w = _mm_mul_ps(_mm_shuffle_ps(line, line, _MM_SHUFFLE(3, 3, 3, 3)), b3);
+				r[i] = _mm_add_ps(_mm_add_ps(x, y), _mm_add_ps(z, w));
+			}
+			for (int i = 0; i < 4; i++) _mm_store_ps(out + i * 4, r[i]);
+		}
+
+		// Multiplies every line with v and sums the four products
+		// with two rounds of horizontal adds.
+		MATH4D_TARGET_SSE41 inline void mat4_mul_vec4(const float* m, const float* v, float* out) {
+			__m128 vv = _mm_load_ps(v);
+			__m128 p0 = _mm_mul_ps(_mm_load_ps(m + 0), vv);
+			__m128 p1 = _mm_mul_ps(_mm_load_ps(m + 4), vv);
+			__m128 p2 = _mm_mul_ps(_mm_load_ps(m + 8), vv);
+			__m128 p3 = _mm_mul_ps(_mm_load_ps(m + 12), vv);
+			_mm_store_ps(out, _mm_hadd_ps(_mm_hadd_ps(p0, p1), _mm_hadd_ps(p2, p3)));
+		}
+	}
+
+	// -----< AVX2 / FMA >-------------------------------------------------------------------------
+
+	namespace avx2 {
+
+		// Works on two lines of a at a time. Each 128-bit half of the ymm
+		// register holds one line, the lines of b are duplicated in both halves.
+		MATH4D_TARGET_AVX2 inline void mat4_mul(const float* a, const float* b, float* out) {
+			__m256 b0 = _mm256_broadcast_ps((const __m128*)(b + 0));
+			__m256 b1 = _mm256_broadcast_ps((const __m128*)(b + 4));
+			__m256 b2 = _mm256_broadcast_ps((const __m128*)(b + 8));
+			__m256 b3 = _mm256_broadcast_ps((const __m128*)(b + 12));
+
+			__m256 a01 = _mm256_loadu_ps(a + 0);
+			__m256 a23 = _mm256_loadu_ps(a + 8);
+
+			__m256 r01 = _mm256_mul_ps(_mm256_shuffle_ps(a01, a01, _MM_SHUFFLE(0, 0, 0, 0)), b0);
+			r01 = _mm256_fmadd_ps(_mm256_shuffle_ps(a01, a01, _MM_SHUFFLE(1, 1, 1, 1)), b1, r01);
+			r01 = _mm256_fmadd_ps(_mm256_shuffle_ps(a01, a01, _MM_SHUFFLE(2, 2, 2, 2)), b2, r01);
+			r01 = _mm256_fmadd_ps(_mm256_shuffle_ps(a01, a01, _MM_SHUFFLE(3, 3, 3, 3)), b3, r01);
+
+			__m256 r23 = _mm256_mul_ps(_mm256_shuffle_ps(a23, a23, _MM_SHUFFLE(0, 0, 0, 0)), b0);
+			r23 = _mm256_fmadd_ps(_mm256_shuffle_ps(a23, a23, _MM_SHUFFLE(1, 1, 1, 1)), b1, r23);
+			r23 = _mm256_fmadd_ps(_mm256_shuffle_ps(a23, a23, _MM_SHUFFLE(2, 2, 2, 2)), b2, r23);
+			r23 = _mm256_fmadd_ps(_mm256_shuffle_ps(a23, a23, _MM_SHUFFLE(3, 3, 3, 3)), b3, r23);
+
+			_mm256_storeu_ps(out + 0, r01);
+			_mm256_storeu_ps(out + 8, r23);
+		}
+
+		// Two lines per ymm register, then the same horizontal add tree as SSE.
+		// The lanes come out as (x, z, y, w) and are put back in order.
+		MATH4D_TARGET_AVX2 inline void mat4_mul_vec4(const float* m, const float* v, float* out) {
+			__m256 vv = _mm256_broadcast_ps((const __m128*)v);
+			__m256 p01 = _mm256_mul_ps(_mm256_loadu_ps(m + 0), vv);
+			__m256 p23 = _mm256_mul_ps(_mm256_loadu_ps(m + 8), vv);
+			__m256 h = _mm256_hadd_ps(p01, p23);
+			__m128 r = _mm_hadd_ps(_mm256_castps256_ps128(h), _mm256_extractf128_ps(h, 1));
+			_mm_store_ps(out, _mm_shuffle_ps(r, r, _MM_SHUFFLE(3, 1, 2, 0)));
+		}
+
+		// Double versions. A double4 fills one ymm register, so these are
+		// the float SSE kernels with the registers twice as wide.
+		// Arrays only have to be 8-byte aligned.
+
+		MATH4D_TARGET_AVX2 inline void vec4_add(const double* a, const double* b, double* out) {
+			_mm256_storeu_pd(out, _mm256_add_pd(_mm256_loadu_pd(a), _mm256_loadu_pd(b)));
+		}
+
+		MATH4D_TARGET_AVX2 inline void vec4_sub(const double* a, const double* b, double* out) {
+			_mm256_storeu_pd(out, _mm256_sub_pd(_mm256_loadu_pd(a), _mm256_loadu_pd(b)));
+		}
+
+		MATH4D_TARGET_AVX2 inline void vec4_mul(const double* a, const double* b, double* out) {
+			_mm256_storeu_pd(out, _mm256_mul_pd(_mm256_loadu_pd(a), _mm256_loadu_pd(b)));
+		}
+
+		MATH4D_TARGET_AVX2 inline void vec4_div(const double* a, const double* b, double* out) {
+			_mm256_storeu_pd(out, _mm256_div_pd(_mm256_loadu_pd(a), _mm256_loadu_pd(b)));
+		}
+
+		MATH4D_TARGET_AVX2 inline void vec4_scale(const double* a, double s, double* out) {
+			_mm256_storeu_pd(out, _mm256_mul_pd(_mm256_loadu_pd(a), _mm256_set1_pd(s)));
+		}
+
+		MATH4D_TARGET_AVX2 inline double vec4_dot(const double* a, const double* b) {
+			__m256d p = _mm256_mul_pd(_mm256_loadu_pd(a), _mm256_loadu_pd(b));
+			// (x + z, y + w) then (x + z) + (y + w), the same order as the float kernel.
+			__m128d s = _mm_add_pd(_mm256_castpd256_pd128(p), _mm256_extractf128_pd(p, 1));
+			return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+		}
+
+		// Broadcast per value of a, as in the float SSE kernel.
+		MATH4D_TARGET_AVX2 inline void mat4_mul(const double* a, const double* b, double* out) {
+			__m256d b0 = _mm256_loadu_pd(b + 0);
+			__m256d b1 = _mm256_loadu_pd(b + 4);
+			__m256d b2 = _mm256_loadu_pd(b + 8);
+			__m256d b3 = _mm256_loadu_pd(b + 12);
+			__m256d r[4];
+			for (int i = 0; i < 4; i++) {
+				__m256d line = _mm256_mul_pd(_mm256_broadcast_sd(a + i * 4 + 0), b0);
+				line = _mm256_fmadd_pd(_mm256_broadcast_sd(a + i * 4 + 1), b1, line);
+				line = _mm256_fmadd_pd(_mm256_broadcast_sd(a + i * 4 + 2), b2, line);
+				r[i] = _mm256_fmadd_pd(_mm256_broadcast_sd(a + i * 4 + 3), b3, line);
+			}
+			for (int i = 0; i < 4; i++) _mm256_storeu_pd(out + i * 4, r[i]);
+		}
+
+		// Multiplies every line with v, then sums the products with
+		// one horizontal add and a cross-lane add.
+		MATH4D_TARGET_AVX2 inline void mat4_mul_vec4(const double* m, const double* v, double* out) {
+			__m256d vv = _mm256_loadu_pd(v);
+			__m256d p0 = _mm256_mul_pd(_mm256_loadu_pd(m + 0), vv);
+			__m256d p1 = _mm256_mul_pd(_mm256_loadu_pd(m + 4), vv);
+			__m256d p2 = _mm256_mul_pd(_mm256_loadu_pd(m + 8), vv);
+			__m256d p3 = _mm256_mul_pd(_mm256_loadu_pd(m + 12), vv);
+			// (p0.x + p0.y, p1.x + p1.y, p0.z + p0.w, p1.z + p1.w), same for p2 / p3.
+			__m256d h01 = _mm256_hadd_pd(p0, p1);
+			__m256d h23 = _mm256_hadd_pd(p2, p3);
+			// Low halves of h01 / h23 plus their high halves.
+			__m256d lo = _mm256_permute2f128_pd(h01, h23, 0x20);
+			__m256d hi = _mm256_permute2f128_pd(h01, h23, 0x31);
+			_mm256_storeu_pd(out, _mm256_add_pd(lo, hi));
+		}
+	}
+
+#endif
+
+	// -----< Dispatch >---------------------------------------------------------------------------
+
+	constexpr void vec4_add(const float* a, const float* b, float* out) {
+		if (std::is_constant_evaluated()) {
+			scalar::vec4_add(a, b, out);
+			return;
+		}
+#if defined(MATH4D_SIMD)
+		sse::vec4_add(a, b, out);
+#else
+		scalar::vec4_add(a, b, out);
+#endif
+	}
+
+	constexpr void vec4_sub(const float* a, const float* b, float* out) {
+		if (std::is_constant_evaluated()) {
+			scalar::vec4_sub(a, b, out);
+			return;
+		}
+#if defined(MATH4D_SIMD)
+		sse::vec4_sub(a, b, out);
+#else
+		scalar::vec4_sub(a, b, out);
+#endif
+	}
+
+	constexpr void vec4_mul(const float* a, const float* b, float* out) {
+		if (std::is_constant_evaluated()) {
+			scalar::vec4_mul(a, b, out);
+			return;
+		}
+#if defined(MATH4D_SIMD)
+		sse::vec4_mul(a, b, out);
+#else
+		scalar::vec4_mul(a, b, out);
+#endif
+	}
+
+	constexpr void vec4_div(const float* a, const float* b, float* out) {
+		if (std::is_constant_evaluated()) {
+			scalar::vec4_div(a, b, out);
+			return;
+		}
+#if defined(MATH4D_SIMD)
+		sse::vec4_div(a, b, out);
+#else
+		scalar::vec4_div(a, b, out);
+#endif
+	}
+
+	constexpr void vec4_scale(const float* a, float s, float* out) {
+		if (std::is_constant_evaluated()) {
+			scalar::vec4_scale(a, s, out);
+			return;
+		}
+#if defined(MATH4D_SIMD)
+		sse::vec4_scale(a, s, out);
+#else
+		scalar::vec4_scale(a, s, out);
+#endif
+	}
+
+	constexpr float vec4_dot(const float* a, const float* b) {
+		if (std::is_constant_evaluated()) {
+			return scalar::vec4_dot(a, b);
+		}
+#if defined(MATH4D_SIMD)
+		return sse::vec4_dot(a, b);
+#else
+		return scalar::vec4_dot(a, b);
+#endif
+	}
+
+	// out = a / |a| over the first n components (3 or 4). Not constexpr, std::sqrt is not.
+	inline void vec4_normalize(const float* a, float* out, int n) {
+#if defined(MATH4D_SIMD)
+		sse::vec4_normalize(a, out, n);
+#else
+		scalar::vec4_normalize(a, out, n);
+#endif
+	}
+
+	// As vec4_normalize with rsqrtps and one Newton-Raphson step.
+	inline void vec4_normalize_fast(const float* a, float* out, int n) {
+#if defined(MATH4D_SIMD)
+		sse::vec4_normalize_fast(a, out, n);
+#else
+		scalar::vec4_normalize(a, out, n);
+#endif
+	}
+
+	// out = transpose of m. Only uses SSE, so it is not dispatched.
+	constexpr void mat4_transpose(const float* m, float* out) {
+		if (std::is_constant_evaluated()) {
+			scalar::mat4_transpose(m, out);
+			return;
+		}
+#if defined(MATH4D_SIMD)
+		sse::mat4_transpose(m, out);
+#else
+		scalar::mat4_transpose(m, out);
+#endif
+	}
+
+	// out = a * b, dispatched on the active backend.
+	constexpr void mat4_mul(const float* a, const float* b, float* out) {
+		if (std::is_constant_evaluated()) {
+			scalar::mat4_mul(a, b, out);
+			return;
+		}
+#if defined(MATH4D_SIMD)
+		switch (simd::active_backend()) {
+		case simd::Backend::AVX2:	avx2::mat4_mul(a, b, out); return;
+		case simd::Backend::SSE41:	sse::mat4_mul(a, b, out); return;
+		default: break;
+		}
+#endif
+		scalar::mat4_mul(a, b, out);
+	}
+
+	// out = m * v, dispatched on the active backend.
+	constexpr void mat4_mul_vec4(const float* m, const float* v, float* out) {
+		if (std::is_constant_evaluated()) {
+			scalar::mat4_mul_vec4(m, v, out);
+			return;
+		}
+#if defined(MATH4D_SIMD)
+		switch (simd::active_backend()) {
+		case simd::Backend::AVX2:	avx2::mat4_mul_vec4(m, v, out); return;
+		case simd::Backend::SSE41:	sse::mat4_mul_vec4(m, v, out); return;
+		default: break;
+		}
+#endif
+		scalar::mat4_mul_vec4(m, v, out);
+	}
+
+	// The inverse has no SIMD version yet, every backend uses the scalar kernel.
+	constexpr float mat4_determinant(const float* m) {
+		return scalar::mat4_determinant(m);
+	}
+
+	constexpr bool mat4_inverse(const float* m, float* out) {
+		return scalar::mat4_inverse(m, out);
+	}
+
+	// -----< Dispatch, double >-------------------------------------------------------------------
+
+	// The double kernels need AVX, so they run on the AVX2 backend
+	// and fall back to the scalar kernels on the others.
+	constexpr bool use_avx_double() {
+#if defined(MATH4D_SIMD)
+		return !std::is_constant_evaluated() && simd::active_backend() == simd::Backend::AVX2;
+#else
+		return false;
+#endif
+	}
+
+	constexpr void vec4_add(const double* a, const double* b, double* out) {
+#if defined(MATH4D_SIMD)
+		if (use_avx_double()) {
+			avx2::vec4_add(a, b, out);
+			return;
+		}
+#endif
+		scalar::vec4_add(a, b, out);
+	}
+
+	constexpr void vec4_sub(const double* a, const double* b, double* out) {
+#if defined(MATH4D_SIMD)
+		if (use_avx_double()) {
+			avx2::vec4_sub(a, b, out);
+			return;
+		}
+#endif
+		scalar::vec4_sub(a, b, out);
+	}
+
+	constexpr void vec4_mul(const double* a, const double* b, double* out) {
+#if defined(MATH4D_SIMD)
+		if (use_avx_double()) {
+			avx2::vec4_mul(a, b, out);
+			return;
+		}
+#endif
+		scalar::vec4_mul(a, b, out);
+	}
+
+	constexpr void vec4_div(const double* a, const double* b, double* out) {
+#if defined(MATH4D_SIMD)
+		if (use_avx_double()) {
+			avx2::vec4_div(a, b, out);
+			return;
+		}
+#endif
+		scalar::vec4_div(a, b, out);
+	}
+
+	constexpr void vec4_scale(const double* a, double s, double* out) {
+#if defined(MATH4D_SIMD)
+		if (use_avx_double()) {
+			avx2::vec4_scale(a, s, out);
+			return;
+		}
+#endif
+		scalar::vec4_scale(a, s, out);
+	}
+
+	constexpr double vec4_dot(const double* a, const double* b) {
+#if defined(MATH4D_SIMD)
+		if (use_avx_double()) {
+			return avx2::vec4_dot(a, b);
+		}
+#endif
+		return scalar::vec4_dot(a, b);
+	}
+
+	constexpr void mat4_mul(const double* a, const double* b, double* out) {
+#if defined(MATH4D_SIMD)
+		if (use_avx_double()) {
+			avx2::mat4_mul(a, b, out);
+			return;
+		}
+#endif
+		scalar::mat4_mul(a, b, out);
+	}
+
+	constexpr void mat4_mul_vec4(const double* m, const double* v, double* out) {
+#if defined(MATH4D_SIMD)
+		if (use_avx_double()) {
+			avx2::mat4_mul_vec4(m, v, out);
+			return;
+		}
+#endif
+		scalar::mat4_mul_vec4(m, v, out);
+	}
+}
+}
@@ -0,0 +1,421 @@
+#pragma once
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include "instrument4D.h"
+#include "matrix4D.h"
+#include "parallel4D.h"
+#include "quaternion.h"
+#include "simd4D.h"
+#include "thread_pool.h"
+#include "vector4D.h"
+
+// Vertex skinning: deforms a mesh by a palette of bone transforms.
+//
+// Every vertex is moved by up to 4 (BoneInfluences4) or 8 (BoneInfluences8)
+// bones, each with a weight. skin() with a Matrix4D palette does linear
+// blend skinning: the bone matrices of a vertex are blended by the weights
+// once, and the position and the normal are transformed by the blended
+// matrix in the same pass. The normals come out with unit length:
+//
+//	// One matrix per bone, world(bone) * inverse(bind pose of bone).
+//	std::vector<Matrix4D> palette(bones);
+//	math4D::skin(palette, influences, positions, normals, out_positions, out_normals);
+//
+// skin() with a DualQuaternion palette blends dual quaternions instead,
+// which keeps the volume of joints that twist (linear blending collapses
+// them, the "candy wrapper"). The bones may then only rotate and
+// translate. dual_quaternion_palette() converts a Matrix4D palette.
+//
+// Large meshes are split over the threads of a ThreadPool, see ParallelOptions.
+// The normals are transformed by the blended matrix and not by its inverse
+// transpose, which is only the same for bones without non-uniform scale.
+
+// -----< Dual quaternion >--------------------------------------------------------------------
+
+// A rotation followed by a translation t, stored as the rotation (real)
+// and dual = 0.5 * t * real. Blending dual quaternions and normalizing
+// the result gives a rotation and translation again, unlike matrices.
+struct alignas(32) DualQuaternion {
+	Quaternion real;
+	Quaternion dual{ 0, 0, 0, 0 };
+
+	// The identity transform.
+	constexpr DualQuaternion() noexcept = default;
+
+	constexpr DualQuaternion(const Quaternion& r, const Quaternion& d) noexcept
+		: real(r), dual(d) {
+	}
+
+	// Rotation r followed by the translation t (w ignored).
+	static constexpr DualQuaternion from_rotation_translation(const Quaternion& r, const Vector4D& t) noexcept {
+		return DualQuaternion(r, (Quaternion(t[0], t[1], t[2], 0) * r).scalar(0.5f));
+	}
+
+	// From a Matrix4D that only rotates and translates.
+	static DualQuaternion from_matrix(const Matrix4D& m) noexcept {
+		const float* v = m.data();
+		return from_rotation_translation(Quaternion::from_matrix(m), Vector4D(v[3], v[7], v[11], 0));
+	}
+
+	// Returns the translation, w is 0.
+	constexpr Vector4D translation() const noexcept {
+		Quaternion t = (dual * real.conjugate()).scalar(2);
+		return Vector4D(t[0], t[1], t[2], 0);
+	}
+
+	constexpr Matrix4D to_matrix() const noexcept {
+		Matrix4D m = real.to_matrix();
+		Vector4D t = translation();
+		m.translate(t[0], t[1], t[2]);
+		return m;
+	}
+
+	// Rotates and translates a point. The w value of the point is kept.
+	constexpr Vector4D transform_point(const Vector4D& p) const noexcept {
+		Vector4D r = real * p;
+		Vector4D t = translation();
+		return Vector4D(r[0] + t[0], r[1] + t[1], r[2] + t[2], r[3]);
+	}
+};
+
+static_assert(sizeof(DualQuaternion) == 8 * sizeof(float), "DualQuaternion must be exactly eight floats");
+
+namespace math4D {
+
+	// The bones that move one vertex and their weights. The weights should
+	// sum to 1. Unused slots have weight 0, their bone index is still read
+	// and has to be a valid one (0 is fine).
+	template<std::size_t N>
+	struct BoneInfluences {
+		static_assert(N == 4 || N == 8, "skinning supports 4 or 8 influences per vertex");
+
+		float weights[N] = {};
+		std::uint16_t bones[N] = {};
+	};
+}
+
+using BoneInfluences4 = math4D::BoneInfluences<4>;
+using BoneInfluences8 = math4D::BoneInfluences<8>;
+
+namespace math4D {
+namespace kernels {
+
+	// The kernels take the palette as raw floats (16 per Matrix4D, 8 per
+	// DualQuaternion) and the points as 4 floats each. normals and
+	// out_normals are nullptr when there are no normals. out may be the
+	// same array as the input.
+
+	namespace scalar {
+
+		template<std::size_t N>
+		inline void skin_linear(const float* palette, const BoneInfluences<N>* influences, const float* positions,
+				const float* normals, float* out_positions, float* out_normals, std::size_t n) {
+			for (std::size_t i = 0; i < n; i++) {
+				float m[16] = {};
+				for (std::size_t k = 0; k < N; k++) {
+					float w = influences[i].weights[k];
+					const float* b = palette + (std::size_t)influences[i].bones[k] * 16;
+					for (int j = 0; j < 16; j++) m[j] += w * b[j];
+				}
+				float r[4];
+				mat4_mul_vec4(m, positions + i * 4, r);
+				for (int c = 0; c < 4; c++) out_positions[i * 4 + c] = r[c];
+				if (normals != nullptr) {
+					mat4_mul_vec4(m, normals + i * 4, r);
+					vec4_normalize(r, out_normals + i * 4, 3);
+				}
+			}
+		}
+
+		template<std::size_t N>
+		inline void skin_dual_quaternion(const float* palette, const BoneInfluences<N>* influences, const float* positions,
+				const float* normals, float* out_positions, float* out_normals, std::size_t n) {
+			for (std::size_t i = 0; i < n; i++) {
+				// q and -q are the same rotation. Every bone is flipped to the
+				// side of the first one, so the blend does not take the long way.
+				const float* first = palette + (std::size_t)influences[i].bones[0] * 8;
+				float r[4] = {}, d[4] = {};
+				for (std::size_t k = 0; k < N; k++) {
+					const float* q = palette + (std::size_t)influences[i].bones[k] * 8;
+					float w = influences[i].weights[k];
+					if (vec4_dot(q, first) < 0) w = -w;
+					for (int c = 0; c < 4; c++) {
+						r[c] += w * q[c];
+						d[c] += w * q[4 + c];
+					}
+				}
+				float len2 = vec4_dot(r, r);
+				float inv = len2 > 0 ? 1 / std::sqrt(len2) : 0;
+				for (int c = 0; c < 4; c++) {
+					r[c] *= inv;
+					d[c] *= inv;
+				}
+
+				// translation = 2 * (r.w * d.xyz - d.w * r.xyz + r.xyz x d.xyz)
+				float t[3] = {
+					2 * (r[3] * d[0] - d[3] * r[0] + r[1] * d[2] - r[2] * d[1]),
+					2 * (r[3] * d[1] - d[3] * r[1] + r[2] * d[0] - r[0] * d[2]),
+					2 * (r[3] * d[2] - d[3] * r[2] + r[0] * d[1] - r[1] * d[0])
+				};
+				Quaternion rotation(r[0], r[1], r[2], r[3]);
+				const float* p = positions + i * 4;
+				Vector4D rp = rotation * Vector4D(p[0], p[1], p[2], p[3]);
+				for (int c = 0; c < 3; c++) out_positions[i * 4 + c] = rp[c] + t[c];
+				out_positions[i * 4 + 3] = rp[3];
+				if (normals != nullptr) {
+					const float* nv = normals + i * 4;
+					Vector4D rn = rotation * Vector4D(nv[0], nv[1], nv[2], nv[3]);
+					for (int c = 0; c < 4; c++) out_normals[i * 4 + c] = rn[c];
+				}
+			}
+		}
+	}
+
+#if defined(MATH4D_SIMD)
+
+	namespace sse {
+
+		// The blended matrix times v, as mat4_mul_vec4.
+		MATH4D_TARGET_SSE41 inline __m128 blended_mul_vec4(__m128 r0, __m128 r1, __m128 r2, __m128 r3, __m128 v) {
+			return _mm_hadd_ps(_mm_hadd_ps(_mm_mul_ps(r0, v), _mm_mul_ps(r1, v)),
+							   _mm_hadd_ps(_mm_mul_ps(r2, v), _mm_mul_ps(r3, v)));
+		}
+
+		// a x b in x, y and z, 0 in w.
+		inline __m128 cross3(__m128 a, __m128 b) {
+			__m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+			__m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+			__m128 c = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+			return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+		}
+
+		// One vertex per iteration, the four lines of the blended matrix in four registers.
+		template<std::size_t N>
+		MATH4D_TARGET_SSE41 inline void skin_linear(const float* palette, const BoneInfluences<N>* influences, const float* positions,
+				const float* normals, float* out_positions, float* out_normals, std::size_t n) {
+			for (std::size_t i = 0; i < n; i++) {
+				__m128 r0 = _mm_setzero_ps(), r1 = _mm_setzero_ps(), r2 = _mm_setzero_ps(), r3 = _mm_setzero_ps();
+				for (std::size_t k = 0; k < N; k++) {
+					__m128 w = _mm_set1_ps(influences[i].weights[k]);
+					const float* b = palette + (std::size_t)influences[i].bones[k] * 16;
+					r0 = _mm_add_ps(r0, _mm_mul_ps(w, _mm_load_ps(b + 0)));
+					r1 = _mm_add_ps(r1, _mm_mul_ps(w, _mm_load_ps(b + 4)));
+					r2 = _mm_add_ps(r2, _mm_mul_ps(w, _mm_load_ps(b + 8)));
+					r3 = _mm_add_ps(r3, _mm_mul_ps(w, _mm_load_ps(b + 12)));
+				}
+				_mm_store_ps(out_positions + i * 4, blended_mul_vec4(r0, r1, r2, r3, _mm_load_ps(positions + i * 4)));
+				if (normals != nullptr) {
+					__m128 nv = blended_mul_vec4(r0, r1, r2, r3, _mm_load_ps(normals + i * 4));
+					_mm_store_ps(out_normals + i * 4, normalize(nv, 3));
+				}
+			}
+		}
+
+		// One vertex per iteration, the blended real and dual parts in two registers.
+		template<std::size_t N>
+		MATH4D_TARGET_SSE41 inline void skin_dual_quaternion(const float* palette, const BoneInfluences<N>* influences, const float* positions,
+				const float* normals, float* out_positions, float* out_normals, std::size_t n) {
+			const __m128 sign_bit = _mm_set1_ps(-0.0f);
+			const __m128 zero = _mm_setzero_ps();
+			for (std::size_t i = 0; i < n; i++) {
+				__m128 first = _mm_load_ps(palette + (std::size_t)influences[i].bones[0] * 8);
+				__m128 r = zero, d = zero;
+				for (std::size_t k = 0; k < N; k++) {
+					const float* q = palette + (std::size_t)influences[i].bones[k] * 8;
+					__m128 real = _mm_load_ps(q);
+					__m128 sign = _mm_and_ps(_mm_dp_ps(real, first, 0xff), sign_bit);
+					__m128 w = _mm_xor_ps(_mm_set1_ps(influences[i].weights[k]), sign);
+					r = _mm_add_ps(r, _mm_mul_ps(w, real));
+					d = _mm_add_ps(d, _mm_mul_ps(w, _mm_load_ps(q + 4)));
+				}
+				__m128 len2 = _mm_dp_ps(r, r, 0xff);
+				__m128 inv = _mm_and_ps(_mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(len2)), _mm_cmpgt_ps(len2, zero));
+				r = _mm_mul_ps(r, inv);
+				d = _mm_mul_ps(d, inv);
+
+				__m128 rw = _mm_shuffle_ps(r, r, _MM_SHUFFLE(3, 3, 3, 3));
+				__m128 dw = _mm_shuffle_ps(d, d, _MM_SHUFFLE(3, 3, 3, 3));
+				// The w values of rw * d and dw * r cancel, so t.w is 0.
+				__m128 t = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(rw, d), _mm_mul_ps(dw, r)), cross3(r, d));
+				t = _mm_add_ps(t, t);
+
+				// v + w * c + r x c with c = 2 * (r x v), as Quaternion * Vector4D.
+				__m128 p = _mm_load_ps(positions + i * 4);
+				__m128 c = cross3(r, p);
+				c = _mm_add_ps(c, c);
+				p = _mm_add_ps(_mm_add_ps(p, _mm_mul_ps(rw, c)), cross3(r, c));
+				_mm_store_ps(out_positions + i * 4, _mm_add_ps(p, t));
+				if (normals != nullptr) {
+					__m128 nv = _mm_load_ps(normals + i * 4);
+					c = cross3(r, nv);
+					c = _mm_add_ps(c, c);
+					_mm_store_ps(out_normals + i * 4, _mm_add_ps(_mm_add_ps(nv, _mm_mul_ps(rw, c)), cross3(r, c)));
+				}
+			}
+		}
+	}
+
+	namespace avx2 {
+
+		// The blended matrix in two registers, two lines each, so blending
+		// a bone takes two multiply-adds instead of four multiplies and four adds.
+		// The product with v is the same horizontal add tree as mat4_mul_vec4.
+		template<std::size_t N>
+		MATH4D_TARGET_AVX2 inline void skin_linear(const float* palette, const BoneInfluences<N>* influences, const float* positions,
+				const float* normals, float* out_positions, float* out_normals, std::size_t n) {
+			for (std::size_t i = 0; i < n; i++) {
+				__m256 r01 = _mm256_setzero_ps(), r23 = _mm256_setzero_ps();
+				for (std::size_t k = 0; k < N; k++) {
+					__m256 w = _mm256_set1_ps(influences[i].weights[k]);
+					const float* b = palette + (std::size_t)influences[i].bones[k] * 16;
+					r01 = _mm256_fmadd_ps(w, _mm256_loadu_ps(b + 0), r01);
+					r23 = _mm256_fmadd_ps(w, _mm256_loadu_ps(b + 8), r23);
+				}
+
+				__m256 vv = _mm256_broadcast_ps((const __m128*)(positions + i * 4));
+				__m256 h = _mm256_hadd_ps(_mm256_mul_ps(r01, vv), _mm256_mul_ps(r23, vv));
+				__m128 p = _mm_hadd_ps(_mm256_castps256_ps128(h), _mm256_extractf128_ps(h, 1));
+				_mm_store_ps(out_positions + i * 4, _mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 1, 2, 0)));
+				if (normals != nullptr) {
+					vv = _mm256_broadcast_ps((const __m128*)(normals + i * 4));
+					h = _mm256_hadd_ps(_mm256_mul_ps(r01, vv), _mm256_mul_ps(r23, vv));
+					__m128 nv = _mm_hadd_ps(_mm256_castps256_ps128(h), _mm256_extractf128_ps(h, 1));
+					_mm_store_ps(out_normals + i * 4, sse::normalize(_mm_shuffle_ps(nv, nv, _MM_SHUFFLE(3, 1, 2, 0)), 3));
+				}
+			}
+		}
+	}
+
+#endif
+
+	// -----< Dispatch >---------------------------------------------------------------------------
+
+	template<std::size_t N>
+	inline void skin_linear(const float* palette, const BoneInfluences<N>* influences, const float* positions,
+			const float* normals, float* out_positions, float* out_normals, std::size_t n) {
+#if defined(MATH4D_SIMD)
+		switch (simd::active_backend()) {
+		case simd::Backend::AVX2:	avx2::skin_linear(palette, influences, positions, normals, out_positions, out_normals, n); return;
+		case simd::Backend::SSE41:	sse::skin_linear(palette, influences, positions, normals, out_positions, out_normals, n); return;
+		default: break;
+		}
+#endif
+		scalar::skin_linear(palette, influences, positions, normals, out_positions, out_normals, n);
+	}
+
+	// There is no AVX2 version: a dual quaternion fits one SSE register per
+	// part, and most of the work per vertex is the shuffles of the cross products.
+	template<std::size_t N>
+	inline void skin_dual_quaternion(const float* palette, const BoneInfluences<N>* influences, const float* positions,
+			const float* normals, float* out_positions, float* out_normals, std::size_t n) {
+#if defined(MATH4D_SIMD)
+		if (simd::active_backend() >= simd::Backend::SSE41) {
+			sse::skin_dual_quaternion(palette, influences, positions, normals, out_positions, out_normals, n);
+			return;
+		}
+#endif
+		scalar::skin_dual_quaternion(palette, influences, positions, normals, out_positions, out_normals, n);
+	}
+}
+
+	namespace detail {
+
+		// Splits the vertices in chunks on the pool, as parallel_transform(),
+		// and calls kernel(first, count) for every chunk.
+		template<class F>
+		inline void skin_parallel(std::size_t n, const Vector4D* out, const ParallelOptions& options, F kernel) {
+			if (n == 0) return;
+			ThreadPool& pool = options.pool != nullptr ? *options.pool : ThreadPool::default_pool();
+			std::size_t chunk = options.chunk < points_per_cache_line ? points_per_cache_line : options.chunk;
+			chunk = (chunk + points_per_cache_line - 1) / points_per_cache_line * points_per_cache_line;
+
+			std::size_t lead = ((64 - ((std::uintptr_t)out & 63)) & 63) / sizeof(Vector4D);
+			if (lead > n) lead = n;
+			if (lead > 0) kernel(0, lead);
+
+			pool.parallel_for(lead, n, chunk, [&](std::size_t begin, std::size_t end) {
+				kernel(begin, end - begin);
+			});
+		}
+
+		template<std::size_t N, class Palette, class Kernel>
+		inline void skin(std::span<const Palette> palette, std::span<const BoneInfluences<N>> influences,
+				std::span<const Vector4D> positions, std::span<const Vector4D> normals,
+				std::span<Vector4D> out_positions, std::span<Vector4D> out_normals,
+				const ParallelOptions& options, Kernel kernel) {
+			MATH4D_TIME(Skin, positions.size());
+			assert(influences.size() == positions.size() && out_positions.size() >= positions.size());
+			assert(normals.empty() || (normals.size() == positions.size() && out_normals.size() >= normals.size()));
+			if (positions.empty()) return;
+			assert(!palette.empty());
+
+			const float* bones = reinterpret_cast<const float*>(palette.data());
+			const float* in_normals = normals.empty() ? nullptr : normals[0].data();
+			float* result_normals = normals.empty() ? nullptr : out_normals[0].data();
+			skin_parallel(positions.size(), out_positions.data(), options, [&](std::size_t first, std::size_t count) {
+				kernel(bones, influences.data() + first, positions[first].data(),
+					in_normals != nullptr ? in_normals + first * 4 : nullptr,
+					out_positions[first].data(),
+					result_normals != nullptr ? result_normals + first * 4 : nullptr, count);
+			});
+		}
+	}
+
+	// -----< Linear blend skinning >--------------------------------------------------------------
+
+	// Moves every vertex by the bones of palette it is bound to: the bone
+	// matrices are blended by the weights and the position and the normal
+	// are transformed by the blend. The normals are normalized in x, y and z.
+	// normals may be empty, then out_normals is not used. influences, positions
+	// and normals have the same size and the outputs hold as many; they may
+	// be the same lists as the inputs. Every bone index has to be < palette.size().
+	inline void skin(std::span<const Matrix4D> palette, std::span<const BoneInfluences4> influences,
+			std::span<const Vector4D> positions, std::span<const Vector4D> normals,
+			std::span<Vector4D> out_positions, std::span<Vector4D> out_normals,
+			const ParallelOptions& options = ParallelOptions()) {
+		detail::skin(palette, influences, positions, normals, out_positions, out_normals, options,
+			kernels::skin_linear<4>);
+	}
+
+	inline void skin(std::span<const Matrix4D> palette, std::span<const BoneInfluences8> influences,
+			std::span<const Vector4D> positions, std::span<const Vector4D> normals,
+			std::span<Vector4D> out_positions, std::span<Vector4D> out_normals,
+			const ParallelOptions& options = ParallelOptions()) {
+		detail::skin(palette, influences, positions, normals, out_positions, out_normals, options,
+			kernels::skin_linear<8>);
+	}
+
+	// -----< Dual quaternion skinning >-----------------------------------------------------------
+
+	// As skin() with matrices, but blends the dual quaternions of the bones,
+	// normalizes the blend and rotates and translates the position by it.
+	// The normals are only rotated, so unit normals stay unit length.
+	inline void skin(std::span<const DualQuaternion> palette, std::span<const BoneInfluences4> influences,
+			std::span<const Vector4D> positions, std::span<const Vector4D> normals,
+			std::span<Vector4D> out_positions, std::span<Vector4D> out_normals,
+			const ParallelOptions& options = ParallelOptions()) {
+		detail::skin(palette, influences, positions, normals, out_positions, out_normals, options,
+			kernels::skin_dual_quaternion<4>);
+	}
+
+	inline void skin(std::span<const DualQuaternion> palette, std::span<const BoneInfluences8> influences,
+			std::span<const Vector4D> positions, std::span<const Vector4D> normals,
+			std::span<Vector4D> out_positions, std::span<Vector4D> out_normals,
+			const ParallelOptions& options = ParallelOptions()) {
+		detail::skin(palette, influences, positions, normals, out_positions, out_normals, options,
+			kernels::skin_dual_quaternion<8>);
+	}
+
+	// Converts a palette of matrices that only rotate and translate.
+	// out has to hold palette.size() dual quaternions.
+	inline void dual_quaternion_palette(std::span<const Matrix4D> palette, std::span<DualQuaternion> out) {
+		assert(out.size() >= palette.size());
+		for (std::size_t i = 0; i < palette.size(); i++) {
+			out[i] = DualQuaternion::from_matrix(palette[i]);
+		}
+	}
+}
@@ -0,0 +1,223 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A work-stealing thread pool.
+//
+// Every worker has its own task queue. A worker takes new tasks from the
+// back of its own queue (the most recent, still in cache) and steals from
+// the front of the other queues (the oldest, usually the biggest ranges)
+// when its own queue is empty.
+//
+// parallel_for() splits a range in halves until the pieces are no bigger
+// than the grain size. The halves are pushed on the queue of the thread
+// doing the split, so idle workers steal big pieces and split them further.
+
+namespace math4D {
+
+	class ThreadPool {
+	private:
+		// Padded to a cache line so two queues never share one.
+		struct alignas(64) Queue {
+			std::mutex mutex;
+			std::deque<std::function<void()>> tasks;
+		};
+
+		std::vector<std::unique_ptr<Queue>> queues;
+		std::vector<std::thread> threads;
+
+		std::atomic<std::size_t> queued{ 0 };
+		std::atomic<std::size_t> next_queue{ 0 };
+		std::mutex sleep_mutex;
+		std::condition_variable sleep_cv;
+		bool stopping = false;
+
+		// Index of the worker running on this thread, or -1 for
+		// threads that do not belong to this pool.
+		int worker_index() const {
+			return current_pool() == this ? current_index() : -1;
+		}
+
+		static const ThreadPool*& current_pool() {
+			thread_local const ThreadPool* pool = nullptr;
+			return pool;
+		}
+
+		static int& current_index() {
+			thread_local int index = -1;
+			return index;
+		}
+
+		// Takes a task from the back of the own queue or steals one from
+		// the front of another queue. Returns false if all queues are empty.
+		bool pop_task(int self, std::function<void()>& task) {
+			if (queues.empty()) return false;
+			if (self >= 0) {
+				Queue& own = *queues[self];
+				std::lock_guard<std::mutex> lock(own.mutex);
+				if (!own.tasks.empty()) {
+					task = std::move(own.tasks.back());
+					own.tasks.pop_back();
+					queued.fetch_sub(1, std::memory_order_relaxed);
+					return true;
+				}
+			}
+			std::size_t count = queues.size();
+			std::size_t start = self >= 0 ? (std::size_t)self + 1 : next_queue.load(std::memory_order_relaxed);
+			for (std::size_t i = 0; i < count; i++) {
+				Queue& victim = *queues[(start + i) % count];
+				std::lock_guard<std::mutex> lock(victim.mutex);
+				if (!victim.tasks.empty()) {
+					task = std::move(victim.tasks.front());
+					victim.tasks.pop_front();
+					queued.fetch_sub(1, std::memory_order_relaxed);
+					return true;
+				}
+			}
+			return false;
+		}
+
+		void worker_loop(int index) {
+			current_pool() = this;
+			current_index() = index;
+			std::function<void()> task;
+			while (true) {
+				if (pop_task(index, task)) {
+					task();
+					task = nullptr;
+					continue;
+				}
+				std::unique_lock<std::mutex> lock(sleep_mutex);
+				sleep_cv.wait(lock, [this] { return stopping || queued.load() != 0; });
+				if (stopping && queued.load() == 0) return;
+			}
+		}
+
+	public:
+
+		// -----< Constructors >-----------------------------------------------------------------------
+
+		// Creates a pool with a number of worker threads.
+		// 0 (zero) gives one worker less than the number of hardware threads,
+		// since the thread calling parallel_for() also does work.
+		explicit ThreadPool(unsigned int workers = 0) {
+			if (workers == 0) {
+				unsigned int hw = std::thread::hardware_concurrency();
+				workers = hw > 1 ? hw - 1 : 0;
+			}
+			for (unsigned int i = 0; i < workers; i++) {
+				queues.push_back(std::make_unique<Queue>());
+			}
+			for (unsigned int i = 0; i < workers; i++) {
+				threads.emplace_back(&ThreadPool::worker_loop, this, (int)i);
+			}
+		}
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		// Waits for the queued tasks to finish and stops the workers.
+		~ThreadPool() {
+			{
+				std::lock_guard<std::mutex> lock(sleep_mutex);
+				stopping = true;
+			}
+			sleep_cv.notify_all();
+			for (std::thread& t : threads) {
+				t.join();
+			}
+		}
+
+		// -----< Getters >----------------------------------------------------------------------------
+
+		// Returns the number of worker threads.
+		std::size_t size() const {
+			return threads.size();
+		}
+
+		// Returns the number of threads that work on a parallel_for(),
+		// the workers plus the calling thread.
+		std::size_t concurrency() const {
+			return threads.size() + 1;
+		}
+
+		// -----< Tasks >------------------------------------------------------------------------------
+
+		// Queues a task. From a worker the task goes on its own queue,
+		// from other threads the queues are used in turn.
+		void submit(std::function<void()> task) {
+			if (queues.empty()) {
+				task();
+				return;
+			}
+			int self = worker_index();
+			std::size_t target = self >= 0 ? (std::size_t)self
+				: next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+			// Counted before it is pushed, so the count never drops below zero.
+			{
+				std::lock_guard<std::mutex> lock(sleep_mutex);
+				queued.fetch_add(1);
+			}
+			{
+				std::lock_guard<std::mutex> lock(queues[target]->mutex);
+				queues[target]->tasks.push_back(std::move(task));
+			}
+			sleep_cv.notify_one();
+		}
+
+		// Runs one queued task on the calling thread.
+		// Returns false if there was nothing to run.
+		bool run_one() {
+			std::function<void()> task;
+			if (!pop_task(worker_index(), task)) return false;
+			task();
+			return true;
+		}
+
+		// Calls f(begin, end) on sub-ranges of [begin, end) in parallel and
+		// waits until all of them are done. Every split point is begin plus
+		// a multiple of grain, so pieces start on the same alignment as begin.
+		template<class F>
+		void parallel_for(std::size_t begin, std::size_t end, std::size_t grain, F&& f) {
+			if (begin >= end) return;
+			if (grain == 0) grain = 1;
+			if (queues.empty() || end - begin <= grain) {
+				f(begin, end);
+				return;
+			}
+
+			std::atomic<std::size_t> remaining{ end - begin };
+			std::function<void(std::size_t, std::size_t)> run;
+			run = [&](std::size_t b, std::size_t e) {
+				// Split off the upper half until the piece is small enough.
+				while (e - b > grain) {
+					std::size_t chunks = (e - b + grain - 1) / grain;
+					std::size_t mid = b + (chunks / 2) * grain;
+					submit([&run, mid, e] { run(mid, e); });
+					e = mid;
+				}
+				f(b, e);
+				remaining.fetch_sub(e - b, std::memory_order_acq_rel);
+			};
+			run(begin, end);
+
+			// Help with the queued pieces instead of blocking.
+			while (remaining.load(std::memory_order_acquire) != 0) {
+				if (!run_one()) std::this_thread::yield();
+			}
+		}
+
+		// Returns a pool shared by the library, sized for the machine.
+		static ThreadPool& default_pool() {
+			static ThreadPool pool;
+			return pool;
+		}
+	};
+}
@@ -0,0 +1,383 @@
+#pragma once
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <type_traits>
+
+#include "simd4D.h"
+
+// Trigonometry for the rotation builders.
+//
+// math4D::sin / math4D::cos call std::sin / std::cos at runtime and a
+// constexpr implementation when they are evaluated at compile time, so
+// rotation matrices can be built in constant expressions.
+//
+// math4D::sincos is a faster float version for runtime use, with batch
+// kernels for long lists of angles.
+//
+// math4D::sin_float / cos_float / acos_float are the float functions used
+// by Quaternion. In MATH4D_DETERMINISTIC builds these and math4D::sin / cos
+// always use the in-library series, so they do not depend on the C library.
+
+namespace math4D {
+namespace cx {
+
+	// -----< Constexpr >--------------------------------------------------------------------------
+
+	// pi / 2 split in a high and a low part (Cody-Waite), so the range
+	// reduction x - k * pi / 2 keeps full double precision for moderate k.
+	constexpr double pio2_hi = 1.57079632679489655800e+00;
+	constexpr double pio2_lo = 6.12323399573676603587e-17;
+	constexpr double two_over_pi = 6.36619772367581382433e-01;
+
+	// Taylor series for sin(r) and cos(r) on |r| <= pi / 4.
+	// Enough terms for the error to stay below one double ulp.
+	constexpr double sin_kernel(double r) {
+		double r2 = r * r;
+		double term = r;
+		double sum = r;
+		for (int i = 1; i < 12; i++) {
+			term *= -r2 / ((2 * i) * (2 * i + 1));
+			sum += term;
+		}
+		return sum;
+	}
+
+	constexpr double cos_kernel(double r) {
+		double r2 = r * r;
+		double term = 1;
+		double sum = 1;
+		for (int i = 1; i < 12; i++) {
+			term *= -r2 / ((2 * i - 1) * (2 * i));
+			sum += term;
+		}
+		return sum;
+	}
+
+	// Splits x into x = k * pi / 2 + r, |r| <= pi / 4.
+	// Returns the quadrant (k mod 4) and sets r. r is NaN for NaN and
+	// infinite x, and for |k| >= 2^48 (x above about 4e14), where the
+	// reduction has no correct digit left (and k soon does not fit a long long).
+	constexpr int reduce(double x, double& r) {
+		double kf = x * two_over_pi;
+		if (!(kf > -0x1p48 && kf < 0x1p48)) {
+			r = std::numeric_limits<double>::quiet_NaN();
+			return 0;
+		}
+		long long k = (long long)(kf >= 0 ? kf + 0.5 : kf - 0.5);
+		r = (x - k * pio2_hi) - k * pio2_lo;
+		return (int)(k & 3);
+	}
+
+	// Constexpr sin(x), x in radians.
+	constexpr double sin(double x) {
+		double r = 0;
+		switch (reduce(x, r)) {
+		case 0:		return sin_kernel(r);
+		case 1:		return cos_kernel(r);
+		case 2:		return -sin_kernel(r);
+		default:	return -cos_kernel(r);
+		}
+	}
+
+	// Constexpr cos(x), x in radians.
+	constexpr double cos(double x) {
+		double r = 0;
+		switch (reduce(x, r)) {
+		case 0:		return cos_kernel(r);
+		case 1:		return -sin_kernel(r);
+		case 2:		return -cos_kernel(r);
+		default:	return sin_kernel(r);
+		}
+	}
+
+	// Taylor series for asin(x) on |x| <= 0.5.
+	constexpr double asin_kernel(double x) {
+		double x2 = x * x;
+		double c = 1;
+		double power = x;
+		double sum = x;
+		for (int i = 1; i < 30; i++) {
+			c *= (2.0 * i - 1) / (2.0 * i);
+			power *= x2;
+			sum += c * power / (2 * i + 1);
+		}
+		return sum;
+	}
+}
+
+	// -----< Sin / Cos >--------------------------------------------------------------------------
+
+	// sin(x), x in radians. Usable in constant expressions.
+	constexpr double sin(double x) noexcept {
+		if (std::is_constant_evaluated() || deterministic) {
+			return cx::sin(x);
+		}
+		return std::sin(x);
+	}
+
+	// cos(x), x in radians. Usable in constant expressions.
+	constexpr double cos(double x) noexcept {
+		if (std::is_constant_evaluated() || deterministic) {
+			return cx::cos(x);
+		}
+		return std::cos(x);
+	}
+
+	// -----< Float helpers >----------------------------------------------------------------------
+
+	// sin(x) in float, x in radians.
+	inline float sin_float(float x) noexcept {
+		if constexpr (deterministic) {
+			return (float)cx::sin(x);
+		}
+		return std::sin(x);
+	}
+
+	// cos(x) in float, x in radians.
+	inline float cos_float(float x) noexcept {
+		if constexpr (deterministic) {
+			return (float)cx::cos(x);
+		}
+		return std::cos(x);
+	}
+
+	// acos(x) in float, in radians. NaN outside [-1, 1].
+	inline float acos_float(float x) noexcept {
+		if constexpr (deterministic) {
+			constexpr double pi = 3.14159265358979323846;
+			double d = x;
+			if (!(d >= -1 && d <= 1)) return std::numeric_limits<float>::quiet_NaN();
+			if (d > 0.5) return (float)(2 * cx::asin_kernel(std::sqrt((1 - d) * 0.5)));
+			if (d < -0.5) return (float)(pi - 2 * cx::asin_kernel(std::sqrt((1 + d) * 0.5)));
+			return (float)(pi * 0.5 - cx::asin_kernel(d));
+		}
+		return std::acos(x);
+	}
+}
+
+// -----< Fast sincos >------------------------------------------------------------------------
+//
+// Float sin and cos evaluated together, in float precision (the Cephes
+// sinf / cosf polynomials, as used in sse_mathfun). The angle is reduced
+// once and both polynomials share it, so sincos() costs about as much as
+// one std::sin call. The scalar, SSE and AVX2 versions do the same
+// operations; the compiler may fuse some of them into FMAs in the AVX2
+// version, so results can differ in the last bits near zero.
+//
+// Accuracy, measured against std::sin / std::cos in double:
+//	|x| <= 2 * pi		at most 1.5 ULP of the exact result (absolute error below 8e-8)
+//	|x| <= 8192			absolute error below 8e-8
+// Above 8192 the range reduction loses precision, so such angles, NaN
+// and infinities go to sin_float / cos_float. The batch kernels check
+// each block of 4 or 8 angles and run a block that holds one through the
+// scalar version, so every backend gives the same result for them, at
+// any position in the list.
+
+namespace math4D {
+
+	// A sine / cosine pair. Builders that take a SinCos let callers
+	// compute the pair once and reuse it for many matrices.
+	struct SinCos {
+		float s = 0;
+		float c = 1;
+	};
+
+namespace kernels {
+namespace sincos_constants {
+	constexpr float four_over_pi = 1.27323954473516f;
+	constexpr float dp1 = 0.78515625f;
+	constexpr float dp2 = 2.4187564849853515625e-4f;
+	constexpr float dp3 = 3.77489497744594108e-8f;
+	constexpr float sin_p0 = -1.9515295891e-4f;
+	constexpr float sin_p1 = 8.3321608736e-3f;
+	constexpr float sin_p2 = -1.6666654611e-1f;
+	constexpr float cos_p0 = 2.443315711809948e-5f;
+	constexpr float cos_p1 = -1.388731625493765e-3f;
+	constexpr float cos_p2 = 4.166664568298827e-2f;
+}
+
+	namespace scalar {
+
+		inline void sincos(float x, float& s, float& c) {
+			using namespace sincos_constants;
+			// NaN, infinities and angles too large for the reduction below
+			// (the conversion to int would be undefined above 2^31 / 1.27).
+			if (!(std::fabs(x) <= 8192.0f)) {
+				s = math4D::sin_float(x);
+				c = math4D::cos_float(x);
+				return;
+			}
+			std::uint32_t sign_sin = std::bit_cast<std::uint32_t>(x) & 0x80000000u;
+			x = std::fabs(x);
+
+			// Octant, rounded up to an even number so the reduced angle is in [-pi/4, pi/4].
+			std::int32_t j = (std::int32_t)(x * four_over_pi);
+			j = (j + 1) & ~1;
+			float y = (float)j;
+			x = ((x - y * dp1) - y * dp2) - y * dp3;
+
+			sign_sin ^= (std::uint32_t)(j & 4) << 29;
+			std::uint32_t sign_cos = (std::uint32_t)(~(j - 2) & 4) << 29;
+			bool swap = (j & 2) != 0;
+
+			float z = x * x;
+			float pc = ((cos_p0 * z + cos_p1) * z + cos_p2) * z * z - 0.5f * z + 1.0f;
+			float ps = ((sin_p0 * z + sin_p1) * z + sin_p2) * z * x + x;
+
+			float rs = swap ? pc : ps;
+			float rc = swap ? ps : pc;
+			s = std::bit_cast<float>(std::bit_cast<std::uint32_t>(rs) ^ sign_sin);
+			c = std::bit_cast<float>(std::bit_cast<std::uint32_t>(rc) ^ sign_cos);
+		}
+
+		inline void sincos_batch(const float* x, float* s, float* c, std::size_t n) {
+			for (std::size_t i = 0; i < n; i++) {
+				sincos(x[i], s[i], c[i]);
+			}
+		}
+	}
+
+#if defined(MATH4D_SIMD)
+
+	namespace sse {
+
+		// Four angles at once, same steps as scalar::sincos.
+		MATH4D_TARGET_SSE41 inline void sincos(__m128 x, __m128& s, __m128& c) {
+			using namespace sincos_constants;
+			const __m128 sign_mask = _mm_set1_ps(-0.0f);
+			__m128 sign_sin = _mm_and_ps(x, sign_mask);
+			x = _mm_andnot_ps(sign_mask, x);
+
+			__m128i j = _mm_cvttps_epi32(_mm_mul_ps(x, _mm_set1_ps(four_over_pi)));
+			j = _mm_and_si128(_mm_add_epi32(j, _mm_set1_epi32(1)), _mm_set1_epi32(~1));
+			__m128 y = _mm_cvtepi32_ps(j);
+			x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(dp1)));
+			x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(dp2)));
+			x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(dp3)));
+
+			sign_sin = _mm_xor_ps(sign_sin, _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(j, _mm_set1_epi32(4)), 29)));
+			__m128 sign_cos = _mm_castsi128_ps(_mm_slli_epi32(
+				_mm_andnot_si128(_mm_sub_epi32(j, _mm_set1_epi32(2)), _mm_set1_epi32(4)), 29));
+			__m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(j, _mm_set1_epi32(2)), _mm_set1_epi32(2)));
+
+			__m128 z = _mm_mul_ps(x, x);
+			__m128 pc = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(cos_p0), z), _mm_set1_ps(cos_p1));
+			pc = _mm_add_ps(_mm_mul_ps(pc, z), _mm_set1_ps(cos_p2));
+			pc = _mm_mul_ps(_mm_mul_ps(pc, z), z);
+			pc = _mm_add_ps(_mm_sub_ps(pc, _mm_mul_ps(_mm_set1_ps(0.5f), z)), _mm_set1_ps(1.0f));
+			__m128 ps = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(sin_p0), z), _mm_set1_ps(sin_p1));
+			ps = _mm_add_ps(_mm_mul_ps(ps, z), _mm_set1_ps(sin_p2));
+			ps = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(ps, z), x), x);
+
+			s = _mm_xor_ps(_mm_blendv_ps(ps, pc, swap), sign_sin);
+			c = _mm_xor_ps(_mm_blendv_ps(pc, ps, swap), sign_cos);
+		}
+
+		MATH4D_TARGET_SSE41 inline void sincos_batch(const float* x, float* s, float* c, std::size_t n) {
+			const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+			const __m128 limit = _mm_set1_ps(8192.0f);
+			std::size_t i = 0;
+			for (; i + 4 <= n; i += 4) {
+				__m128 vx = _mm_loadu_ps(x + i);
+				// A NaN, an infinity or an angle above 8192 sends the four
+				// angles to the scalar version, which handles them.
+				if (_mm_movemask_ps(_mm_cmple_ps(_mm_and_ps(vx, abs_mask), limit)) != 0xf) {
+					scalar::sincos_batch(x + i, s + i, c + i, 4);
+					continue;
+				}
+				__m128 vs, vc;
+				sincos(vx, vs, vc);
+				_mm_storeu_ps(s + i, vs);
+				_mm_storeu_ps(c + i, vc);
+			}
+			scalar::sincos_batch(x + i, s + i, c + i, n - i);
+		}
+	}
+
+	namespace avx2 {
+
+		// Eight angles at once, same steps as scalar::sincos.
+		MATH4D_TARGET_AVX2 inline void sincos(__m256 x, __m256& s, __m256& c) {
+			using namespace sincos_constants;
+			const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+			__m256 sign_sin = _mm256_and_ps(x, sign_mask);
+			x = _mm256_andnot_ps(sign_mask, x);
+
+			__m256i j = _mm256_cvttps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(four_over_pi)));
+			j = _mm256_and_si256(_mm256_add_epi32(j, _mm256_set1_epi32(1)), _mm256_set1_epi32(~1));
+			__m256 y = _mm256_cvtepi32_ps(j);
+			x = _mm256_sub_ps(x, _mm256_mul_ps(y, _mm256_set1_ps(dp1)));
+			x = _mm256_sub_ps(x, _mm256_mul_ps(y, _mm256_set1_ps(dp2)));
+			x = _mm256_sub_ps(x, _mm256_mul_ps(y, _mm256_set1_ps(dp3)));
+
+			sign_sin = _mm256_xor_ps(sign_sin, _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(j, _mm256_set1_epi32(4)), 29)));
+			__m256 sign_cos = _mm256_castsi256_ps(_mm256_slli_epi32(
+				_mm256_andnot_si256(_mm256_sub_epi32(j, _mm256_set1_epi32(2)), _mm256_set1_epi32(4)), 29));
+			__m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(j, _mm256_set1_epi32(2)), _mm256_set1_epi32(2)));
+
+			__m256 z = _mm256_mul_ps(x, x);
+			__m256 pc = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(cos_p0), z), _mm256_set1_ps(cos_p1));
+			pc = _mm256_add_ps(_mm256_mul_ps(pc, z), _mm256_set1_ps(cos_p2));
+			pc = _mm256_mul_ps(_mm256_mul_ps(pc, z), z);
+			pc = _mm256_add_ps(_mm256_sub_ps(pc, _mm256_mul_ps(_mm256_set1_ps(0.5f), z)), _mm256_set1_ps(1.0f));
+			__m256 ps = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(sin_p0), z), _mm256_set1_ps(sin_p1));
+			ps = _mm256_add_ps(_mm256_mul_ps(ps, z), _mm256_set1_ps(sin_p2));
+			ps = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(ps, z), x), x);
+
+			s = _mm256_xor_ps(_mm256_blendv_ps(ps, pc, swap), sign_sin);
+			c = _mm256_xor_ps(_mm256_blendv_ps(pc, ps, swap), sign_cos);
+		}
+
+		MATH4D_TARGET_AVX2 inline void sincos_batch(const float* x, float* s, float* c, std::size_t n) {
+			const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+			const __m256 limit = _mm256_set1_ps(8192.0f);
+			std::size_t i = 0;
+			for (; i + 8 <= n; i += 8) {
+				__m256 vx = _mm256_loadu_ps(x + i);
+				// Same range check as the SSE version.
+				if (_mm256_movemask_ps(_mm256_cmp_ps(_mm256_and_ps(vx, abs_mask), limit, _CMP_LE_OQ)) != 0xff) {
+					scalar::sincos_batch(x + i, s + i, c + i, 8);
+					continue;
+				}
+				__m256 vs, vc;
+				sincos(vx, vs, vc);
+				_mm256_storeu_ps(s + i, vs);
+				_mm256_storeu_ps(c + i, vc);
+			}
+			sse::sincos_batch(x + i, s + i, c + i, n - i);
+		}
+	}
+
+#endif
+
+	inline void sincos_batch(const float* x, float* s, float* c, std::size_t n) {
+#if defined(MATH4D_SIMD)
+		switch (simd::active_backend()) {
+		case simd::Backend::AVX2:	avx2::sincos_batch(x, s, c, n); return;
+		case simd::Backend::SSE41:	sse::sincos_batch(x, s, c, n); return;
+		default: break;
+		}
+#endif
+		scalar::sincos_batch(x, s, c, n);
+	}
+}
+
+	// Returns sin(x) and cos(x), x in radians, in float precision.
+	inline SinCos sincos(float x) noexcept {
+		SinCos r;
+		kernels::scalar::sincos(x, r.s, r.c);
+		return r;
+	}
+
+	// s[i] = sin(x[i]), c[i] = cos(x[i]) for a list of angles in radians.
+	// s and c have to hold at least x.size() values.
+	inline void sincos_batch(std::span<const float> x, std::span<float> s, std::span<float> c) {
+		assert(s.size() >= x.size() && c.size() >= x.size());
+		kernels::sincos_batch(x.data(), s.data(), c.data(), x.size());
+	}
+}
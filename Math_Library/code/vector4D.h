@@ -1,42 +1,63 @@
 #pragma once
 #include <iostream>
 #include <cmath>
+#include <type_traits>
 
-class Vector4D {
+#include "instrument4D.h"
+#include "simd4D.h"
+#include "vectorN.h"
+
+// Vector4D is math4D::Vector<float, 4>, specialized here with the SSE kernels.
+
+namespace math4D {
+
+template<>
+class Vector<float, 4> {
 private:
-	float arr_values[4];
+	// 16-byte aligned so the values can be loaded straight into an SSE register.
+	alignas(16) float arr_values[4];
 public:
 
 	// -----< Constructors >-----------------------------------------------------------------------
 
-	Vector4D(float nx = 0, float ny = 0, float nz = 0, float nw = 1) {
-		arr_values[0] = nx;
-		arr_values[1] = ny;
-		arr_values[2] = nz;
-		arr_values[3] = nw; // w is 1 by default. 
+	constexpr Vector(float nx = 0, float ny = 0, float nz = 0, float nw = 1) noexcept
+		: arr_values{ nx, ny, nz, nw } {	// w is 1 by default.
 	}
 
-	Vector4D(const Vector4D& v) {
-		arr_values[0] = v[0];
-		arr_values[1] = v[1];
-		arr_values[2] = v[2];
-		arr_values[3] = v[3];
+	// Copying is defaulted so Vector4D stays trivially copyable: copies are
+	// plain 16-byte moves and arrays of it can be memcpy'd and mapped from files.
+	constexpr Vector(const Vector4D& v) noexcept = default;
+	constexpr Vector4D& operator=(const Vector4D& v) noexcept = default;
+
+	// Converts from a vector with another value type, ex) Vector4DDouble to Vector4D.
+	template<class U>
+	explicit constexpr Vector(const Vector<U, 4>& v) noexcept
+		: arr_values{ (float)v[0], (float)v[1], (float)v[2], (float)v[3] } {
 	}
 
 	// -----< Getters >----------------------------------------------------------------------------
 
 	// Operator that returns the value of the inserted index. 
-	float operator[] (int index) const {
+	constexpr float operator[] (int index) const noexcept {
 		return arr_values[index];
 	}
-	float& operator[] (int index) {
+	constexpr float& operator[] (int index) noexcept {
 		return arr_values[index];
 	}
 
+	// Returns a pointer to the four values (16-byte aligned).
+	// Used by the SIMD kernels.
+	constexpr const float* data() const noexcept {
+		return arr_values;
+	}
+	constexpr float* data() noexcept {
+		return arr_values;
+	}
+
 	// -----< Setters >----------------------------------------------------------------------------
 
 	// Set the values for all values in the vector.
-	void set_components(float nx = 0, float ny = 0, float nz = 0, float nw = 1) {
+	constexpr void set_components(float nx = 0, float ny = 0, float nz = 0, float nw = 1) noexcept {
 		arr_values[0] = nx;
 		arr_values[1] = ny;
 		arr_values[2] = nz;
@@ -46,119 +67,167 @@ public:
 	// -----< Dot Product >------------------------------------------------------------------------
 
 	// Returns the Dot Product as a float.
-	float dot_product(Vector4D v) {
-		return	arr_values[0] * v[0] +
-				arr_values[1] * v[1] +
-				arr_values[2] * v[2] +
-				arr_values[3] * v[3];
+	constexpr float dot_product(const Vector4D& v) const noexcept {
+		return math4D::kernels::vec4_dot(arr_values, v.arr_values);
 	}
 
 	// -----< Scalar >-----------------------------------------------------------------------------
 
 	// Returns the Scalar vector ar a new Vector4D.
-	Vector4D scalar(float s) {
+	constexpr Vector4D scalar(float s) const noexcept {
 		Vector4D new_v;
-		new_v[0] = arr_values[0] * s;
-		new_v[1] = arr_values[1] * s;
-		new_v[2] = arr_values[2] * s;
-		new_v[3] = arr_values[3] * s;
+		math4D::kernels::vec4_scale(arr_values, s, new_v.arr_values);
 		return new_v;
 	}
 
 	// -----< Lenght >-----------------------------------------------------------------------------
 
+	// Returns the squared length, x^2 + y^2 + z^2 + w^2. Cheaper than
+	// lenght() for comparing distances.
+	constexpr float length_squared() const noexcept {
+		return dot_product(*this);
+	}
+
+	// Returns the squared length of x, y and z only (w ignored).
+	constexpr float length3_squared() const noexcept {
+		return arr_values[0] * arr_values[0] + arr_values[1] * arr_values[1] + arr_values[2] * arr_values[2];
+	}
+
 	// Returns the Lenght of the Vector4D as a float.
-	float lenght() {
-		float len;
-		// Lenght is the squarroot of ( x^2 + y^2 + z^2 ).
-		len = sqrt(	pow(arr_values[0], 2) +
-					pow(arr_values[1], 2) +
-					pow(arr_values[2], 2) +
-					pow(arr_values[3], 2));
-		// Returns the lenght of the vector.
-		return len;
+	// Lenght is the squarroot of ( x^2 + y^2 + z^2 + w^2 ).
+	float length() const noexcept {
+		return std::sqrt(length_squared());
+	}
+
+	// Returns the length of x, y and z only (w ignored).
+	float length3() const noexcept {
+		return std::sqrt(length3_squared());
+	}
+
+	// The original spelling of length().
+	float lenght() const noexcept {
+		return length();
 	}
 
 	// -----< Normalize >--------------------------------------------------------------------------
 
-	// Returns a normalized vector as a Vector4D.
-	Vector4D norm() {
-		float len, nx, ny, nz, nw;
-		// len becomes the lenght of the vector.
-		len = lenght();
+	// Returns the vector divided by its length (all four values), every
+	// value within 2e-7 of the exact result. A zero vector is returned as it is.
+	Vector4D normalize() const noexcept {
+		MATH4D_COUNT(VectorNormalize);
+		Vector4D new_v;
+		math4D::kernels::vec4_normalize(arr_values, new_v.arr_values, 4);
+		MATH4D_COUNT_NAN(new_v.arr_values, 4);
+		return new_v;
+	}
 
-		nx = arr_values[0] / len;
-		ny = arr_values[1] / len;
-		nz = arr_values[2] / len;
-		nw = arr_values[3] / len;
+	// Returns x, y and z divided by their length, w unchanged.
+	// For points and directions with a homogeneous w.
+	Vector4D normalize3() const noexcept {
+		MATH4D_COUNT(VectorNormalize);
+		Vector4D new_v;
+		math4D::kernels::vec4_normalize(arr_values, new_v.arr_values, 3);
+		MATH4D_COUNT_NAN(new_v.arr_values, 4);
+		return new_v;
+	}
 
-		return Vector4D(nx, ny, nz, nw);
+	// As normalize() with a reciprocal square root estimate and one
+	// Newton-Raphson step instead of a square root and a division.
+	// Every value is within 6e-7 of the exact result. On recent CPUs this
+	// only pays off for many vectors at once (math4D::normalize with
+	// Precision::Fast), a single call takes about as long as normalize().
+	Vector4D normalize_fast() const noexcept {
+		MATH4D_COUNT(VectorNormalize);
+		Vector4D new_v;
+		math4D::kernels::vec4_normalize_fast(arr_values, new_v.arr_values, 4);
+		MATH4D_COUNT_NAN(new_v.arr_values, 4);
+		return new_v;
+	}
+
+	// As normalize3() with the fast reciprocal square root.
+	Vector4D normalize3_fast() const noexcept {
+		MATH4D_COUNT(VectorNormalize);
+		Vector4D new_v;
+		math4D::kernels::vec4_normalize_fast(arr_values, new_v.arr_values, 3);
+		MATH4D_COUNT_NAN(new_v.arr_values, 4);
+		return new_v;
+	}
+
+	// Returns a normalized vector as a Vector4D. Same as normalize().
+	Vector4D norm() const noexcept {
+		return normalize();
 	}
 
 	// -----< Operators >--------------------------------------------------------------------------
 
 	// Operator for addition between two Vector4D.
-	Vector4D operator+(const Vector4D& v) {
-		float nx, ny, nz, nw;
-		nx = arr_values[0] + v[0];	// x value
-		ny = arr_values[1] + v[1];	// y value
-		nz = arr_values[2] + v[2];	// z value
-		nw = arr_values[3] + v[3];	// w value
-		return Vector4D(nx, ny, nz, nw);
+	constexpr Vector4D operator+(const Vector4D& v) const noexcept {
+		Vector4D new_v;
+		math4D::kernels::vec4_add(arr_values, v.arr_values, new_v.arr_values);
+		return new_v;
 	}
 
 	// Operator for subtraction between two Vector4D.
-	Vector4D operator-(const Vector4D& v) {
-		float nx, ny, nz, nw;
-		nx = arr_values[0] - v[0];	// x value
-		ny = arr_values[1] - v[1];	// y value
-		nz = arr_values[2] - v[2];	// z value
-		nw = arr_values[3] - v[3];	// w value
-		return Vector4D(nx, ny, nz, nw);
+	constexpr Vector4D operator-(const Vector4D& v) const noexcept {
+		Vector4D new_v;
+		math4D::kernels::vec4_sub(arr_values, v.arr_values, new_v.arr_values);
+		return new_v;
 	}
 
 	// Operator for division between two Vector4D.
-	Vector4D operator/(const Vector4D& v) {
-		float nx, ny, nz, nw;
-		nx = arr_values[0] / v[0];	// x value
-		ny = arr_values[1] / v[1];	// y value
-		nz = arr_values[2] / v[2];	// z value
-		nw = arr_values[3] / v[3];	// w value
-		return Vector4D(nx, ny, nz, nw);
+	constexpr Vector4D operator/(const Vector4D& v) const noexcept {
+		Vector4D new_v;
+		math4D::kernels::vec4_div(arr_values, v.arr_values, new_v.arr_values);
+		return new_v;
 	}
 
 	// Operator for multiplication between two Vector4D.
-	Vector4D operator*(const Vector4D& v) {
-		float nx, ny, nz, nw;
-		nx = arr_values[0] * v[0];	// x value
-		ny = arr_values[1] * v[1];	// y value
-		nz = arr_values[2] * v[2];	// z value
-		nw = arr_values[3] * v[3];	// w value
-		return Vector4D(nx, ny, nz, nw);
-	}
-
-	// Operator that gives a vector the same values as another.
-	// new_Vector = old_Vector
-	Vector4D operator=(const Vector4D& v) {
-		float nx, ny, nz, nw;
-		nx = arr_values[0] = v[0];	// x value
-		ny = arr_values[1] = v[1];	// y value
-		nz = arr_values[2] = v[2];	// z value
-		nw = arr_values[3] = v[3];	// w value
-		return Vector4D(nx, ny, nz, nw);
+	constexpr Vector4D operator*(const Vector4D& v) const noexcept {
+		Vector4D new_v;
+		math4D::kernels::vec4_mul(arr_values, v.arr_values, new_v.arr_values);
+		return new_v;
+	}
+
+	// In-place versions of the operators above. They write the result
+	// straight back into the vector, no temporary is built.
+	// sum += v
+	constexpr Vector4D& operator+=(const Vector4D& v) noexcept {
+		math4D::kernels::vec4_add(arr_values, v.arr_values, arr_values);
+		return *this;
+	}
+
+	constexpr Vector4D& operator-=(const Vector4D& v) noexcept {
+		math4D::kernels::vec4_sub(arr_values, v.arr_values, arr_values);
+		return *this;
+	}
+
+	constexpr Vector4D& operator*=(const Vector4D& v) noexcept {
+		math4D::kernels::vec4_mul(arr_values, v.arr_values, arr_values);
+		return *this;
+	}
+
+	constexpr Vector4D& operator/=(const Vector4D& v) noexcept {
+		math4D::kernels::vec4_div(arr_values, v.arr_values, arr_values);
+		return *this;
+	}
+
+	// Scales the vector in place, the same as v = v.scalar(s).
+	constexpr Vector4D& operator*=(float s) noexcept {
+		math4D::kernels::vec4_scale(arr_values, s, arr_values);
+		return *this;
 	}
 
 	// Operators that look if two vectors are the same.
 	// vector1 == vector2
 	// If true:		returns 1
 	// If false:	returns 0
-	bool operator==(const Vector4D& v) {
+	constexpr bool operator==(const Vector4D& v) const noexcept {
 		return (arr_values[0] == v[0] &&
 				arr_values[1] == v[1] &&
 				arr_values[2] == v[2] &&
 				arr_values[3] == v[3]);
 	}
-	bool operator!=(const Vector4D& v) {
+	constexpr bool operator!=(const Vector4D& v) const noexcept {
 		return !(arr_values[0] == v[0] &&
 				 arr_values[1] == v[1] &&
 				 arr_values[2] == v[2] &&
@@ -168,7 +237,7 @@ public:
 	// -----< Print / Debug >----------------------------------------------------------------------
 
 	// Prints the values of Vector4D in a list.
-	void print() {
+	void print() const {
 		std::cout	<< "x:\t" << arr_values[0] << "\n"
 					<< "y:\t" << arr_values[1] << "\n"
 					<< "z:\t" << arr_values[2] << "\n"
@@ -176,7 +245,36 @@ public:
 	}
 
 	// Prints the values of the Vector4D in a line.
-	void print_line() {
+	void print_line() const {
 		std::cout << arr_values[0] << "\t" << arr_values[1] << "\t" << arr_values[2] << "\t" << arr_values[3] << "\n";
 	}
-};
\ No newline at end of file
+};
+
+}
+
+// -----< Compile-time checks >----------------------------------------------------------------
+
+static_assert(Vector4D(1, 2, 3, 4)[3] == 4, "Vector4D constructor is not constexpr");
+static_assert(Vector4D(1, 2, 3, 4) + Vector4D(1, 1, 1, 1) == Vector4D(2, 3, 4, 5), "constexpr operator+");
+static_assert(Vector4D(1, 2, 3, 4) - Vector4D(1, 1, 1, 1) == Vector4D(0, 1, 2, 3), "constexpr operator-");
+static_assert(Vector4D(1, 2, 3, 4) * Vector4D(2, 2, 2, 2) == Vector4D(2, 4, 6, 8), "constexpr operator*");
+static_assert(Vector4D(2, 4, 6, 8) / Vector4D(2, 2, 2, 2) == Vector4D(1, 2, 3, 4), "constexpr operator/");
+static_assert(Vector4D(1, 2, 3, 4).scalar(2) == Vector4D(2, 4, 6, 8), "constexpr scalar");
+static_assert(Vector4D(1, 2, 3, 4).dot_product(Vector4D(1, 1, 1, 1)) == 10, "constexpr dot_product");
+static_assert(Vector4D(1, 2, 3, 4).length_squared() == 30, "constexpr length_squared");
+static_assert(Vector4D(1, 2, 3, 4).length3_squared() == 14, "constexpr length3_squared");
+
+namespace math4D::checks {
+	constexpr Vector4D accumulated() {
+		Vector4D sum(0, 0, 0, 0);
+		for (int i = 1; i <= 4; i++) sum += Vector4D((float)i, 1, 2, 3);
+		sum -= Vector4D(0, 1, 1, 1);
+		sum *= Vector4D(1, 2, 1, 1);
+		sum /= Vector4D(2, 1, 1, 1);
+		sum *= 2.0f;
+		return sum;
+	}
+}
+
+static_assert(math4D::checks::accumulated() == Vector4D(10, 12, 14, 22), "constexpr compound operators");
+static_assert(std::is_trivially_copyable_v<Vector4D>, "Vector4D must be trivially copyable");
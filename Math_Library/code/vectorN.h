@@ -0,0 +1,204 @@
+#pragma once
+#include <cmath>
+#include <cstddef>
+#include <type_traits>
+
+#include "half4D.h"
+#include "simd4D.h"
+
+// Fixed-size vector template.
+//
+// Vector<T, N> holds N values of type T. All sizes are known at compile
+// time, so the loops below are unrolled by the compiler and the code is
+// the same as for a hand-written fixed-size class.
+//
+// Vector4D is the float, 4 specialization (vector4D.h), with its SSE
+// kernels. Vector<double, 4> uses the double AVX kernels from simd4D.h,
+// every other type and size the plain loops. Vector<half, N> is storage
+// only: the values can be read and written, for math convert to float.
+//
+// For N = 4 the default constructor and the constructors with fewer than
+// four values set w to 1, the same as Vector4D.
+
+namespace math4D {
+
+	template<class T, std::size_t N>
+	class Vector {
+	private:
+		static_assert(N > 0, "a Vector needs at least one value");
+
+		// Aligned to the full size when that is a power of two (up to 32 bytes),
+		// so a Vector<double, 4> is one aligned ymm load.
+		static constexpr std::size_t alignment =
+			(sizeof(T) * N <= 32 && (sizeof(T) * N & (sizeof(T) * N - 1)) == 0) ? sizeof(T) * N : alignof(T);
+
+		// Vector<double, 4> has AVX kernels.
+		static constexpr bool has_kernels = N == 4 && std::is_same_v<T, double>;
+
+		alignas(alignment) T values[N];
+
+	public:
+
+		// -----< Constructors >-----------------------------------------------------------------------
+
+		constexpr Vector() noexcept : values{} {
+			if constexpr (N == 4) values[3] = T(1);
+		}
+
+		// Takes up to N values, the rest are 0 (w is 1 for N = 4).
+		template<class... Args>
+			requires (sizeof...(Args) > 0 && sizeof...(Args) <= N && (std::is_constructible_v<T, Args> && ...))
+		constexpr Vector(Args... args) noexcept : values{ T(args)... } {
+			if constexpr (N == 4 && sizeof...(Args) < 4) values[3] = T(1);
+		}
+
+		// Converts from a vector with another value type, ex) Vector4D to Vector<double, 4>.
+		template<class U>
+			requires (!std::is_same_v<U, T>)
+		explicit constexpr Vector(const Vector<U, N>& v) noexcept : values{} {
+			for (std::size_t i = 0; i < N; i++) {
+				// half only converts to and from float.
+				if constexpr (std::is_same_v<U, half> || std::is_same_v<T, half>) values[i] = T((float)v[i]);
+				else values[i] = T(v[i]);
+			}
+		}
+
+		// -----< Getters >----------------------------------------------------------------------------
+
+		static constexpr std::size_t size() noexcept {
+			return N;
+		}
+
+		constexpr const T& operator[] (std::size_t index) const noexcept {
+			return values[index];
+		}
+		constexpr T& operator[] (std::size_t index) noexcept {
+			return values[index];
+		}
+
+		constexpr const T* data() const noexcept {
+			return values;
+		}
+		constexpr T* data() noexcept {
+			return values;
+		}
+
+		// -----< Operators >--------------------------------------------------------------------------
+
+		constexpr Vector operator+(const Vector& v) const noexcept {
+			Vector r;
+			if constexpr (has_kernels) kernels::vec4_add(values, v.values, r.values);
+			else for (std::size_t i = 0; i < N; i++) r.values[i] = values[i] + v.values[i];
+			return r;
+		}
+
+		constexpr Vector operator-(const Vector& v) const noexcept {
+			Vector r;
+			if constexpr (has_kernels) kernels::vec4_sub(values, v.values, r.values);
+			else for (std::size_t i = 0; i < N; i++) r.values[i] = values[i] - v.values[i];
+			return r;
+		}
+
+		constexpr Vector operator*(const Vector& v) const noexcept {
+			Vector r;
+			if constexpr (has_kernels) kernels::vec4_mul(values, v.values, r.values);
+			else for (std::size_t i = 0; i < N; i++) r.values[i] = values[i] * v.values[i];
+			return r;
+		}
+
+		constexpr Vector operator/(const Vector& v) const noexcept {
+			Vector r;
+			if constexpr (has_kernels) kernels::vec4_div(values, v.values, r.values);
+			else for (std::size_t i = 0; i < N; i++) r.values[i] = values[i] / v.values[i];
+			return r;
+		}
+
+		// In-place versions, written straight back into the vector.
+		constexpr Vector& operator+=(const Vector& v) noexcept {
+			if constexpr (has_kernels) kernels::vec4_add(values, v.values, values);
+			else for (std::size_t i = 0; i < N; i++) values[i] += v.values[i];
+			return *this;
+		}
+
+		constexpr Vector& operator-=(const Vector& v) noexcept {
+			if constexpr (has_kernels) kernels::vec4_sub(values, v.values, values);
+			else for (std::size_t i = 0; i < N; i++) values[i] -= v.values[i];
+			return *this;
+		}
+
+		constexpr Vector& operator*=(const Vector& v) noexcept {
+			if constexpr (has_kernels) kernels::vec4_mul(values, v.values, values);
+			else for (std::size_t i = 0; i < N; i++) values[i] *= v.values[i];
+			return *this;
+		}
+
+		constexpr Vector& operator/=(const Vector& v) noexcept {
+			if constexpr (has_kernels) kernels::vec4_div(values, v.values, values);
+			else for (std::size_t i = 0; i < N; i++) values[i] /= v.values[i];
+			return *this;
+		}
+
+		constexpr Vector& operator*=(T s) noexcept {
+			if constexpr (has_kernels) kernels::vec4_scale(values, s, values);
+			else for (std::size_t i = 0; i < N; i++) values[i] *= s;
+			return *this;
+		}
+
+		constexpr bool operator==(const Vector& v) const noexcept {
+			for (std::size_t i = 0; i < N; i++) {
+				if (!(values[i] == v.values[i])) return false;
+			}
+			return true;
+		}
+
+		constexpr bool operator!=(const Vector& v) const noexcept {
+			return !(*this == v);
+		}
+
+		// -----< Scalar >-----------------------------------------------------------------------------
+
+		constexpr Vector scalar(T s) const noexcept {
+			Vector r;
+			if constexpr (has_kernels) kernels::vec4_scale(values, s, r.values);
+			else for (std::size_t i = 0; i < N; i++) r.values[i] = values[i] * s;
+			return r;
+		}
+
+		// -----< Dot Product >------------------------------------------------------------------------
+
+		constexpr T dot_product(const Vector& v) const noexcept {
+			if constexpr (has_kernels) {
+				return kernels::vec4_dot(values, v.values);
+			}
+			else {
+				T sum = values[0] * v.values[0];
+				for (std::size_t i = 1; i < N; i++) sum += values[i] * v.values[i];
+				return sum;
+			}
+		}
+
+		// -----< Length / Normalize >-----------------------------------------------------------------
+
+		constexpr T length_squared() const noexcept {
+			return dot_product(*this);
+		}
+
+		T length() const noexcept {
+			return (T)std::sqrt(dot_product(*this));
+		}
+
+		// Returns the vector divided by its length. A zero vector stays zero.
+		Vector normalize() const noexcept {
+			T len = length();
+			return len > T(0) ? scalar(T(1) / len) : *this;
+		}
+	};
+
+	// Defined in vector4D.h.
+	template<>
+	class Vector<float, 4>;
+}
+
+using Vector4D = math4D::Vector<float, 4>;
+using Vector4DDouble = math4D::Vector<double, 4>;
+using Vector4DHalf = math4D::Vector<math4D::half, 4>;
@@ -0,0 +1,2006 @@
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <functional>
+#include <map>
+#include <new>
+#include <memory>
+#include <random>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+#include "test.h"
+#include "batch4D.h"
+#include "culling4D.h"
+#include "dataset4D.h"
+#include "half4D.h"
+#include "hierarchy4D.h"
+#include "jobs4D.h"
+#include "matrix4D.h"
+#include "matrix_stream4D.h"
+#include "parallel4D.h"
+#include "pipeline4D.h"
+#include "pool4D.h"
+#include "quaternion.h"
+#include "skin4D.h"
+#include "thread_pool.h"
+#include "trig4D.h"
+#include "vector4D.h"
+
+// Tests for Math_Library.
+//
+// Differential tests: every kernel with SIMD versions is run on each
+// backend the CPU supports and compared with the scalar backend, the
+// reference implementation of Vector4D / Matrix4D. Where it matters the
+// scalar results are also checked against a double precision reference.
+// Inputs are random, plus near-singular matrices, denormals, zeros and
+// values near the float range limits.
+//
+// Performance gate (--perf): times a fixed set of kernels on every backend
+// and fails if one is slower than the stored baseline by more than
+// --threshold (default 1.0, twice as slow). Times are divided by a scalar
+// calibration loop timed in the same run, so the baseline holds relative
+// costs and a faster or slower machine does not fail the gate by itself.
+// The default threshold is wide enough for a shared machine and catches a
+// kernel that lost its SIMD version; smaller changes need bench/ on a
+// quiet machine.
+//
+//	Math_Library_tests [--filter=<text>]
+//	Math_Library_tests --perf --baseline=<file> [--threshold=<fraction>] [--update-baseline]
+
+using math4D::simd::Backend;
+using test::Budget;
+
+namespace {
+
+	// -----< Helpers >----------------------------------------------------------------------------
+
+	constexpr float eps = FLT_EPSILON;
+
+	// Random values in [lo, hi], the same on every run.
+	std::vector<float> random_floats(std::size_t n, unsigned int seed, float lo = -1.0f, float hi = 1.0f) {
+		std::mt19937 gen(seed);
+		std::uniform_real_distribution<float> dist(lo, hi);
+		std::vector<float> v(n);
+		for (float& x : v) x = dist(gen);
+		return v;
+	}
+
+	std::vector<Vector4D> random_points(std::size_t n, unsigned int seed, float range = 100.0f) {
+		std::vector<float> f = random_floats(n * 4, seed, -range, range);
+		std::vector<Vector4D> points(n);
+		for (std::size_t i = 0; i < n; i++) {
+			points[i] = Vector4D(f[i * 4], f[i * 4 + 1], f[i * 4 + 2], f[i * 4 + 3]);
+		}
+		return points;
+	}
+
+	// Random points followed by zeros, denormals, tiny and huge values.
+	std::vector<Vector4D> test_points(std::size_t n, unsigned int seed) {
+		std::vector<Vector4D> points = random_points(n, seed);
+		const float denormal = 1e-40f;
+		points.push_back(Vector4D(0, 0, 0, 0));
+		points.push_back(Vector4D(-0.0f, 0, -0.0f, 0));
+		points.push_back(Vector4D(denormal, -denormal, 3 * denormal, denormal));
+		points.push_back(Vector4D(denormal, 1, -denormal, 0.5f));
+		points.push_back(Vector4D(1e-20f, -2e-20f, 3e-20f, 1e-20f));
+		points.push_back(Vector4D(1e18f, -1e18f, 3e17f, 1));
+		points.push_back(Vector4D(FLT_MIN, -FLT_MIN, FLT_MIN, 0));
+		points.push_back(Vector4D(1, 1e-30f, -1e30f, 1e-10f));
+		return points;
+	}
+
+	Matrix4D random_matrix(std::mt19937& gen, float range = 10.0f) {
+		std::uniform_real_distribution<float> dist(-range, range);
+		Matrix4D m;
+		for (float& x : m.row_major()) x = dist(gen);
+		return m;
+	}
+
+	// A rotation, a translation in [-10, 10] and, if scaled, a scale in [0.5, 2].
+	Matrix4D random_affine(std::mt19937& gen, bool scaled) {
+		std::uniform_real_distribution<float> angle(-3.14159f, 3.14159f);
+		std::uniform_real_distribution<float> offset(-10.0f, 10.0f);
+		std::uniform_real_distribution<float> scale(0.5f, 2.0f);
+		Matrix4D m = Matrix4D::rotation_xyz(angle(gen), angle(gen), angle(gen));
+		if (scaled) {
+			float s[3] = { scale(gen), scale(gen), scale(gen) };
+			for (int r = 0; r < 3; r++) {
+				for (int c = 0; c < 3; c++) m[r][c] *= s[c];
+			}
+		}
+		m.translate(offset(gen), offset(gen), offset(gen));
+		return m;
+	}
+
+	std::vector<float> flatten(std::span<const Vector4D> points) {
+		std::vector<float> v(points.size() * 4);
+		for (std::size_t i = 0; i < points.size(); i++) {
+			for (int c = 0; c < 4; c++) v[i * 4 + c] = points[i][c];
+		}
+		return v;
+	}
+
+	std::vector<float> flatten(std::span<const Matrix4D> matrices) {
+		std::vector<float> v(matrices.size() * 16);
+		for (std::size_t i = 0; i < matrices.size(); i++) {
+			std::memcpy(&v[i * 16], matrices[i].data(), sizeof(Matrix4D));
+		}
+		return v;
+	}
+
+	bool same_bits(const Matrix4D& a, const Matrix4D& b) {
+		return std::memcmp(a.data(), b.data(), sizeof(Matrix4D)) == 0;
+	}
+
+	bool same_bits(const Vector4D& a, const Vector4D& b) {
+		return std::memcmp(a.data(), b.data(), sizeof(Vector4D)) == 0;
+	}
+
+	// Runs produce() on the scalar backend and on every SIMD backend and
+	// compares the results. scale, if not empty, adds budget.rel * scale[i]
+	// to the absolute budget of value i.
+	template<class F>
+	void compare_backends(const std::string& what, Budget budget, const std::vector<float>& scale, F&& produce) {
+		std::vector<float> want;
+		test::on_scalar([&] { want = produce(); });
+		for (Backend b : test::simd_backends()) {
+			test::BackendScope scope(b);
+			std::vector<float> got = produce();
+			if (!CHECK_MSG(got.size() == want.size(), what + ": result size differs")) continue;
+			CHECK_CLOSE(got.data(), want.data(), want.size(), budget, scale.empty() ? nullptr : scale.data(),
+				what + " on " + math4D::simd::backend_name(b));
+		}
+	}
+
+	template<class F>
+	void compare_backends(const std::string& what, Budget budget, F&& produce) {
+		compare_backends(what, budget, std::vector<float>(), produce);
+	}
+
+	// -----< Double references >------------------------------------------------------------------
+
+	struct Matrix4x4d {
+		double v[4][4];
+	};
+
+	Matrix4x4d to_double(const Matrix4D& m) {
+		Matrix4x4d d;
+		for (int r = 0; r < 4; r++) {
+			for (int c = 0; c < 4; c++) d.v[r][c] = m[r][c];
+		}
+		return d;
+	}
+
+	// Gauss-Jordan with partial pivoting. Returns false for a singular matrix.
+	bool inverse_double(Matrix4x4d a, Matrix4x4d& out) {
+		Matrix4x4d inv{};
+		for (int i = 0; i < 4; i++) inv.v[i][i] = 1;
+		for (int c = 0; c < 4; c++) {
+			int pivot = c;
+			for (int r = c + 1; r < 4; r++) {
+				if (std::fabs(a.v[r][c]) > std::fabs(a.v[pivot][c])) pivot = r;
+			}
+			if (a.v[pivot][c] == 0) return false;
+			std::swap(a.v[pivot], a.v[c]);
+			std::swap(inv.v[pivot], inv.v[c]);
+			double p = a.v[c][c];
+			for (int k = 0; k < 4; k++) {
+				a.v[c][k] /= p;
+				inv.v[c][k] /= p;
+			}
+			for (int r = 0; r < 4; r++) {
+				if (r == c) continue;
+				double f = a.v[r][c];
+				for (int k = 0; k < 4; k++) {
+					a.v[r][k] -= f * a.v[c][k];
+					inv.v[r][k] -= f * inv.v[c][k];
+				}
+			}
+		}
+		out = inv;
+		return true;
+	}
+
+	double determinant_double(const Matrix4x4d& m) {
+		Matrix4x4d a = m;
+		double det = 1;
+		for (int c = 0; c < 4; c++) {
+			int pivot = c;
+			for (int r = c + 1; r < 4; r++) {
+				if (std::fabs(a.v[r][c]) > std::fabs(a.v[pivot][c])) pivot = r;
+			}
+			if (a.v[pivot][c] == 0) return 0;
+			if (pivot != c) {
+				std::swap(a.v[pivot], a.v[c]);
+				det = -det;
+			}
+			det *= a.v[c][c];
+			for (int r = c + 1; r < 4; r++) {
+				double f = a.v[r][c] / a.v[c][c];
+				for (int k = c; k < 4; k++) a.v[r][k] -= f * a.v[c][k];
+			}
+		}
+		return det;
+	}
+
+	double norm_inf(const Matrix4x4d& m) {
+		double n = 0;
+		for (int r = 0; r < 4; r++) {
+			double row = 0;
+			for (int c = 0; c < 4; c++) row += std::fabs(m.v[r][c]);
+			n = std::max(n, row);
+		}
+		return n;
+	}
+
+	double max_abs(const Matrix4x4d& m) {
+		double n = 0;
+		for (int r = 0; r < 4; r++) {
+			for (int c = 0; c < 4; c++) n = std::max(n, std::fabs(m.v[r][c]));
+		}
+		return n;
+	}
+
+	// Bound on the terms of the determinant: the product of the row sums of |m|.
+	double determinant_scale(const Matrix4D& m) {
+		double s = 1;
+		for (int r = 0; r < 4; r++) {
+			double row = 0;
+			for (int c = 0; c < 4; c++) row += std::fabs(m[r][c]);
+			s *= row;
+		}
+		return s;
+	}
+
+	// The matrices for the determinant and inverse tests: random ones,
+	// rigid and scaled transforms, near-singular ones (a row that is
+	// nearly the sum of two others), singular ones and denormal ones.
+	struct InverseCase {
+		Matrix4D m;
+		const char* kind;
+	};
+
+	std::vector<InverseCase> inverse_cases() {
+		std::mt19937 gen(7);
+		std::vector<InverseCase> cases;
+		for (int i = 0; i < 200; i++) cases.push_back({ random_matrix(gen), "random" });
+		for (int i = 0; i < 100; i++) cases.push_back({ random_affine(gen, true), "affine" });
+		for (float delta : { 1e-1f, 1e-2f, 1e-3f, 1e-4f }) {
+			for (int i = 0; i < 50; i++) {
+				Matrix4D m = random_matrix(gen);
+				Matrix4D noise = random_matrix(gen, delta);
+				for (int c = 0; c < 4; c++) m[3][c] = m[0][c] + m[1][c] + noise[3][c];
+				cases.push_back({ m, "near-singular" });
+			}
+		}
+		// A zero row or column makes every term of the determinant 0, so it
+		// is exactly 0 in float. A repeated row is not enough: the rounding
+		// of the cofactors can leave a tiny determinant that inverts.
+		for (int i = 0; i < 20; i++) {
+			Matrix4D m = random_matrix(gen);
+			m[1] = Vector4D(0, 0, 0, 0);
+			cases.push_back({ m, "singular" });
+			Matrix4D z = random_matrix(gen);
+			for (int r = 0; r < 4; r++) z[r][2] = 0;
+			cases.push_back({ z, "singular" });
+		}
+		for (int i = 0; i < 20; i++) {
+			// Every product in the determinant underflows.
+			Matrix4D m = random_matrix(gen, 1.0f);
+			for (int r = 0; r < 4; r++) m[r] = m[r].scalar(1e-39f);
+			cases.push_back({ m, "denormal" });
+			// Denormal entries in an otherwise regular matrix.
+			Matrix4D d = random_affine(gen, false);
+			d[0][1] = 3e-39f;
+			d[2][0] = -1e-40f;
+			d[3][2] = 2e-45f;
+			cases.push_back({ d, "denormal entries" });
+		}
+		return cases;
+	}
+
+	// -----< Vector4D >---------------------------------------------------------------------------
+
+	void vector_arithmetic() {
+		std::vector<Vector4D> a = test_points(1000, 1), b = test_points(1000, 2);
+		std::reverse(b.begin(), b.end());
+
+		// Element-wise operations are single IEEE operations, so every backend gives the same bits.
+		compare_backends("vector4d elementwise", Budget{ 0 }, [&] {
+			std::vector<float> r;
+			for (std::size_t i = 0; i < a.size(); i++) {
+				for (const Vector4D& v : { a[i] + b[i], a[i] - b[i], a[i] * b[i], a[i] / b[i], a[i].scalar(0.37f) }) {
+					for (int c = 0; c < 4; c++) r.push_back(v[c]);
+				}
+				Vector4D acc = a[i];
+				acc += b[i];
+				acc *= 2.0f;
+				for (int c = 0; c < 4; c++) r.push_back(acc[c]);
+			}
+			return r;
+		});
+
+		std::vector<float> scale;
+		for (std::size_t i = 0; i < a.size(); i++) {
+			float s = 0;
+			for (int c = 0; c < 4; c++) s += std::fabs(a[i][c] * b[i][c]);
+			scale.push_back(s);
+		}
+		compare_backends("vector4d dot_product", Budget{ 2, 0, 4 * eps }, scale, [&] {
+			std::vector<float> r;
+			for (std::size_t i = 0; i < a.size(); i++) r.push_back(a[i].dot_product(b[i]));
+			return r;
+		});
+	}
+	TEST_REGISTER("vector4d/arithmetic", vector_arithmetic);
+
+	void vector_normalize() {
+		std::vector<Vector4D> points = test_points(1000, 3);
+		compare_backends("vector4d normalize", Budget{ 4 }, [&] {
+			std::vector<float> r;
+			for (const Vector4D& p : points) {
+				for (const Vector4D& v : { p.normalize(), p.normalize3(), p.norm() }) {
+					for (int c = 0; c < 4; c++) r.push_back(v[c]);
+				}
+				r.push_back(p.length());
+				r.push_back(p.length3());
+			}
+			return r;
+		});
+
+		// The fast versions are documented to stay within 6e-7 of normalize().
+		std::vector<Vector4D> regular = random_points(1000, 4);
+		std::vector<float> want;
+		test::on_scalar([&] {
+			for (const Vector4D& p : regular) {
+				for (const Vector4D& v : { p.normalize(), p.normalize3() }) {
+					for (int c = 0; c < 4; c++) want.push_back(v[c]);
+				}
+			}
+		});
+		std::vector<Backend> backends = test::simd_backends();
+		backends.insert(backends.begin(), Backend::Scalar);
+		for (Backend b : backends) {
+			test::BackendScope scope(b);
+			std::vector<float> got;
+			for (const Vector4D& p : regular) {
+				for (const Vector4D& v : { p.normalize_fast(), p.normalize3_fast() }) {
+					for (int c = 0; c < 4; c++) got.push_back(v[c]);
+				}
+			}
+			CHECK_CLOSE(got.data(), want.data(), want.size(), (Budget{ 0, 6e-7 }), nullptr,
+				std::string("normalize_fast on ") + math4D::simd::backend_name(b));
+		}
+	}
+	TEST_REGISTER("vector4d/normalize", vector_normalize);
+
+	// -----< Matrix4D >---------------------------------------------------------------------------
+
+	void matrix_multiply() {
+		std::mt19937 gen(5);
+		std::vector<Matrix4D> a, b;
+		for (int i = 0; i < 500; i++) {
+			a.push_back(random_matrix(gen));
+			b.push_back(random_matrix(gen));
+		}
+		// Denormal and huge entries.
+		Matrix4D tiny = random_matrix(gen, 1.0f), huge = random_matrix(gen, 1e17f);
+		for (int r = 0; r < 4; r++) tiny[r] = tiny[r].scalar(1e-39f);
+		a.push_back(tiny);
+		b.push_back(random_matrix(gen));
+		a.push_back(huge);
+		b.push_back(huge);
+		std::vector<Vector4D> v = test_points(a.size(), 6);
+
+		std::vector<float> scale;
+		for (std::size_t i = 0; i < a.size(); i++) {
+			for (int r = 0; r < 4; r++) {
+				for (int c = 0; c < 4; c++) {
+					float s = 0;
+					for (int k = 0; k < 4; k++) s += std::fabs(a[i][r][k] * b[i][k][c]);
+					scale.push_back(s);
+				}
+			}
+			for (int r = 0; r < 4; r++) {
+				float s = 0;
+				for (int k = 0; k < 4; k++) s += std::fabs(a[i][r][k] * v[i][k]);
+				scale.push_back(s);
+			}
+		}
+		compare_backends("matrix4d multiply", Budget{ 2, 0, 4 * eps }, scale, [&] {
+			std::vector<float> r;
+			for (std::size_t i = 0; i < a.size(); i++) {
+				Matrix4D m = a[i] * b[i];
+				r.insert(r.end(), m.data(), m.data() + 16);
+				Vector4D p = a[i] * v[i];
+				for (int c = 0; c < 4; c++) r.push_back(p[c]);
+			}
+			return r;
+		});
+
+		// *= has to give the same bits as *.
+		for (Backend be : test::simd_backends()) {
+			test::BackendScope scope(be);
+			for (std::size_t i = 0; i < a.size(); i++) {
+				Matrix4D m = a[i];
+				m *= b[i];
+				CHECK_MSG(same_bits(m, a[i] * b[i]), "a *= b differs from a * b, matrix " + std::to_string(i));
+			}
+		}
+	}
+	TEST_REGISTER("matrix4d/multiply", matrix_multiply);
+
+	void matrix_transpose() {
+		std::mt19937 gen(8);
+		std::vector<Matrix4D> m;
+		for (int i = 0; i < 100; i++) m.push_back(random_matrix(gen));
+		compare_backends("matrix4d transpose", Budget{ 0 }, [&] {
+			std::vector<Matrix4D> t = m;
+			for (Matrix4D& x : t) x.transpose();
+			return flatten(t);
+		});
+	}
+	TEST_REGISTER("matrix4d/transpose", matrix_transpose);
+
+	void matrix_determinant() {
+		std::vector<InverseCase> cases = inverse_cases();
+		std::vector<float> scale;
+		for (const InverseCase& c : cases) scale.push_back((float)determinant_scale(c.m));
+		compare_backends("matrix4d determinant", Budget{ 4, 0, 16 * eps }, scale, [&] {
+			std::vector<float> r;
+			for (const InverseCase& c : cases) r.push_back(c.m.determinant());
+			return r;
+		});
+
+		// The reference itself against double precision.
+		test::on_scalar([&] {
+			for (std::size_t i = 0; i < cases.size(); i++) {
+				double want = determinant_double(to_double(cases[i].m));
+				float got = cases[i].m.determinant();
+				double budget = 32 * eps * scale[i] + 1e-44;
+				CHECK_MSG(std::fabs(got - want) <= budget, std::string(cases[i].kind) + " determinant " +
+					std::to_string(i) + ": " + test::describe(got, (float)want));
+			}
+		});
+	}
+	TEST_REGISTER("matrix4d/determinant", matrix_determinant);
+
+	// Checks an inverse against the double precision inverse, with an error
+	// budget that grows with the condition number of the matrix.
+	void check_inverse(const Matrix4D& m, const Matrix4D& got, const std::string& what) {
+		Matrix4x4d inv;
+		if (!inverse_double(to_double(m), inv)) return;
+		double cond = norm_inf(to_double(m)) * norm_inf(inv);
+		double budget = 64 * eps * cond * max_abs(inv);
+		for (int r = 0; r < 4; r++) {
+			for (int c = 0; c < 4; c++) {
+				double err = std::fabs(got[r][c] - inv.v[r][c]);
+				if (!CHECK_MSG(err <= budget, what + ": element " + std::to_string(r * 4 + c) + " " +
+						test::describe(got[r][c], (float)inv.v[r][c]) + ", condition " + std::to_string(cond))) {
+					return;
+				}
+			}
+		}
+	}
+
+	void matrix_inverse() {
+		std::vector<InverseCase> cases = inverse_cases();
+		std::vector<std::uint8_t> want_ok(cases.size());
+		std::vector<Matrix4D> want(cases.size());
+		test::on_scalar([&] {
+			for (std::size_t i = 0; i < cases.size(); i++) {
+				want_ok[i] = cases[i].m.try_inverse(want[i]);
+				if (want_ok[i]) check_inverse(cases[i].m, want[i], std::string("scalar ") + cases[i].kind + " " + std::to_string(i));
+			}
+		});
+		for (std::size_t i = 0; i < cases.size(); i++) {
+			if (std::strcmp(cases[i].kind, "singular") == 0 || std::strcmp(cases[i].kind, "denormal") == 0) {
+				CHECK_MSG(!want_ok[i], std::string(cases[i].kind) + " matrix " + std::to_string(i) + " was inverted");
+			}
+		}
+		for (Backend b : test::simd_backends()) {
+			test::BackendScope scope(b);
+			std::string backend = math4D::simd::backend_name(b);
+			for (std::size_t i = 0; i < cases.size(); i++) {
+				Matrix4D got;
+				bool ok = cases[i].m.try_inverse(got);
+				std::string what = backend + " " + cases[i].kind + " " + std::to_string(i);
+				if (!CHECK_MSG(ok == (bool)want_ok[i], what + ": try_inverse disagrees with scalar")) continue;
+				if (ok) check_inverse(cases[i].m, got, what);
+			}
+		}
+	}
+	TEST_REGISTER("matrix4d/inverse", matrix_inverse);
+
+	void matrix_inverse_affine() {
+		std::mt19937 gen(9);
+		std::vector<Matrix4D> scaled, rigid;
+		for (int i = 0; i < 200; i++) {
+			scaled.push_back(random_affine(gen, true));
+			rigid.push_back(random_affine(gen, false));
+		}
+		std::vector<Backend> backends = test::simd_backends();
+		backends.insert(backends.begin(), Backend::Scalar);
+		for (Backend b : backends) {
+			test::BackendScope scope(b);
+			std::string backend = math4D::simd::backend_name(b);
+			for (std::size_t i = 0; i < scaled.size(); i++) {
+				Matrix4D inv;
+				if (CHECK_MSG(scaled[i].try_inverse_affine(inv), backend + " inverse_affine failed")) {
+					check_inverse(scaled[i], inv, backend + " inverse_affine " + std::to_string(i));
+				}
+				check_inverse(rigid[i], rigid[i].inverse_rigid(), backend + " inverse_rigid " + std::to_string(i));
+			}
+		}
+		compare_backends("matrix4d inverse_affine / inverse_rigid", Budget{ 8, 1e-6 }, [&] {
+			std::vector<Matrix4D> r;
+			for (std::size_t i = 0; i < scaled.size(); i++) {
+				r.push_back(scaled[i].inverse_affine());
+				r.push_back(rigid[i].inverse_rigid());
+			}
+			return flatten(r);
+		});
+	}
+	TEST_REGISTER("matrix4d/inverse_affine", matrix_inverse_affine);
+
+	// -----< Batch transforms >-------------------------------------------------------------------
+
+	// Sizes that cover the SIMD main loops and every tail length.
+	const std::size_t batch_sizes[] = { 0, 1, 3, 7, 8, 9, 15, 17, 1000, 1027 };
+
+	std::vector<float> transform_scale(const Matrix4D& m, std::span<const Vector4D> points) {
+		std::vector<float> scale;
+		for (const Vector4D& p : points) {
+			for (int r = 0; r < 4; r++) {
+				float s = 0;
+				for (int k = 0; k < 4; k++) s += std::fabs(m[r][k] * p[k]);
+				scale.push_back(s);
+			}
+		}
+		return scale;
+	}
+
+	void batch_transform() {
+		std::mt19937 gen(10);
+		Matrix4D m = random_matrix(gen);
+		for (std::size_t n : batch_sizes) {
+			std::vector<Vector4D> in = random_points(n, 11);
+			std::vector<float> scale = transform_scale(m, in);
+			std::string size = "/" + std::to_string(n);
+
+			// The per-point Matrix4D * Vector4D of the scalar backend is the reference.
+			std::vector<float> want;
+			test::on_scalar([&] {
+				for (const Vector4D& p : in) {
+					Vector4D r = m * p;
+					for (int c = 0; c < 4; c++) want.push_back(r[c]);
+				}
+			});
+			std::vector<Backend> backends = test::simd_backends();
+			backends.insert(backends.begin(), Backend::Scalar);
+			for (Backend b : backends) {
+				test::BackendScope scope(b);
+				std::string what = std::string(" on ") + math4D::simd::backend_name(b) + size;
+
+				std::vector<Vector4D> out(n);
+				math4D::transform(m, in, out);
+				std::vector<float> got = flatten(out);
+				CHECK_CLOSE(got.data(), want.data(), want.size(), (Budget{ 2, 0, 4 * eps }), scale.data(), "transform aos" + what);
+
+				Vector4DStream stream(in), stream_out;
+				math4D::transform(m, stream, stream_out);
+				std::vector<Vector4D> soa(n);
+				stream_out.to_aos(soa);
+				got = flatten(soa);
+				CHECK_CLOSE(got.data(), want.data(), want.size(), (Budget{ 2, 0, 4 * eps }), scale.data(), "transform soa" + what);
+
+				std::vector<Vector4D> in_place = in;
+				math4D::transform(m, in_place);
+				CHECK_MSG(flatten(in_place) == flatten(out), "in-place transform differs" + what);
+			}
+		}
+
+		// Half precision: the inputs are exact halves, the results are off by the final rounding.
+		std::vector<Vector4D> points = random_points(1027, 12, 10.0f);
+		std::vector<Vector4DHalf> in(points.size());
+		for (std::size_t i = 0; i < points.size(); i++) {
+			in[i] = Vector4DHalf(points[i][0], points[i][1], points[i][2], points[i][3]);
+		}
+		compare_backends("transform half", Budget{ 0, 0.08 }, [&] {
+			std::vector<Vector4DHalf> out(in.size());
+			math4D::transform(m, in, out);
+			std::vector<float> r;
+			for (const Vector4DHalf& p : out) {
+				for (int c = 0; c < 4; c++) r.push_back((float)p[c]);
+			}
+			return r;
+		});
+	}
+	TEST_REGISTER("batch/transform", batch_transform);
+
+	void batch_normalize() {
+		for (std::size_t n : batch_sizes) {
+			std::vector<Vector4D> in = random_points(n, 13);
+			std::vector<float> want, want3;
+			test::on_scalar([&] {
+				for (const Vector4D& p : in) {
+					Vector4D v = p.normalize(), v3 = p.normalize3();
+					for (int c = 0; c < 4; c++) want.push_back(v[c]);
+					for (int c = 0; c < 4; c++) want3.push_back(v3[c]);
+				}
+			});
+			std::vector<Backend> backends = test::simd_backends();
+			backends.insert(backends.begin(), Backend::Scalar);
+			for (Backend b : backends) {
+				test::BackendScope scope(b);
+				std::string what = std::string(" on ") + math4D::simd::backend_name(b) + "/" + std::to_string(n);
+				for (math4D::Precision precision : { math4D::Precision::Exact, math4D::Precision::Fast }) {
+					Budget budget = precision == math4D::Precision::Exact ? Budget{ 4 } : Budget{ 0, 6e-7 };
+					std::string kind = precision == math4D::Precision::Exact ? "normalize" : "normalize fast";
+					std::vector<Vector4D> out(n);
+					math4D::normalize(in, out, precision);
+					std::vector<float> got = flatten(out);
+					CHECK_CLOSE(got.data(), want.data(), want.size(), budget, nullptr, kind + what);
+					math4D::normalize3(in, out, precision);
+					got = flatten(out);
+					CHECK_CLOSE(got.data(), want3.data(), want3.size(), budget, nullptr, kind + "3" + what);
+				}
+			}
+		}
+
+		// Against the per-vector functions, also for zero vectors and lengths
+		// around the smallest normal float: on the SIMD backends the exact
+		// results are the same bits, the fast ones stay within 6e-7 and leave
+		// the same vectors as they are.
+		std::vector<Vector4D> in = random_points(1027, 24);
+		for (float tiny : { 0.0f, 1e-30f, 1e-19f, 1.1e-19f, 1.0842022e-19f, 1e-20f }) {
+			in.push_back(Vector4D(tiny, 0, 0, 0));
+			in.push_back(Vector4D(0, tiny, tiny, tiny));
+		}
+		for (Backend b : test::simd_backends()) {
+			test::BackendScope scope(b);
+			std::string on = std::string(" on ") + math4D::simd::backend_name(b);
+			std::vector<Vector4D> out(in.size()), out3(in.size()), fast(in.size()), fast3(in.size());
+			math4D::normalize(in, out);
+			math4D::normalize3(in, out3);
+			math4D::normalize(in, fast, math4D::Precision::Fast);
+			math4D::normalize3(in, fast3, math4D::Precision::Fast);
+			for (std::size_t i = 0; i < in.size(); i++) {
+				std::string at = " " + std::to_string(i) + on;
+				CHECK_MSG(same_bits(out[i], in[i].normalize()), "normalize" + at);
+				CHECK_MSG(same_bits(out3[i], in[i].normalize3()), "normalize3" + at);
+				bool kept = same_bits(in[i].normalize_fast(), in[i]), kept3 = same_bits(in[i].normalize3_fast(), in[i]);
+				CHECK_MSG(same_bits(fast[i], in[i]) == kept, "normalize fast, kept" + at);
+				CHECK_MSG(same_bits(fast3[i], in[i]) == kept3, "normalize3 fast, kept" + at);
+				if (!kept) CHECK_CLOSE(fast[i].data(), in[i].normalize().data(), 4, (Budget{ 0, 6e-7 }), nullptr, "normalize fast" + at);
+				if (!kept3) CHECK_CLOSE(fast3[i].data(), in[i].normalize3().data(), 4, (Budget{ 0, 6e-7 }), nullptr, "normalize3 fast" + at);
+			}
+		}
+	}
+	TEST_REGISTER("batch/normalize", batch_normalize);
+
+	void batch_project() {
+		Matrix4D mvp = Matrix4D::perspective(1.2f, 16.0f / 9.0f, 0.1f, 100.0f) *
+			Matrix4D::look_at(Vector4D(3, 2, 5), Vector4D(0, 0, 0), Vector4D(0, 1, 0));
+		Viewport viewport;
+		viewport.width = 1920;
+		viewport.height = 1080;
+		std::vector<Vector4D> in = random_points(1027, 14, 20.0f);
+		for (Vector4D& p : in) p[3] = 1;
+
+		for (ClipDepth depth : { ClipDepth::NegativeOneToOne, ClipDepth::ZeroToOne }) {
+			std::vector<Vector4D> want(in.size());
+			std::vector<std::uint8_t> want_flags(in.size());
+			test::on_scalar([&] { math4D::project(mvp, viewport, in, want, want_flags, depth); });
+
+			// A point whose clip coordinates are within rounding of a plane may go either way.
+			std::vector<bool> ambiguous(in.size());
+			for (std::size_t i = 0; i < in.size(); i++) {
+				double clip[4] = {};
+				for (int r = 0; r < 4; r++) {
+					for (int k = 0; k < 4; k++) clip[r] += (double)mvp[r][k] * in[i][k];
+				}
+				double w = clip[3], tol = 1e-4 * (std::fabs(w) + 1);
+				for (int k = 0; k < 3; k++) {
+					if (std::fabs(clip[k] - w) < tol || std::fabs(clip[k] + w) < tol) ambiguous[i] = true;
+				}
+				if (depth == ClipDepth::ZeroToOne && std::fabs(clip[2]) < tol) ambiguous[i] = true;
+			}
+
+			for (Backend b : test::simd_backends()) {
+				test::BackendScope scope(b);
+				std::string what = std::string("project on ") + math4D::simd::backend_name(b);
+				std::vector<Vector4D> out(in.size());
+				std::vector<std::uint8_t> flags(in.size());
+				math4D::project(mvp, viewport, in, out, flags, depth);
+				for (std::size_t i = 0; i < in.size(); i++) {
+					if (ambiguous[i]) continue;
+					if (!CHECK_MSG(flags[i] == want_flags[i], what + ": flags of point " + std::to_string(i))) continue;
+					if (want_flags[i] != 0) continue;
+					std::string point = what + ": point " + std::to_string(i);
+					CHECK_MSG(std::fabs(out[i][0] - want[i][0]) <= 1e-3f, point + " x " + test::describe(out[i][0], want[i][0]));
+					CHECK_MSG(std::fabs(out[i][1] - want[i][1]) <= 1e-3f, point + " y " + test::describe(out[i][1], want[i][1]));
+					CHECK_MSG(std::fabs(out[i][2] - want[i][2]) <= 1e-5f, point + " depth " + test::describe(out[i][2], want[i][2]));
+					CHECK_MSG(test::within(out[i][3], want[i][3], Budget{ 8 }), point + " 1 / w " + test::describe(out[i][3], want[i][3]));
+				}
+			}
+		}
+	}
+	TEST_REGISTER("batch/project", batch_project);
+
+	// -----< Trigonometry / rotations >-----------------------------------------------------------
+
+	void trig_sincos() {
+		std::vector<float> x = random_floats(1027, 15, -6.2832f, 6.2832f);
+		std::vector<float> wide = random_floats(1000, 16, -8192.0f, 8192.0f);
+		x.insert(x.end(), wide.begin(), wide.end());
+		for (float special : { 0.0f, -0.0f, 1e-40f, -1e-30f, 8192.0f, -8192.0f }) x.push_back(special);
+
+		std::vector<Backend> backends = test::simd_backends();
+		backends.insert(backends.begin(), Backend::Scalar);
+		for (Backend b : backends) {
+			test::BackendScope scope(b);
+			std::vector<float> s(x.size()), c(x.size());
+			math4D::sincos_batch(x, s, c);
+			std::string what = std::string(" on ") + math4D::simd::backend_name(b);
+			std::vector<float> want_s, want_c;
+			for (float v : x) {
+				want_s.push_back((float)std::sin((double)v));
+				want_c.push_back((float)std::cos((double)v));
+			}
+			CHECK_CLOSE(s.data(), want_s.data(), x.size(), (Budget{ 0, 8e-8 }), nullptr, "sin" + what);
+			CHECK_CLOSE(c.data(), want_c.data(), x.size(), (Budget{ 0, 8e-8 }), nullptr, "cos" + what);
+		}
+
+		// The single sincos is the scalar kernel.
+		std::vector<float> s(x.size()), c(x.size());
+		test::on_scalar([&] { math4D::sincos_batch(x, s, c); });
+		for (std::size_t i = 0; i < x.size(); i++) {
+			math4D::SinCos sc = math4D::sincos(x[i]);
+			CHECK_ULP(sc.s, s[i], 0);
+			CHECK_ULP(sc.c, c[i], 0);
+		}
+
+		// The float helpers, the in-library series in deterministic builds.
+		for (float v : random_floats(1000, 17, -100.0f, 100.0f)) {
+			CHECK_MSG(test::within(math4D::sin_float(v), (float)std::sin((double)v), Budget{ 1, 1e-9 }), "sin_float");
+			CHECK_MSG(test::within(math4D::cos_float(v), (float)std::cos((double)v), Budget{ 1, 1e-9 }), "cos_float");
+		}
+		for (float v : random_floats(1000, 18)) {
+			CHECK_MSG(test::within(math4D::acos_float(v), (float)std::acos((double)v), Budget{ 1 }), "acos_float");
+		}
+	}
+	TEST_REGISTER("trig/sincos", trig_sincos);
+
+	// NaN, infinite and huge angles give NaN instead of undefined float to
+	// integer conversions (build with -fsanitize=float-cast-overflow to check).
+	void trig_special() {
+		const double nan = std::numeric_limits<double>::quiet_NaN(), inf = std::numeric_limits<double>::infinity();
+		for (double x : { nan, inf, -inf }) {
+			CHECK_MSG(std::isnan(math4D::cx::sin(x)) && std::isnan(math4D::cx::cos(x)), "cx::sin / cos of " + std::to_string(x));
+			CHECK_MSG(std::isnan(math4D::sin(x)) && std::isnan(math4D::cos(x)), "sin / cos of " + std::to_string(x));
+			CHECK_MSG(std::isnan(math4D::sin_float((float)x)) && std::isnan(math4D::cos_float((float)x)),
+				"sin_float / cos_float of " + std::to_string(x));
+		}
+		for (double x : { 1e10, -3e9, 1e14 }) {
+			CHECK_MSG(std::fabs(math4D::cx::sin(x) - std::sin(x)) <= 0.05 && std::fabs(math4D::cx::cos(x) - std::cos(x)) <= 0.05,
+				"cx::sin / cos of " + std::to_string(x));
+		}
+		for (double x : { 1e15, 1e19, -1e30, 1e300 }) {
+			CHECK_MSG(std::isnan(math4D::cx::sin(x)) && std::isnan(math4D::cx::cos(x)), "cx::sin / cos of " + std::to_string(x));
+		}
+		// The scalar sincos, the only one in deterministic builds.
+		test::on_scalar([&] {
+			for (float x : { (float)nan, (float)inf, (float)-inf }) {
+				math4D::SinCos sc = math4D::sincos(x);
+				CHECK_MSG(std::isnan(sc.s) && std::isnan(sc.c), "sincos of " + std::to_string(x));
+			}
+			for (float x : { 8192.5f, -1e5f, 3e9f, -1e20f }) {
+				math4D::SinCos sc = math4D::sincos(x);
+				CHECK_MSG(test::ulp_distance(sc.s, math4D::sin_float(x)) == 0 &&
+					test::ulp_distance(sc.c, math4D::cos_float(x)) == 0, "sincos of " + std::to_string(x));
+			}
+			Matrix4D m = Matrix4D::rotation_x((float)nan);
+			CHECK_MSG(std::isnan(m[1][1]) && std::isnan(m[2][1]), "rotation_x(NaN) is not NaN");
+		});
+		Matrix4D nan_rotation = Matrix4D::rotate_x((float)nan);
+		CHECK_MSG(std::isnan(nan_rotation[1][1]) && std::isnan(nan_rotation[2][1]), "rotate_x(NaN) is not NaN");
+
+		// The batch kernels on every backend, with each special angle at
+		// every position of an 8-wide block and in the tail.
+		std::vector<float> x;
+		for (float special : { (float)nan, (float)inf, (float)-inf, 1e5f, -1e6f, 3e9f }) {
+			for (std::size_t at = 0; at < 11; at++) {
+				std::vector<float> list = random_floats(11, 23, -6.2832f, 6.2832f);
+				list[at] = special;
+				x.insert(x.end(), list.begin(), list.end());
+			}
+		}
+		std::vector<Backend> backends = test::simd_backends();
+		backends.insert(backends.begin(), Backend::Scalar);
+		for (Backend b : backends) {
+			test::BackendScope scope(b);
+			std::vector<float> s(x.size()), c(x.size());
+			math4D::sincos_batch(x, s, c);
+			std::vector<Matrix4D> out(x.size());
+			math4D::rotations(math4D::Axis::Z, x, out);
+			std::string on = std::string(" on ") + math4D::simd::backend_name(b);
+			for (std::size_t i = 0; i < x.size(); i++) {
+				if (std::fabs(x[i]) <= 8192.0f) continue;
+				math4D::SinCos sc = math4D::sincos(x[i]);
+				std::string what = std::to_string(x[i]) + " at " + std::to_string(i) + on;
+				CHECK_MSG(test::ulp_distance(s[i], sc.s) == 0 && test::ulp_distance(c[i], sc.c) == 0, "sincos_batch of " + what);
+				Matrix4D want = Matrix4D::rotation_z(sc);
+				CHECK_MSG(test::ulp_distance(out[i][0][0], want[0][0]) == 0 && test::ulp_distance(out[i][1][0], want[1][0]) == 0,
+					"rotations of " + what);
+			}
+		}
+	}
+	TEST_REGISTER("trig/special", trig_special);
+
+	void rotations() {
+		std::vector<float> x = random_floats(1027, 19, -6.2832f, 6.2832f);
+		std::vector<float> y = random_floats(1027, 20, -6.2832f, 6.2832f);
+		std::vector<float> z = random_floats(1027, 21, -6.2832f, 6.2832f);
+		for (math4D::Axis axis : { math4D::Axis::X, math4D::Axis::Y, math4D::Axis::Z }) {
+			compare_backends("rotations", Budget{ 0, 2e-7 }, [&] {
+				std::vector<Matrix4D> out(x.size());
+				math4D::rotations(axis, x, out);
+				return flatten(out);
+			});
+		}
+		compare_backends("rotations_xyz", Budget{ 0, 4e-7 }, [&] {
+			std::vector<Matrix4D> out(x.size());
+			math4D::rotations_xyz(x, y, z, out);
+			return flatten(out);
+		});
+
+		// Against the single-matrix builders.
+		test::on_scalar([&] {
+			std::vector<Matrix4D> out(x.size());
+			math4D::rotations_xyz(x, y, z, out);
+			for (std::size_t i = 0; i < x.size(); i++) {
+				CHECK_MSG(same_bits(out[i], Matrix4D::rotation_xyz(x[i], y[i], z[i])), "rotations_xyz " + std::to_string(i));
+			}
+		});
+	}
+	TEST_REGISTER("trig/rotations", rotations);
+
+	// -----< Quaternion >-------------------------------------------------------------------------
+
+	void quaternion_slerp() {
+		std::mt19937 gen(22);
+		std::uniform_real_distribution<float> dist(-1.0f, 1.0f), unit(0.0f, 1.0f);
+		std::vector<Quaternion> a, b;
+		std::vector<float> t;
+		for (std::size_t i = 0; i < 1027; i++) {
+			Vector4D axis(dist(gen), dist(gen), dist(gen), 0);
+			a.push_back(Quaternion::from_axis_angle(axis, dist(gen) * 3.14159f));
+			Vector4D axis_b(dist(gen), dist(gen), dist(gen), 0);
+			b.push_back(Quaternion::from_axis_angle(axis_b, dist(gen) * 3.14159f));
+			t.push_back(unit(gen));
+		}
+
+		std::vector<Backend> backends = test::simd_backends();
+		backends.insert(backends.begin(), Backend::Scalar);
+		for (Backend be : backends) {
+			test::BackendScope scope(be);
+			std::string what = std::string("slerp_batch on ") + math4D::simd::backend_name(be);
+			std::vector<Quaternion> out(a.size());
+			math4D::slerp_batch(a, b, t, out);
+			for (std::size_t i = 0; i < a.size(); i++) {
+				// acos / sin slerp in double, the short way around.
+				double d = 0;
+				for (int c = 0; c < 4; c++) d += (double)a[i][c] * b[i][c];
+				double sign = d < 0 ? -1 : 1;
+				d = std::min(1.0, std::fabs(d));
+				double theta = std::acos(d);
+				double wa = 1 - t[i], wb = t[i];
+				if (theta > 1e-6) {
+					wa = std::sin((1 - t[i]) * theta) / std::sin(theta);
+					wb = std::sin(t[i] * theta) / std::sin(theta);
+				}
+				// Documented: below 1.5e-6 for keyframes less than 120 degrees apart, 3e-5 otherwise.
+				double budget = d >= 0.5 ? 1.5e-6 : 3e-5;
+				for (int c = 0; c < 4; c++) {
+					double want = wa * a[i][c] + sign * wb * b[i][c];
+					if (!CHECK_MSG(std::fabs(out[i][c] - want) <= budget, what + ": quaternion " + std::to_string(i) +
+							" " + test::describe(out[i][c], (float)want))) break;
+				}
+			}
+		}
+	}
+	TEST_REGISTER("quaternion/slerp_batch", quaternion_slerp);
+
+	// The rotations for the matrix round trip: random ones, and 180 degree
+	// rotations (w = 0) and rotations close to them about axes with one,
+	// two and three non-zero components.
+	std::vector<Quaternion> round_trip_rotations() {
+		std::mt19937 gen(44);
+		std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+		std::vector<Quaternion> q;
+		for (int i = 0; i < 1000; i++) {
+			q.push_back(Quaternion::from_axis_angle(Vector4D(dist(gen), dist(gen), dist(gen), 0), dist(gen) * 3.14159265f));
+		}
+		const Vector4D axes[] = {
+			Vector4D(1, 0, 0, 0), Vector4D(0, 1, 0, 0), Vector4D(0, 0, 1, 0),
+			Vector4D(1, -1, 0, 0), Vector4D(1, 1, 0, 0), Vector4D(0, 1, -1, 0), Vector4D(-1, 0, 1, 0),
+			Vector4D(1, 1, 1, 0), Vector4D(1, -2, 3, 0), Vector4D(-3, 1, 2, 0), Vector4D(2, 3, -1, 0)
+		};
+		for (const Vector4D& axis : axes) {
+			for (float angle : { 3.14159265f, -3.14159265f, 3.1415f, 3.14f, 0.0f, 1e-4f }) {
+				q.push_back(Quaternion::from_axis_angle(axis, angle));
+			}
+		}
+		for (int i = 0; i < 200; i++) {
+			q.push_back(Quaternion::from_axis_angle(Vector4D(dist(gen), dist(gen), dist(gen), 0), 3.14159265f));
+		}
+		return q;
+	}
+
+	void quaternion_matrix() {
+		for (const Quaternion& q : round_trip_rotations()) {
+			Matrix4D m = q.to_matrix();
+			Quaternion r = Quaternion::from_matrix(m);
+			std::string what = "from_matrix of (" + std::to_string(q[0]) + ", " + std::to_string(q[1]) + ", " +
+				std::to_string(q[2]) + ", " + std::to_string(q[3]) + ")";
+			// q and -q are the same rotation.
+			float same = 0, flipped = 0;
+			for (int c = 0; c < 4; c++) {
+				same = std::max(same, std::fabs(r[c] - q[c]));
+				flipped = std::max(flipped, std::fabs(r[c] + q[c]));
+			}
+			CHECK_MSG(std::min(same, flipped) <= 2e-6f, what + ": got (" + std::to_string(r[0]) + ", " +
+				std::to_string(r[1]) + ", " + std::to_string(r[2]) + ", " + std::to_string(r[3]) + ")");
+			CHECK_MSG(r[3] >= 0, what + ": w < 0");
+			Matrix4D back = r.to_matrix();
+			float err = 0;
+			for (int i = 0; i < 16; i++) err = std::max(err, std::fabs(back.data()[i] - m.data()[i]));
+			CHECK_MSG(err <= 4e-6f, what + ": matrix round trip off by " + std::to_string(err));
+		}
+
+		// The counter-example of the old sign rule: 180 degrees about (1, -1, 0) / sqrt(2).
+		Matrix4D m(0, -1, 0, 0, -1, 0, 0, 0, 0, 0, -1, 0, 0, 0, 0, 1);
+		Quaternion q = Quaternion::from_matrix(m);
+		CHECK_MSG(std::fabs(std::fabs(q[0]) - 0.70710678f) <= 1e-6f && std::fabs(q[0] + q[1]) <= 1e-6f &&
+			std::fabs(q[2]) <= 1e-6f && std::fabs(q[3]) <= 1e-6f, "from_matrix of a 180 degree rotation about (1, -1, 0)");
+
+		// from_euler against the matrix builders.
+		std::vector<float> x = random_floats(300, 45, -3.14159f, 3.14159f), y = random_floats(300, 46, -3.14159f, 3.14159f),
+			z = random_floats(300, 47, -3.14159f, 3.14159f);
+		for (std::size_t i = 0; i < x.size(); i++) {
+			Matrix4D want = Matrix4D::rotation_x(x[i]) * Matrix4D::rotation_y(y[i]) * Matrix4D::rotation_z(z[i]);
+			Matrix4D got = Quaternion::from_euler(x[i], y[i], z[i]).to_matrix();
+			float err = 0;
+			for (int k = 0; k < 16; k++) err = std::max(err, std::fabs(got.data()[k] - want.data()[k]));
+			CHECK_MSG(err <= 4e-6f, "from_euler " + std::to_string(i) + " off by " + std::to_string(err));
+		}
+	}
+	TEST_REGISTER("quaternion/from_matrix", quaternion_matrix);
+
+	// -----< Culling >----------------------------------------------------------------------------
+
+	void culling() {
+		Frustum frustum = Frustum::from_matrix(Matrix4D::perspective(1.2f, 1.5f, 0.1f, 50.0f) *
+			Matrix4D::look_at(Vector4D(1, 2, 8), Vector4D(0, 0, 0), Vector4D(0, 1, 0)));
+		std::vector<Vector4D> centers = random_points(2051, 23, 20.0f);
+		std::vector<float> r = random_floats(centers.size(), 24, 0.0f, 2.0f);
+		std::vector<Sphere> spheres;
+		std::vector<AABB> boxes;
+		for (std::size_t i = 0; i < centers.size(); i++) {
+			spheres.push_back(Sphere(centers[i], r[i]));
+			Vector4D e(r[i], r[i] * 0.5f, r[i] * 2, 0);
+			boxes.push_back(AABB(centers[i] - e, centers[i] + e));
+		}
+
+		// The per-object tests are the reference. An object whose test flips
+		// when it grows or shrinks by a rounding error may go either way.
+		const float slack = 1e-4f;
+		std::vector<int> sphere_state(spheres.size()), box_state(boxes.size());
+		for (std::size_t i = 0; i < spheres.size(); i++) {
+			bool in = frustum.intersects(spheres[i]);
+			bool big = frustum.intersects(Sphere(centers[i], r[i] + slack));
+			bool small = frustum.intersects(Sphere(centers[i], std::max(0.0f, r[i] - slack)));
+			sphere_state[i] = big != small ? -1 : in;
+			Vector4D e(slack, slack, slack, 0);
+			bool box_big = frustum.intersects(AABB(boxes[i].min - e, boxes[i].max + e));
+			bool box_small = frustum.intersects(AABB(boxes[i].min + e, boxes[i].max - e));
+			box_state[i] = box_big != box_small ? -1 : frustum.intersects(boxes[i]);
+		}
+
+		std::vector<Backend> backends = test::simd_backends();
+		backends.insert(backends.begin(), Backend::Scalar);
+		for (Backend b : backends) {
+			test::BackendScope scope(b);
+			std::string backend = math4D::simd::backend_name(b);
+			auto check_visible = [&](std::span<const std::uint32_t> visible, const std::vector<int>& state, const std::string& what) {
+				std::vector<int> seen(state.size());
+				for (std::size_t k = 0; k < visible.size(); k++) {
+					CHECK_MSG(k == 0 || visible[k] > visible[k - 1], what + ": indices out of order");
+					seen[visible[k]] = 1;
+				}
+				for (std::size_t i = 0; i < state.size(); i++) {
+					if (state[i] < 0) continue;
+					CHECK_MSG(seen[i] == state[i], what + ": object " + std::to_string(i));
+				}
+			};
+			std::vector<std::uint32_t> visible(spheres.size());
+			std::size_t n = math4D::cull(frustum, spheres, visible);
+			check_visible(std::span<const std::uint32_t>(visible.data(), n), sphere_state, "cull spheres on " + backend);
+			n = math4D::cull(frustum, boxes, visible);
+			check_visible(std::span<const std::uint32_t>(visible.data(), n), box_state, "cull boxes on " + backend);
+		}
+	}
+	TEST_REGISTER("culling/cull", culling);
+
+	// -----< Skinning >---------------------------------------------------------------------------
+
+	template<std::size_t N>
+	std::vector<math4D::BoneInfluences<N>> random_influences(std::size_t n, std::size_t bones, unsigned int seed) {
+		std::mt19937 gen(seed);
+		std::uniform_real_distribution<float> weight(0.0f, 1.0f);
+		std::uniform_int_distribution<int> bone(0, (int)bones - 1);
+		std::vector<math4D::BoneInfluences<N>> influences(n);
+		for (auto& inf : influences) {
+			float sum = 0;
+			for (std::size_t k = 0; k < N; k++) {
+				inf.weights[k] = weight(gen);
+				inf.bones[k] = (std::uint16_t)bone(gen);
+				sum += inf.weights[k];
+			}
+			for (std::size_t k = 0; k < N; k++) inf.weights[k] /= sum;
+		}
+		return influences;
+	}
+
+	template<class Palette, std::size_t N>
+	void compare_skin(const std::string& what, std::span<const Palette> palette, std::size_t bones) {
+		std::size_t n = 1027;
+		auto influences = random_influences<N>(n, bones, 25);
+		std::vector<Vector4D> positions = random_points(n, 26, 10.0f);
+		for (Vector4D& p : positions) p[3] = 1;
+		std::vector<Vector4D> normals = random_points(n, 27);
+		for (Vector4D& v : normals) v = Vector4D(v[0], v[1], v[2], 0).normalize3();
+		compare_backends(what, Budget{ 0, 1e-4 }, [&] {
+			std::vector<Vector4D> out_positions(n), out_normals(n);
+			math4D::skin(palette, std::span<const math4D::BoneInfluences<N>>(influences), positions, normals,
+				out_positions, out_normals);
+			std::vector<float> r = flatten(out_positions), rn = flatten(out_normals);
+			r.insert(r.end(), rn.begin(), rn.end());
+			return r;
+		});
+	}
+
+	void skinning() {
+		std::mt19937 gen(28);
+		std::vector<Matrix4D> palette;
+		for (int i = 0; i < 64; i++) palette.push_back(random_affine(gen, false));
+		// Bones turned by 180 degrees about mixed axes, where w = 0.
+		for (const Vector4D& axis : { Vector4D(1, -1, 0, 0), Vector4D(1, 1, 1, 0), Vector4D(1, -2, 3, 0), Vector4D(0, 1, -1, 0) }) {
+			Matrix4D m = Quaternion::from_axis_angle(axis, 3.14159265f).to_matrix();
+			m.translate(1, -2, 3);
+			palette.push_back(m);
+		}
+		std::vector<DualQuaternion> dq(palette.size());
+		math4D::dual_quaternion_palette(palette, dq);
+
+		// The dual quaternion palette gives back the matrices.
+		for (std::size_t i = 0; i < palette.size(); i++) {
+			Matrix4D back = dq[i].to_matrix();
+			float err = 0;
+			for (int k = 0; k < 16; k++) err = std::max(err, std::fabs(back.data()[k] - palette[i].data()[k]));
+			CHECK_MSG(err <= 2e-5f, "dual_quaternion_palette bone " + std::to_string(i) + " off by " + std::to_string(err));
+		}
+
+		// One bone per vertex: blending does nothing, so both skinning methods move the vertex as the bone matrix.
+		{
+			test::BackendScope scope(Backend::Scalar);
+			std::size_t n = palette.size();
+			std::vector<BoneInfluences4> single(n);
+			for (std::size_t i = 0; i < n; i++) {
+				single[i].weights[0] = 1;
+				single[i].bones[0] = (std::uint16_t)i;
+			}
+			std::vector<Vector4D> positions = random_points(n, 48, 5.0f), normals(n, Vector4D(0, 0, 1, 0));
+			for (Vector4D& p : positions) p[3] = 1;
+			std::vector<Vector4D> linear(n), blended(n), linear_normals(n), blended_normals(n);
+			math4D::skin(std::span<const Matrix4D>(palette), std::span<const BoneInfluences4>(single), positions, normals,
+				linear, linear_normals);
+			math4D::skin(std::span<const DualQuaternion>(dq), std::span<const BoneInfluences4>(single), positions, normals,
+				blended, blended_normals);
+			for (std::size_t i = 0; i < n; i++) {
+				float err = 0;
+				for (int c = 0; c < 4; c++) {
+					err = std::max(err, std::fabs(blended[i][c] - linear[i][c]));
+					err = std::max(err, std::fabs(blended_normals[i][c] - linear_normals[i][c]));
+				}
+				CHECK_MSG(err <= 1e-4f, "dual quaternion skin of bone " + std::to_string(i) + " off by " + std::to_string(err));
+			}
+		}
+		compare_skin<Matrix4D, 4>("skin linear4", palette, palette.size());
+		compare_skin<Matrix4D, 8>("skin linear8", palette, palette.size());
+		compare_skin<DualQuaternion, 4>("skin dual_quaternion4", dq, dq.size());
+		compare_skin<DualQuaternion, 8>("skin dual_quaternion8", dq, dq.size());
+	}
+	TEST_REGISTER("skin/skin", skinning);
+
+	// -----< Matrix streams >---------------------------------------------------------------------
+
+	void matrix_streams() {
+		std::vector<InverseCase> cases = inverse_cases();
+		std::vector<Matrix4D> a, b;
+		std::mt19937 gen(29);
+		for (const InverseCase& c : cases) {
+			a.push_back(c.m);
+			b.push_back(random_matrix(gen));
+		}
+		std::size_t n = a.size();
+		Matrix4DStream sa(a), sb(b);
+
+		std::vector<Backend> backends = test::simd_backends();
+		backends.insert(backends.begin(), Backend::Scalar);
+		for (Backend be : backends) {
+			test::BackendScope scope(be);
+			std::string backend = std::string(" on ") + math4D::simd::backend_name(be);
+
+			Matrix4DStream product;
+			math4D::multiply(sa, sb, product);
+			Matrix4DStream transposed;
+			math4D::transpose(sa, transposed);
+			std::vector<float> det(n);
+			math4D::determinant(sa, det);
+			Matrix4DStream inv;
+			std::vector<std::uint8_t> singular(n);
+			math4D::inverse(sa, inv, singular);
+
+			std::vector<Matrix4D> want_product(n), want_transposed(n);
+			std::vector<float> want_det(n), product_scale, det_scale;
+			test::on_scalar([&] {
+				for (std::size_t i = 0; i < n; i++) {
+					want_product[i] = a[i] * b[i];
+					want_transposed[i] = a[i];
+					want_transposed[i].transpose();
+					want_det[i] = a[i].determinant();
+					det_scale.push_back((float)determinant_scale(a[i]));
+					for (int r = 0; r < 4; r++) {
+						for (int c = 0; c < 4; c++) {
+							float s = 0;
+							for (int k = 0; k < 4; k++) s += std::fabs(a[i][r][k] * b[i][k][c]);
+							product_scale.push_back(s);
+						}
+					}
+				}
+			});
+			std::vector<Matrix4D> got(n);
+			product.to_aos(got);
+			std::vector<float> g = flatten(got), w = flatten(want_product);
+			CHECK_CLOSE(g.data(), w.data(), w.size(), (Budget{ 2, 0, 4 * eps }), product_scale.data(), "stream multiply" + backend);
+			transposed.to_aos(got);
+			CHECK_MSG(flatten(got) == flatten(want_transposed), "stream transpose" + backend);
+			CHECK_CLOSE(det.data(), want_det.data(), n, (Budget{ 4, 0, 16 * eps }), det_scale.data(), "stream determinant" + backend);
+
+			inv.to_aos(got);
+			for (std::size_t i = 0; i < n; i++) {
+				Matrix4D single;
+				bool ok;
+				{
+					test::BackendScope scalar(Backend::Scalar);
+					ok = a[i].try_inverse(single);
+				}
+				std::string what = "stream inverse" + backend + " " + cases[i].kind + " " + std::to_string(i);
+				if (!CHECK_MSG(singular[i] == (ok ? 0 : 1), what + ": singular mask disagrees with try_inverse")) continue;
+				if (ok) check_inverse(a[i], got[i], what);
+			}
+		}
+	}
+	TEST_REGISTER("matrix_stream/operations", matrix_streams);
+
+	// -----< Half floats >------------------------------------------------------------------------
+
+	void half_conversions() {
+		// Every half value to float and back.
+		std::vector<math4D::half> all(65536);
+		for (std::size_t i = 0; i < all.size(); i++) all[i] = math4D::half::from_bits((std::uint16_t)i);
+		compare_backends("f16 to f32 to f16", Budget{ 0 }, [&] {
+			std::vector<float> f(all.size());
+			math4D::to_float(all, f);
+			std::vector<math4D::half> back(all.size());
+			math4D::to_half(f, back);
+			std::vector<float> r = f;
+			for (const math4D::half& h : back) r.push_back((float)h.bits);
+			return r;
+		});
+
+		// Floats that round, overflow, or land on half denormals.
+		std::vector<float> f = random_floats(1027, 30, -70000.0f, 70000.0f);
+		std::vector<float> small = random_floats(1027, 31, -1e-4f, 1e-4f);
+		f.insert(f.end(), small.begin(), small.end());
+		for (float special : { 0.0f, -0.0f, 1e-40f, 65504.0f, 65520.0f, -1e9f, INFINITY, -INFINITY }) f.push_back(special);
+		std::vector<Backend> backends = test::simd_backends();
+		backends.insert(backends.begin(), Backend::Scalar);
+		for (Backend b : backends) {
+			test::BackendScope scope(b);
+			std::vector<math4D::half> h(f.size());
+			math4D::to_half(f, h);
+			for (std::size_t i = 0; i < f.size(); i++) {
+				CHECK_MSG(h[i].bits == math4D::float_to_half_bits(f[i]), std::string("to_half on ") +
+					math4D::simd::backend_name(b) + " of " + std::to_string(f[i]));
+			}
+		}
+	}
+	TEST_REGISTER("half/conversions", half_conversions);
+
+	// -----< Parallel >---------------------------------------------------------------------------
+
+	void parallel() {
+		std::size_t n = 100003;
+		std::vector<Vector4D> a = random_points(n, 32), b = random_points(n, 33);
+		std::mt19937 gen(34);
+		Matrix4D m = random_affine(gen, true);
+
+		std::vector<Backend> backends = test::simd_backends();
+		backends.insert(backends.begin(), Backend::Scalar);
+		for (Backend be : backends) {
+			test::BackendScope scope(be);
+			std::string backend = std::string(" on ") + math4D::simd::backend_name(be);
+			// The split into tasks changes which points the AVX2 kernel passes
+			// to its SSE tail (no FMA), so the points are compared with the
+			// transform budget rather than bit for bit.
+			std::vector<Vector4D> want(n);
+			math4D::transform(m, a, want);
+			std::vector<float> want_flat = flatten(want), scale = transform_scale(m, a);
+
+			// The sum of |a|, for the accuracy of the reductions.
+			double exact_dot = 0, magnitude = 0;
+			for (std::size_t i = 0; i < n; i++) {
+				for (int c = 0; c < 4; c++) {
+					exact_dot += (double)a[i][c] * b[i][c];
+					magnitude += std::fabs((double)a[i][c] * b[i][c]);
+				}
+			}
+
+			bool first = true;
+			Vector4D sum0;
+			float dot0 = 0;
+			for (unsigned int workers : { 0u, 1u, 3u }) {
+				math4D::ThreadPool pool(workers);
+				for (std::size_t chunk : { (std::size_t)1, (std::size_t)4096, (std::size_t)16384, (std::size_t)1 << 30 }) {
+					math4D::ParallelOptions options;
+					options.pool = &pool;
+					options.chunk = chunk;
+					std::string what = backend + ", " + std::to_string(workers) + " workers, chunk " + std::to_string(chunk);
+
+					std::vector<Vector4D> out(n);
+					math4D::parallel_transform(m, a, out, options);
+					std::vector<float> got = flatten(out);
+					CHECK_CLOSE(got.data(), want_flat.data(), want_flat.size(), (Budget{ 2, 0, 4 * eps }), scale.data(),
+						"parallel_transform" + what);
+
+					Vector4D sum = math4D::parallel_sum(a, options);
+					float dot = math4D::parallel_dot(a, b, options);
+					if (first) {
+						sum0 = sum;
+						dot0 = dot;
+						first = false;
+						CHECK_MSG(std::fabs(dot - exact_dot) <= 1e-5 * magnitude, "parallel_dot" + what + ": " +
+							test::describe(dot, (float)exact_dot));
+					}
+					CHECK_MSG(std::memcmp(&sum, &sum0, sizeof(sum)) == 0, "parallel_sum is not reproducible" + what);
+					CHECK_MSG(std::memcmp(&dot, &dot0, sizeof(dot)) == 0, "parallel_dot is not reproducible" + what);
+				}
+			}
+		}
+	}
+	TEST_REGISTER("parallel/transform_reduce", parallel);
+
+	// -----< Jobs >-------------------------------------------------------------------------------
+
+	void jobs() {
+		std::size_t n = 50000;
+		std::vector<Vector4D> in = random_points(n, 35), mid(n), out(n), want_mid(n), want(n);
+		std::mt19937 gen(36);
+		Matrix4D a = random_affine(gen, true), b = random_affine(gen, true);
+		math4D::transform(a, in, want_mid);
+		math4D::transform(b, want_mid, want);
+
+		for (unsigned int workers : { 0u, 1u, 3u }) {
+			math4D::ThreadPool pool(workers);
+			math4D::JobSystem system(&pool, 8);
+			std::string what = " with " + std::to_string(workers) + " workers";
+
+			std::atomic<int> callbacks{ 0 };
+			math4D::Job first = math4D::transform_async(system, a, in, mid);
+			math4D::Job second = math4D::transform_async(system, b, mid, out, { first },
+				[&](const math4D::JobTimes&) { callbacks++; });
+
+			// Many small jobs, more than the capacity, all after the first transform.
+			std::atomic<int> ran{ 0 };
+			std::vector<math4D::Job> small;
+			for (int i = 0; i < 50; i++) {
+				small.push_back(system.submit([&] {
+					if (!first.done()) ran += 1000;
+					ran++;
+				}, { first }));
+			}
+			math4D::Job last = system.submit([&] { CHECK_MSG(ran == 50, "dependencies ran late" + what); }, small);
+
+			second.future().wait();
+			last.wait();
+			CHECK_MSG(callbacks == 1, "completion callback" + what);
+			std::vector<float> got_flat = flatten(out), want_flat = flatten(want), scale = transform_scale(b, want_mid);
+			CHECK_CLOSE(got_flat.data(), want_flat.data(), want_flat.size(), (Budget{ 4, 0, 8 * eps }), scale.data(),
+				"chained transforms" + what);
+
+			std::vector<Matrix4D> matrices;
+			for (int i = 0; i < 100; i++) matrices.push_back(random_affine(gen, true));
+			Matrix4DStream stream(matrices), inverse;
+			std::vector<std::uint8_t> singular(matrices.size());
+			math4D::inverse_async(system, stream, inverse, singular).wait();
+			Matrix4DStream want_inverse;
+			math4D::inverse(stream, want_inverse);
+			std::vector<Matrix4D> got(matrices.size()), expected(matrices.size());
+			inverse.to_aos(got);
+			want_inverse.to_aos(expected);
+			CHECK_MSG(flatten(got) == flatten(expected), "inverse_async" + what);
+
+			system.wait_all();
+			math4D::JobSystem::Stats stats = system.stats();
+			CHECK_MSG(stats.submitted == stats.completed && system.pending() == 0, "jobs left after wait_all" + what);
+			CHECK(second.times().run_ns > 0);
+		}
+	}
+	TEST_REGISTER("jobs/chain", jobs);
+
+	// Destroys job systems while their last jobs are finishing (run under
+	// ThreadSanitizer to see races with the end of JobSystem::run()).
+	void jobs_lifetime() {
+		math4D::ThreadPool pool(3);
+		std::atomic<int> ran{ 0 };
+		for (int i = 0; i < 500; i++) {
+			math4D::JobSystem system(&pool, 4);
+			math4D::Job first = system.submit([&] { ran++; });
+			system.submit([&] { ran++; }, { first });
+		}
+		CHECK_MSG(ran == 1000, std::to_string(ran.load()) + " of 1000 jobs ran");
+	}
+	TEST_REGISTER("jobs/lifetime", jobs_lifetime);
+
+	// A throwing job or callback ends up in the future of its Job and does
+	// not hold up its dependents, wait() or wait_all().
+	void jobs_exceptions() {
+		for (unsigned int workers : { 0u, 2u }) {
+			math4D::ThreadPool pool(workers);
+			math4D::JobSystem system(&pool, 4);
+			std::string what = " with " + std::to_string(workers) + " workers";
+
+			bool called = false;
+			math4D::Job failed = system.submit([] { throw std::runtime_error("job"); }, {},
+				[&](const math4D::JobTimes&) { called = true; });
+			math4D::Job failed_callback = system.submit([] {}, {},
+				[](const math4D::JobTimes&) { throw std::runtime_error("callback"); });
+			std::atomic<bool> dependent_ran{ false };
+			math4D::Job dependent = system.submit([&] { dependent_ran = true; }, { failed, failed_callback });
+
+			failed.wait();
+			dependent.wait();
+			CHECK_MSG(failed.done() && dependent_ran, "dependents of a failed job did not run" + what);
+			CHECK_MSG(called, "callback of a failed job was not called" + what);
+			for (const math4D::Job& job : { failed, failed_callback }) {
+				bool thrown = false;
+				try {
+					job.future().get();
+				}
+				catch (const std::runtime_error&) {
+					thrown = true;
+				}
+				CHECK_MSG(thrown, "future of a failed job did not throw" + what);
+			}
+			system.wait_all();
+			CHECK_MSG(system.pending() == 0 && system.stats().completed == 3, "failed jobs not counted as done" + what);
+		}
+	}
+	TEST_REGISTER("jobs/exceptions", jobs_exceptions);
+
+	// -----< Pipeline >---------------------------------------------------------------------------
+
+	// A source that hands out points from a list, count points at most per call.
+	math4D::StreamSource list_source(const std::vector<Vector4D>& points, std::atomic<int>& reads,
+			std::chrono::microseconds delay = std::chrono::microseconds(0)) {
+		std::size_t next = 0;
+		return [&points, &reads, delay, next](std::span<Vector4D> out) mutable {
+			reads++;
+			if (delay.count() > 0) std::this_thread::sleep_for(delay);
+			std::size_t n = std::min(out.size(), points.size() - next);
+			std::copy(points.begin() + next, points.begin() + next + n, out.begin());
+			next += n;
+			return n;
+		};
+	}
+
+	void stream_transform() {
+		std::size_t n = 10007;
+		std::vector<Vector4D> in = random_points(n, 37);
+		std::mt19937 gen(38);
+		Matrix4D m = random_affine(gen, true);
+		std::vector<Vector4D> want(n);
+		math4D::transform(m, in, want);
+		std::vector<float> want_flat = flatten(want), scale = transform_scale(m, in);
+
+		for (std::size_t buffers : { 3, 5 }) {
+			std::string what = "stream_transform, " + std::to_string(buffers) + " buffers";
+			math4D::StreamOptions options;
+			options.chunk = 1000;
+			options.buffers = buffers;
+			std::atomic<int> reads{ 0 };
+			std::vector<Vector4D> out;
+			math4D::StreamStats stats;
+			bool ok = math4D::stream_transform(m, list_source(in, reads), [&](std::span<const Vector4D> points) {
+				out.insert(out.end(), points.begin(), points.end());
+				return true;
+			}, options, &stats);
+			CHECK_MSG(ok, what + ": returned false");
+			CHECK_MSG(stats.points == n && stats.chunks == 11, what + ": stats");
+			if (!CHECK_MSG(out.size() == n, what + ": point count")) continue;
+			std::vector<float> got = flatten(out);
+			CHECK_CLOSE(got.data(), want_flat.data(), want_flat.size(), (Budget{ 2, 0, 4 * eps }), scale.data(), what);
+		}
+	}
+	TEST_REGISTER("pipeline/stream_transform", stream_transform);
+
+	// A sink that stops the stream has to stop the reads too, not only the writes.
+	void stream_sink_stop() {
+		std::vector<Vector4D> in = random_points(1000 * 64, 39);
+		for (std::size_t buffers : { 3, 5 }) {
+			math4D::StreamOptions options;
+			options.chunk = 64;
+			options.buffers = buffers;
+			std::atomic<int> reads{ 0 };
+			int written = 0;
+			bool ok = math4D::stream_transform(Matrix4D(), list_source(in, reads, std::chrono::milliseconds(2)),
+				[&](std::span<const Vector4D>) { return ++written < 2; }, options);
+			std::string what = "sink stop, " + std::to_string(buffers) + " buffers";
+			CHECK_MSG(!ok, what + ": returned true");
+			CHECK_MSG(written == 2, what + ": sink called " + std::to_string(written) + " times");
+			// The two chunks written plus at most one per buffer read ahead.
+			CHECK_MSG(reads <= 2 + (int)buffers, what + ": " + std::to_string(reads.load()) + " source reads");
+		}
+	}
+	TEST_REGISTER("pipeline/sink_stop", stream_sink_stop);
+
+	// An exception of the source or the sink comes out of stream_transform
+	// instead of terminating the program, and stops the other stages.
+	void stream_exceptions() {
+		std::vector<Vector4D> in = random_points(64 * 20, 40);
+		for (std::size_t buffers : { 3, 5 }) {
+			math4D::StreamOptions options;
+			options.chunk = 64;
+			options.buffers = buffers;
+			std::string what = ", " + std::to_string(buffers) + " buffers";
+
+			std::atomic<int> reads{ 0 };
+			math4D::StreamSource inner = list_source(in, reads);
+			int written = 0;
+			std::string message;
+			try {
+				math4D::stream_transform(Matrix4D(), [&](std::span<Vector4D> out) {
+					if (reads == 3) throw std::runtime_error("source");
+					return inner(out);
+				}, [&](std::span<const Vector4D>) { return ++written > 0; }, options);
+			}
+			catch (const std::runtime_error& e) {
+				message = e.what();
+			}
+			CHECK_MSG(message == "source", "source exception not rethrown" + what);
+			CHECK_MSG(written <= 3, "sink called " + std::to_string(written) + " times after 3 reads" + what);
+
+			reads = 0;
+			written = 0;
+			message.clear();
+			try {
+				math4D::stream_transform(Matrix4D(), list_source(in, reads), [&](std::span<const Vector4D>) -> bool {
+					if (++written == 2) throw std::runtime_error("sink");
+					return true;
+				}, options);
+			}
+			catch (const std::runtime_error& e) {
+				message = e.what();
+			}
+			CHECK_MSG(message == "sink", "sink exception not rethrown" + what);
+			CHECK_MSG(written == 2, "sink called " + std::to_string(written) + " times" + what);
+			CHECK_MSG(reads <= 2 + (int)buffers, std::to_string(reads.load()) + " source reads after the sink threw" + what);
+		}
+	}
+	TEST_REGISTER("pipeline/exceptions", stream_exceptions);
+
+	// -----< Pool / Arena >-----------------------------------------------------------------------
+
+	void pool() {
+		Matrix4DPool matrices(4);
+		std::vector<Matrix4DPool::Handle> handles;
+		for (int i = 0; i < 4; i++) handles.push_back(matrices.create(Matrix4D::rotation_x((float)i)));
+		CHECK_MSG(matrices.create() == Matrix4DPool::Handle(), "a full pool handed out a slot");
+		CHECK(matrices.size() == 4);
+		for (int i = 0; i < 4; i++) {
+			const Matrix4D* m = matrices.get(handles[i]);
+			CHECK_MSG(m != nullptr && same_bits(*m, Matrix4D::rotation_x((float)i)), "pool object " + std::to_string(i));
+			CHECK_MSG(((std::uintptr_t)m & 63) == 0, "pool object not on a cache line");
+		}
+
+		// A released handle stays invalid after its slot is taken again.
+		CHECK(matrices.release(handles[1]));
+		CHECK_MSG(!matrices.release(handles[1]), "a handle was released twice");
+		CHECK(matrices.get(handles[1]) == nullptr);
+		Matrix4DPool::Handle again = matrices.create();
+		CHECK_MSG(again.index == handles[1].index && again.generation != handles[1].generation, "slot not reused");
+		CHECK(matrices.get(handles[1]) == nullptr && matrices.get(again) != nullptr);
+		CHECK(matrices.get(Matrix4DPool::Handle()) == nullptr);
+
+		// Threads creating and releasing at once never share a slot.
+		Vector4DPool points(64);
+		std::atomic<int> errors{ 0 };
+		std::vector<std::thread> threads;
+		for (int t = 0; t < 4; t++) {
+			threads.emplace_back([&points, &errors, t] {
+				std::vector<Vector4DPool::Handle> own;
+				for (int round = 0; round < 2000; round++) {
+					for (int k = 0; k < 8; k++) {
+						Vector4DPool::Handle h = points.create((float)t, (float)round, (float)k, 1.0f);
+						if (h == Vector4DPool::Handle()) errors++;
+						else own.push_back(h);
+					}
+					for (std::size_t k = 0; k < own.size(); k++) {
+						const Vector4D* p = points.get(own[k]);
+						if (p == nullptr || (*p)[0] != (float)t || (*p)[1] != (float)round) errors++;
+						if (!points.release(own[k])) errors++;
+					}
+					own.clear();
+				}
+			});
+		}
+		for (std::thread& t : threads) t.join();
+		CHECK_MSG(errors == 0, std::to_string(errors.load()) + " errors with threads sharing a pool");
+		CHECK(points.size() == 0);
+	}
+	TEST_REGISTER("pool/pool", pool);
+
+	void arena() {
+		math4D::Arena arena(1024);
+		char* byte = arena.create<char>('a');
+		Matrix4D* m = arena.create<Matrix4D>(Matrix4D::rotation_y(0.5f));
+		CHECK(byte != nullptr && *byte == 'a');
+		CHECK_MSG(m != nullptr && ((std::uintptr_t)m & 63) == 0, "a Matrix4D in the arena is not on a cache line");
+		CHECK(m != nullptr && same_bits(*m, Matrix4D::rotation_y(0.5f)));
+		std::span<Vector4D> list = arena.create_array<Vector4D>(10);
+		CHECK(list.size() == 10 && ((std::uintptr_t)list.data() & 63) == 0);
+		CHECK_MSG(arena.create_array<Vector4D>(100).empty(), "a full arena handed out memory");
+		CHECK(arena.size() <= arena.capacity());
+
+		arena.reset();
+		CHECK(arena.size() == 0);
+		CHECK(arena.create_array<Vector4D>(64).size() == 64);
+		arena.reset();
+
+		// Containers: bad_alloc once the arena is full.
+		bool thrown = false;
+		try {
+			std::vector<Matrix4D, math4D::ArenaAllocator<Matrix4D>> matrices(arena);
+			for (int i = 0; i < 100; i++) matrices.push_back(Matrix4D());
+		}
+		catch (const std::bad_alloc&) {
+			thrown = true;
+		}
+		CHECK_MSG(thrown, "ArenaAllocator did not throw on a full arena");
+
+		// Threads allocating at once get blocks that do not overlap.
+		math4D::Arena shared(1 << 16);
+		std::vector<std::vector<std::pair<std::uintptr_t, std::size_t>>> blocks(4);
+		std::vector<std::thread> threads;
+		for (int t = 0; t < 4; t++) {
+			threads.emplace_back([&shared, &blocks, t] {
+				for (std::size_t k = 0; k < 200; k++) {
+					std::size_t size = 8 + (k * 24 + t * 8) % 96;
+					void* p = shared.allocate(size, 8);
+					if (p != nullptr) blocks[t].push_back({ (std::uintptr_t)p, size });
+				}
+			});
+		}
+		for (std::thread& t : threads) t.join();
+		std::vector<std::pair<std::uintptr_t, std::size_t>> all;
+		for (const auto& b : blocks) all.insert(all.end(), b.begin(), b.end());
+		std::sort(all.begin(), all.end());
+		bool overlap = false;
+		for (std::size_t i = 1; i < all.size(); i++) {
+			if (all[i - 1].first + all[i - 1].second > all[i].first) overlap = true;
+		}
+		CHECK_MSG(!overlap, "arena blocks of different threads overlap");
+		CHECK(all.size() == 800);
+	}
+	TEST_REGISTER("pool/arena", arena);
+
+	// -----< Hierarchy >--------------------------------------------------------------------------
+
+	// World matrices computed from scratch: world(parent) * local, parents first.
+	std::vector<Matrix4D> reference_worlds(const TransformHierarchy& scene) {
+		std::vector<Matrix4D> worlds(scene.size());
+		for (TransformHierarchy::Node i = 0; i < scene.size(); i++) {
+			TransformHierarchy::Node parent = scene.parent(i);
+			worlds[i] = parent == TransformHierarchy::none ? scene.local(i) : worlds[parent] * scene.local(i);
+		}
+		return worlds;
+	}
+
+	void hierarchy() {
+		for (unsigned int workers : { 0u, 3u }) {
+			math4D::ThreadPool pool(workers);
+			math4D::ParallelOptions options;
+			options.pool = &pool;
+			options.chunk = 64;
+			std::string what = " with " + std::to_string(workers) + " workers";
+
+			// Children are added after other subtrees, so the first update sorts.
+			std::mt19937 gen(49);
+			TransformHierarchy scene;
+			std::size_t n = 3000;
+			for (std::size_t i = 0; i < n; i++) {
+				TransformHierarchy::Node parent = TransformHierarchy::none;
+				if (i > 4) parent = std::uniform_int_distribution<std::uint32_t>(0, (std::uint32_t)i - 1)(gen);
+				scene.add(random_affine(gen, false), parent);
+			}
+
+			for (int frame = 0; frame < 6; frame++) {
+				// Few changes (sorted dirty list), then many (flag pass), then a root.
+				std::size_t changes = frame % 3 == 0 ? 5 : frame % 3 == 1 ? 500 : 1;
+				for (std::size_t k = 0; k < changes && frame > 0; k++) {
+					TransformHierarchy::Node node = frame % 3 == 2 ? 0 :
+						std::uniform_int_distribution<std::uint32_t>(0, (std::uint32_t)n - 1)(gen);
+					scene.set_local(node, random_affine(gen, false));
+				}
+				scene.update(options);
+				CHECK(scene.changed_count() == 0);
+				std::vector<Matrix4D> want = reference_worlds(scene);
+				for (TransformHierarchy::Node i = 0; i < n; i++) {
+					if (!CHECK_MSG(same_bits(scene.world(i), want[i]), "frame " + std::to_string(frame) + " node " +
+							std::to_string(i) + what)) break;
+				}
+			}
+		}
+	}
+	TEST_REGISTER("hierarchy/update", hierarchy);
+
+	// -----< Datasets >---------------------------------------------------------------------------
+
+	void datasets() {
+		std::filesystem::path dir = std::filesystem::temp_directory_path();
+		std::string path = (dir / "math4d_tests_points.m4d").string();
+		std::string out_path = (dir / "math4d_tests_world.m4d").string();
+		std::vector<Vector4D> points = random_points(100003, 50);
+
+		math4D::DatasetWriter<Vector4D> writer;
+		CHECK(writer.open(path.c_str()));
+		CHECK(writer.append(std::span<const Vector4D>(points.data(), 3)));
+		CHECK(writer.append(points[3]));
+		CHECK(writer.append(std::span<const Vector4D>(points.data() + 4, points.size() - 4)));
+		CHECK(writer.size() == points.size());
+		CHECK(writer.close());
+
+		math4D::MappedDataset file;
+		if (CHECK_MSG(file.open(path.c_str()), "mapping the dataset failed")) {
+			std::span<const Vector4D> mapped = file.elements<Vector4D>();
+			CHECK_MSG(mapped.size() == points.size() &&
+				std::memcmp(mapped.data(), points.data(), points.size() * sizeof(Vector4D)) == 0, "mapped dataset differs");
+			CHECK_MSG(((std::uintptr_t)mapped.data() & 63) == 0, "mapped elements not on a cache line");
+			CHECK_MSG(file.elements<Matrix4D>().empty(), "Vector4D dataset read as Matrix4D");
+		}
+
+		math4D::DatasetReader<Vector4D> reader;
+		if (CHECK_MSG(reader.open(path.c_str()), "reading the dataset failed")) {
+			std::vector<Vector4D> read, piece(4096);
+			while (std::size_t got = reader.read(piece)) read.insert(read.end(), piece.begin(), piece.begin() + got);
+			CHECK_MSG(flatten(read) == flatten(points), "streamed dataset differs");
+			reader.close();
+		}
+		math4D::DatasetReader<Matrix4D> wrong_type;
+		CHECK_MSG(!wrong_type.open(path.c_str()) && wrong_type.error() == math4D::DatasetError::Format,
+			"Vector4D dataset opened as Matrix4D");
+
+		// File to file through stream_transform.
+		std::mt19937 gen(51);
+		Matrix4D m = random_affine(gen, true);
+		{
+			math4D::DatasetWriter<Vector4D> out;
+			CHECK(out.open(out_path.c_str()));
+			math4D::StreamOptions options;
+			options.chunk = 4096;
+			CHECK(math4D::stream_transform(m, math4D::dataset_source(file), math4D::dataset_sink(out), options));
+			CHECK(out.close());
+		}
+		math4D::MappedDataset world;
+		if (CHECK(world.open(out_path.c_str()))) {
+			std::vector<Vector4D> want(points.size());
+			math4D::transform(m, points, want);
+			std::span<const Vector4D> got = world.elements<Vector4D>();
+			std::vector<float> g = flatten(got), w = flatten(want), scale = transform_scale(m, points);
+			if (CHECK(g.size() == w.size())) {
+				CHECK_CLOSE(g.data(), w.data(), w.size(), (Budget{ 2, 0, 4 * eps }), scale.data(), "dataset stream_transform");
+			}
+			world.close();
+		}
+		file.close();
+
+		// A damaged header is refused.
+		{
+			std::FILE* f = std::fopen(path.c_str(), "r+b");
+			if (CHECK(f != nullptr)) {
+				std::fputc('X', f);
+				std::fclose(f);
+			}
+			math4D::MappedDataset damaged;
+			CHECK_MSG(!damaged.open(path.c_str()) && damaged.error() == math4D::DatasetError::Format,
+				"dataset with a damaged magic opened");
+		}
+		std::filesystem::remove(path);
+		std::filesystem::remove(out_path);
+	}
+	TEST_REGISTER("dataset/files", datasets);
+
+	// -----< Performance gate >-------------------------------------------------------------------
+
+	struct PerfCase {
+		std::string name;
+		std::function<void(bench::State&)> function;
+	};
+
+	const std::size_t perf_n = 10000;
+
+	// A dependent chain of scalar float operations, about as fast on every
+	// backend. The kernels are timed relative to it.
+	void calibration(bench::State& state) {
+		float x = 1.0f;
+		while (state.keep_running()) {
+			for (int i = 0; i < 1000; i++) x = x * 0.999f + 0.001f;
+			bench::do_not_optimize(x);
+		}
+		state.set_items_per_iteration(1000);
+	}
+
+	// The cases run on one thread (pools without workers), since other
+	// threads make the timings depend on the load of the machine.
+	std::vector<PerfCase> perf_cases() {
+		std::vector<PerfCase> cases;
+		auto points = std::make_shared<std::vector<Vector4D>>(random_points(perf_n, 40));
+		auto out = std::make_shared<std::vector<Vector4D>>(perf_n);
+		std::mt19937 gen(41);
+		auto matrices = std::make_shared<std::vector<Matrix4D>>();
+		for (std::size_t i = 0; i < 1000; i++) matrices->push_back(random_affine(gen, true));
+		Matrix4D m = random_affine(gen, true);
+
+		cases.push_back({ "matrix4d/multiply", [matrices](bench::State& state) {
+			Matrix4D acc;
+			while (state.keep_running()) {
+				for (const Matrix4D& x : *matrices) bench::do_not_optimize(acc = x * acc);
+			}
+			state.set_items_per_iteration((double)matrices->size());
+		} });
+		cases.push_back({ "matrix4d/inverse", [matrices](bench::State& state) {
+			while (state.keep_running()) {
+				for (const Matrix4D& x : *matrices) {
+					Matrix4D r;
+					bench::do_not_optimize(x.try_inverse(r));
+					bench::do_not_optimize(r);
+				}
+			}
+			state.set_items_per_iteration((double)matrices->size());
+		} });
+		cases.push_back({ "matrix_stream/inverse", [matrices](bench::State& state) {
+			Matrix4DStream in(*matrices), result;
+			while (state.keep_running()) {
+				math4D::inverse(in, result);
+				bench::clobber_memory();
+			}
+			state.set_items_per_iteration((double)matrices->size());
+		} });
+		cases.push_back({ "batch/transform", [points, out, m](bench::State& state) {
+			while (state.keep_running()) {
+				math4D::transform(m, *points, *out);
+				bench::clobber_memory();
+			}
+			state.set_items_per_iteration((double)points->size());
+		} });
+		cases.push_back({ "batch/normalize", [points, out](bench::State& state) {
+			while (state.keep_running()) {
+				math4D::normalize(*points, *out);
+				bench::clobber_memory();
+			}
+			state.set_items_per_iteration((double)points->size());
+		} });
+		cases.push_back({ "batch/project", [points, out, m](bench::State& state) {
+			Matrix4D mvp = Matrix4D::perspective(1.2f, 1.5f, 0.1f, 100.0f) * m;
+			std::vector<std::uint8_t> flags(points->size());
+			while (state.keep_running()) {
+				math4D::project(mvp, Viewport(), *points, *out, flags);
+				bench::clobber_memory();
+			}
+			state.set_items_per_iteration((double)points->size());
+		} });
+		cases.push_back({ "trig/sincos_batch", [](bench::State& state) {
+			std::vector<float> x = random_floats(perf_n, 42, -6.3f, 6.3f), s(perf_n), c(perf_n);
+			while (state.keep_running()) {
+				math4D::sincos_batch(x, s, c);
+				bench::clobber_memory();
+			}
+			state.set_items_per_iteration((double)perf_n);
+		} });
+		cases.push_back({ "culling/spheres", [points](bench::State& state) {
+			Frustum frustum = Frustum::from_matrix(Matrix4D::perspective(1.2f, 1.5f, 0.1f, 100.0f));
+			std::vector<Sphere> spheres;
+			for (const Vector4D& p : *points) spheres.push_back(Sphere(p, 1));
+			std::vector<std::uint32_t> visible(spheres.size());
+			while (state.keep_running()) {
+				bench::do_not_optimize(math4D::cull(frustum, spheres, visible));
+				bench::clobber_memory();
+			}
+			state.set_items_per_iteration((double)spheres.size());
+		} });
+		cases.push_back({ "parallel/dot", [points](bench::State& state) {
+			math4D::ThreadPool pool(0);
+			math4D::ParallelOptions options;
+			options.pool = &pool;
+			while (state.keep_running()) bench::do_not_optimize(math4D::parallel_dot(*points, *points, options));
+			state.set_items_per_iteration((double)points->size());
+		} });
+		cases.push_back({ "skin/linear4", [points, out, matrices](bench::State& state) {
+			std::span<const Matrix4D> palette(matrices->data(), 64);
+			auto influences = random_influences<4>(points->size(), palette.size(), 43);
+			std::vector<Vector4D> normals = *points, out_normals(points->size());
+			math4D::ThreadPool pool(0);
+			math4D::ParallelOptions options;
+			options.pool = &pool;
+			while (state.keep_running()) {
+				math4D::skin(palette, std::span<const BoneInfluences4>(influences), *points, normals, *out, out_normals, options);
+				bench::clobber_memory();
+			}
+			state.set_items_per_iteration((double)points->size());
+		} });
+		return cases;
+	}
+
+	// Times a kernel and the calibration loop in turns and keeps the best
+	// of each, so a slow spell of the machine hits both or neither.
+	// Returns the ns per item of the kernel / ns per step of the calibration.
+	double relative_cost(const std::function<void(bench::State&)>& function, double& ns) {
+		bench::Benchmark kernel{ "", function, {} }, reference{ "", calibration, {} };
+		double best = 0, best_calibration = 0;
+		for (int i = 0; i < 7; i++) {
+			double k = bench::run(kernel, 0, "").ns_per_op;
+			double c = bench::run(reference, 0, "").ns_per_op;
+			if (i == 0 || k < best) best = k;
+			if (i == 0 || c < best_calibration) best_calibration = c;
+		}
+		ns = best;
+		return best / best_calibration;
+	}
+
+	std::map<std::string, double> read_baseline(const std::string& path) {
+		std::map<std::string, double> baseline;
+		std::ifstream file(path);
+		std::string line;
+		while (std::getline(file, line)) {
+			if (line.empty() || line[0] == '#') continue;
+			std::istringstream fields(line);
+			std::string name;
+			double cost = 0;
+			if (fields >> name >> cost) baseline[name] = cost;
+		}
+		return baseline;
+	}
+
+	bool write_baseline(const std::string& path, const std::map<std::string, double>& costs) {
+		std::FILE* f = std::fopen(path.c_str(), "w");
+		if (f == nullptr) {
+			std::fprintf(stderr, "Error: could not open %s\n", path.c_str());
+			return false;
+		}
+		std::fprintf(f, "# Math_Library performance baseline, written by Math_Library_tests --perf --update-baseline.\n");
+		std::fprintf(f, "# <kernel>/<backend> <ns per item / ns per calibration step>\n");
+		for (const auto& [name, cost] : costs) std::fprintf(f, "%s %.4f\n", name.c_str(), cost);
+		std::fclose(f);
+		return true;
+	}
+
+	// Returns the number of kernels that are slower than the baseline allows.
+	int run_perf_gate(const std::string& baseline_path, double threshold, bool update) {
+		bench::options().min_time = 0.015;
+		std::map<std::string, double> baseline = read_baseline(baseline_path);
+		if (baseline.empty() && !update) {
+			std::printf("No baseline in %s, nothing to compare. Write one with --update-baseline.\n", baseline_path.c_str());
+		}
+
+		std::vector<Backend> backends = test::simd_backends();
+		backends.insert(backends.begin(), Backend::Scalar);
+		std::map<std::string, double> costs;
+		int slower = 0;
+		std::printf("%-40s %12s %12s %10s\n", "Kernel", "ns/item", "cost", "baseline");
+		for (const PerfCase& c : perf_cases()) {
+			for (Backend b : backends) {
+				test::BackendScope scope(b);
+				double ns = 0;
+				double cost = relative_cost(c.function, ns);
+				std::string name = c.name + "/" + math4D::simd::backend_name(b);
+
+				auto it = baseline.find(name);
+				if (update || it == baseline.end()) {
+					costs[name] = cost;
+					std::printf("%-40s %12.3f %12.4f %10s\n", name.c_str(), ns, cost, "-");
+					continue;
+				}
+				// A slow spell of the machine passes, a slower kernel does not:
+				// a case over the limit is timed again before it fails.
+				double limit = it->second * (1 + threshold);
+				for (int retry = 0; retry < 2 && cost > limit; retry++) {
+					double retry_ns = 0;
+					double retry_cost = relative_cost(c.function, retry_ns);
+					if (retry_cost < cost) {
+						cost = retry_cost;
+						ns = retry_ns;
+					}
+				}
+				costs[name] = cost;
+				bool ok = cost <= limit;
+				std::printf("%-40s %12.3f %12.4f %10.4f%s\n", name.c_str(), ns, cost, it->second,
+					ok ? "" : "  SLOWER");
+				if (!ok) slower++;
+			}
+		}
+		if (update && !write_baseline(baseline_path, costs)) return 1;
+		std::printf("%d kernels slower than the baseline by more than %.0f%%\n", slower, threshold * 100);
+		return slower;
+	}
+}
+
+int main(int argc, char** argv) {
+	std::string filter, baseline;
+	bool perf = false, update = false;
+	double threshold = 1.0;
+	for (int i = 1; i < argc; i++) {
+		const char* a = argv[i];
+		auto value = [a](const char* key) -> const char* {
+			std::size_t len = std::strlen(key);
+			return std::strncmp(a, key, len) == 0 ? a + len : nullptr;
+		};
+		if (const char* v = value("--filter=")) filter = v;
+		else if (const char* v = value("--baseline=")) baseline = v;
+		else if (const char* v = value("--threshold=")) threshold = std::atof(v);
+		else if (std::strcmp(a, "--perf") == 0) perf = true;
+		else if (std::strcmp(a, "--update-baseline") == 0) update = true;
+		else {
+			std::fprintf(stderr,
+				"usage: %s [--filter=<text>]\n"
+				"       %s --perf --baseline=<file> [--threshold=<fraction>] [--update-baseline]\n", argv[0], argv[0]);
+			return 2;
+		}
+	}
+
+	if (perf) {
+		if (baseline.empty()) {
+			std::fprintf(stderr, "Error: --perf needs --baseline=<file>\n");
+			return 2;
+		}
+		return run_perf_gate(baseline, threshold, update) == 0 ? 0 : 1;
+	}
+	return test::run_tests(filter) == 0 ? 0 : 1;
+}
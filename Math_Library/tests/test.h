@@ -0,0 +1,213 @@
+#pragma once
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "simd4D.h"
+
+// A small test harness in the style of bench.h.
+//
+// A test is a function registered with TEST_REGISTER. A failed check is
+// printed and counted, and the test goes on, so one run shows every
+// kernel that is off:
+//
+//	void vector_add() {
+//		for (Backend b : test::simd_backends()) {
+//			test::BackendScope scope(b);
+//			CHECK_ULP(sum_on_backend[i], sum_on_scalar[i], 0);
+//		}
+//	}
+//	TEST_REGISTER("vector4d/add", vector_add);
+//
+// Errors are measured in ULPs (the number of floats between two values)
+// with an absolute floor for results that come out of cancellation, where
+// the ULP distance says nothing.
+
+namespace test {
+
+	// -----< Registry >---------------------------------------------------------------------------
+
+	struct Test {
+		std::string name;
+		std::function<void()> function;
+	};
+
+	inline std::vector<Test>& registry() {
+		static std::vector<Test> tests;
+		return tests;
+	}
+
+	inline bool add(std::string name, std::function<void()> function) {
+		registry().push_back({ std::move(name), std::move(function) });
+		return true;
+	}
+
+#define TEST_CONCAT_INNER(a, b) a##b
+#define TEST_CONCAT(a, b) TEST_CONCAT_INNER(a, b)
+#define TEST_REGISTER(name, function) \
+	[[maybe_unused]] static const bool TEST_CONCAT(test_registered_, __LINE__) = test::add(name, function)
+
+	// -----< Results >----------------------------------------------------------------------------
+
+	struct Counts {
+		std::size_t checks = 0;
+		std::size_t failures = 0;
+	};
+
+	inline Counts& counts() {
+		static Counts c;
+		return c;
+	}
+
+	// Failures printed per test, the others are only counted.
+	constexpr std::size_t max_printed_failures = 10;
+
+	inline std::size_t& failures_in_test() {
+		static std::size_t n = 0;
+		return n;
+	}
+
+	// Records one check. Prints the message of a failed one.
+	inline bool check(bool ok, const char* file, int line, const std::string& message) {
+		counts().checks++;
+		if (ok) return true;
+		counts().failures++;
+		if (failures_in_test()++ < max_printed_failures) {
+			std::printf("  %s:%d: %s\n", file, line, message.c_str());
+		}
+		return false;
+	}
+
+	// -----< ULP >--------------------------------------------------------------------------------
+
+	// Maps a float to an integer that grows with its value, so the
+	// difference of two keys is the number of floats between them.
+	inline std::int64_t ordered(float f) {
+		std::int32_t i = std::bit_cast<std::int32_t>(f);
+		return i < 0 ? -(std::int64_t)(i & 0x7fffffff) : (std::int64_t)i;
+	}
+
+	// Returns the number of floats between a and b. 0 if both are NaN,
+	// the largest value if only one is.
+	inline std::uint64_t ulp_distance(float a, float b) {
+		if (std::isnan(a) || std::isnan(b)) return std::isnan(a) && std::isnan(b) ? 0 : UINT64_MAX;
+		std::int64_t d = ordered(a) - ordered(b);
+		return (std::uint64_t)(d < 0 ? -d : d);
+	}
+
+	// How far a result may be from the reference: within ulps floats, or
+	// within abs + rel * scale of it. scale is the size of the terms the
+	// result was summed from (sum of |a * b| for a dot product), which
+	// bounds the rounding error where the ULP distance cannot.
+	struct Budget {
+		std::uint64_t ulps = 0;
+		double abs = 0;
+		double rel = 0;
+	};
+
+	inline bool within(float got, float want, Budget budget, double scale = 0) {
+		if (ulp_distance(got, want) <= budget.ulps) return true;
+		return std::fabs((double)got - (double)want) <= budget.abs + budget.rel * scale;
+	}
+
+	inline std::string describe(float got, float want) {
+		char text[160];
+		std::snprintf(text, sizeof(text), "got %.9g, want %.9g (%llu ulp)", got, want,
+			(unsigned long long)ulp_distance(got, want));
+		return text;
+	}
+
+	// Compares n floats against the reference and reports the first ones
+	// that are off, with what and their index. scale, if not nullptr, holds
+	// the scale of each value for budget.rel.
+	inline bool check_close(const float* got, const float* want, std::size_t n, Budget budget,
+			const float* scale, const std::string& what, const char* file, int line) {
+		bool ok = true;
+		for (std::size_t i = 0; i < n; i++) {
+			if (!within(got[i], want[i], budget, scale != nullptr ? scale[i] : 0)) {
+				check(false, file, line, what + "[" + std::to_string(i) + "]: " + describe(got[i], want[i]));
+				ok = false;
+			}
+		}
+		if (ok) counts().checks++;
+		return ok;
+	}
+
+#define CHECK(condition) \
+	test::check((condition), __FILE__, __LINE__, #condition)
+#define CHECK_MSG(condition, message) \
+	test::check((condition), __FILE__, __LINE__, (message))
+#define CHECK_ULP(got, want, max_ulps) \
+	test::check(test::ulp_distance((got), (want)) <= (max_ulps), __FILE__, __LINE__, \
+		std::string(#got " vs " #want ": ") + test::describe((got), (want)))
+#define CHECK_CLOSE(got, want, n, budget, scale, what) \
+	test::check_close((got), (want), (n), (budget), (scale), (what), __FILE__, __LINE__)
+
+	// -----< Backends >---------------------------------------------------------------------------
+
+	// The SIMD backends the CPU supports, without Scalar (the reference).
+	inline std::vector<math4D::simd::Backend> simd_backends() {
+		using math4D::simd::Backend;
+		std::vector<Backend> list;
+		Backend best = math4D::simd::detect_backend();
+		for (Backend b : { Backend::SSE41, Backend::AVX2 }) {
+			if (b <= best) list.push_back(b);
+		}
+		return list;
+	}
+
+	// Selects a backend for a scope and restores the previous one.
+	class BackendScope {
+	private:
+		math4D::simd::Backend previous;
+
+	public:
+		explicit BackendScope(math4D::simd::Backend b) : previous(math4D::simd::active_backend()) {
+			math4D::simd::set_backend(b);
+		}
+		~BackendScope() {
+			math4D::simd::set_backend(previous);
+		}
+		BackendScope(const BackendScope&) = delete;
+		BackendScope& operator=(const BackendScope&) = delete;
+	};
+
+	// Runs f() on the scalar backend, the reference every kernel is compared to.
+	template<class F>
+	void on_scalar(F&& f) {
+		BackendScope scope(math4D::simd::Backend::Scalar);
+		f();
+	}
+
+	// -----< Runner >-----------------------------------------------------------------------------
+
+	// Runs every test whose name contains filter. Returns the number of failed tests.
+	inline int run_tests(const std::string& filter) {
+		int failed_tests = 0;
+		std::size_t run = 0;
+		for (const Test& t : registry()) {
+			if (!filter.empty() && t.name.find(filter) == std::string::npos) continue;
+			failures_in_test() = 0;
+			std::printf("[ RUN  ] %s\n", t.name.c_str());
+			std::fflush(stdout);
+			t.function();
+			run++;
+			if (failures_in_test() != 0) {
+				failed_tests++;
+				std::printf("[ FAIL ] %s (%zu failed checks)\n", t.name.c_str(), failures_in_test());
+			}
+			else {
+				std::printf("[  OK  ] %s\n", t.name.c_str());
+			}
+		}
+		std::printf("%zu tests, %zu checks, %d failed tests\n", run, counts().checks, failed_tests);
+		return failed_tests;
+	}
+}